@@ -97,7 +97,7 @@ protected:
 
 private:        
 
-    void put_frame(const Frame& frame);
+    void put_frame(DataContainer& data);
     void put_system(const System& sys);
 
     std::shared_ptr<TaskDriver> driver;
@@ -30,11 +30,13 @@
 #pragma once
 
 #include <string>
+#include "pteros/core/interned_string.h"
 
 namespace pteros {
 /**
 * Class which represents a single atom.
 * Coordinates are stored separately in the System.
+* Textual fields are interned, so Atom is trivially copyable.
 */
 class Atom {
   public:
@@ -44,13 +46,13 @@ class Atom {
     /// Residue ID (unique only inside given chain)
     int  resid;
     /// %Atom name (CA, O, N, etc.)
-    std::string  name;
+    InternedString  name;
     /// Chain. Single letter (A,B,Z)
     char  chain;
     /// Residue name in 3-letters code (ALA, GLY, MET, etc.)
-    std::string  resname;
+    InternedString  resname;
     /// Arbitrary textual tag
-    std::string  tag;
+    InternedString  tag;
     /// Occupancy field
     float  occupancy;
     /// B-factor field
@@ -74,22 +76,18 @@ class Atom {
     /// %Atom type code. -1 means unknown.
     int type;
     /// %Atom type name - textual representation of the atom type
-    std::string type_name;
+    InternedString type_name;
     /// @}
 
     Atom():
         resid(-1),
-        name(""),
         chain(' '),
-        resname(""),
-        tag(""),
         occupancy(0),
         beta(0),
         resindex(-1),
         mass(0),
         charge(0),
         type(-1),
-        type_name(""),
         atomic_number(0)
     {}
 };
@@ -30,7 +30,9 @@
 #pragma once
 
 #include "pteros/core/atom.h"
+#include "pteros/core/copy_on_write.h"
 #include <Eigen/Core>
+#include <utility>
 
 namespace pteros {
 
@@ -60,41 +62,41 @@ public:
     /// @{
     inline const int& index() const { return ind; }
 
-    inline int& resid(){ return atom_ptr->resid; }
-    inline const int& resid() const { return atom_ptr->resid; }
+    inline int& resid(){ return atom().resid; }
+    inline const int& resid() const { return atom().resid; }
 
-    inline std::string& name(){ return atom_ptr->name; }
-    inline const std::string& name() const { return atom_ptr->name; }
+    inline InternedString& name(){ return atom().name; }
+    inline const std::string& name() const { return atom().name.str(); }
 
-    inline char& chain(){ return atom_ptr->chain; }
-    inline const char& chain() const { return atom_ptr->chain; }
+    inline char& chain(){ return atom().chain; }
+    inline const char& chain() const { return atom().chain; }
 
-    inline std::string& resname(){ return atom_ptr->resname; }
-    inline const std::string& resname() const { return atom_ptr->resname; }
+    inline InternedString& resname(){ return atom().resname; }
+    inline const std::string& resname() const { return atom().resname.str(); }
 
-    inline std::string& tag(){ return atom_ptr->tag; }
-    inline const std::string& tag() const { return atom_ptr->tag; }
+    inline InternedString& tag(){ return atom().tag; }
+    inline const std::string& tag() const { return atom().tag.str(); }
 
-    inline float& occupancy(){ return atom_ptr->occupancy; }
-    inline const float& occupancy() const { return atom_ptr->occupancy; }
+    inline float& occupancy(){ return atom().occupancy; }
+    inline const float& occupancy() const { return atom().occupancy; }
 
-    inline float& beta(){ return atom_ptr->beta; }
-    inline const float& beta() const { return atom_ptr->beta; }
+    inline float& beta(){ return atom().beta; }
+    inline const float& beta() const { return atom().beta; }
 
-    inline int& resindex() { return atom_ptr->resindex; }
-    inline const int& resindex() const { return atom_ptr->resindex; }
+    inline int& resindex() { return atom().resindex; }
+    inline const int& resindex() const { return atom().resindex; }
 
-    inline float& mass(){ return atom_ptr->mass; }
-    inline const float& mass() const { return atom_ptr->mass; }
+    inline float& mass(){ return atom().mass; }
+    inline const float& mass() const { return atom().mass; }
 
-    inline float& charge(){ return atom_ptr->charge; }
-    inline const float& charge() const { return atom_ptr->charge; }
+    inline float& charge(){ return atom().charge; }
+    inline const float& charge() const { return atom().charge; }
 
-    inline int& type(){ return atom_ptr->type; }
-    inline const int& type() const { return atom_ptr->type; }
+    inline int& type(){ return atom().type; }
+    inline const int& type() const { return atom().type; }
 
-    inline std::string& type_name(){ return atom_ptr->type_name; }
-    inline const std::string& type_name() const { return atom_ptr->type_name; }
+    inline InternedString& type_name(){ return atom().type_name; }
+    inline const std::string& type_name() const { return atom().type_name.str(); }
 
     inline float& x(){ return (*coord_ptr)(0); }
     inline const float& x() const { return (*coord_ptr)(0); }
@@ -116,11 +118,11 @@ public:
     inline const Eigen::Vector3f& force() const { return *f_ptr; }
     */
 
-    inline Atom& atom(){ return *atom_ptr; }
-    inline const Atom& atom() const { return *atom_ptr; }
+    inline Atom& atom(){ return atoms_ptr->ref()[ind]; }
+    inline const Atom& atom() const { return std::as_const(*atoms_ptr)[ind]; }
 
-    inline int& atomic_number(){ return atom_ptr->atomic_number; }
-    inline const int& atomic_number() const { return atom_ptr->atomic_number; }
+    inline int& atomic_number(){ return atom().atomic_number; }
+    inline const int& atomic_number() const { return atom().atomic_number; }
 
     std::string element_name() const;
 
@@ -128,7 +130,9 @@ public:
     ///@}
 
 private:
-    AtomIterator atom_ptr;
+    // Atoms are looked up on each access: non-const access marks them as referenced
+    // by the System, while const access never does and never copies shared atoms.
+    CowVector<Atom>* atoms_ptr;
     AtomStateIterator coord_ptr;
     // Atom don't store it's own index, so store it here
     int ind;
@@ -136,7 +140,6 @@ private:
     // Move handler by n atoms. For internal usage.
     inline void advance(int n=1){
         coord_ptr+=n;
-        atom_ptr+=n;
         ind+=n;
     }
 };
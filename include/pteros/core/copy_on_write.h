@@ -0,0 +1,170 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <atomic>
+
+namespace pteros {
+
+/**
+* Pointer to data, which is shared between the copies of the owner
+* and is copied on first modification (copy-on-write).
+* Const access never copies the data. Non-const access makes a private
+* copy if the data is shared with other owners.
+* References, which are handed out by the owner and could outlive the call,
+* are obtained with ref(). After that the data is never shared: the copies
+* of the owner receive their own data, so writing through such references
+* does not affect the copies. This lasts until release_references() is called
+* by the owner when the references become invalid.
+*/
+template<class T>
+class CowPtr {
+public:
+    CowPtr(): ptr(std::make_shared<T>()), referenced(false) {}
+    CowPtr(const CowPtr& other): ptr(other.share()), referenced(false) {}
+
+    CowPtr& operator=(const CowPtr& other){
+        if(&other==this) return *this;
+        ptr = other.share();
+        referenced = false;
+        return *this;
+    }
+
+    const T& operator*() const { return *ptr; }
+    const T* operator->() const { return ptr.get(); }
+
+    T& operator*() { return detach(); }
+    T* operator->() { return &detach(); }
+
+    /// Non-const access for the references handed out to the user
+    T& ref(){
+        // Flag is checked first to avoid writing to it in parallel loops
+        if(!referenced.load(std::memory_order_relaxed)) referenced.store(true,std::memory_order_relaxed);
+        return detach();
+    }
+
+    /// True if ref() was called since the last release_references()
+    bool is_referenced() const { return referenced.load(std::memory_order_relaxed); }
+
+    /// Forget about the references, which are no longer valid
+    void release_references(){ referenced.store(false,std::memory_order_relaxed); }
+
+    /// True if the data is shared with other owners
+    bool is_shared() const { return ptr.use_count()>1; }
+
+    /// Drops shared data and starts with default-constructed one without copying
+    void reset(){
+        if(is_shared()) ptr = std::make_shared<T>(); else *ptr = T();
+    }
+
+private:
+    std::shared_ptr<T> ptr;
+    std::atomic<bool> referenced;
+
+    // Data with handed out references is copied right away
+    std::shared_ptr<T> share() const {
+        return is_referenced() ? std::make_shared<T>(*ptr) : ptr;
+    }
+
+    T& detach(){
+        // use_count()==1 means that nobody else could read the data,
+        // so it could be modified in place
+        if(ptr.use_count()>1) ptr = std::make_shared<T>(*ptr);
+        return *ptr;
+    }
+};
+
+/**
+* Copy-on-write vector with the interface of std::vector.
+* Modifying methods and non-const element access make a private copy
+* if the data is shared.
+*/
+template<class T>
+class CowVector {
+public:
+    typedef T value_type;
+    typedef typename std::vector<T>::iterator iterator;
+    typedef typename std::vector<T>::const_iterator const_iterator;
+
+    CowVector() {}
+    CowVector(const std::vector<T>& v){ *data = v; }
+
+    CowVector& operator=(const std::vector<T>& v){
+        data.reset();
+        *data = v;
+        return *this;
+    }
+
+    operator const std::vector<T>&() const { return *data; }
+
+    size_t size() const { return data->size(); }
+    bool empty() const { return data->empty(); }
+
+    const T& operator[](size_t i) const { return (*data)[i]; }
+    // Checks for sharing on each access, use detached() in loops
+    T& operator[](size_t i) { return (*data)[i]; }
+
+    const T& front() const { return data->front(); }
+    T& front() { return data->front(); }
+    const T& back() const { return data->back(); }
+    T& back() { return data->back(); }
+
+    const_iterator begin() const { return data->begin(); }
+    const_iterator end() const { return data->end(); }
+    iterator begin() { return data->begin(); }
+    iterator end() { return data->end(); }
+
+    void push_back(const T& v){ data->push_back(v); }
+    void reserve(size_t n){ data->reserve(n); }
+    void resize(size_t n){ data->resize(n); }
+    // No need to copy shared data, which is going to be discarded
+    void clear(){ data.reset(); }
+
+    /// Non-const access for the references handed out to the user
+    std::vector<T>& ref(){ return data.ref(); }
+    /// Private copy of the data for internal modification in place.
+    /// Detaches once, so the loops could index the storage directly.
+    std::vector<T>& detached(){ return *data; }
+    bool is_referenced() const { return data.is_referenced(); }
+    void release_references(){ data.release_references(); }
+
+    bool is_shared() const { return data.is_shared(); }
+
+private:
+    CowPtr<std::vector<T>> data;
+};
+
+}
+
+
+
+
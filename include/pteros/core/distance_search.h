@@ -62,9 +62,56 @@
 
 #include "pteros/core/selection.h"
 #include "pteros/core/distance_search_within.h"
+#include <functional>
 
 namespace pteros {       
 
+class DistanceSearchContacts;
+
+/// Reusable storage for the results of contact search.
+/// Pairs are stored as structure of arrays in separate chunks filled by individual threads,
+/// so no concatenation is needed after the search. Memory of the chunks is kept between searches.
+/// Order of pairs in the chunks depends on scheduling of the threads.
+/// C++ only, in Python search_contacts() returns numpy arrays directly.
+class ContactsBuffer {
+public:
+    /// Contacts found by single thread
+    struct Chunk {
+        std::vector<int> i;
+        std::vector<int> j;
+        std::vector<float> d;
+        size_t size() const {return i.size();}
+    };
+
+    /// If squared is true the squared distances are stored and sqrt is not computed
+    ContactsBuffer(bool squared = false): squared(squared) {}
+
+    /// Store squared distances
+    bool squared;
+
+    /// Total number of contacts in all chunks
+    size_t size() const;
+    int num_chunks() const {return chunks.size();}
+    const Chunk& chunk(int k) const {return chunks[k];}
+
+    /// Reserve space for n contacts in each of n_chunks chunks
+    void reserve(size_t n, int n_chunks);
+    /// Remove all contacts, allocated memory is kept
+    void clear();
+    /// Copy contacts to plain vectors of pairs and distances
+    void to_vectors(std::vector<Eigen::Vector2i>& pairs, std::vector<float>& distances) const;
+
+private:
+    std::vector<Chunk> chunks;
+    friend class DistanceSearchContacts;
+};
+
+/// Function consuming found contacts: visitor(i, j, distance_squared, thread).
+/// It is called concurrently from the threads of ThreadPool,
+/// thread is in the range [0:ThreadPool::instance().get_num_threads()).
+/// C++ only, since calling Python from the worker threads would serialize them on GIL.
+typedef std::function<void(int,int,float,int)> ContactVisitor;
+
 /// Search contacts within single selection
 /// Optionally returns distances for each pair.
 void search_contacts(float d,
@@ -83,6 +130,38 @@ void search_contacts(float d,
                      bool absolute_index,
                      Vector3i_const_ref pbc);
 
+/// Search contacts within single selection into reusable buffer
+void search_contacts(float d,
+                     const Selection& sel,
+                     ContactsBuffer& res,
+                     bool absolute_index,
+                     Vector3i_const_ref pbc);
+
+/// Search contacts between two selections into reusable buffer
+void search_contacts(float d,
+                     const Selection& sel1,
+                     const Selection& sel2,
+                     ContactsBuffer& res,
+                     bool absolute_index,
+                     Vector3i_const_ref pbc);
+
+/// Search contacts within single selection and pass them to visitor
+/// without storing
+void search_contacts(float d,
+                     const Selection& sel,
+                     const ContactVisitor& visitor,
+                     bool absolute_index,
+                     Vector3i_const_ref pbc);
+
+/// Search contacts between two selections and pass them to visitor
+/// without storing
+void search_contacts(float d,
+                     const Selection& sel1,
+                     const Selection& sel2,
+                     const ContactVisitor& visitor,
+                     bool absolute_index,
+                     Vector3i_const_ref pbc);
+
 /// Search atoms from source selection around the traget selection
 /// Returns absolute indexes only!
 void search_within(float d,
@@ -57,6 +57,17 @@ public:
                        std::vector<int> &res,
                        bool include_self=true);
 
+    /// Search around many points at once in parallel.
+    /// Result is in CSR form: sorted atoms around points[k] are
+    /// res[offsets[k]]...res[offsets[k+1]-1].
+    void search_within(const std::vector<Eigen::Vector3f>& points,
+                       std::vector<int> &res,
+                       std::vector<int> &offsets);
+
+    /// Returns true if any atom is within given distance from the point.
+    /// Stops at first found atom.
+    bool any_within(Vector3f_const_ref coord);
+
 private:
     class DistanceSearchWithinImpl;
     std::unique_ptr<DistanceSearchWithinImpl> p;
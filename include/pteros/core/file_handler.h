@@ -32,6 +32,8 @@
 #include "pteros/core/system.h"
 #include "pteros/core/selection.h"
 #include <bitset>
+#include <vector>
+#include <cstdint>
 
 namespace pteros {
 
@@ -102,6 +104,28 @@ public:
     /// Reports content of this file type
     virtual FileContent get_content_type() const = 0;
 
+    /// Skips n trajectory frames without decoding them if possible.
+    /// Returns the number of skipped frames, which is less than n at the end of file.
+    /// Default implementation reads the frames and discards them.
+    virtual int skip_frames(int n);
+
+    /// Returns byte offsets of all trajectory frames if the format allows
+    /// to find them without decoding. Returns empty vector otherwise.
+    /// Reading position is not changed.
+    virtual std::vector<int64_t> get_frame_offsets();
+
+    /// Moves reading position to the frame starting at given byte offset.
+    /// Only valid for offsets returned by get_frame_offsets().
+    virtual void seek_offset(int64_t offset);
+
+    /// Returns current byte offset or -1 if not supported.
+    virtual int64_t tell_offset();
+
+    /// Sets precision of coordinates for formats with lossy compression (XTC).
+    /// Coordinates are stored with the accuracy of 1/prec nm.
+    /// Ignored by other formats.
+    virtual void set_precision(float prec);
+
 protected:    
     FileHandler(std::string& file_name);
 
@@ -31,23 +31,32 @@
 
 #include <Eigen/Core>
 #include <vector>
-#include <deque>
 #include "pteros/core/selection.h"
-#include <unsupported/Eigen/CXX11/Tensor>
 
 namespace pteros {    
 
+    /// Read-only view of the points of single grid cell.
+    /// Points of the cell are stored contiguously inside the parent Grid,
+    /// so the view is cheap to create and copy.
     class GridCell {
     public:
-        void add_point(int ind, Vector3f_const_ref crd);
-        void clear();
-        int get_index(int i) const {return indexes[i];}
-        Eigen::Vector3f get_coord(int i) const {return coords[i];}
-        size_t size() const {return indexes.size();}
+        GridCell(const int* ind, const float* x, const float* y, const float* z, int n):
+            _ind(ind), _x(x), _y(y), _z(z), _n(n) {}
+
+        int get_index(int i) const {return _ind[i];}
+        Eigen::Vector3f get_coord(int i) const {return Eigen::Vector3f(_x[i],_y[i],_z[i]);}
+        size_t size() const {return _n;}
+
+        /// Raw access to contiguous SoA data of the cell
+        const int*   index_data() const {return _ind;}
+        const float* x_data() const {return _x;}
+        const float* y_data() const {return _y;}
+        const float* z_data() const {return _z;}
 
     private:
-        std::vector<int> indexes;
-        std::vector<Eigen::Vector3f> coords;
+        const int* _ind;
+        const float *_x, *_y, *_z;
+        int _n;
     };
 
     /**
@@ -67,18 +76,35 @@ namespace pteros {
             for(int k=0;k< 100;++k)
                 cout << g.cell(i,j,k).size() << endl;
     \endcode
+
+    Internally this is a flat cell list: the points are sorted by cell
+    with counting sort into contiguous coordinate arrays, the cells are
+    described by an array of offsets. Memory is reused between
+    populate() calls, so refilling the grid on each frame does not reallocate.
+    Subsequent populate() calls add points to the grid until clear() or resize().
      */
     class Grid {
     public:
-        Grid(){}
+        Grid(){ resize(0,0,0); }
         Grid(int X, int Y, int Z){ resize(X,Y,Z); }
         virtual ~Grid(){}
 
+        /// Removes all points, keeps dimensions and allocated memory
         void clear();
+        /// Sets new dimensions and removes all points
         void resize(int X, int Y, int Z);
-        GridCell& cell(int i, int j, int k){ return data(i,j,k); }
-        GridCell& cell(Vector3i_const_ref ind){ return data(ind(0),ind(1),ind(2)); }
-        const GridCell& cell(Vector3i_const_ref ind) const { return data(ind(0),ind(1),ind(2)); }
+
+        Eigen::Vector3i dimensions() const {return dims;}
+        int num_cells() const {return offsets.size()-1;}
+        int num_points() const {return indexes.size();}
+
+        GridCell cell(int i, int j, int k) const { return cell_by_linear((i*dims(1)+j)*dims(2)+k); }
+        GridCell cell(Vector3i_const_ref ind) const { return cell(ind(0),ind(1),ind(2)); }
+        /// Cell by linear index, which is k+NZ*j+NZ*NY*i
+        GridCell cell_by_linear(int c) const {
+            int b = offsets[c];
+            return GridCell(indexes.data()+b, x.data()+b, y.data()+b, z.data()+b, offsets[c+1]-b);
+        }
 
         /// Non-periodic populate
         void populate(const Selection& sel,bool abs_index = false);
@@ -98,7 +124,25 @@ namespace pteros {
                                Vector3i_const_ref pbc_dims = fullPBC,
                                bool abs_index = false);
     private:
-        Eigen::Tensor<GridCell,3> data;
+        Eigen::Vector3i dims;
+        // Start of each cell in sorted arrays, size is num_cells+1
+        std::vector<int> offsets;
+        // Sorted point data (SoA)
+        std::vector<int> indexes;
+        std::vector<float> x,y,z;
+        // Unsorted points accumulated since last clear()
+        std::vector<int> raw_cell, raw_index;
+        std::vector<Eigen::Vector3f> raw_coord;
+        // Insertion positions used while sorting
+        std::vector<int> cursor;
+
+        void add_raw(int cell, int ind, Vector3f_const_ref crd){
+            raw_cell.push_back(cell);
+            raw_index.push_back(ind);
+            raw_coord.push_back(crd);
+        }
+        // Counting sort of raw points into cells
+        void sort_points();
     };
 
 }
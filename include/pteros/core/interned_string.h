@@ -0,0 +1,122 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <ostream>
+#include <fmt/format.h>
+
+namespace pteros {
+
+/**
+* String, which is stored in the global table of unique strings.
+* Only the integer id of the string is kept in the object, so it is
+* cheap to copy and equal strings are compared as integers.
+* Atom names, residue names, tags and type names are not numerous even
+* in huge systems, so the table stays small.
+* Behaves as a read-only std::string and could be assigned from a string.
+*/
+class InternedString {
+public:
+    InternedString(): id(0) {}
+    InternedString(const std::string& s): id(intern(s)) {}
+    InternedString(const char* s): id(intern(s)) {}
+    /// Interns the view without creating temporary string
+    explicit InternedString(std::string_view s): id(intern(s)) {}
+
+    InternedString& operator=(const std::string& s){ id = intern(s); return *this; }
+    InternedString& operator=(const char* s){ id = intern(s); return *this; }
+
+    /// Stored string
+    const std::string& str() const { return get_string(id); }
+    operator const std::string&() const { return str(); }
+
+    const char* c_str() const { return str().c_str(); }
+    size_t size() const { return str().size(); }
+    size_t length() const { return str().size(); }
+    bool empty() const { return id==0; }
+    char operator[](size_t i) const { return str()[i]; }
+    char front() const { return str().front(); }
+    char back() const { return str().back(); }
+    std::string::const_iterator begin() const { return str().begin(); }
+    std::string::const_iterator end() const { return str().end(); }
+    std::string substr(size_t pos = 0, size_t n = std::string::npos) const { return str().substr(pos,n); }
+    size_t find(const std::string& s, size_t pos = 0) const { return str().find(s,pos); }
+    size_t find(char c, size_t pos = 0) const { return str().find(c,pos); }
+    size_t copy(char* dest, size_t n, size_t pos = 0) const { return str().copy(dest,n,pos); }
+    int compare(const std::string& s) const { return str().compare(s); }
+
+    /// Unique id of the string. Empty string has id 0.
+    uint32_t get_id() const { return id; }
+
+    /// Returns id of existing string or -1 if there is no such string in the table.
+    /// The string is not added to the table.
+    static int find_id(const std::string& s);
+
+    bool operator==(const InternedString& other) const { return id==other.id; }
+    bool operator!=(const InternedString& other) const { return id!=other.id; }
+    bool operator==(const std::string& s) const { return str()==s; }
+    bool operator!=(const std::string& s) const { return str()!=s; }
+    bool operator==(const char* s) const { return str()==s; }
+    bool operator!=(const char* s) const { return str()!=s; }
+    // Ordering is the same as for strings
+    bool operator<(const InternedString& other) const { return str()<other.str(); }
+
+private:
+    uint32_t id;
+    static uint32_t intern(std::string_view s);
+    static const std::string& get_string(uint32_t id);
+};
+
+inline bool operator==(const std::string& s, const InternedString& is){ return is==s; }
+inline bool operator!=(const std::string& s, const InternedString& is){ return is!=s; }
+inline bool operator==(const char* s, const InternedString& is){ return is==s; }
+inline bool operator!=(const char* s, const InternedString& is){ return is!=s; }
+
+inline std::string operator+(const std::string& s, const InternedString& is){ return s+is.str(); }
+inline std::string operator+(const InternedString& is, const std::string& s){ return is.str()+s; }
+
+inline std::ostream& operator<<(std::ostream& os, const InternedString& s){ return os << s.str(); }
+
+}
+
+template<>
+struct fmt::formatter<pteros::InternedString>: fmt::formatter<fmt::string_view> {
+    template<class FormatContext>
+    auto format(const pteros::InternedString& s, FormatContext& ctx) -> decltype(ctx.out()) {
+        return fmt::formatter<fmt::string_view>::format(fmt::string_view(s.str()),ctx);
+    }
+};
+
+
+
+
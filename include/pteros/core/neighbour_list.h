@@ -0,0 +1,115 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include "pteros/core/selection.h"
+
+namespace pteros {
+
+/** Neighbour (Verlet) list for repeated contact search on consecutive frames.
+ Pairs are searched with the cutoff extended by the skin and cached.
+ On subsequent updates the cached pairs are only filtered by the actual cutoff
+ until any atom moves by more than half of the skin since the last build.
+ Then the list is rebuilt automatically.
+ \code
+ NeighbourList nlist(0.5, 0.1, sel, true);
+ vector<Vector2i> pairs;
+ vector<float> dist;
+ for(int fr=0; fr<sys.num_frames(); ++fr){
+    sel.set_frame(fr);
+    nlist.search_contacts(sel,pairs,dist);
+ }
+ \endcode
+ The list is built for the current frame of selections passed to setup().
+ Selections passed to search_contacts() should be the same as used for setup(),
+ possibly pointing to the other frame. If the atoms of selection change the list
+ is rebuilt.
+ */
+class NeighbourList {
+public:
+    NeighbourList();
+
+    /// Neighbour list for contacts within single selection
+    NeighbourList(float cutoff,
+                  float skin,
+                  const Selection& sel,
+                  bool absolute_index = false,
+                  Vector3i_const_ref pbc = fullPBC);
+
+    /// Neighbour list for contacts between two selections
+    NeighbourList(float cutoff,
+                  float skin,
+                  const Selection& sel1,
+                  const Selection& sel2,
+                  bool absolute_index = false,
+                  Vector3i_const_ref pbc = fullPBC);
+
+    virtual ~NeighbourList();
+
+    void setup(float cutoff,
+               float skin,
+               const Selection& sel,
+               bool absolute_index = false,
+               Vector3i_const_ref pbc = fullPBC);
+
+    void setup(float cutoff,
+               float skin,
+               const Selection& sel1,
+               const Selection& sel2,
+               bool absolute_index = false,
+               Vector3i_const_ref pbc = fullPBC);
+
+    /// Contacts within single selection for its current frame
+    void search_contacts(const Selection& sel,
+                         std::vector<Eigen::Vector2i>& pairs,
+                         std::vector<float>& distances);
+
+    /// Contacts between two selections for their current frame
+    void search_contacts(const Selection& sel1,
+                         const Selection& sel2,
+                         std::vector<Eigen::Vector2i>& pairs,
+                         std::vector<float>& distances);
+
+    /// Force rebuild of the list on next search
+    void invalidate();
+
+    /// Number of list rebuilds performed so far
+    int num_rebuilds() const;
+
+private:
+    class NeighbourListImpl;
+    std::unique_ptr<NeighbourListImpl> p;
+};
+
+}
+
+
+
+
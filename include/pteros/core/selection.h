@@ -270,6 +270,16 @@ class Selection {
     */
     void apply();
 
+    /** Sets the skin (nm) used by apply() to re-evaluate "within" incrementally.
+    *   While no atom moves further than half of the skin only the atoms close
+    *   to the cutoff are re-checked. Larger skin allows larger motion between frames,
+    *   but more atoms are re-checked. Zero disables incremental evaluation.
+    *   The result does not depend on the skin. Default is 0.1 nm.
+    *   Kept until selection text is parsed again. Does nothing if selection
+    *   is not coordinate-dependent.
+    */
+    void set_within_skin(float skin);
+
     /** Recomputes selection completely.
     *   May be used when new file is loaded into the system, or when atoms are
     *   created/deleted. Forces re-parsing of selection text.
@@ -376,6 +386,10 @@ class Selection {
     /// Get vector of all indexes in selection
     std::vector<int> get_index() const { return _index; }
 
+    /// Get index as runs of consecutive atoms.
+    /// Each run is {first,last} pair of global indexes.
+    std::vector<Eigen::Vector2i> get_index_runs() const;
+
     /// Get vector of all chains in selection
     std::vector<char> get_chain(bool unique=false) const;
 
@@ -726,8 +740,10 @@ class Selection {
     *   Frames from b to e are written.
     *   If @param b is not set or -1 it means current frame
     *   If @param e is not set or -1 it means the last frame
+    *   If @param prec is positive it sets the precision of lossy formats (XTC),
+    *   see FileHandler::set_precision()
     */
-    void write(std::string fname, int b=-1,int e=-1) const;
+    void write(std::string fname, int b=-1,int e=-1, float prec=0) const;
 
     void write(const std::unique_ptr<FileHandler>& handler, FileContent what,int b=-1,int e=-1) const;
     /// @}
@@ -916,19 +932,24 @@ class Selection {
     inline const Eigen::Vector3f& force(int ind, int fr) const { return system->traj[fr].force[_index[ind]]; }
 
 #define DEFINE_ACCESSOR(T,prop) \
-    inline T& prop(int ind){ return system->atoms[_index[ind]].prop; } \
-    inline const T& prop(int ind) const { return system->atoms[_index[ind]].prop; }
+    inline T& prop(int ind){ return system->atoms.ref()[_index[ind]].prop; } \
+    inline const T& prop(int ind) const { return csys()->atoms[_index[ind]].prop; }
+
+// Textual fields are interned and are assigned as a whole
+#define DEFINE_STR_ACCESSOR(prop) \
+    inline InternedString& prop(int ind){ return system->atoms.ref()[_index[ind]].prop; } \
+    inline const std::string& prop(int ind) const { return csys()->atoms[_index[ind]].prop.str(); }
 
     /// Extracts type
     DEFINE_ACCESSOR(int,type)
     /// Extracts typename
-    DEFINE_ACCESSOR(std::string,type_name)
+    DEFINE_STR_ACCESSOR(type_name)
     /// Extracts residue name
-    DEFINE_ACCESSOR(std::string,resname)
+    DEFINE_STR_ACCESSOR(resname)
     /// Extracts chain
     DEFINE_ACCESSOR(char,chain)
     /// Extracts atom name
-    DEFINE_ACCESSOR(std::string,name)
+    DEFINE_STR_ACCESSOR(name)
     /// Extracts atom mass
     DEFINE_ACCESSOR(float,mass)
     /// Extracts atom charge
@@ -940,14 +961,14 @@ class Selection {
     /// Extracts residue number
     DEFINE_ACCESSOR(int,resid)
     /// Extracts tag
-    DEFINE_ACCESSOR(std::string,tag)
+    DEFINE_STR_ACCESSOR(tag)
 
     /// Extracts atom index in the system, which is pointed by selection
     inline int index(int ind) const { return _index[ind]; }
 
     /// Extracts whole atom
-    inline Atom& atom(int ind){ return system->atoms[_index[ind]]; }
-    inline const Atom& atom(int ind) const { return system->atoms[_index[ind]]; }
+    inline Atom& atom(int ind){ return system->atoms.ref()[_index[ind]]; }
+    inline const Atom& atom(int ind) const { return csys()->atoms[_index[ind]]; }
 
     /// Extracts resindex
     DEFINE_ACCESSOR(int,resindex)
@@ -993,15 +1014,28 @@ protected:
     std::vector<int> _index;
     // Pointer to target system
     System* system;
+    // Read-only access to target system. Reading atoms and force field
+    // through it never copies the data shared with other systems.
+    const System* csys() const { return system; }
 
     // Stores current frame
     int frame;
 
-    // Holds an instance of selection parser
-    std::unique_ptr<SelectionParser> parser;
+    // Holds an instance of selection parser.
+    // Shared between copies of selection and copied before evaluation if shared.
+    std::shared_ptr<SelectionParser> parser;
     void allocate_parser();
     void sort_and_remove_duplicates();    
     void process_pbc_atom(int& a) const;
+    // True if index is a single run of consecutive atoms.
+    // Coordinates of such selections are contiguous in the frame.
+    bool is_contiguous() const {
+        return !_index.empty() && _index.back()-_index.front()+1==int(_index.size());
+    }
+    // Splits index into spans of consecutive atoms {first,size} for vectorized kernels.
+    // Long runs are cut into several spans for parallel processing.
+    // Returns false if index is too fragmented for that.
+    bool get_spans(std::vector<Eigen::Vector2i>& spans) const;
     void get_local_bonds_from_topology(std::vector<std::vector<int>>& con) const;
 };
 
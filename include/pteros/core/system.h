@@ -33,6 +33,8 @@
 #include <vector>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <Eigen/Core>
 #include <Eigen/Dense>
 #include "pteros/core/atom.h"
@@ -40,6 +42,7 @@
 #include "pteros/core/periodic_box.h"
 #include "pteros/core/typedefs.h"
 #include "pteros/core/atom_handler.h"
+#include "pteros/core/copy_on_write.h"
 
 
 namespace pteros {
@@ -76,6 +79,8 @@ class Selection;
 class FileHandler;
 class FileContent;
 class AtomHandler;
+class SelectionCache;
+struct TopologyTables;
 
 //====================================================================================
 
@@ -89,6 +94,18 @@ class AtomHandler;
     signals if selections should adapt to the changes of coordinates of atom properties.
 *   Copying and assignment of systems is allowed, but associated selections are
     not copied.
+*   Atoms and force field are shared between the copies of the system and
+    are copied only when one of the copies modifies them (copy-on-write), so
+    copying large systems is cheap. If mutable references to atoms or force field
+    were obtained (by non-const atom(), get_force_field(), Selection accessors, AtomHandler, etc.)
+    the copies receive their own data right away, so the references are never shared.
+    Const accessors never do this, so use them for reading.
+*   Text selections and residue tables are cached until atoms or force field are
+    modified by the methods of System or by the setters of Selection. Caching is
+    disabled while mutable references to atoms or force field could be alive,
+    that is until the next change of topology by the methods of System or Selection,
+    clear() or loading new structure. References obtained before such changes
+    should not be used for writing after them.
 */
 class System {
     // System and Selection are friends because they are closely integrated.
@@ -97,6 +114,10 @@ class System {
     friend class SelectionParser;
     // Needs an access for constructing the system in IO handlers
     friend class SystemBuilder;
+    // Uses revision of the topology
+    friend class SelectionCache;
+    // Accesses atoms without marking them as referenced on reading
+    friend class AtomHandler;
 
 public:    
     //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -291,7 +312,9 @@ public:
               FileContent what,
               std::function<bool(System*,int)> on_frame = 0);    
 
-    void write(std::string fname, int b=-1,int e=-1) const;
+    /// Write structure or trajectory. If @param prec is positive it sets
+    /// the precision of lossy formats (XTC), see FileHandler::set_precision().
+    void write(std::string fname, int b=-1,int e=-1, float prec=0) const;
 
     void write(const std::unique_ptr<FileHandler>& handler, FileContent what,int b=-1,int e=-1) const;
 
@@ -396,7 +419,7 @@ public:
     inline const Eigen::Vector3f& force(int ind, int fr=0) const { return traj[fr].force[ind]; }
 
     /// Read/Write access for given atom
-    inline Atom& atom(int ind) { return atoms[ind]; }
+    inline Atom& atom(int ind) { return atoms.ref()[ind]; }
 
     /// Read only access for given atom
     inline const Atom& atom(int ind) const { return atoms[ind]; }
@@ -411,8 +434,8 @@ public:
 
     /// Iterators and indexing
     /// {@
-    AtomIterator atoms_begin(){ return atoms.begin(); }
-    AtomIterator atoms_end(){ return atoms.end(); }
+    AtomIterator atoms_begin(){ return atoms.ref().begin(); }
+    AtomIterator atoms_end(){ return atoms.ref().end(); }
     std::vector<Frame>::iterator traj_begin(){ return traj.begin(); }
     std::vector<Frame>::iterator traj_end(){ return traj.end(); }
 
@@ -496,11 +519,16 @@ public:
     /// Clears the system and prepares for loading completely new structure
     void clear();
 
-    bool force_field_ready(){return force_field.ready;}
+    bool force_field_ready() const {return force_field->ready;}
 
     /// Returns internal Force_field object
     ForceField& get_force_field(){
-        return force_field;
+        return force_field.ref();
+    }
+
+    /// Returns internal Force_field object. Never copies shared force field.
+    const ForceField& get_force_field() const {
+        return *force_field;
     }
 
     /// Assign unique resindexes
@@ -523,14 +551,15 @@ public:
 
 protected:
 
-    // Holds all atom attributes except the coordinates
-    std::vector<Atom>  atoms;
+    // Holds all atom attributes except the coordinates.
+    // Shared between copies of the system until modified.
+    CowVector<Atom>  atoms;
 
     // Coordinates for any number of frames
     std::vector<Frame> traj;
 
-    // Force field parameters
-    ForceField force_field;
+    // Force field parameters. Shared between copies of the system until modified.
+    CowPtr<ForceField> force_field;
 
     // Indexes for filtering
     std::vector<int> filter;
@@ -539,6 +568,34 @@ protected:
 
     void filter_atoms();
     void filter_coord(int fr);
+
+    // Cache of text selections. Not copied with the system.
+    std::unique_ptr<SelectionCache> sel_cache;
+
+    // Revision of atoms and force field. Incremented after their modification.
+    // Zero means that mutable references to them could be alive,
+    // so the data derived from them should not be cached.
+    uint64_t topology_revision() const;
+    // Tables of residues and molecules. Rebuilt on demand after topology changes.
+    std::shared_ptr<const TopologyTables> topology_tables() const;
+
+    // Scope of modification of atoms or force field by the methods of System and Selection.
+    // Increments topology revision at the end and forgets about the references
+    // handed out before, so caching is disabled only until the next topology change.
+    class TopologyChange {
+    public:
+        TopologyChange(System& s);
+        ~TopologyChange();
+    private:
+        System& sys;
+    };
+
+    // Drops mutable references to atoms and force field, which became invalid
+    void release_references();
+
+    std::atomic<uint64_t> topo_revision;
+    mutable std::mutex topo_mutex;
+    mutable std::shared_ptr<const TopologyTables> topo_tables;
 };
 
 //====================================================================================
@@ -0,0 +1,83 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+namespace pteros {
+
+/** Persistent pool of worker threads used for parallel code paths of the library,
+ which are not based on OpenMP (distance search in particular).
+ Work is split into blocks, which are distributed among the threads dynamically
+ with work stealing, so inhomogeneous workloads are balanced automatically.
+ The threads are created once on first use and then reused.
+ \code
+ // Use 4 threads pinned to cores
+ ThreadPool::instance().set_num_threads(4);
+ ThreadPool::instance().set_pinning(true);
+ \endcode
+ Default number of threads is taken from PTEROS_NUM_THREADS environment variable
+ or equals to the number of hardware threads if it is not set.
+ */
+class ThreadPool {
+public:
+    /// Global pool instance
+    static ThreadPool& instance();
+
+    virtual ~ThreadPool();
+
+    /// Set number of threads including the calling one.
+    /// Zero means the number of hardware threads.
+    void set_num_threads(int n);
+    int get_num_threads() const;
+
+    /// Pin worker threads to CPU cores (Linux only)
+    void set_pinning(bool pin);
+    bool get_pinning() const;
+
+    /// Calls func(b,e,thread_id) for the blocks [b:e) of given size covering [0:N).
+    /// thread_id is in the range [0:get_num_threads()) and could be used to access
+    /// per-thread buffers. Calling thread also takes part in the work.
+    /// Nested calls and calls made while the pool is busy are executed serially.
+    void parallel_for(int N, int block, const std::function<void(int,int,int)>& func);
+
+private:
+    ThreadPool();
+
+    class ThreadPoolImpl;
+    std::unique_ptr<ThreadPoolImpl> p;
+};
+
+}
+
+
+
+
@@ -29,6 +29,7 @@
 
 #pragma once
 #include "pteros/core/selection.h"
+#include "pteros/core/neighbour_list.h"
 #include "pteros/core/logging.h"
 #include "pteros/core/utilities.h"
 #include <Eigen/Core>
@@ -208,6 +209,13 @@ public:
     void compute_averages();
     void write_averages(std::string path=".");
 
+    /// Skin of the neighbour list of lipid markers (0.2 nm by default).
+    /// Lateral displacement of lipids is ~0.06 nm per 100 ps, so the list is reused
+    /// for several frames if they are saved every 100 ps or more often. If markers
+    /// move by more than half of the skin between frames the list is rebuilt every time
+    /// with larger cutoff, then the skin should be decreased or set to zero.
+    void set_neighbour_skin(float skin);
+
     std::vector<LipidMolecule> lipids;
     std::vector<LipidGroup> groups;
 
@@ -217,6 +225,10 @@ private:
     std::shared_ptr<spdlog::logger> log;
 
     Selection all_mid_sel;
+    // Neighbour list of lipid markers, its cutoff and skin
+    NeighbourList mid_nlist;
+    float mid_nlist_cutoff;
+    float mid_nlist_skin;
 };
 
 
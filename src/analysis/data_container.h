@@ -2,6 +2,10 @@
 
 #include "pteros/core/system.h"
 #include "pteros/analysis/frame_info.h"
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
 
 namespace pteros {
 
@@ -11,6 +15,78 @@ struct DataContainer {
     Frame frame;
     /// Frame information
     FrameInfo frame_info;
+
+    DataContainer(): n_consumers(1) {}
+
+    /// Sets how many tasks will receive this container
+    void set_consumers(int n){ n_consumers.store(n,std::memory_order_relaxed); }
+
+    /// Puts the frame into the target frame.
+    /// All consumers except the last one copy the frame. The last one
+    /// takes the frame storage without copying and leaves its old storage
+    /// in the container, so it is reused when the container is recycled.
+    void take_frame(Frame& target){
+        // Counter is decremented only after copying is finished, so if
+        // it is 1 nobody else reads the frame anymore
+        if(n_consumers.load(std::memory_order_acquire)==1){
+            std::swap(target,frame);
+        } else {
+            target = frame;
+            n_consumers.fetch_sub(1,std::memory_order_release);
+        }
+    }
+
+private:
+    std::atomic<int> n_consumers;
+};
+
+
+/// Pool of data containers, which are reused once all consumers
+/// release them. Frame storage of reused containers is not reallocated.
+class DataContainerPool {
+public:
+    DataContainerPool(): store(std::make_shared<Store>()) {}
+
+    /// Returns free container or allocates new one if there are no free containers
+    std::shared_ptr<DataContainer> get(){
+        DataContainer* ptr = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(store->mut);
+            if(!store->free.empty()){
+                ptr = store->free.back();
+                store->free.pop_back();
+            }
+        }
+        if(!ptr){
+            ptr = new DataContainer;
+        } else {
+            // Capacity of vectors is preserved
+            ptr->frame.coord.clear();
+            ptr->frame.vel.clear();
+            ptr->frame.force.clear();
+            ptr->set_consumers(1);
+        }
+
+        // Container returns to the pool when the last reference is released.
+        // If the pool is destroyed already container is just deleted.
+        std::weak_ptr<Store> weak_store = store;
+        return std::shared_ptr<DataContainer>(ptr, [weak_store](DataContainer* p){
+            if(auto s = weak_store.lock()){
+                std::lock_guard<std::mutex> lock(s->mut);
+                s->free.push_back(p);
+            } else {
+                delete p;
+            }
+        });
+    }
+
+private:
+    struct Store {
+        std::mutex mut;
+        std::vector<DataContainer*> free;
+        ~Store(){ for(auto p: free) delete p; }
+    };
+    std::shared_ptr<Store> store;
 };
 
 }
@@ -20,8 +20,8 @@ TaskBase::TaskBase(const TaskBase &other)
     n_consumed = 0;
 }
 
-void pteros::TaskBase::put_frame(const pteros::Frame &frame){
-    system.frame(0) = frame;
+void pteros::TaskBase::put_frame(DataContainer &data){
+    data.take_frame(system.frame(0));
 }
 
 void pteros::TaskBase::put_system(const pteros::System &sys){
@@ -51,7 +51,7 @@ void TaskDriver::process_until_end() {
     while(channel->recieve(data)){
         if(stop_now) return; // Emergency stop point
 
-        task->put_frame(data->frame);
+        task->put_frame(*data);
         if(!pre_process_done){
             task->pre_process_handler();
             pre_process_done = true;
@@ -2,10 +2,96 @@
 #include "pteros/core/pteros_error.h"
 #include "pteros/core/file_handler.h"
 #include "pteros/core/utilities.h"
+#include <algorithm>
+#include <exception>
 
 using namespace std;
 using namespace pteros;
 
+namespace pteros {
+
+/// Decodes frames of one trajectory file in several threads.
+/// Decoder k reads frames start+(k+i*N)*stride with its own file handler
+/// and the frames are received in round-robin order, so the order of frames is preserved.
+/// If frame offsets are known decoders seek directly, otherwise they skip
+/// foreign frames without decoding them if the format allows.
+class FrameDecoders {
+public:
+    FrameDecoders(const string& fname, int n, int start, int stride,
+                  const vector<int64_t>& offsets, DataContainerPool& pool):
+        n(n), start(start), stride(stride), cur(0), eof(false), offsets(offsets), errors(n)
+    {
+        for(int k=0; k<n; ++k) channels.emplace_back(new Channel(4));
+        for(int k=0; k<n; ++k) threads.emplace_back(&FrameDecoders::decoder_body, this, fname, k, ref(pool));
+    }
+
+    ~FrameDecoders(){
+        for(auto& ch: channels) ch->send_stop();
+        for(auto& t: threads) t.join();
+    }
+
+    /// Gets next frame and its index in the file. Returns false at the end of file.
+    bool next(shared_ptr<DataContainer>& data, int& fr){
+        if(eof) return false;
+        Item item;
+        if(!channels[cur]->recieve(item)){
+            eof = true;
+            // Stop all other decoders
+            for(auto& ch: channels) ch->send_stop();
+            if(errors[cur]) rethrow_exception(errors[cur]);
+            return false;
+        }
+        cur = (cur+1)%n;
+        fr = item.first;
+        data = item.second;
+        return true;
+    }
+
+private:
+    using Item = pair<int,shared_ptr<DataContainer>>;
+    using Channel = MessageChannel<Item>;
+
+    int n, start, stride, cur;
+    bool eof;
+    const vector<int64_t>& offsets;
+    vector<unique_ptr<Channel>> channels;
+    vector<thread> threads;
+    // Exception of each decoder, passed to the consumer through the channel
+    vector<exception_ptr> errors;
+
+    // Moves to frame fr skipping nskip frames from current position
+    bool go_to(FileHandler* trj, int fr, int nskip){
+        if(!offsets.empty()){
+            if(fr>=int(offsets.size())) return false;
+            trj->seek_offset(offsets[fr]);
+            return true;
+        }
+        return trj->skip_frames(nskip)==nskip;
+    }
+
+    void decoder_body(const string& fname, int k, DataContainerPool& pool){
+        auto& ch = channels[k];
+        try {
+            auto trj = FileHandler::open(fname,'r');
+            int fr = start+k*stride;
+            if(go_to(trj.get(),fr,fr)){
+                while(true){
+                    auto data = pool.get();
+                    if(!trj->read(nullptr, &data->frame, FileContent().traj(true))) break;
+                    if(!ch->send(Item(fr,data))) return; // Stop requested
+                    fr += n*stride;
+                    if(!go_to(trj.get(),fr,n*stride-1)) break;
+                }
+            }
+        } catch(...) {
+            errors[k] = current_exception();
+        }
+        ch->send_stop();
+    }
+};
+
+}
+
 void process_suffix_value(const string& s, int* intval, float* floatval){
     size_t pos = s.find_last_of("0123456789");
     if(pos==string::npos) throw PterosError("A number with optional suffix required!");
@@ -63,6 +149,9 @@ Traj_file_reader::Traj_file_reader(Options &options, int natoms){
         throw PterosError("Last time {} is smaller that first time {}", last_time, first_time);
 
     log_interval = options("log","-1").as_int();
+
+    n_decoders = options("decoders","1").as_int();
+    if(n_decoders<1) throw PterosError("Number of decoders should be at least 1!");
 }
 
 bool Traj_file_reader::is_frame_valid(int fr, float t){
@@ -132,6 +221,8 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
             log->info("Reading trajectory {}...", fname);
 
             auto trj = FileHandler::open(fname,'r');
+            bool seeked = false; // Seek is done in this file
+            int frames_before = abs_frame; // Number of frames in previous files
 
             // If we need to seek do it now if trajectory supports it
             if(seek_status==1 && trj->get_content_type().rand()){
@@ -142,20 +233,22 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
                 float last_t;
                 rand_trj->tell_last_frame_and_time(last_fr,last_t);
                 if(first_frame>0){
+                    // Frame in this trajectory
+                    int fr = first_frame-abs_frame;
                     // If beyond this trajectory try the next one
-                    if(first_frame>=last_fr){
-                        log->info("First frame is {}, while this trajectory ends at {}.",first_frame,last_fr);
-                        abs_frame += last_fr;
+                    if(fr>last_fr){
+                        log->info("First frame is {}, while this trajectory ends at {}.",first_frame,abs_frame+last_fr);
+                        abs_frame += last_fr+1;
                         abs_time += last_t;
                         continue;
                     }
                     log->info("Fast forward to frame {}...",first_frame);
-                    rand_trj->seek_frame(first_frame);
+                    rand_trj->seek_frame(fr);
                 } else if(first_time>0){
                     // If beyond this trajectory try the next one
-                    if(first_time>=last_t){
-                        log->info("First time is {}, while this trajectory ends at {}.",first_frame,last_fr);
-                        abs_frame += last_fr;
+                    if(first_time>last_t){
+                        log->info("First time is {}, while this trajectory ends at {}.",first_time,last_t);
+                        abs_frame += last_fr+1;
                         abs_time += last_t;
                         continue;
                     }
@@ -170,6 +263,43 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
                 abs_frame += fr;
                 abs_time += t;
                 if(custom_dt>0) abs_time = custom_start_time + custom_dt*abs_frame;
+                seeked = true;
+            }
+
+            // Start parallel decoders if asked
+            vector<int64_t> offsets;
+            unique_ptr<FrameDecoders> decoders;
+            int local_frame = -1; // Last frame received from decoders
+            if(n_decoders>1){
+                offsets = trj->get_frame_offsets();
+                int start = 0;
+                if(seeked){
+                    // Index of current frame is only known from offsets
+                    if(!offsets.empty())
+                        start = lower_bound(offsets.begin(),offsets.end(),trj->tell_offset()) - offsets.begin();
+                    else
+                        start = -1;
+                }
+
+                if(start>=0){
+                    local_frame = start-1;
+                    // If all frames are valid skipped frames are not decoded at all.
+                    // This is only possible if the number of frames is known from offsets.
+                    // Time of the frames in next files could be smaller than the first time,
+                    // so the first time should not be given.
+                    int stride = 1;
+                    if(skip>1 && !offsets.empty() && seek_status==0 && first_time<=0){
+                        stride = skip;
+                        // Continue counting from the previous trajectory
+                        start += (skip - (frame_in_range+1)%skip) % skip;
+                    }
+                    log->debug("Decoding in {} threads, stride {}",n_decoders,stride);
+                    // Decoders have their own file handlers
+                    trj.reset();
+                    decoders.reset(new FrameDecoders(fname,n_decoders,start,stride,offsets,pool));
+                } else {
+                    log->info("Can't decode {} in parallel after seeking, reading sequentially",fname);
+                }
             }
 
             --abs_frame;
@@ -178,21 +308,39 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
             while(true){
                 if(stop_now) return;
 
-                // To avoid excessive copy operations we allocate a shared pointer
-                // and will load data into its storage
-                std::shared_ptr<DataContainer> data(new DataContainer);
+                // To avoid excessive copy operations we take a shared pointer
+                // from the pool and will load data into its storage.
+                // Containers released by the tasks are reused.
+                std::shared_ptr<DataContainer> data;
+                bool good;
+                // Number of frames since the last loaded one
+                int delta = 1;
+
+                if(decoders){
+                    int fr;
+                    good = decoders->next(data,fr);
+                    if(good){
+                        delta = fr-local_frame;
+                        local_frame = fr;
+                    } else if(!offsets.empty()){
+                        // Account for skipped frames at the end of file
+                        abs_frame += offsets.size()-1-local_frame;
+                        frame_in_range += offsets.size()-1-local_frame;
+                    }
+                } else {
+                    data = pool.get();
+                    // Load data to this container
+                    good = trj->read(nullptr, &data->frame, FileContent().traj(true));
+                }
 
-                // Load data to this container
-                bool good = trj->read(nullptr, &data->frame, FileContent().traj(true));
+                // Check if EOF reached in trajectory
+                if(!good) break;
 
                 // Check number of atoms
                 if(data->frame.coord.size() != Natoms)
                     throw PterosError("Expected {} atoms but trajectory has {}.",data->frame.coord.size(),Natoms);
 
-                // Check if EOF reached in trajectory
-                if(!good) break;
-
-                ++abs_frame; // Next absolute frame loaded
+                abs_frame += delta; // Next absolute frame loaded
 
                 // If time stamps are overriden, override time
                 if(custom_dt>=0){
@@ -217,7 +365,8 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
                 // If not go to next frame
                 if( !is_frame_valid(abs_frame,abs_time) ) continue;
 
-                ++frame_in_range;
+                // Skipped frames are always valid
+                frame_in_range += delta;
 
                 // See if we need to skip it
                 if(skip>0 && frame_in_range%skip!=0) continue;
@@ -246,13 +395,14 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
                 channel->send(data);
 
                 // Do fast-forward skipping if asked
-                if(skip>0){
+                if(skip>0 && !decoders){
                     if(trj->get_content_type().rand() && skip>0){
                         log->debug("Skipping {} frames by fast-forward...",skip);
                         try {
-                            dynamic_cast<FileHandlerRandomAccess*>(trj.get())->seek_frame(abs_frame+skip);
-                            abs_frame += skip;
-                            frame_in_range += skip;
+                            dynamic_cast<FileHandlerRandomAccess*>(trj.get())->seek_frame(abs_frame-frames_before+skip);
+                            // Next read frame is counted as usual
+                            abs_frame += skip-1;
+                            frame_in_range += skip-1;
                         } catch(PterosError e){
                             log->debug("Can't seek, maybe EOF is reached");
                         }
@@ -260,6 +410,9 @@ void Traj_file_reader::reader_thread_body(const vector<string> &traj_files, cons
                 }
             } // Over frames
 
+            // abs_frame is the number of frames read so far for the next trajectory
+            ++abs_frame;
+
             log->info("Done with trajectory {}", fname);
 
             // If end reached break here too
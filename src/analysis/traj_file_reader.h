@@ -39,9 +39,12 @@ private:
     int first_frame, last_frame;
     float first_time, last_time;
     int skip;
+    int n_decoders; // Number of parallel decoding threads
 
     std::thread t;
     bool stop_now; // Emergency stop flag
+    // Recycled containers for frames
+    DataContainerPool pool;
     std::shared_ptr<spdlog::logger> log;
 };
 
@@ -87,6 +87,10 @@ Processing options:
     -buffer <n>
         Number of frames, which are kept in memory, default: 10
         Only touch this if individual frames are very large.
+    -decoders <n>
+        Number of threads decoding trajectory frames, default: 1
+        Frames are still delivered to the tasks in their order.
+        Useful for compressed trajectories (XTC) if the tasks are fast.
 
 Suffixes:
     All parameters marked as <value[suffix]> accept the following optional suffixes:
@@ -361,8 +365,10 @@ void TrajectoryReader::run(){
                 tasks[i]->driver->process_until_end_in_thread();
             }
 
-            // Recieve all frames for reader channel and dispatch them to workers
+            // Recieve all frames for reader channel and dispatch them to workers.
+            // The same container is shared by all workers.
             while(reader_channel->recieve(data)){
+                data->set_consumers(worker_channels.size());
                 for(auto &ch: worker_channels){
                     ch->send(data);
                 }
@@ -21,8 +21,7 @@ void AtomHandler::set(const Selection &sel, int i)
         throw PterosError("Can't point at frame {}, there are only {} frames in the system!",i,sel.get_system()->num_frames());
     coord_ptr = sel.get_system()->frame(sel.get_frame()).coord.begin();
     coord_ptr += i;
-    atom_ptr = sel.get_system()->atoms_begin();
-    atom_ptr += i;
+    atoms_ptr = &sel.get_system()->atoms;
     ind = i;
 }
 
@@ -32,15 +31,14 @@ void AtomHandler::set(const System &sys, int i, int fr)
         throw PterosError("Can't point ot frame {}, there are only {} frames in the system!",i,sys.num_frames());
     coord_ptr = const_cast<System&>(sys).frame(fr).coord.begin();
     coord_ptr += i;
-    atom_ptr = const_cast<System&>(sys).atoms_begin();
-    atom_ptr += i;
+    atoms_ptr = &const_cast<System&>(sys).atoms;
     ind = i;
 }
 
 string AtomHandler::element_name() const {
-    return get_element_name(atom_ptr->atomic_number);
+    return get_element_name(atom().atomic_number);
 }
 
 float AtomHandler::vdw() const {
-    return get_vdw_radius(atom_ptr->atomic_number,atom_ptr->name);
+    return get_vdw_radius(atom().atomic_number,atom().name);
 }
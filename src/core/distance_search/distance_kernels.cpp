@@ -0,0 +1,327 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "distance_kernels.h"
+#include "pteros/core/logging.h"
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PTEROS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace pteros;
+
+namespace {
+
+// Scalar kernel for points in [b:e), also used for the tails of SIMD loops.
+// Operations and rounding mode are the same as in SIMD kernels, so all kernels
+// give bitwise identical distances.
+template<bool PBC>
+inline int scan_scalar(const float* x, const float* y, const float* z, int b, int e,
+                       const float* p, const RectPBC* pbc, float cutoff2,
+                       int* hits, float* hits_d2, int nh)
+{
+    for(int i=b;i<e;++i){
+        float dx = x[i]-p[0];
+        float dy = y[i]-p[1];
+        float dz = z[i]-p[2];
+        if(PBC){
+            dx -= pbc->ext[0]*nearbyint(dx*pbc->inv[0]);
+            dy -= pbc->ext[1]*nearbyint(dy*pbc->inv[1]);
+            dz -= pbc->ext[2]*nearbyint(dz*pbc->inv[2]);
+        }
+        float d2 = dx*dx+dy*dy+dz*dz;
+        if(d2<=cutoff2){
+            if(!hits) return 1; // Any point is enough
+            hits[nh] = i;
+            hits_d2[nh] = d2;
+            ++nh;
+        }
+    }
+    return nh;
+}
+
+int kernel_scalar(const float* x, const float* y, const float* z, int n,
+                  const float* p, const RectPBC* pbc, float cutoff2,
+                  int* hits, float* hits_d2)
+{
+    if(pbc)
+        return scan_scalar<true>(x,y,z,0,n,p,pbc,cutoff2,hits,hits_d2,0);
+    else
+        return scan_scalar<false>(x,y,z,0,n,p,pbc,cutoff2,hits,hits_d2,0);
+}
+
+#ifdef PTEROS_X86_KERNELS
+
+//-------------------------------------------
+// SSE4.1, 4 points at once
+//-------------------------------------------
+template<bool PBC>
+__attribute__((target("sse4.1")))
+int scan_sse(const float* x, const float* y, const float* z, int n,
+             const float* p, const RectPBC* pbc, float cutoff2,
+             int* hits, float* hits_d2)
+{
+    __m128 px = _mm_set1_ps(p[0]);
+    __m128 py = _mm_set1_ps(p[1]);
+    __m128 pz = _mm_set1_ps(p[2]);
+    __m128 c2 = _mm_set1_ps(cutoff2);
+    __m128 ex,ey,ez,ix,iy,iz;
+    if(PBC){
+        ex = _mm_set1_ps(pbc->ext[0]); ix = _mm_set1_ps(pbc->inv[0]);
+        ey = _mm_set1_ps(pbc->ext[1]); iy = _mm_set1_ps(pbc->inv[1]);
+        ez = _mm_set1_ps(pbc->ext[2]); iz = _mm_set1_ps(pbc->inv[2]);
+    }
+
+    int nh = 0;
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(x+i),px);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(y+i),py);
+        __m128 dz = _mm_sub_ps(_mm_loadu_ps(z+i),pz);
+        if(PBC){
+            const int r = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+            dx = _mm_sub_ps(dx,_mm_mul_ps(ex,_mm_round_ps(_mm_mul_ps(dx,ix),r)));
+            dy = _mm_sub_ps(dy,_mm_mul_ps(ey,_mm_round_ps(_mm_mul_ps(dy,iy),r)));
+            dz = _mm_sub_ps(dz,_mm_mul_ps(ez,_mm_round_ps(_mm_mul_ps(dz,iz),r)));
+        }
+        __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,dx),_mm_mul_ps(dy,dy)),_mm_mul_ps(dz,dz));
+        int m = _mm_movemask_ps(_mm_cmple_ps(d2,c2));
+        if(!m) continue;
+        if(!hits) return 1; // Any point is enough
+        alignas(16) float buf[4];
+        _mm_store_ps(buf,d2);
+        while(m){
+            int k = __builtin_ctz(m);
+            hits[nh] = i+k;
+            hits_d2[nh] = buf[k];
+            ++nh;
+            m &= m-1;
+        }
+    }
+
+    return scan_scalar<PBC>(x,y,z,i,n,p,pbc,cutoff2,hits,hits_d2,nh);
+}
+
+int kernel_sse(const float* x, const float* y, const float* z, int n,
+               const float* p, const RectPBC* pbc, float cutoff2,
+               int* hits, float* hits_d2)
+{
+    if(pbc)
+        return scan_sse<true>(x,y,z,n,p,pbc,cutoff2,hits,hits_d2);
+    else
+        return scan_sse<false>(x,y,z,n,p,pbc,cutoff2,hits,hits_d2);
+}
+
+//-------------------------------------------
+// AVX2, 8 points at once
+//-------------------------------------------
+template<bool PBC>
+__attribute__((target("avx2")))
+int scan_avx2(const float* x, const float* y, const float* z, int n,
+              const float* p, const RectPBC* pbc, float cutoff2,
+              int* hits, float* hits_d2)
+{
+    __m256 px = _mm256_set1_ps(p[0]);
+    __m256 py = _mm256_set1_ps(p[1]);
+    __m256 pz = _mm256_set1_ps(p[2]);
+    __m256 c2 = _mm256_set1_ps(cutoff2);
+    __m256 ex,ey,ez,ix,iy,iz;
+    if(PBC){
+        ex = _mm256_set1_ps(pbc->ext[0]); ix = _mm256_set1_ps(pbc->inv[0]);
+        ey = _mm256_set1_ps(pbc->ext[1]); iy = _mm256_set1_ps(pbc->inv[1]);
+        ez = _mm256_set1_ps(pbc->ext[2]); iz = _mm256_set1_ps(pbc->inv[2]);
+    }
+
+    int nh = 0;
+    int i = 0;
+    for(;i+8<=n;i+=8){
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x+i),px);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y+i),py);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z+i),pz);
+        if(PBC){
+            const int r = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+            dx = _mm256_sub_ps(dx,_mm256_mul_ps(ex,_mm256_round_ps(_mm256_mul_ps(dx,ix),r)));
+            dy = _mm256_sub_ps(dy,_mm256_mul_ps(ey,_mm256_round_ps(_mm256_mul_ps(dy,iy),r)));
+            dz = _mm256_sub_ps(dz,_mm256_mul_ps(ez,_mm256_round_ps(_mm256_mul_ps(dz,iz),r)));
+        }
+        __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx,dx),_mm256_mul_ps(dy,dy)),_mm256_mul_ps(dz,dz));
+        int m = _mm256_movemask_ps(_mm256_cmp_ps(d2,c2,_CMP_LE_OQ));
+        if(!m) continue;
+        if(!hits) return 1; // Any point is enough
+        alignas(32) float buf[8];
+        _mm256_store_ps(buf,d2);
+        while(m){
+            int k = __builtin_ctz(m);
+            hits[nh] = i+k;
+            hits_d2[nh] = buf[k];
+            ++nh;
+            m &= m-1;
+        }
+    }
+
+    return scan_scalar<PBC>(x,y,z,i,n,p,pbc,cutoff2,hits,hits_d2,nh);
+}
+
+int kernel_avx2(const float* x, const float* y, const float* z, int n,
+                const float* p, const RectPBC* pbc, float cutoff2,
+                int* hits, float* hits_d2)
+{
+    if(pbc)
+        return scan_avx2<true>(x,y,z,n,p,pbc,cutoff2,hits,hits_d2);
+    else
+        return scan_avx2<false>(x,y,z,n,p,pbc,cutoff2,hits,hits_d2);
+}
+
+//-------------------------------------------
+// AVX-512, 16 points at once, tail is masked
+//-------------------------------------------
+template<bool PBC>
+__attribute__((target("avx512f")))
+int scan_avx512(const float* x, const float* y, const float* z, int n,
+                const float* p, const RectPBC* pbc, float cutoff2,
+                int* hits, float* hits_d2)
+{
+    __m512 px = _mm512_set1_ps(p[0]);
+    __m512 py = _mm512_set1_ps(p[1]);
+    __m512 pz = _mm512_set1_ps(p[2]);
+    __m512 c2 = _mm512_set1_ps(cutoff2);
+    __m512 ex,ey,ez,ix,iy,iz;
+    if(PBC){
+        ex = _mm512_set1_ps(pbc->ext[0]); ix = _mm512_set1_ps(pbc->inv[0]);
+        ey = _mm512_set1_ps(pbc->ext[1]); iy = _mm512_set1_ps(pbc->inv[1]);
+        ez = _mm512_set1_ps(pbc->ext[2]); iz = _mm512_set1_ps(pbc->inv[2]);
+    }
+    const __m512i lanes = _mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+
+    int nh = 0;
+    for(int i=0;i<n;i+=16){
+        __mmask16 lm = (n-i>=16) ? 0xFFFF : __mmask16((1u<<(n-i))-1);
+        __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(lm,x+i),px);
+        __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(lm,y+i),py);
+        __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(lm,z+i),pz);
+        if(PBC){
+            const int r = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+            dx = _mm512_sub_ps(dx,_mm512_mul_ps(ex,_mm512_maskz_roundscale_ps(0xFFFF,_mm512_mul_ps(dx,ix),r)));
+            dy = _mm512_sub_ps(dy,_mm512_mul_ps(ey,_mm512_maskz_roundscale_ps(0xFFFF,_mm512_mul_ps(dy,iy),r)));
+            dz = _mm512_sub_ps(dz,_mm512_mul_ps(ez,_mm512_maskz_roundscale_ps(0xFFFF,_mm512_mul_ps(dz,iz),r)));
+        }
+        __m512 d2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx,dx),_mm512_mul_ps(dy,dy)),_mm512_mul_ps(dz,dz));
+        __mmask16 m = _mm512_mask_cmp_ps_mask(lm,d2,c2,_CMP_LE_OQ);
+        if(!m) continue;
+        if(!hits) return 1; // Any point is enough
+        _mm512_mask_compressstoreu_epi32(hits+nh,m,_mm512_add_epi32(lanes,_mm512_set1_epi32(i)));
+        _mm512_mask_compressstoreu_ps(hits_d2+nh,m,d2);
+        nh += __builtin_popcount(m);
+    }
+    return nh;
+}
+
+int kernel_avx512(const float* x, const float* y, const float* z, int n,
+                  const float* p, const RectPBC* pbc, float cutoff2,
+                  int* hits, float* hits_d2)
+{
+    if(pbc)
+        return scan_avx512<true>(x,y,z,n,p,pbc,cutoff2,hits,hits_d2);
+    else
+        return scan_avx512<false>(x,y,z,n,p,pbc,cutoff2,hits,hits_d2);
+}
+
+#endif
+
+struct KernelChoice {
+    DistanceKernel kernel;
+    const char* name;
+};
+
+KernelChoice kernel_by_name(const string& name){
+#ifdef PTEROS_X86_KERNELS
+    __builtin_cpu_init();
+    if(name=="avx512" && __builtin_cpu_supports("avx512f"))
+        return {kernel_avx512,"avx512"};
+    if(name=="avx2" && __builtin_cpu_supports("avx2"))
+        return {kernel_avx2,"avx2"};
+    if(name=="sse" && __builtin_cpu_supports("sse4.1"))
+        return {kernel_sse,"sse"};
+#endif
+    if(name=="scalar") return {kernel_scalar,"scalar"};
+    return {nullptr,""};
+}
+
+KernelChoice choose_kernel(){
+    // Optional limit for instruction set
+    string limit = "avx512";
+    if(const char* env = getenv("PTEROS_SIMD")) limit = env;
+
+    // Try from the widest instruction set starting from the limit
+    const char* names[] = {"avx512","avx2","sse","scalar"};
+    bool allowed = false;
+    for(auto nm: names){
+        if(limit==nm) allowed = true;
+        if(!allowed) continue;
+        auto c = kernel_by_name(nm);
+        if(c.kernel) return c;
+    }
+
+    return {kernel_scalar,"scalar"};
+}
+
+const KernelChoice& current_kernel(){
+    static KernelChoice choice = [](){
+        auto c = choose_kernel();
+        LOG()->debug("Distance search kernel: {}",c.name);
+        return c;
+    }();
+    return choice;
+}
+
+} // namespace
+
+
+DistanceKernel pteros::get_distance_kernel()
+{
+    return current_kernel().kernel;
+}
+
+DistanceKernel pteros::get_distance_kernel(const string& name)
+{
+    return kernel_by_name(name).kernel;
+}
+
+const char* pteros::distance_kernel_name()
+{
+    return current_kernel().name;
+}
+
+
+
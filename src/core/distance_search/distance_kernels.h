@@ -0,0 +1,73 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <string>
+
+namespace pteros {
+
+/// Rectangular periodic box prepared for the distance kernels.
+/// Zero extent means that the dimension is not periodic.
+struct RectPBC {
+    float ext[3];
+    float inv[3];
+};
+
+/// Distance kernel. Finds the points among n points stored as SoA arrays x,y,z,
+/// which are within squared cutoff cutoff2 from point p.
+/// Their positions in x,y,z and squared distances are written to hits and hits_d2,
+/// which should have the room for n elements.
+/// If hits is nullptr the search stops at first found point and 1 is returned
+/// (0 if nothing is found).
+/// If pbc is not nullptr the minimal image is used along periodic dimensions.
+/// Returns the number of found points.
+typedef int (*DistanceKernel)(const float* x, const float* y, const float* z, int n,
+                              const float* p,
+                              const RectPBC* pbc,
+                              float cutoff2,
+                              int* hits, float* hits_d2);
+
+/// Returns the fastest distance kernel supported by current CPU.
+/// The choice is made on first call and could be limited by setting
+/// environment variable PTEROS_SIMD to one of "avx512", "avx2", "sse" or "scalar".
+DistanceKernel get_distance_kernel();
+
+/// Returns the kernel for given instruction set ("avx512", "avx2", "sse" or "scalar")
+/// or nullptr if it is unknown or not supported by current CPU.
+DistanceKernel get_distance_kernel(const std::string& name);
+
+/// Name of the instruction set used by get_distance_kernel()
+const char* distance_kernel_name();
+
+}
+
+
+
+
@@ -48,7 +48,7 @@ void search_contacts(float d,
                      bool absolute_index = false,
                      Vector3i_const_ref pbc = noPBC)
 {    
-    DistanceSearchContacts1sel(d,sel,pairs,distances,absolute_index,pbc);
+    DistanceSearchContacts1sel(d,sel,absolute_index,pbc).do_search(pairs,distances);
 }
 
 
@@ -60,7 +60,49 @@ void search_contacts(float d,
                      bool absolute_index = false,
                      Vector3i_const_ref pbc = noPBC)
 {
-    DistanceSearchContacts2sel(d,sel1,sel2,pairs,distances,absolute_index,pbc);
+    DistanceSearchContacts2sel(d,sel1,sel2,absolute_index,pbc).do_search(pairs,distances);
+}
+
+
+void search_contacts(float d,
+                     const Selection& sel,
+                     ContactsBuffer& res,
+                     bool absolute_index,
+                     Vector3i_const_ref pbc)
+{
+    DistanceSearchContacts1sel(d,sel,absolute_index,pbc).do_search(res);
+}
+
+
+void search_contacts(float d,
+                     const Selection& sel1,
+                     const Selection& sel2,
+                     ContactsBuffer& res,
+                     bool absolute_index,
+                     Vector3i_const_ref pbc)
+{
+    DistanceSearchContacts2sel(d,sel1,sel2,absolute_index,pbc).do_search(res);
+}
+
+
+void search_contacts(float d,
+                     const Selection& sel,
+                     const ContactVisitor& visitor,
+                     bool absolute_index,
+                     Vector3i_const_ref pbc)
+{
+    DistanceSearchContacts1sel(d,sel,absolute_index,pbc).do_search(visitor);
+}
+
+
+void search_contacts(float d,
+                     const Selection& sel1,
+                     const Selection& sel2,
+                     const ContactVisitor& visitor,
+                     bool absolute_index,
+                     Vector3i_const_ref pbc)
+{
+    DistanceSearchContacts2sel(d,sel1,sel2,absolute_index,pbc).do_search(visitor);
 }
 
 
@@ -76,6 +118,50 @@ void search_within(float d,
 
 }
 
+//-------------------------------
+// ContactsBuffer
+//-------------------------------
+
+size_t ContactsBuffer::size() const
+{
+    size_t n = 0;
+    for(auto& c: chunks) n += c.size();
+    return n;
+}
+
+void ContactsBuffer::reserve(size_t n, int n_chunks)
+{
+    if(int(chunks.size())<n_chunks) chunks.resize(n_chunks);
+    for(auto& c: chunks){
+        c.i.reserve(n);
+        c.j.reserve(n);
+        c.d.reserve(n);
+    }
+}
+
+void ContactsBuffer::clear()
+{
+    for(auto& c: chunks){
+        c.i.clear();
+        c.j.clear();
+        c.d.clear();
+    }
+}
+
+void ContactsBuffer::to_vectors(std::vector<Vector2i> &pairs, std::vector<float> &distances) const
+{
+    pairs.clear();
+    distances.clear();
+    pairs.reserve(size());
+    distances.reserve(size());
+    for(auto& c: chunks){
+        for(size_t k=0;k<c.size();++k){
+            pairs.emplace_back(c.i[k],c.j[k]);
+            distances.push_back(c.d[k]);
+        }
+    }
+}
+
 
 
 
@@ -34,69 +34,119 @@ using namespace std;
 using namespace pteros;
 using namespace Eigen;
 
-// Non-periodic variant
-void DistanceSearchBase::set_grid_size(const Vector3f &min, const Vector3f &max)
+// Cells are made twice smaller than cutoff if there are at least that many
+// points in the cell of cutoff size on average. Smaller cells reduce the
+// volume, which is scanned around each point, from 27 to 15.6 cutoff cells,
+// but this only pays off if the cells are still large enough for the kernels.
+static const int half_cell_occupancy = 128;
+
+void DistanceSearchBase::setup_cells(Vector3f_const_ref widths, int n_points, bool rectangular)
 {
-    Vector3f extents = max-min;    
+    min_image_dims.fill(0);
+    for(int dim=0;dim<3;++dim){
+        // Only one image of each point could be within cutoff if the box is at least
+        // twice larger than cutoff. Otherwise minimal image convention is used.
+        if(periodic_dims(dim) && widths(dim)<2.0*cutoff) min_image_dims(dim) = 1;
+    }
+
+    // Cell size should be >= cutoff/div for all dimentions
+    int div = 1;
+    for(int pass=0;pass<2;++pass){
+        for(int dim=0;dim<3;++dim){
+            Ngrid(dim) = min_image_dims(dim) ? 1 : floor(div*widths(dim)/cutoff);
+            if(Ngrid(dim)<1) Ngrid(dim) = 1;
+        }
+        if(div==2 || n_points < half_cell_occupancy*Ngrid.prod()) break;
+        div = 2;
+    }
+
+    // Number of neighbour cells to look at in each direction
+    Vector3f cell_widths = widths.array()/Ngrid.cast<float>().array();
+    Vector3i range;
+    for(int dim=0;dim<3;++dim){
+        range(dim) = std::min(div,int(ceil(cutoff/cell_widths(dim))));
+        if(range(dim)>Ngrid(dim)-1) range(dim) = Ngrid(dim)-1;
+    }
 
-    // Cell size should be >= cutoff for all dimentions
-    Ngrid(0) = floor(extents(0)/cutoff);
-    Ngrid(1) = floor(extents(1)/cutoff);
-    Ngrid(2) = floor(extents(2)/cutoff);
+    stencil.clear();
+    point_stencil.clear();
+    Vector3i o;
+    Vector3f gap;
+    for(o(0)=-range(0);o(0)<=range(0);++o(0)){
+        for(o(1)=-range(1);o(1)<=range(1);++o(1)){
+            for(o(2)=-range(2);o(2)<=range(2);++o(2)){
+                // Lower bound of the distance between the points of two cells
+                for(int dim=0;dim<3;++dim) gap(dim) = std::max(0,abs(o(dim))-1)*cell_widths(dim);
+                // In triclinic box the gaps are measured along different normals
+                // and only the largest of them is the safe estimate
+                float d = rectangular ? gap.norm() : gap.maxCoeff();
+                if(d>cutoff) continue;
+
+                point_stencil.push_back(o);
+                // Take only one of the opposite offsets
+                if(o(0)>0 || (o(0)==0 && (o(1)>0 || (o(1)==0 && o(2)>=0))))
+                    stencil.push_back(o);
+            }
+        }
+    }
+
+    // Distances along minimal image dimensions
+    scalar_only = false;
+    if((min_image_dims.array()!=0).any()){
+        if(box.is_triclinic()){
+            scalar_only = true;
+        } else {
+            for(int dim=0;dim<3;++dim){
+                if(min_image_dims(dim)){
+                    min_image_pbc.ext[dim] = box.get_element(dim,dim);
+                    min_image_pbc.inv[dim] = 1.0/min_image_pbc.ext[dim];
+                } else {
+                    min_image_pbc.ext[dim] = min_image_pbc.inv[dim] = 0.0;
+                }
+            }
+        }
+    }
+}
 
-    if(Ngrid(0)<1) Ngrid(0) = 1;
-    if(Ngrid(1)<1) Ngrid(1) = 1;
-    if(Ngrid(2)<1) Ngrid(2) = 1;
+// Non-periodic variant
+void DistanceSearchBase::set_grid_size(const Vector3f &min, const Vector3f &max, int n_points)
+{
+    box_m.fill(0.0);
+    setup_cells(max-min, n_points, true);
 }
 
 // Periodic variant
-void DistanceSearchBase::set_grid_size(const PeriodicBox &box)
+void DistanceSearchBase::set_grid_size(const PeriodicBox &box, int n_points)
 {
-    Vector3f extents;
-    extents(0) = box.box_to_lab(box.get_vector(0))(0);
-    extents(1) = box.box_to_lab(box.get_vector(1))(1);
-    extents(2) = box.box_to_lab(box.get_vector(2))(2);
-
-    // Cell size should be >= cutoff for all dimentions
-    Ngrid(0) = floor(extents(0)/cutoff);
-    Ngrid(1) = floor(extents(1)/cutoff);
-    Ngrid(2) = floor(extents(2)/cutoff);
-
-    if(Ngrid(0)<1) Ngrid(0) = 1;
-    if(Ngrid(1)<1) Ngrid(1) = 1;
-    if(Ngrid(2)<1) Ngrid(2) = 1;
+    box_m = box.get_matrix();
+    // Distances between opposite faces of the box
+    float vol = box_m.col(0).cross(box_m.col(1)).dot(box_m.col(2));
+    Vector3f widths;
+    widths(0) = vol/box_m.col(1).cross(box_m.col(2)).norm();
+    widths(1) = vol/box_m.col(2).cross(box_m.col(0)).norm();
+    widths(2) = vol/box_m.col(0).cross(box_m.col(1)).norm();
+
+    setup_cells(widths, n_points, !box.is_triclinic());
 }
 
-bool DistanceSearchBase::process_neighbour_pair(PlannedPair& pair){
-    pair.wrapped.fill(0);
+bool DistanceSearchBase::make_pair(Vector3i_const_ref c, Vector3i_const_ref offset, PlannedPair& pair) const
+{
+    pair.c1 = c;
+    pair.c2 = c+offset;
+    pair.shift.fill(0);
     for(int dim=0;dim<3;++dim){
-        if(pair.c1(dim)==Ngrid(dim)){ // point beyond the right edge
-            if(periodic_dims(dim)){
-                pair.c1(dim) = pair.c1(dim) % Ngrid(dim); // Wrap this dimension
-                pair.wrapped(dim) = 1;
-            } else {
-                return false; // don't use this pair
-            }
-        }
-
-        if(pair.c2(dim)==Ngrid(dim)){ // point beyond the right edge
-            if(periodic_dims(dim)){
-                pair.c2(dim) = pair.c2(dim) % Ngrid(dim); // Wrap this dimension
-                pair.wrapped(dim) = 1;
-            } else {
-                return false; // don't use this pair
-            }
+        int n = pair.c2(dim);
+        if(n<0 || n>=Ngrid(dim)){
+            if(!periodic_dims(dim)) return false; // don't use this pair
+            // Wrap this dimension and remember the image
+            int s = (n>=0) ? n/Ngrid(dim) : -((Ngrid(dim)-1-n)/Ngrid(dim));
+            pair.c2(dim) = n - s*Ngrid(dim);
+            pair.shift(dim) = s;
         }
-
-        // Corner case: if cutoff>=0.5*extent then all pairs along this extent should
-        // be forced periodic.
-        if(periodic_dims(dim) && Ngrid(dim)<=2) pair.wrapped(dim) = 1;
     }
-
     return true; // use this pair
 }
 
-
 Vector3i DistanceSearchBase::index_to_pos(int i){
     Vector3i pos;
     // i = z+Nz*y+Nz*Ny*x
@@ -106,30 +156,6 @@ Vector3i DistanceSearchBase::index_to_pos(int i){
     return pos;
 }
 
-/*
-void Distance_search_base::make_search_plan(vector<Planned_pair>& plan){
-    plan.reserve(Ngrid.prod()*stencil.size());
-
-    Planned_pair pair;
-
-    for(int x=0;x<Ngrid(0);++x){
-        for(int y=0;y<Ngrid(1);++y){
-            for(int z=0;z<Ngrid(2);++z){
-
-                Vector3i p(x,y,z);
-                for(int i=0;i<stencil.size();i+=2){
-                    pair.c1 = p + stencil[i];
-                    pair.c2 = p + stencil[i+1];
-                    if(process_neighbour_pair(pair)) plan.push_back(pair);
-                }
-
-            } //z
-        } //y
-    } //x
-
-}
-*/
-
 void DistanceSearchBase::create_grid(const Selection &sel)
 {
     if(!is_periodic){
@@ -137,13 +163,13 @@ void DistanceSearchBase::create_grid(const Selection &sel)
         // add small margin to tolerate numeric errors
         max.array() += 1e-5;
         min.array() -= 1e-5;
-        set_grid_size(min,max);
+        set_grid_size(min,max,sel.size());
     } else {
         // Check if we have periodicity
         if(!box.is_periodic())
             throw PterosError("Asked for pbc in distance search, but there is no periodic box!");
         // Set dimensions of the current unit cell
-        set_grid_size(box);
+        set_grid_size(box,sel.size());
     }
 
     // Allocate one grid
@@ -173,7 +199,7 @@ void overlap_1d(float a1, float a2, float b1, float b2, float& res1, float& res2
 
 
 
-void DistanceSearchBase::create_grids(const Selection &sel1, const Selection &sel2)
+bool DistanceSearchBase::create_grids(const Selection &sel1, const Selection &sel2)
 {
     if(!is_periodic){
         // Get the minmax of each selection
@@ -186,26 +212,28 @@ void DistanceSearchBase::create_grids(const Selection &sel1, const Selection &se
         for(int i=0;i<3;++i){
             overlap_1d(min1(i)-cutoff,max1(i)+cutoff,min2(i)-cutoff,max2(i)+cutoff,min(i),max(i));
             // If no overlap just exit
-            if(max(i)==min(i)) return;
+            if(max(i)==min(i)) return false;
         }
 
         // In case of intersection add small margin to tolerate numeric errors
         max.array() += 1e-5;
         min.array() -= 1e-5;
 
-        set_grid_size(min,max);
+        set_grid_size(min,max,std::max(sel1.size(),sel2.size()));
 
     } else {
         // Check if we have periodicity
         if(!box.is_periodic())
             throw PterosError("Asked for pbc in distance search, but there is no periodic box!");
         // Set dimensions of the current unit cell
-        set_grid_size(box);
+        set_grid_size(box,std::max(sel1.size(),sel2.size()));
     }
 
     // Allocate both grids
     grid1.resize(Ngrid(0),Ngrid(1),Ngrid(2));
     grid2.resize(Ngrid(0),Ngrid(1),Ngrid(2));
+
+    return true;
 }
 
 
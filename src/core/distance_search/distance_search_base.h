@@ -33,13 +33,15 @@
 #include <vector>
 #include "pteros/core/periodic_box.h"
 #include "pteros/core/grid.h"
+#include "distance_kernels.h"
 
 namespace pteros {
 
     struct PlannedPair {
         Eigen::Vector3i c1;
         Eigen::Vector3i c2;
-        Eigen::Vector3i wrapped;
+        // Periodic image of c2 with respect to c1 in the units of box vectors
+        Eigen::Vector3i shift;
     };
 
 
@@ -62,42 +64,55 @@ namespace pteros {
         // Is periodicity required?
         bool is_periodic;
 
-        // Periodic grid size
-        void set_grid_size(const Eigen::Vector3f& min,
-                           const Eigen::Vector3f& max);
+        // Periodic dimensions, which are narrower than 2*cutoff.
+        // There is a single cell along them and minimal image convention is used.
+        // Other periodic dimensions are treated by explicit image shifts.
+        Eigen::Vector3i min_image_dims;
+        // Rectangular box for the kernels along min_image_dims
+        RectPBC min_image_pbc;
+        // True if minimal image is needed in triclinic box, so kernels can't be used
+        bool scalar_only;
+        // Box matrix used to compute image shifts
+        Eigen::Matrix3f box_m;
+
+        // Half-shell stencil of cell offsets. Contains only one of each
+        // pair of opposite offsets and zero offset for the cell itself.
+        std::vector<Eigen::Vector3i> stencil;
+        // Full stencil for searching around the point
+        std::vector<Eigen::Vector3i> point_stencil;
+
         // Non-periodic grid size
-        void set_grid_size(const PeriodicBox& box);
+        void set_grid_size(const Eigen::Vector3f& min,
+                           const Eigen::Vector3f& max,
+                           int n_points);
+        // Periodic grid size
+        void set_grid_size(const PeriodicBox& box, int n_points);
         // Create single grid
         void create_grid(const Selection &sel);
-        // Create two grids
-        void create_grids(const Selection &sel1, const Selection &sel2);
-
-        // Neighbours stencil
-        const std::vector<Eigen::Vector3i> stencil = {
-            // Center
-            {0,0,0},{0,0,0},
-            // Edges
-            {0,0,0},{1,0,0}, //X
-            {0,0,0},{0,1,0}, //Y
-            {0,0,0},{0,0,1}, //Z
-            // Face angles
-            {0,0,0},{1,1,0}, //XY
-            {0,0,0},{1,0,1}, //XZ
-            {0,0,0},{0,1,1}, //YZ
-            // Far angle
-            {0,0,0},{1,1,1}, //XYZ
-            // Face-diagonals
-            {1,0,0},{0,1,0}, // XY
-            {1,0,0},{0,0,1}, // XZ
-            {0,1,0},{0,0,1}, // YZ
-            // Cross-diagonals
-            {1,1,0},{0,0,1}, // XY-Z
-            {1,0,1},{0,1,0}, // XZ-Y
-            {0,1,1},{1,0,0}, // YZ-X
-        };
+        // Create two grids. Returns false if selections can't have any contacts
+        bool create_grids(const Selection &sel1, const Selection &sel2);
 
         Eigen::Vector3i index_to_pos(int i);
-        bool process_neighbour_pair(PlannedPair &pair);
+
+        // Makes the pair of cell c with the cell at given offset from it.
+        // The neighbour is wrapped in periodic dimensions and its image shift is set.
+        // Returns false if the neighbour is outside the grid.
+        bool make_pair(Vector3i_const_ref c, Vector3i_const_ref offset, PlannedPair& pair) const;
+
+        // Cartesian shift of periodic image
+        Eigen::Vector3f shift_vector(Vector3i_const_ref shift) const {
+            return box_m*shift.cast<float>();
+        }
+
+        // Rectangular pbc for the kernels (nullptr if no minimal image dimensions)
+        const RectPBC* kernel_pbc() const {
+            return (min_image_dims.array()!=0).any() ? &min_image_pbc : nullptr;
+        }
+
+    private:
+        // Computes grid dimensions and stencils for given widths of the grid.
+        // For triclinic box the widths are the distances between opposite faces.
+        void setup_cells(Vector3f_const_ref widths, int n_points, bool rectangular);
     };
 
 }
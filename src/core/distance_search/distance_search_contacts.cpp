@@ -30,7 +30,7 @@
 
 
 #include "distance_search_contacts.h"
-#include <thread>
+#include "pteros/core/thread_pool.h"
 #include <algorithm>
 
 using namespace std;
@@ -38,80 +38,129 @@ using namespace pteros;
 using namespace Eigen;
 
 
-void DistanceSearchContacts::compute_chunk(int b, int e,
-                                             vector<Eigen::Vector2i>& pairs_buf,
-                                             vector<float>& dist_buf)
+void DistanceSearchContacts::compute_chunk(int b, int e, ContactsSink& sink)
 {
     PlannedPair pair;
     for(int ind=b;ind<e;++ind){
         // Get array position
         auto p = index_to_pos(ind);
         // Apply stencil
-        for(int j=0;j<stencil.size();j+=2){
-            pair.c1 = p + stencil[j];
-            pair.c2 = p + stencil[j+1];
-            if(process_neighbour_pair(pair)){
-                search_planned_pair(pair, pairs_buf, dist_buf);
+        for(const auto& o: stencil){
+            if(make_pair(p,o,pair)){
+                search_planned_pair(pair, sink);
             }
         }
     }
 }
 
-void DistanceSearchContacts::do_search()
+void DistanceSearchContacts::run_in_pool(std::vector<ContactsSink> &sinks)
+{
+    int Ncells = Ngrid.prod();
+    int nt = std::min(Ncells, int(sinks.size()));
+
+    if(nt==1){
+        compute_chunk(0,Ncells,sinks[0]);
+    } else {
+        // Several blocks per thread for load balancing
+        int block = std::max(1, Ncells/(nt*16));
+        ThreadPool::instance().parallel_for(Ncells, block, [&](int b, int e, int t){
+            compute_chunk(b,e, sinks[t]);
+        });
+    }
+}
+
+void DistanceSearchContacts::do_search(std::vector<Vector2i> &pairs, std::vector<float> &distances)
 {
     // Prepare for searching
-    pairs->clear();
-    distances->clear();
+    pairs.clear();
+    distances.clear();
 
-    // See if we need parallelization    
-    int nt = std::min(size_t(Ngrid.prod()), size_t(std::thread::hardware_concurrency()));
+    auto& pool = ThreadPool::instance();
+    int Ncells = Ngrid.prod();
+
+    // See if we need parallelization
+    int nt = std::min(Ncells, pool.get_num_threads());
 
     if(nt==1){        
-        compute_chunk(0,Ngrid.prod(),*pairs,*distances);
+        ContactsSink sink;
+        sink.pairs = &pairs;
+        sink.distances = &distances;
+        compute_chunk(0,Ncells,sink);
 
     } else {
         // Thread parallel
-        vector<vector<Vector2i>> pairs_buf(nt);
-        vector<vector<float>>    dist_buf(nt);
-
-        vector<thread> threads;
-        int chunk = floor(Ngrid.prod()/nt);
-
-        for(int i=0;i<nt;++i){
-            int b = chunk*i;
-            int e = (i<nt-1) ? chunk*(i+1) : Ngrid.prod();
-
-            // Launch thread
-            threads.emplace_back(
-            [&,b,e,i](){
-                compute_chunk(b,e, pairs_buf[i], dist_buf[i]);
-            }
-            );
+        vector<vector<Vector2i>> pairs_buf(pool.get_num_threads());
+        vector<vector<float>>    dist_buf(pool.get_num_threads());
+
+        // Blocks of cells processed by each thread: {first cell, thread, start, end in buffer}.
+        // Used to keep the order of results independent on scheduling.
+        vector<vector<Vector4i>> done(pool.get_num_threads());
+
+        // Several blocks per thread for load balancing
+        int block = std::max(1, Ncells/(nt*16));
+
+        pool.parallel_for(Ncells, block, [&](int b, int e, int t){
+            int n = pairs_buf[t].size();
+            ContactsSink sink;
+            sink.pairs = &pairs_buf[t];
+            sink.distances = &dist_buf[t];
+            compute_chunk(b,e,sink);
+            done[t].emplace_back(b,t,n,pairs_buf[t].size());
+        });
+
+        // Collect results in the order of cells
+        vector<Vector4i> order;
+        for(auto& d: done) order.insert(order.end(),d.begin(),d.end());
+        sort(order.begin(),order.end(),[](const Vector4i& a, const Vector4i& b){return a(0)<b(0);});
+
+        int tot = 0;
+        for(auto& pb: pairs_buf) tot += pb.size();
+        pairs.reserve(tot);
+        distances.reserve(tot);
+
+        for(auto& o: order){
+            pairs.insert(pairs.end(),pairs_buf[o(1)].begin()+o(2),pairs_buf[o(1)].begin()+o(3));
+            distances.insert(distances.end(),dist_buf[o(1)].begin()+o(2),dist_buf[o(1)].begin()+o(3));
         }
+    }
+}
 
-        // Wait for threads
-        for(auto& t: threads) t.join();
+void DistanceSearchContacts::do_search(ContactsBuffer &res)
+{
+    // One chunk per thread, memory of existing chunks is reused
+    int nt = ThreadPool::instance().get_num_threads();
+    if(int(res.chunks.size())<nt) res.chunks.resize(nt);
+    res.clear();
+
+    vector<ContactsSink> sinks(nt);
+    for(int i=0;i<nt;++i){
+        sinks[i].chunk = &res.chunks[i];
+        sinks[i].squared = res.squared;
+    }
 
-        // Collect results
-        for(int i=0;i<nt;++i){
-            copy(begin(pairs_buf[i]),end(pairs_buf[i]),back_inserter(*pairs));
-            copy(begin(dist_buf[i]),end(dist_buf[i]),back_inserter(*distances));
-        }
+    run_in_pool(sinks);
+}
+
+void DistanceSearchContacts::do_search(const ContactVisitor &visitor)
+{
+    int nt = ThreadPool::instance().get_num_threads();
+    vector<ContactsSink> sinks(nt);
+    for(int i=0;i<nt;++i){
+        sinks[i].visitor = &visitor;
+        sinks[i].thread = i;
     }
+
+    run_in_pool(sinks);
 }
 
 
 void DistanceSearchContacts::search_between_cells(const pteros::PlannedPair &pair,
                                                 const Grid& grid1,
                                                 const Grid& grid2,
-                                                std::vector<Eigen::Vector2i>& pairs_buffer,
-                                                std::vector<float>& distances_buffer)
+                                                ContactsSink& sink)
 {
-    const GridCell& cell1 = grid1.cell(pair.c1);
-    const GridCell& cell2 = grid2.cell(pair.c2);
-
-    // The cells could be not adjucent if one of them is wrapped around
-    // but this only happens in peridic case and is treated automatically
+    GridCell cell1 = grid1.cell(pair.c1);
+    GridCell cell2 = grid2.cell(pair.c2);
 
     int N1 = cell1.size();
     int N2 = cell2.size();
@@ -120,43 +169,46 @@ void DistanceSearchContacts::search_between_cells(const pteros::PlannedPair &pai
 
     float cutoff2 = cutoff*cutoff;
 
-    if((pair.wrapped.array()>0).any()){
+    // Instead of moving all points of cell2 to its periodic image
+    // the points of cell1 are moved in opposite direction
+    Vector3f sh = shift_vector(pair.shift);
 
+    if(scalar_only){
+        // Minimal image in triclinic box, no fast path
         for(int i1=0;i1<N1;++i1){
-            Vector3f p = cell1.get_coord(i1); // Coord of point in grid1
+            Vector3f p = cell1.get_coord(i1) - sh; // Coord of point in grid1
             for(int i2=0;i2<N2;++i2){
-                float d = box.distance_squared(cell2.get_coord(i2), p, pair.wrapped);
-                if(d<=cutoff2){
-                    pairs_buffer.emplace_back(cell1.get_index(i1),
-                                              cell2.get_index(i2));
-                    distances_buffer.push_back(sqrt(d));
-                }
+                float d = box.distance_squared(cell2.get_coord(i2), p, min_image_dims);
+                if(d<=cutoff2) sink.add(cell1.get_index(i1),cell2.get_index(i2),d);
             }
         }
+        return;
+    }
 
-    } else {
+    // Vectorized path
+    auto kernel = get_distance_kernel();
+    thread_local vector<int> hits;
+    thread_local vector<float> hits_d2;
+    if(int(hits.size())<N2){
+        hits.resize(N2);
+        hits_d2.resize(N2);
+    }
 
-        for(int i1=0;i1<N1;++i1){
-            Vector3f p = cell1.get_coord(i1); // Coord of point in grid1
-            for(int i2=0;i2<N2;++i2){
-                float d = (cell2.get_coord(i2)-p).squaredNorm();
-                if(d<=cutoff2){
-                    pairs_buffer.emplace_back(cell1.get_index(i1),
-                                              cell2.get_index(i2));
-                    distances_buffer.push_back(sqrt(d));
-                }
-            }
+    for(int i1=0;i1<N1;++i1){
+        Vector3f p = cell1.get_coord(i1) - sh; // Coord of point in grid1
+        int nh = kernel(cell2.x_data(),cell2.y_data(),cell2.z_data(),N2,
+                        p.data(),kernel_pbc(),cutoff2,hits.data(),hits_d2.data());
+        for(int k=0;k<nh;++k){
+            sink.add(cell1.get_index(i1),cell2.get_index(hits[k]),hits_d2[k]);
         }
-
     }
 }
 
 void DistanceSearchContacts::search_inside_cell(const PlannedPair& pair,
                                                   const Grid &grid,
-                                                  std::vector<Vector2i> &pairs_buffer,
-                                                  std::vector<float> &distances_buffer)
+                                                  ContactsSink& sink)
 {
-    const GridCell& cell = grid.cell(pair.c1);
+    GridCell cell = grid.cell(pair.c1);
 
     int N = cell.size();
 
@@ -164,39 +216,38 @@ void DistanceSearchContacts::search_inside_cell(const PlannedPair& pair,
 
     float cutoff2 = cutoff*cutoff;
 
-    if((pair.wrapped.array()>0).any()){
-
+    if(scalar_only){
+        // Minimal image in triclinic box, no fast path
         for(int i1=0;i1<N-1;++i1){
             Vector3f p = cell.get_coord(i1); // Coord of point in grid1
             for(int i2=i1+1;i2<N;++i2){
-                float d = box.distance_squared(cell.get_coord(i2),p,pair.wrapped);
-                if(d<=cutoff2){
-                    pairs_buffer.emplace_back(cell.get_index(i1),
-                                              cell.get_index(i2));
-                    distances_buffer.push_back(sqrt(d));
-                }
+                float d = box.distance_squared(cell.get_coord(i2),p,min_image_dims);
+                if(d<=cutoff2) sink.add(cell.get_index(i1),cell.get_index(i2),d);
             }
         }
+        return;
+    }
 
-    } else {
+    // Vectorized path
+    auto kernel = get_distance_kernel();
+    thread_local vector<int> hits;
+    thread_local vector<float> hits_d2;
+    if(int(hits.size())<N){
+        hits.resize(N);
+        hits_d2.resize(N);
+    }
 
-        for(int i1=0;i1<N-1;++i1){
-            Vector3f p = cell.get_coord(i1); // Coord of point in grid1
-            for(int i2=i1+1;i2<N;++i2){
-                float d = (cell.get_coord(i2)-p).squaredNorm();
-                if(d<=cutoff2){
-                    pairs_buffer.emplace_back(cell.get_index(i1),
-                                              cell.get_index(i2));
-                    distances_buffer.push_back(sqrt(d));
-                }
-            }
+    const float* x = cell.x_data();
+    const float* y = cell.y_data();
+    const float* z = cell.z_data();
+
+    for(int i1=0;i1<N-1;++i1){
+        Vector3f p = cell.get_coord(i1);
+        // Only points after i1 are tested
+        int nh = kernel(x+i1+1,y+i1+1,z+i1+1,N-i1-1,
+                        p.data(),kernel_pbc(),cutoff2,hits.data(),hits_d2.data());
+        for(int k=0;k<nh;++k){
+            sink.add(cell.get_index(i1),cell.get_index(i1+1+hits[k]),hits_d2[k]);
         }
-
     }
 }
-
-
-
-
-
-
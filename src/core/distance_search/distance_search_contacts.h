@@ -27,41 +27,71 @@
 */
 
 
+
 #pragma once
 
 #include "distance_search_base.h"
+#include "pteros/core/distance_search.h"
 
 namespace pteros {
 
+// Destination of the pairs found by single thread
+struct ContactsSink {
+    ContactsSink(): pairs(nullptr), distances(nullptr), chunk(nullptr),
+                    visitor(nullptr), thread(0), squared(false) {}
+
+    std::vector<Eigen::Vector2i>* pairs;
+    std::vector<float>* distances;
+    ContactsBuffer::Chunk* chunk;
+    const ContactVisitor* visitor;
+    int thread;
+    bool squared;
+
+    void add(int i, int j, float d2){
+        if(chunk){
+            chunk->i.push_back(i);
+            chunk->j.push_back(j);
+            chunk->d.push_back(squared ? d2 : sqrt(d2));
+        } else if(visitor){
+            (*visitor)(i,j,d2,thread);
+        } else {
+            pairs->emplace_back(i,j);
+            distances->push_back(sqrt(d2));
+        }
+    }
+};
+
 
 class DistanceSearchContacts: public DistanceSearchBase {
+public:
+    /// Search into plain vectors. Order of pairs doesn't depend on number of threads.
+    void do_search(std::vector<Eigen::Vector2i>& pairs, std::vector<float>& distances);
+
+    /// Search into per-thread chunks of reusable buffer
+    void do_search(ContactsBuffer& res);
+
+    /// Pass found pairs to visitor without storing them
+    void do_search(const ContactVisitor& visitor);
+
 protected:
     // Implements logic for calling search_between_cells() or search_inside_cell()
     // with correct grids in derived classes
-    virtual void search_planned_pair(const PlannedPair& pair,
-                                     std::vector<Eigen::Vector2i> &pairs_buffer,
-                                     std::vector<float> &distances_buffer) = 0;
-
-    void do_search();
+    virtual void search_planned_pair(const PlannedPair& pair, ContactsSink& sink) = 0;
 
     void search_between_cells(const PlannedPair &pair,
                               const Grid &grid1,
                               const Grid &grid2,
-                              std::vector<Eigen::Vector2i> &pairs_buffer,
-                              std::vector<float> &distances_buffer);
+                              ContactsSink& sink);
 
     void search_inside_cell(const PlannedPair &pair,
                             const Grid &grid,
-                            std::vector<Eigen::Vector2i> &pairs_buffer,
-                            std::vector<float> &distances_buffer);
+                            ContactsSink& sink);
 
-    // Pointers to search results
-    std::vector<Eigen::Vector2i>* pairs;
-    std::vector<float>* distances;
+    void compute_chunk(int b, int e, ContactsSink& sink);
 
-    void compute_chunk(int b, int e,
-                       std::vector<Eigen::Vector2i> &pairs_buf,
-                       std::vector<float> &dist_buf);
+    // Runs compute_chunk() over all cells in the thread pool
+    // with separate sink for each thread
+    void run_in_pool(std::vector<ContactsSink>& sinks);
 };
 
 }
@@ -41,8 +41,6 @@ using namespace Eigen;
 
 DistanceSearchContacts1sel::DistanceSearchContacts1sel(float d,
                                                              const Selection& sel,
-                                                             std::vector<Eigen::Vector2i>& res_pairs,
-                                                             std::vector<float>& res_distances,
                                                              bool absolute_index,
                                                              Vector3i_const_ref pbc)
 {
@@ -51,8 +49,6 @@ DistanceSearchContacts1sel::DistanceSearchContacts1sel(float d,
     is_periodic = (pbc.array()!=0).any();
     abs_index = absolute_index;
     box = sel.box();
-    pairs = &res_pairs;
-    distances = &res_distances;
 
     create_grid(sel);
 
@@ -61,20 +57,16 @@ DistanceSearchContacts1sel::DistanceSearchContacts1sel(float d,
     } else {
         grid1.populate(sel,min,max,abs_index);
     }
-
-    do_search();
 }
 
-void DistanceSearchContacts1sel::search_planned_pair(const PlannedPair& pair,
-                                                        std::vector<Vector2i> &pairs_buffer,
-                                                        std::vector<float> &distances_buffer)
+void DistanceSearchContacts1sel::search_planned_pair(const PlannedPair& pair, ContactsSink &sink)
 {
-    if(pair.c1==pair.c2){
+    if(pair.c1==pair.c2 && pair.shift.isZero()){
         // Inside cell
-        search_inside_cell(pair,grid1,pairs_buffer,distances_buffer);
+        search_inside_cell(pair,grid1,sink);
     } else {
         // Between cells
-        search_between_cells(pair,grid1,grid1,pairs_buffer,distances_buffer);
+        search_between_cells(pair,grid1,grid1,sink);
     }
 }
 
@@ -42,8 +42,6 @@ using namespace Eigen;
 DistanceSearchContacts2sel::DistanceSearchContacts2sel(float d,
                                                              const Selection &sel1,
                                                              const Selection &sel2,
-                                                             std::vector<Eigen::Vector2i>& res_pairs,
-                                                             std::vector<float> &res_distances,
                                                              bool absolute_index,
                                                              Vector3i_const_ref pbc)
 {
@@ -56,10 +54,14 @@ DistanceSearchContacts2sel::DistanceSearchContacts2sel(float d,
         throw PterosError("Selections for distance search should be from the same system!");
 
     box = sel1.box();
-    pairs = &res_pairs;
-    distances = &res_distances;
 
-    create_grids(sel1,sel2);
+    if(!create_grids(sel1,sel2)){
+        // Selections are too far from each other, search in empty grid
+        Ngrid.fill(1);
+        grid1.resize(1,1,1);
+        grid2.resize(1,1,1);
+        return;
+    }
 
     if(is_periodic){
         grid1.populate_periodic(sel1,box,periodic_dims,abs_index);
@@ -68,16 +70,17 @@ DistanceSearchContacts2sel::DistanceSearchContacts2sel(float d,
         grid1.populate(sel1,min,max,abs_index);
         grid2.populate(sel2,min,max,abs_index);
     }
-
-    do_search();
 }
 
-void DistanceSearchContacts2sel::search_planned_pair(const PlannedPair &pair,
-                                                        std::vector<Vector2i> &pairs_buffer,
-                                                        std::vector<float> &distances_buffer)
+void DistanceSearchContacts2sel::search_planned_pair(const PlannedPair &pair, ContactsSink &sink)
 {
-    search_between_cells(pair,grid1,grid2,pairs_buffer,distances_buffer);
-    if(pair.c1!=pair.c2) search_between_cells(pair,grid2,grid1,pairs_buffer,distances_buffer);
+    search_between_cells(pair,grid1,grid2,sink);
+    if(pair.c1!=pair.c2 || !pair.shift.isZero()){
+        // Points of sel1 in c2 against points of sel2 in c1.
+        // Cells are swapped rather than grids to keep sel1 first in the pair.
+        PlannedPair swapped = {pair.c2, pair.c1, -pair.shift};
+        search_between_cells(swapped,grid1,grid2,sink);
+    }
 }
 
 
@@ -40,15 +40,11 @@ public:
     DistanceSearchContacts2sel(float d,
                                   const Selection& sel1,
                                   const Selection& sel2,
-                                  std::vector<Eigen::Vector2i>& res_pairs,
-                                  std::vector<float>& res_distances,
                                   bool absolute_index = false,
                                   Vector3i_const_ref pbc = fullPBC);
 protected:
 
-    virtual void search_planned_pair(const PlannedPair& pair,
-                                     std::vector<Eigen::Vector2i> &pairs_buffer,
-                                     std::vector<float> &distances_buffer) override;
+    virtual void search_planned_pair(const PlannedPair& pair, ContactsSink& sink) override;
 };
 
 }
@@ -29,6 +29,7 @@
 
 #include "pteros/core/distance_search_within.h"
 #include "distance_search_within_base.h"
+#include "pteros/core/thread_pool.h"
 
 using namespace std;
 using namespace pteros;
@@ -61,6 +62,7 @@ public:
         periodic_dims = pbc;
         is_periodic = (pbc.array()!=0).any();
         abs_index = absolute_index;
+        index_range = abs_index ? src.get_system()->num_atoms() : src.size();
         box = src.box();
 
         create_grid(src);
@@ -78,28 +80,55 @@ public:
                        std::vector<int> &res)
     {
         res.clear();
-        // grid1 has parent selection, which is "src". Our point is "target"
-        System tmp; // tmp system with just one atom with coordinates coord
-        vector<Vector3f> crd{coord};
-        vector<Atom> atm(1);
-        tmp.atoms_add(atm,crd);
-        auto target = tmp.select_all(); // This is our target selection
+        search_point(coord,&res);
+    }
 
-        // Allocate second grid of the same size
-        grid2.resize(Ngrid(0),Ngrid(1),Ngrid(2));
 
-        // We have to force local indexes here in order to allow atomic array to work correctly
-        if(is_periodic){
-            grid2.populate_periodic(target,box,periodic_dims,abs_index);
-        } else {
-            grid2.populate(target,min,max,abs_index);
+    /// Search around many points, result in CSR form
+    void search_within(const std::vector<Eigen::Vector3f>& points,
+                       std::vector<int> &res,
+                       std::vector<int> &offsets)
+    {
+        res.clear();
+        offsets.assign(points.size()+1,0);
+        if(points.empty()) return;
+
+        auto& pool = ThreadPool::instance();
+        int nt = pool.get_num_threads();
+        int Np = points.size();
+
+        // Per-thread found atoms and records {point, start, end} for each point
+        vector<vector<int>> buf(nt);
+        vector<vector<Vector3i>> done(nt);
+
+        pool.parallel_for(Np, std::max(1,Np/(nt*16)), [&](int b, int e, int t){
+            for(int k=b;k<e;++k){
+                int n = buf[t].size();
+                search_point(points[k],&buf[t]);
+                done[t].emplace_back(k,n,buf[t].size());
+            }
+        });
+
+        // Offsets from the counts of found atoms
+        for(auto& d: done){
+            for(auto& rec: d) offsets[rec(0)+1] = rec(2)-rec(1);
         }
+        for(int k=0;k<Np;++k) offsets[k+1] += offsets[k];
+
+        // Scatter results
+        res.resize(offsets[Np]);
+        for(int t=0;t<nt;++t){
+            for(auto& rec: done[t]){
+                copy(buf[t].begin()+rec(1),buf[t].begin()+rec(2),res.begin()+offsets[rec(0)]);
+            }
+        }
+    }
 
-        // Now search
-        do_search();
 
-        copy(result.begin(),result.end(),back_inserter(res));
-        sort(res.begin(),res.end());
+    /// Is any atom of source within given distance from the point
+    bool any_within(Vector3f_const_ref coord)
+    {
+        return search_point(coord,nullptr);
     }
 
 
@@ -120,12 +149,84 @@ public:
 
         do_search();
 
-        if(include_self) result.insert(target.index_begin(),target.index_end());
-        // Elements in set are unique already, need to copy to result and sort
-        copy(result.begin(),result.end(),back_inserter(res));
-        sort(res.begin(),res.end());
+        if(include_self){
+            for(int i=0;i<target.size();++i) set_found(target.index(i),true);
+        }
+        // Found atoms come out sorted
+        get_found(res);
     }
 
+private:
+
+    // Finds the cell containing the point.
+    // Returns the cell and the point wrapped into the box.
+    Vector3i point_cell(Vector3f_const_ref coord, Vector3f& p){
+        Vector3i n;
+        p = coord;
+        if(is_periodic){
+            if(!box.in_box(p)) box.wrap_point(p,periodic_dims);
+            Vector3f rel = box.get_inv_matrix()*p;
+            for(int dim=0;dim<3;++dim) n(dim) = floor(Ngrid(dim)*rel(dim));
+        } else {
+            for(int dim=0;dim<3;++dim) n(dim) = floor(Ngrid(dim)*(p(dim)-min(dim))/(max(dim)-min(dim)));
+        }
+        // Points outside the grid are attributed to the nearest cell
+        for(int dim=0;dim<3;++dim){
+            if(n(dim)<0) n(dim)=0;
+            if(n(dim)>=Ngrid(dim)) n(dim)=Ngrid(dim)-1;
+        }
+        return n;
+    }
+
+    // Appends sorted atoms within cutoff from the point to res.
+    // If res is nullptr stops at first found atom.
+    // Returns true if anything is found.
+    bool search_point(Vector3f_const_ref coord, std::vector<int>* res){
+        Vector3f p;
+        Vector3i n = point_cell(coord,p);
+
+        auto kernel = get_distance_kernel();
+        float cutoff2 = cutoff*cutoff;
+        int first = res ? res->size() : 0;
+
+        thread_local vector<int> hits;
+        thread_local vector<float> hits_d2;
+
+        PlannedPair pair;
+        for(const auto& o: point_stencil){
+            if(!make_pair(n,o,pair)) continue;
+            GridCell cell = grid1.cell(pair.c2);
+            int N = cell.size();
+            if(N==0) continue;
+
+            // The point is moved instead of the periodic image of the cell
+            Vector3f q = p - shift_vector(pair.shift);
+
+            if(scalar_only){
+                for(int i=0;i<N;++i){
+                    if(box.distance_squared(cell.get_coord(i),q,min_image_dims)<=cutoff2){
+                        if(!res) return true;
+                        res->push_back(cell.get_index(i));
+                    }
+                }
+            } else if(!res){
+                if(kernel(cell.x_data(),cell.y_data(),cell.z_data(),N,
+                          q.data(),kernel_pbc(),cutoff2,nullptr,nullptr)) return true;
+            } else {
+                if(int(hits.size())<N){
+                    hits.resize(N);
+                    hits_d2.resize(N);
+                }
+                int nh = kernel(cell.x_data(),cell.y_data(),cell.z_data(),N,
+                                q.data(),kernel_pbc(),cutoff2,hits.data(),hits_d2.data());
+                for(int k=0;k<nh;++k) res->push_back(cell.get_index(hits[k]));
+            }
+        }
+
+        if(!res) return false;
+        sort(res->begin()+first,res->end());
+        return int(res->size())>first;
+    }
 };
 
 
@@ -160,6 +261,16 @@ void DistanceSearchWithin::search_within(const Selection &target, std::vector<in
     p->search_within(target,res,include_self);
 }
 
+void DistanceSearchWithin::search_within(const std::vector<Vector3f> &points, std::vector<int> &res, std::vector<int> &offsets)
+{
+    p->search_within(points,res,offsets);
+}
+
+bool DistanceSearchWithin::any_within(Vector3f_const_ref coord)
+{
+    return p->any_within(coord);
+}
+
 
 
 
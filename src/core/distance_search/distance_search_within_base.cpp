@@ -31,25 +31,22 @@
 
 
 #include "distance_search_within_base.h"
-#include <thread>
+#include "pteros/core/thread_pool.h"
 
 using namespace std;
 using namespace pteros;
 using namespace Eigen;
 
-void DistanceSearchWithinBase::compute_chunk(int b, int e,
-                                             std::unordered_set<int>& res_buf)
+void DistanceSearchWithinBase::compute_chunk(int b, int e, std::vector<uint64_t>& bits)
 {
     PlannedPair pair;
     for(int ind=b;ind<e;++ind){
         // Get array position
         auto p = index_to_pos(ind);
         // Apply stencil
-        for(int j=0;j<stencil.size();j+=2){
-            pair.c1 = p + stencil[j];
-            pair.c2 = p + stencil[j+1];
-            if(process_neighbour_pair(pair)){
-                search_planned_pair(pair, res_buf);
+        for(const auto& o: stencil){
+            if(make_pair(p,o,pair)){
+                search_planned_pair(pair, bits);
             }
         }
     }
@@ -58,42 +55,59 @@ void DistanceSearchWithinBase::compute_chunk(int b, int e,
 
 void DistanceSearchWithinBase::do_search()
 {
-    // Prepare for searching
-    result.clear();
+    auto& pool = ThreadPool::instance();
+    int Ncells = Ngrid.prod();
 
     // See if we need parallelization
-    int nt = std::min(size_t(Ngrid.prod()), size_t(std::thread::hardware_concurrency()));
+    int nt = std::min(Ncells, pool.get_num_threads());
+
+    // Bitmaps keep their memory between searches
+    int n_words = index_range/64+1;
+    if(int(found.size())<nt) found.resize(nt);
+    for(int i=0;i<nt;++i) found[i].assign(n_words,0);
 
     if(nt==1){
         // Serial
-        compute_chunk(0,Ngrid.prod(),result);
+        compute_chunk(0,Ncells,found[0]);
 
     } else {
-        // Thread parallel
-        vector<unordered_set<int>> res_buf(nt);
-
-        vector<thread> threads;
-        int chunk = floor(Ngrid.prod()/nt);
+        // Thread parallel, each thread marks its own bitmap
+        // Several blocks per thread for load balancing
+        int block = std::max(1, Ncells/(nt*16));
 
-        for(int i=0;i<nt;++i){
-            int b = chunk*i;
-            int e = (i<nt-1) ? chunk*(i+1) : Ngrid.prod();
+        pool.parallel_for(Ncells, block, [&](int b, int e, int t){
+            compute_chunk(b,e, found[t]);
+        });
 
-            // Launch thread
-            threads.emplace_back(
-            [&,b,e,i](){
-                compute_chunk(b,e, res_buf[i]);
-            }
-            );
+        // Merge bitmaps
+        for(int t=1;t<nt;++t){
+            for(int w=0;w<n_words;++w) found[0][w] |= found[t][w];
         }
+    }
+}
 
-        // Wait for threads
-        for(auto& t: threads) t.join();
+void DistanceSearchWithinBase::set_found(int i, bool val)
+{
+    if(found.empty()) found.resize(1);
+    auto& bits = found[0];
+    if(i/64>=int(bits.size())) bits.resize(i/64+1,0);
+    if(val)
+        bits[i/64] |= uint64_t(1)<<(i%64);
+    else
+        bits[i/64] &= ~(uint64_t(1)<<(i%64));
+}
 
-        // Collect results
-        for(int i=0;i<nt;++i){
-            // Copy to result guarantied to be unique, but not sorted
-            result.insert(begin(res_buf[i]),end(res_buf[i]));
+void DistanceSearchWithinBase::get_found(std::vector<int> &res) const
+{
+    res.clear();
+    if(found.empty()) return;
+    const auto& bits = found[0];
+    for(size_t w=0;w<bits.size();++w){
+        uint64_t word = bits[w];
+        // Set bits are extracted in ascending order
+        while(word){
+            res.push_back(w*64+__builtin_ctzll(word));
+            word &= word-1;
         }
     }
 }
@@ -101,14 +115,11 @@ void DistanceSearchWithinBase::do_search()
 // grid1 is the source which is searched
 void DistanceSearchWithinBase::search_between_cells(Vector3i_const_ref c1,
                                                        Vector3i_const_ref c2,
-                                                       Vector3i_const_ref wrapped,
-                                                       std::unordered_set<int> &res_buffer)
+                                                       Vector3f_const_ref shift,
+                                                       std::vector<uint64_t>& bits)
 {
-    const GridCell& cell1 = grid1.cell(c1);
-    const GridCell& cell2 = grid2.cell(c2);
-
-    // The cells could be not adjucent if one of them is wrapped around
-    // but this only happens in peridic case and is treated automatically
+    GridCell cell1 = grid1.cell(c1);
+    GridCell cell2 = grid2.cell(c2);
 
     int N1 = cell1.size();
     int N2 = cell2.size();
@@ -117,40 +128,44 @@ void DistanceSearchWithinBase::search_between_cells(Vector3i_const_ref c1,
 
     float cutoff2 = cutoff*cutoff;
 
-    if((wrapped.array()>0).any()){
-
+    if(scalar_only){
+        // Minimal image in triclinic box, no fast path
         for(int i1=0;i1<N1;++i1){
-            Vector3f p = cell1.get_coord(i1); // Coord of point in grid1
+            int ind = cell1.get_index(i1);
+            if(bits[ind/64] & (uint64_t(1)<<(ind%64))) continue; // Already found
+            Vector3f p = cell1.get_coord(i1) - shift; // Coord of point in grid1
             for(int i2=0;i2<N2;++i2){
-                float d = box.distance_squared(cell2.get_coord(i2), p, wrapped);
+                float d = box.distance_squared(cell2.get_coord(i2), p, min_image_dims);
                 if(d<=cutoff2){
-                    res_buffer.insert(cell1.get_index(i1));
+                    bits[ind/64] |= uint64_t(1)<<(ind%64);
+                    break;
                 }
             }
         }
+        return;
+    }
 
-    } else {
-
-        for(int i1=0;i1<N1;++i1){
-            Vector3f p = cell1.get_coord(i1); // Coord of point in grid1
-            for(int i2=0;i2<N2;++i2){                
-                float d = (cell2.get_coord(i2)-p).squaredNorm();                
-                if(d<=cutoff2){                    
-                    res_buffer.insert(cell1.get_index(i1));
-                }
-            }
+    // Vectorized path, kernel stops at first found point
+    auto kernel = get_distance_kernel();
+    for(int i1=0;i1<N1;++i1){
+        int ind = cell1.get_index(i1);
+        if(bits[ind/64] & (uint64_t(1)<<(ind%64))) continue; // Already found
+        Vector3f p = cell1.get_coord(i1) - shift; // Coord of point in grid1
+        if(kernel(cell2.x_data(),cell2.y_data(),cell2.z_data(),N2,
+                  p.data(),kernel_pbc(),cutoff2,nullptr,nullptr)){
+            bits[ind/64] |= uint64_t(1)<<(ind%64);
         }
-
     }
 }
 
-void DistanceSearchWithinBase::search_planned_pair(const PlannedPair &pair, std::unordered_set<int> &res_buffer)
+void DistanceSearchWithinBase::search_planned_pair(const PlannedPair &pair, std::vector<uint64_t>& bits)
 {
-    search_between_cells(pair.c1,pair.c2,pair.wrapped,res_buffer);
-    if(pair.c1!=pair.c2){
-        search_between_cells(pair.c2,pair.c1,pair.wrapped,res_buffer);
+    Vector3f sh = shift_vector(pair.shift);
+    search_between_cells(pair.c1,pair.c2,sh,bits);
+    if(pair.c1!=pair.c2 || !pair.shift.isZero()){
+        // Image of c1 with respect to c2 is opposite
+        search_between_cells(pair.c2,pair.c1,-sh,bits);
     }
 }
 
 
-
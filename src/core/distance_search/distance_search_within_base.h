@@ -40,24 +40,33 @@ namespace pteros {
 // No distances are computed.
 class DistanceSearchWithinBase: public DistanceSearchBase {
 protected:
-    // Implements logic for calling search_between_cells() or search_inside_cell()
-    // with correct grids in derived classes
+    // Bitmaps of found source atoms, one per thread.
+    // After do_search() the merged result is in found[0].
+    std::vector<std::vector<uint64_t>> found;
 
-    // Pointer to search results
-    std::unordered_set<int> result;
+    // Range of indexes of source atoms in the grid
+    int index_range;
 
     void do_search();
 
-    void compute_chunk(int b, int e, std::unordered_set<int> &res_buf);
+    void compute_chunk(int b, int e, std::vector<uint64_t>& bits);
+
+    // Marks or unmarks atom i in the result. Result is enlarged if needed.
+    void set_found(int i, bool val);
+
+    // Returns sorted indexes of found atoms
+    void get_found(std::vector<int>& res) const;
 
 private:
+    // Points of c1 from grid1 are tested against points of c2 from grid2,
+    // which are moved to their periodic image by shift
     void search_between_cells(Vector3i_const_ref c1,
                               Vector3i_const_ref c2,
-                              Vector3i_const_ref wrapped,
-                              std::unordered_set<int> &res_buffer);
+                              Vector3f_const_ref shift,
+                              std::vector<uint64_t>& bits);
 
     void search_planned_pair(const PlannedPair& pair,
-                             std::unordered_set<int> &res_buffer);
+                             std::vector<uint64_t>& bits);
 };
 
 }
@@ -46,11 +46,15 @@ DistanceSearchWithinSel::DistanceSearchWithinSel(float d,
     periodic_dims = pbc;
     is_periodic = (pbc.array()!=0).any();
     abs_index = true; // Absolute index is enforced here!
+    index_range = src.get_system()->num_atoms();
     box = src.box();
 
     res.clear();
 
-    create_grids(src,target);
+    if(!create_grids(src,target)){
+        // Selections are too far from each other, nothing is found
+        return;
+    }
 
     if(is_periodic){
         grid1.populate_periodic(src,box,periodic_dims,abs_index);
@@ -60,17 +64,14 @@ DistanceSearchWithinSel::DistanceSearchWithinSel(float d,
         grid2.populate(target,min,max,abs_index);
     }
 
-    do_search();    
-
-    // Elements in set are unique already, need to copy to result and sort
-    copy(result.begin(),result.end(),back_inserter(res));
-    sort(res.begin(),res.end());
+    do_search();
 
     if(!include_self){
-        auto tmp = res;
-        res.clear();
-        set_difference(tmp.begin(),tmp.end(),target.index_begin(),target.index_end(),back_inserter(res));
+        for(int i=0;i<target.size();++i) set_found(target.index(i),false);
     }
+
+    // Found atoms come out sorted
+    get_found(res);
 }
 
 
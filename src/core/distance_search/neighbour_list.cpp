@@ -0,0 +1,239 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "pteros/core/neighbour_list.h"
+#include "pteros/core/distance_search.h"
+#include "pteros/core/pteros_error.h"
+#include "pteros/core/logging.h"
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+
+class NeighbourList::NeighbourListImpl {
+public:
+    NeighbourListImpl(): is_set(false), valid(false), n_rebuilds(0) {}
+
+    void setup(float d, float sk, bool absolute_index, Vector3i_const_ref pbc, bool two){
+        if(d<=0) throw PterosError("Cutoff of neighbour list should be positive!");
+        if(sk<0) throw PterosError("Skin of neighbour list should be non-negative!");
+        cutoff = d;
+        skin = sk;
+        abs_index = absolute_index;
+        periodic_dims = pbc;
+        is_periodic = (pbc.array()!=0).any();
+        two_sel = two;
+        is_set = true;
+        valid = false;
+    }
+
+    void search(const Selection& sel1, const Selection* sel2,
+                vector<Vector2i>& pairs, vector<float>& distances)
+    {
+        if(!is_set) throw PterosError("Neighbour list is not set up!");
+        if(two_sel != (sel2!=nullptr))
+            throw PterosError("Neighbour list was set up for {} selection(s)!",two_sel ? 2 : 1);
+
+        const Selection& s2 = sel2 ? *sel2 : sel1;
+
+        if(!valid || need_rebuild(sel1,s2)) rebuild(sel1,s2);
+
+        filter(sel1,s2,pairs,distances);
+    }
+
+    void rebuild(const Selection& sel1, const Selection& sel2){
+        vector<float> dummy;
+        if(two_sel){
+            pteros::search_contacts(cutoff+skin,sel1,sel2,cached,dummy,false,periodic_dims);
+            store(sel2,index2,ref2);
+        } else {
+            pteros::search_contacts(cutoff+skin,sel1,cached,dummy,false,periodic_dims);
+        }
+        store(sel1,index1,ref1);
+        ref_box = sel1.box().get_matrix();
+        valid = true;
+        ++n_rebuilds;
+        LOG()->debug("Neighbour list rebuilt: {} pairs",cached.size());
+    }
+
+    float cutoff, skin;
+    bool abs_index;
+    Vector3i periodic_dims;
+    bool is_periodic;
+    bool two_sel;
+    bool is_set;
+    bool valid;
+    int n_rebuilds;
+
+private:
+    // Cached pairs within cutoff+skin in local indexes
+    vector<Vector2i> cached;
+    // Atoms and coordinates at the moment of last build
+    vector<int> index1, index2;
+    vector<Vector3f> ref1, ref2;
+    Matrix3f ref_box;
+
+    void store(const Selection& sel, vector<int>& ind, vector<Vector3f>& ref){
+        ind.assign(sel.index_begin(),sel.index_end());
+        ref.resize(sel.size());
+        for(int i=0;i<sel.size();++i) ref[i] = sel.xyz(i);
+    }
+
+    // Returns true if some atom moved further than allowed
+    bool moved(const Selection& sel, const vector<int>& ind, const vector<Vector3f>& ref, float allowed2){
+        if(sel.size()!=int(ind.size()) || !equal(ind.begin(),ind.end(),sel.index_begin())) return true;
+
+        const PeriodicBox& box = sel.box();
+        for(int i=0;i<sel.size();++i){
+            float d2 = is_periodic ? box.distance_squared(sel.xyz(i),ref[i],periodic_dims)
+                                   : (sel.xyz(i)-ref[i]).squaredNorm();
+            if(d2>allowed2) return true;
+        }
+        return false;
+    }
+
+    bool need_rebuild(const Selection& sel1, const Selection& sel2){
+        // Change of the box shifts periodic images, this uses part of the skin.
+        // Neighbouring image is shifted by the sum of box vectors in the worst case.
+        float box_change = 0.0;
+        if(is_periodic) box_change = (sel1.box().get_matrix()-ref_box).colwise().norm().sum();
+
+        // Any pair could come closer by two displacements
+        float allowed = 0.5*(skin-box_change);
+        if(allowed<0) return true;
+        float allowed2 = allowed*allowed;
+
+        if(moved(sel1,index1,ref1,allowed2)) return true;
+        if(two_sel && moved(sel2,index2,ref2,allowed2)) return true;
+        return false;
+    }
+
+    void filter(const Selection& sel1, const Selection& sel2,
+                vector<Vector2i>& pairs, vector<float>& distances)
+    {
+        pairs.clear();
+        distances.clear();
+
+        float cutoff2 = cutoff*cutoff;
+        const PeriodicBox& box = sel1.box();
+
+        // Fast minimal image for rectangular box
+        bool rect = is_periodic && !box.is_triclinic();
+        Vector3f ext, inv;
+        if(rect){
+            for(int dim=0;dim<3;++dim){
+                ext(dim) = periodic_dims(dim) ? box.get_element(dim,dim) : 0.0;
+                inv(dim) = periodic_dims(dim) ? 1.0/ext(dim) : 0.0;
+            }
+        }
+
+        for(const auto& pair: cached){
+            Vector3f v = sel2.xyz(pair(1))-sel1.xyz(pair(0));
+            float d2;
+            if(rect){
+                for(int dim=0;dim<3;++dim) v(dim) -= ext(dim)*round(v(dim)*inv(dim));
+                d2 = v.squaredNorm();
+            } else if(is_periodic){
+                d2 = box.distance_squared(sel1.xyz(pair(0)),sel2.xyz(pair(1)),periodic_dims);
+            } else {
+                d2 = v.squaredNorm();
+            }
+
+            if(d2<=cutoff2){
+                if(abs_index)
+                    pairs.emplace_back(sel1.index(pair(0)),sel2.index(pair(1)));
+                else
+                    pairs.push_back(pair);
+                distances.push_back(sqrt(d2));
+            }
+        }
+    }
+};
+
+
+NeighbourList::NeighbourList()
+{
+    p = unique_ptr<NeighbourListImpl>(new NeighbourListImpl());
+}
+
+NeighbourList::NeighbourList(float cutoff, float skin, const Selection &sel, bool absolute_index, Vector3i_const_ref pbc)
+{
+    p = unique_ptr<NeighbourListImpl>(new NeighbourListImpl());
+    setup(cutoff,skin,sel,absolute_index,pbc);
+}
+
+NeighbourList::NeighbourList(float cutoff, float skin, const Selection &sel1, const Selection &sel2, bool absolute_index, Vector3i_const_ref pbc)
+{
+    p = unique_ptr<NeighbourListImpl>(new NeighbourListImpl());
+    setup(cutoff,skin,sel1,sel2,absolute_index,pbc);
+}
+
+NeighbourList::~NeighbourList()
+{
+
+}
+
+void NeighbourList::setup(float cutoff, float skin, const Selection &sel, bool absolute_index, Vector3i_const_ref pbc)
+{
+    p->setup(cutoff,skin,absolute_index,pbc,false);
+    // Otherwise the list is built on first search
+    if(sel.size() && sel.get_system()->num_frames()) p->rebuild(sel,sel);
+}
+
+void NeighbourList::setup(float cutoff, float skin, const Selection &sel1, const Selection &sel2, bool absolute_index, Vector3i_const_ref pbc)
+{
+    if(sel1.get_system() != sel2.get_system())
+        throw PterosError("Selections for neighbour list should be from the same system!");
+    p->setup(cutoff,skin,absolute_index,pbc,true);
+    if(sel1.size() && sel2.size() && sel1.get_system()->num_frames()) p->rebuild(sel1,sel2);
+}
+
+void NeighbourList::search_contacts(const Selection &sel, std::vector<Vector2i> &pairs, std::vector<float> &distances)
+{
+    p->search(sel,nullptr,pairs,distances);
+}
+
+void NeighbourList::search_contacts(const Selection &sel1, const Selection &sel2, std::vector<Vector2i> &pairs, std::vector<float> &distances)
+{
+    p->search(sel1,&sel2,pairs,distances);
+}
+
+void NeighbourList::invalidate()
+{
+    p->valid = false;
+}
+
+int NeighbourList::num_rebuilds() const
+{
+    return p->n_rebuilds;
+}
+
+
+
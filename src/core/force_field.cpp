@@ -180,7 +180,7 @@ void ForceField::setup_kernels(){
 }
 
 
-Vector2f ForceField::pair_energy(int at1, int at2, float r, float q1, float q2, int type1, int type2)
+Vector2f ForceField::pair_energy(int at1, int at2, float r, float q1, float q2, int type1, int type2) const
 {
     float c6,c12;
     // indexes have to be in increasing order
@@ -206,13 +206,14 @@ Vector2f ForceField::pair_energy(int at1, int at2, float r, float q1, float q2,
     }
 }
 
-float ForceField::get_cutoff(){
+float ForceField::get_cutoff() const {
     return std::min(rcoulomb,rvdw);
 }
 
-ForceField::ForceField():  ready(false) {}
+ForceField::ForceField(): natoms(0), ready(false) {}
 
 ForceField::ForceField(const ForceField &other){
+    natoms = other.natoms;
     exclusions = other.exclusions;
     molecules = other.molecules;
     bonds = other.bonds;
@@ -239,6 +240,7 @@ ForceField::ForceField(const ForceField &other){
 }
 
 ForceField &ForceField::operator=(ForceField other){    
+    natoms = other.natoms;
     exclusions = other.exclusions;
     molecules = other.molecules;
     bonds = other.bonds;
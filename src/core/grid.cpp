@@ -36,20 +36,52 @@ using namespace Eigen;
 
 void Grid::clear()
 {    
-    int i,j,k;
-    for(i=0;i<data.dimension(0);++i)
-        for(j=0;j<data.dimension(1);++j)
-            for(k=0;k<data.dimension(2);++k){
-                data(i,j,k).clear();
-        }    
+    // Only sizes are reset, capacity of all arrays is kept
+    fill(offsets.begin(),offsets.end(),0);
+    indexes.clear();
+    x.clear();
+    y.clear();
+    z.clear();
+    raw_cell.clear();
+    raw_index.clear();
+    raw_coord.clear();
 }
 
 void Grid::resize(int X, int Y, int Z)
 {
-    data.resize(X,Y,Z);
+    dims << X,Y,Z;
+    offsets.resize(X*Y*Z+1);
     clear();
 }
 
+void Grid::sort_points()
+{
+    int Ncells = num_cells();
+    int N = raw_cell.size();
+
+    // Count points in cells
+    fill(offsets.begin(),offsets.end(),0);
+    for(int i=0;i<N;++i) ++offsets[raw_cell[i]+1];
+
+    // Prefix sum gives starts of the cells
+    for(int c=0;c<Ncells;++c) offsets[c+1] += offsets[c];
+
+    // Scatter points. Order of points inside the cell is preserved.
+    indexes.resize(N);
+    x.resize(N);
+    y.resize(N);
+    z.resize(N);
+
+    cursor.assign(offsets.begin(),offsets.end()-1);
+    for(int i=0;i<N;++i){
+        int k = cursor[raw_cell[i]]++;
+        indexes[k] = raw_index[i];
+        x[k] = raw_coord[i](0);
+        y[k] = raw_coord[i](1);
+        z[k] = raw_coord[i](2);
+    }
+}
+
 void Grid::populate(const Selection &sel, bool abs_index)
 {
     Vector3f min,max;
@@ -60,11 +92,15 @@ void Grid::populate(const Selection &sel, bool abs_index)
 void Grid::populate(const Selection &sel, Vector3f_const_ref min, Vector3f_const_ref max, bool abs_index)
 {    
     int Natoms = sel.size();
-    int NX = data.dimension(0);
-    int NY = data.dimension(1);
-    int NZ = data.dimension(2);
+    int NX = dims(0);
+    int NY = dims(1);
+    int NZ = dims(2);
     int n1,n2,n3;
 
+    raw_cell.reserve(raw_cell.size()+Natoms);
+    raw_index.reserve(raw_index.size()+Natoms);
+    raw_coord.reserve(raw_coord.size()+Natoms);
+
     // Non-periodic variant
     Vector3f* coor;
     for(int i=0;i<Natoms;++i){
@@ -80,12 +116,10 @@ void Grid::populate(const Selection &sel, Vector3f_const_ref min, Vector3f_const
         n3 = floor(NZ*((*coor)(2)-min(2))/(max(2)-min(2)));
         if(n3<0 || n3>=NZ) continue;
 
-        if(abs_index){
-            cell(n1,n2,n3).add_point(sel.index(i),*coor);
-        } else {
-            cell(n1,n2,n3).add_point(i,*coor);
-        }        
+        add_raw((n1*NY+n2)*NZ+n3, abs_index ? sel.index(i) : i, *coor);
     }
+
+    sort_points();
 }
 
 void Grid::populate_periodic(const Selection &sel, Vector3i_const_ref pbc_dims, bool abs_index)
@@ -99,11 +133,15 @@ void Grid::populate_periodic(const Selection &sel, const PeriodicBox &box, Vecto
         throw PterosError("No periodic dimensions specified for periodic grid!");
 
     int Natoms = sel.size();
-    int NX = data.dimension(0);
-    int NY = data.dimension(1);
-    int NZ = data.dimension(2);
+    int NX = dims(0);
+    int NY = dims(1);
+    int NZ = dims(2);
     int n1,n2,n3;
 
+    raw_cell.reserve(raw_cell.size()+Natoms);
+    raw_index.reserve(raw_index.size()+Natoms);
+    raw_coord.reserve(raw_coord.size()+Natoms);
+
     // Periodic variant
     Vector3f coor;    
     Matrix3f m_inv = box.get_inv_matrix();
@@ -144,24 +182,10 @@ void Grid::populate_periodic(const Selection &sel, const PeriodicBox &box, Vecto
             n3=0;
 
         // Assign to grid
-        if(abs_index){
-            cell(n1,n2,n3).add_point(sel.index(i),coor);
-        } else {
-            cell(n1,n2,n3).add_point(i,coor);
-        }
+        add_raw((n1*NY+n2)*NZ+n3, abs_index ? sel.index(i) : i, coor);
     }
-}
-
-
 
-void GridCell::add_point(int ind, Vector3f_const_ref crd){
-    indexes.push_back(ind);
-    coords.push_back(crd);
-}
-
-void GridCell::clear(){
-    indexes.clear();
-    coords.clear();
+    sort_points();
 }
 
 
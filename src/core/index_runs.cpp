@@ -0,0 +1,202 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+
+#include "index_runs.h"
+#include <algorithm>
+#include <iterator>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+bool pteros::index_to_runs(const vector<int> &ind, IndexRuns &runs, int max_runs)
+{
+    runs.clear();
+    int n = ind.size();
+    int i = 0;
+    while(i<n){
+        // ind[j]-j is the same for all elements of the run and grows
+        // between the runs, so the end of the run is found by galloping
+        // and binary search instead of looking at each element.
+        int key = ind[i]-i;
+        int step = 1;
+        while(i+step<n && ind[i+step]-(i+step)==key) step *= 2;
+        int lo = i+step/2; // inside the run
+        int hi = std::min(i+step,n); // after the run
+        while(hi-lo>1){
+            int mid = (lo+hi)/2;
+            if(ind[mid]-mid==key) lo = mid; else hi = mid;
+        }
+        if(max_runs>=0 && int(runs.size())==max_runs) return false;
+        runs.emplace_back(ind[i],ind[hi-1]);
+        i = hi;
+    }
+    return true;
+}
+
+void pteros::runs_to_index(const IndexRuns &runs, vector<int> &ind)
+{
+    int n = 0;
+    for(auto& r: runs) n += r(1)-r(0)+1;
+    ind.resize(n);
+    int k = 0;
+    for(auto& r: runs){
+        for(int i=r(0);i<=r(1);++i) ind[k++] = i;
+    }
+}
+
+namespace {
+
+// Appends run to the list merging it with the last one if they touch
+void add_run(IndexRuns& runs, int b, int e){
+    if(!runs.empty() && b<=runs.back()(1)+1){
+        if(e>runs.back()(1)) runs.back()(1) = e;
+    } else {
+        runs.emplace_back(b,e);
+    }
+}
+
+void runs_union(const IndexRuns& a, const IndexRuns& b, IndexRuns& res){
+    res.clear();
+    int na = a.size(), nb = b.size();
+    int i=0, j=0;
+    while(i<na || j<nb){
+        // Take the run which starts first
+        if(j==nb || (i<na && a[i](0)<=b[j](0))){
+            add_run(res,a[i](0),a[i](1));
+            ++i;
+        } else {
+            add_run(res,b[j](0),b[j](1));
+            ++j;
+        }
+    }
+}
+
+void runs_intersection(const IndexRuns& a, const IndexRuns& b, IndexRuns& res){
+    res.clear();
+    int na = a.size(), nb = b.size();
+    int i=0, j=0;
+    while(i<na && j<nb){
+        int lo = std::max(a[i](0),b[j](0));
+        int hi = std::min(a[i](1),b[j](1));
+        if(lo<=hi) res.emplace_back(lo,hi);
+        // Advance the run which ends first
+        if(a[i](1)<b[j](1)) ++i; else ++j;
+    }
+}
+
+void runs_difference(const IndexRuns& a, const IndexRuns& b, IndexRuns& res){
+    res.clear();
+    int nb = b.size();
+    int j=0;
+    for(auto& r: a){
+        int cur = r(0);
+        // Skip runs of b which end before this run
+        while(j<nb && b[j](1)<cur) ++j;
+        // Cut out all runs of b, which overlap with this run
+        int k = j;
+        while(k<nb && b[k](0)<=r(1)){
+            if(b[k](0)>cur) res.emplace_back(cur,b[k](0)-1);
+            cur = std::max(cur,b[k](1)+1);
+            ++k;
+        }
+        if(cur<=r(1)) res.emplace_back(cur,r(1));
+    }
+}
+
+// Runs pay off only if they are much shorter than the index itself.
+// Returns false if index is too fragmented, then plain merge is used.
+bool short_runs(const vector<int>& ind, IndexRuns& runs){
+    return index_to_runs(ind,runs,ind.size()/4);
+}
+
+} // namespace
+
+void pteros::index_union(const vector<int> &a, const vector<int> &b, vector<int> &res)
+{
+    IndexRuns ra, rb, rr;
+    if(short_runs(a,ra) && short_runs(b,rb)){
+        runs_union(ra,rb,rr);
+        runs_to_index(rr,res);
+    } else {
+        res.clear();
+        res.reserve(a.size()+b.size());
+        set_union(a.begin(),a.end(),b.begin(),b.end(),back_inserter(res));
+    }
+}
+
+void pteros::index_intersection(const vector<int> &a, const vector<int> &b, vector<int> &res)
+{
+    IndexRuns ra, rb, rr;
+    if(short_runs(a,ra) && short_runs(b,rb)){
+        runs_intersection(ra,rb,rr);
+        runs_to_index(rr,res);
+    } else {
+        res.clear();
+        set_intersection(a.begin(),a.end(),b.begin(),b.end(),back_inserter(res));
+    }
+}
+
+void pteros::index_difference(const vector<int> &a, const vector<int> &b, vector<int> &res)
+{
+    IndexRuns ra, rb, rr;
+    if(short_runs(a,ra) && short_runs(b,rb)){
+        runs_difference(ra,rb,rr);
+        runs_to_index(rr,res);
+    } else {
+        res.clear();
+        set_difference(a.begin(),a.end(),b.begin(),b.end(),back_inserter(res));
+    }
+}
+
+void pteros::index_complement(const vector<int> &a, int n, vector<int> &res)
+{
+    IndexRuns ra, rr, all;
+    if(short_runs(a,ra)){
+        if(n>0) all.emplace_back(0,n-1);
+        runs_difference(all,ra,rr);
+        runs_to_index(rr,res);
+    } else {
+        res.clear();
+        int na = a.size();
+        int k = 0;
+        for(int i=0;i<n;++i){
+            if(k<na && a[k]==i) ++k; else res.push_back(i);
+        }
+    }
+}
+
+void pteros::index_sort_unique(vector<int> &ind)
+{
+    // Most indexes are already ordered
+    if(adjacent_find(ind.begin(),ind.end(),greater_equal<int>())==ind.end()) return;
+    sort(ind.begin(),ind.end());
+    ind.erase(unique(ind.begin(),ind.end()),ind.end());
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <vector>
+#include <Eigen/Core>
+
+namespace pteros {
+
+/// Run-length form of sorted index without duplicates.
+/// Each run is the range of consecutive indexes {first,last}.
+typedef std::vector<Eigen::Vector2i> IndexRuns;
+
+/// Splits sorted unique index into runs.
+/// Cost is proportional to the number of runs rather than to the size of index.
+/// Returns false and stops if there are more than max_runs runs.
+bool index_to_runs(const std::vector<int>& ind, IndexRuns& runs, int max_runs = -1);
+
+/// Expands runs into explicit index
+void runs_to_index(const IndexRuns& runs, std::vector<int>& ind);
+
+/// Set operations on sorted unique indexes. The result is sorted and unique.
+/// They are done on runs, so indexes made of long runs are processed
+/// without comparing individual elements. Fragmented indexes are merged element-wise.
+void index_union(const std::vector<int>& a, const std::vector<int>& b, std::vector<int>& res);
+void index_intersection(const std::vector<int>& a, const std::vector<int>& b, std::vector<int>& res);
+void index_difference(const std::vector<int>& a, const std::vector<int>& b, std::vector<int>& res);
+
+/// All indexes from 0 to n-1, which are not in a
+void index_complement(const std::vector<int>& a, int n, std::vector<int>& res);
+
+/// Sorts index and removes duplicates. Sorting is skipped if index is already ordered.
+void index_sort_unique(std::vector<int>& ind);
+
+}
+
+
+
+
@@ -0,0 +1,130 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "pteros/core/interned_string.h"
+#include "pteros/core/pteros_error.h"
+#include <unordered_map>
+#include <string_view>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <memory>
+
+using namespace std;
+using namespace pteros;
+
+namespace {
+
+// Strings are stored in fixed-size chunks, which are never moved,
+// so reading the string by id does not require locking.
+constexpr uint32_t chunk_bits = 12;
+constexpr uint32_t chunk_size = 1<<chunk_bits;
+constexpr uint32_t max_chunks = 1<<(32-chunk_bits-4);
+
+struct StringTable {
+    StringTable(){
+        for(auto& c: chunks) c.store(nullptr,memory_order_relaxed);
+        // Id 0 is always an empty string
+        add("");
+    }
+
+    ~StringTable(){
+        for(auto& c: chunks) delete[] c.load(memory_order_relaxed);
+    }
+
+    const string& get(uint32_t id) const {
+        return chunks[id>>chunk_bits].load(memory_order_acquire)[id&(chunk_size-1)];
+    }
+
+    int find(string_view s) const {
+        shared_lock<shared_mutex> lock(mut);
+        auto it = ids.find(s);
+        return it==ids.end() ? -1 : it->second;
+    }
+
+    uint32_t intern(string_view s){
+        {
+            shared_lock<shared_mutex> lock(mut);
+            auto it = ids.find(s);
+            if(it!=ids.end()) return it->second;
+        }
+        unique_lock<shared_mutex> lock(mut);
+        // Could be added by other thread while we were waiting
+        auto it = ids.find(s);
+        if(it!=ids.end()) return it->second;
+        return add(s);
+    }
+
+private:
+    // Called under unique lock
+    uint32_t add(string_view s){
+        uint32_t id = num;
+        uint32_t c = id>>chunk_bits;
+        if(c>=max_chunks) throw PterosError("Too many unique strings in the string table!");
+        string* chunk = chunks[c].load(memory_order_relaxed);
+        if(!chunk){
+            chunk = new string[chunk_size];
+            chunks[c].store(chunk,memory_order_release);
+        }
+        string& stored = chunk[id&(chunk_size-1)];
+        stored = s;
+        // Key views the stored string, which never moves
+        ids.emplace(string_view(stored),id);
+        ++num;
+        return id;
+    }
+
+    atomic<string*> chunks[max_chunks];
+    unordered_map<string_view,uint32_t> ids;
+    uint32_t num = 0;
+    mutable shared_mutex mut;
+};
+
+StringTable& table(){
+    static StringTable t;
+    return t;
+}
+
+}
+
+int InternedString::find_id(const string &s)
+{
+    return table().find(s);
+}
+
+uint32_t InternedString::intern(string_view s)
+{
+    if(s.empty()) return 0;
+    return table().intern(s);
+}
+
+const string &InternedString::get_string(uint32_t id)
+{
+    return table().get(id);
+}
@@ -41,6 +41,14 @@ DcdFile::DcdFile(string fname): VmdMolfilePluginWrapper(fname){
     plugin = molfile_plugins["dcd"];
 }
 
+int DcdFile::skip_frames(int n){
+    // DCD plugin skips the frame without decoding if timestep is NULL
+    for(int i=0; i<n; ++i){
+        if(plugin->read_next_timestep(r_handle,natoms,NULL)!=MOLFILE_SUCCESS) return i;
+    }
+    return n;
+}
+
 
 
 
@@ -45,6 +45,7 @@ public:
                 .traj(true);
     }
 
+    virtual int skip_frames(int n) override;
 };
 
 }
@@ -36,6 +36,7 @@
 #include "xyz_file.h"
 #include "trr_file.h"
 #include "xtc_file.h"
+#include "ptb_file.h"
 
 #ifdef USE_TNGIO
 #include "tng_file.h"
@@ -71,6 +72,29 @@ void FileHandler::write(const Selection &sel, const FileContent &what) {
     do_write(sel,what);
 }
 
+int FileHandler::skip_frames(int n){
+    Frame fr;
+    for(int i=0; i<n; ++i){
+        if(!do_read(nullptr,&fr,FileContent().traj(true))) return i;
+    }
+    return n;
+}
+
+vector<int64_t> FileHandler::get_frame_offsets(){
+    return {};
+}
+
+void FileHandler::seek_offset(int64_t){
+    throw PterosError("Seeking by offset is not supported for file '{}'!",fname);
+}
+
+int64_t FileHandler::tell_offset(){
+    return -1;
+}
+
+void FileHandler::set_precision(float){
+}
+
 void FileHandler::sanity_check_read(System *sys, Frame *frame, const FileContent& what) const {
     auto c = get_content_type();
     if( !c.atoms() && what.atoms() )
@@ -115,6 +139,7 @@ unique_ptr<FileHandler> FileHandler::recognize(string fname){
     else if(ext=="gro")     return FileHandler_ptr(new GroFile(fname));
     else if(ext=="dcd")     return FileHandler_ptr(new DcdFile(fname));
     else if(ext=="xyz")     return FileHandler_ptr(new XyzFile(fname));
+    else if(ext=="ptb")     return FileHandler_ptr(new PtbFile(fname));
 #ifdef USE_TNGIO
     else if(ext=="tng")     return FileHandler_ptr(new TngFile(fname));
 #endif
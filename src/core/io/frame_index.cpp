@@ -0,0 +1,195 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "frame_index.h"
+#include "pteros/core/pteros_error.h"
+#include "pteros/core/logging.h"
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <random>
+#include <cstdlib>
+
+using namespace std;
+using namespace pteros;
+namespace fs = std::filesystem;
+
+// Sidecar format: magic, trajectory size, trajectory mtime, number of frames, offsets, times
+static const char idx_magic[8] = {'P','T','I','D','X','0','0','1'};
+
+// Sidecar files are not used if PTEROS_NO_INDEX_FILES is set to anything except 0
+static bool index_files_enabled(){
+    static const bool enabled = [](){
+        const char* env = getenv("PTEROS_NO_INDEX_FILES");
+        bool res = !env || string(env)=="0";
+        if(!res) LOG()->info("Frame index files are disabled by PTEROS_NO_INDEX_FILES");
+        return res;
+    }();
+    return enabled;
+}
+
+void FrameIndex::build(const string& fname,
+                       const function<bool(float&)>& skip_frame,
+                       const function<int64_t()>& tell,
+                       bool cached)
+{
+    offsets.clear();
+    times.clear();
+
+    int64_t size = -1, mtime = 0;
+    string idx_name;
+    error_code ec;
+    fs::path p(fname);
+    size = fs::file_size(p,ec);
+    if(!ec){
+        mtime = fs::last_write_time(p,ec).time_since_epoch().count();
+        idx_name = (p.parent_path() / ("."+p.filename().string()+".ptidx")).string();
+    }
+    if(ec) size = -1;
+
+    cached = cached && index_files_enabled();
+    if(cached && size>=0 && load(idx_name,size,mtime)){
+        LOG()->debug("Frame index of {} is loaded from {}",fname,idx_name);
+        ready = true;
+        return;
+    }
+
+    // Scan the file
+    float t;
+    while(true){
+        int64_t off = tell();
+        if(!skip_frame(t)) break;
+        // Incomplete last frame
+        if(size>=0 && tell()>size) break;
+        offsets.push_back(off);
+        times.push_back(t);
+    }
+    ready = true;
+    LOG()->debug("Frame index of {} is built: {} frames",fname,offsets.size());
+
+    if(cached && size>=0) save(idx_name,size,mtime);
+}
+
+int64_t FrameIndex::frame_offset(int fr) const
+{
+    if(fr<0 || fr>=int(offsets.size()))
+        throw PterosError("Can't seek to frame {}, there are {} frames",fr,offsets.size());
+    return offsets[fr];
+}
+
+int64_t FrameIndex::time_offset(float t) const
+{
+    // Times are not required to be equally spaced or sorted
+    auto it = find_if(times.begin(),times.end(),[t](float v){ return v>=t; });
+    if(it==times.end())
+        throw PterosError("Can't seek to time {}, last time is {}",t,times.empty() ? 0.0 : times.back());
+    return offsets[it-times.begin()];
+}
+
+void FrameIndex::frame_and_time(int64_t offset, int& fr, float& t) const
+{
+    fr = lower_bound(offsets.begin(),offsets.end(),offset) - offsets.begin();
+    if(fr>=int(offsets.size())) throw PterosError("End of trajectory reached");
+    t = times[fr];
+}
+
+void FrameIndex::last_frame_and_time(int& fr, float& t) const
+{
+    if(offsets.empty()) throw PterosError("Trajectory has no frames");
+    fr = offsets.size()-1;
+    t = times.back();
+}
+
+bool FrameIndex::load(const string& idx_name, int64_t size, int64_t mtime)
+{
+    ifstream f(idx_name,ios::binary);
+    if(!f) return false;
+
+    char magic[8];
+    int64_t sz, mt, n;
+    f.read(magic,8);
+    f.read((char*)&sz,sizeof(sz));
+    f.read((char*)&mt,sizeof(mt));
+    f.read((char*)&n,sizeof(n));
+    if(!f || !equal(magic,magic+8,idx_magic) || sz!=size || mt!=mtime || n<0) return false;
+
+    // Number of frames should agree with the size of sidecar, otherwise it is corrupted
+    error_code ec;
+    int64_t header_size = 8+3*sizeof(int64_t);
+    int64_t file_size = fs::file_size(idx_name,ec);
+    if(ec || n>(file_size-header_size)/int64_t(sizeof(int64_t)+sizeof(float))
+          || header_size+n*int64_t(sizeof(int64_t)+sizeof(float))!=file_size) return false;
+
+    offsets.resize(n);
+    times.resize(n);
+    f.read((char*)offsets.data(),n*sizeof(int64_t));
+    f.read((char*)times.data(),n*sizeof(float));
+    if(!f){
+        offsets.clear();
+        times.clear();
+        return false;
+    }
+    return true;
+}
+
+void FrameIndex::save(const string& idx_name, int64_t size, int64_t mtime) const
+{
+    // Written to temporary file in the same directory and renamed,
+    // so that concurrent readers never see partially written index
+    string tmp_name = idx_name + "." + to_string(random_device()()) + ".tmp";
+    error_code ec;
+    {
+        ofstream f(tmp_name,ios::binary);
+        if(!f){
+            LOG()->debug("Can't write frame index {}",idx_name);
+            return;
+        }
+        int64_t n = offsets.size();
+        f.write(idx_magic,8);
+        f.write((char*)&size,sizeof(size));
+        f.write((char*)&mtime,sizeof(mtime));
+        f.write((char*)&n,sizeof(n));
+        f.write((char*)offsets.data(),n*sizeof(int64_t));
+        f.write((char*)times.data(),n*sizeof(float));
+        f.close();
+        if(!f){
+            LOG()->debug("Can't write frame index {}",idx_name);
+            fs::remove(tmp_name,ec);
+            return;
+        }
+    }
+
+    fs::rename(tmp_name,idx_name,ec);
+    if(ec){
+        LOG()->debug("Can't write frame index {}: {}",idx_name,ec.message());
+        fs::remove(tmp_name,ec);
+        return;
+    }
+    LOG()->info("Frame index is saved to {} (set PTEROS_NO_INDEX_FILES=1 to disable)",idx_name);
+}
@@ -0,0 +1,87 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+namespace pteros {
+
+/**
+* Offsets and times of all frames in trajectory file.
+* Built once by scanning frame headers and cached in the hidden sidecar file
+* .<name>.ptidx next to the trajectory. Cache is used while the size and
+* modification time of trajectory are unchanged.
+* If sidecar can't be written (read-only directory) the index is just rebuilt next time.
+* Sidecar files are neither read nor written if PTEROS_NO_INDEX_FILES environment
+* variable is set to anything except 0.
+*/
+class FrameIndex {
+public:
+    FrameIndex(): ready(false) {}
+
+    /// Loads index from sidecar or builds it.
+    /// skip_frame() skips one frame at current position and returns its time or false at EOF,
+    /// tell() returns current position in the file.
+    /// If cached is false the sidecar is not used, which is better for formats
+    /// where scanning is as cheap as reading the sidecar.
+    void build(const std::string& fname,
+               const std::function<bool(float&)>& skip_frame,
+               const std::function<int64_t()>& tell,
+               bool cached = true);
+
+    bool is_ready() const { return ready; }
+    int num_frames() const { return offsets.size(); }
+    const std::vector<int64_t>& get_offsets() const { return offsets; }
+
+    /// Offset of given frame
+    int64_t frame_offset(int fr) const;
+    /// Offset of the first frame with time >= t
+    int64_t time_offset(float t) const;
+    /// Frame and time of the frame, which starts at given offset or after it
+    void frame_and_time(int64_t offset, int& fr, float& t) const;
+    /// Last frame and its time
+    void last_frame_and_time(int& fr, float& t) const;
+
+private:
+    bool ready;
+    std::vector<int64_t> offsets;
+    std::vector<float> times;
+
+    bool load(const std::string& idx_name, int64_t size, int64_t mtime);
+    void save(const std::string& idx_name, int64_t size, int64_t mtime) const;
+};
+
+}
+
+
+
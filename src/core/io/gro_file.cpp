@@ -31,6 +31,7 @@
 #include "pteros/core/pteros_error.h"
 #include "pteros/core/utilities.h"
 #include "system_builder.h"
+#include <sstream>
 
 using namespace std;
 using namespace pteros;
@@ -39,8 +40,7 @@ using namespace Eigen;
 void GroFile::open(char open_mode)
 {
     if(open_mode=='r'){
-        f.open(fname.c_str(),ios_base::in);
-        if(!f) throw PterosError("Can't open GRO file '{}' for reading",fname);
+        if(!text.open(fname)) throw PterosError("Can't open GRO file '{}' for reading",fname);
     } else {
         f.open(fname.c_str(),ios_base::out);
         if(!f) throw PterosError("Can't open GRO file '{}' for writing",fname);
@@ -51,66 +51,69 @@ void GroFile::close(){
     if(f){
         f.close();
     }
+    text.close();
 }
 
 bool GroFile::do_read(System *sys, Frame *frame, const FileContent &what){
-
-    string line;
-
-    int N,i,j;
-    float v;
-    // tmp atom
-    Atom tmp_atom;
-    // Temporary coordinates
-    Vector3f tmp_coor;
-    // Buffers for scanf
-    char resname_buf[5], name_buf[5];
-
     // Skip header line
-    getline(f,line);    
+    text.next_line();
 
     // Read number of atoms
-    getline(f,line);
-    sscanf(line.c_str(),"%d",&N);
+    int N = parse_int(text.next_line());
+
+    // Collect atom lines, they are parsed independently
+    lines.resize(N);
+    for(int i=0;i<N;++i) lines[i] = text.next_line();
+
+    // Width of coordinate fields is the distance between decimal points
+    // (8 for usual %8.3f, but Gromacs allows other precisions)
+    int w = 8;
+    if(N>0){
+        size_t p1 = lines[0].find('.',20);
+        size_t p2 = (p1==string_view::npos) ? p1 : lines[0].find('.',p1+1);
+        if(p2!=string_view::npos) w = p2-p1;
+    }
 
     frame->coord.resize(N);
 
     SystemBuilder builder(sys);
+    int first_atom = 0;
+    if(what.atoms()){
+        first_atom = sys->num_atoms();
+        builder.allocate_atoms(first_atom+N);
+    }
 
-    // Read coordinates
-    for(i=0;i<N;++i){
-        getline(f,line);
-
-        tmp_atom.resid = atoi(line.substr(0,5).c_str());
-        tmp_atom.resname = line.substr(5,5);
-        tmp_atom.name = line.substr(10,5);
-        // dum - 5 chars
-        tmp_coor(0) = atof(line.substr(20,8).c_str());
-        tmp_coor(1) = atof(line.substr(28,8).c_str());
-        tmp_coor(2) = atof(line.substr(36,8).c_str());
-
-        str_trim_in_place(tmp_atom.resname);
-        str_trim_in_place(tmp_atom.name);
-
-        // Coordinates are in nm, so no need to convert
-
-        if(what.atoms()){
-            // Assign masses
-            get_element_from_atom_name(tmp_atom.name, tmp_atom.atomic_number, tmp_atom.mass);
-            tmp_atom.type = -1; //Undefined type so far
-            // There is no chain, occupancy and beta in GRO file, so add it manually
-            tmp_atom.chain = 'X';
-            tmp_atom.beta = 0.0;
-            tmp_atom.occupancy = 0.0;
-            // We have to deduce the element number
-            tmp_atom.atomic_number = get_element_number(tmp_atom.name);
-            // Add new atom to the system
-            builder.add_atom(tmp_atom);
-        }
-
-        if(what.coord()){
-            // Add column of coordinates
-            frame->coord[i] = tmp_coor;
+    #pragma omp parallel if(N>parallel_parse_threshold)
+    {
+        NameCache cache(true); // Atomic numbers of GRO atoms are deduced by get_element_number()
+
+        #pragma omp for schedule(static)
+        for(int i=0;i<N;++i){
+            string_view line = lines[i];
+
+            if(what.atoms()){
+                Atom& at = builder.atom(first_atom+i);
+                at.resid = parse_int(fixed_field(line,0,5));
+                at.resname = cache.resname(trim_view(fixed_field(line,5,5)));
+                const ParsedName& name = cache.name(trim_view(fixed_field(line,10,5)));
+                at.name = name.str;
+                at.mass = name.mass;
+                at.atomic_number = name.atomic_number;
+                at.type = -1; //Undefined type so far
+                // There is no chain, occupancy and beta in GRO file, so add it manually
+                at.chain = 'X';
+                at.beta = 0.0;
+                at.occupancy = 0.0;
+            }
+
+            if(what.coord()){
+                // dum - 5 chars
+                // Coordinates are in nm, so no need to convert
+                Vector3f& c = frame->coord[i];
+                c(0) = parse_double(fixed_field(line,20,w));
+                c(1) = parse_double(fixed_field(line,20+w,w));
+                c(2) = parse_double(fixed_field(line,20+2*w,w));
+            }
         }
     }
 
@@ -119,9 +122,8 @@ bool GroFile::do_read(System *sys, Frame *frame, const FileContent &what){
     if(what.coord()){
         // Read box. Adapted form VMD.
         stringstream ss;
-        getline(f,line);
-        ss.clear();
-        ss.str(line);
+        ss.str(string(text.next_line()));
+        float v;
         //ss >> &x[0], &y[1], &z[2], &x[1], &x[2], &y[0], &y[2], &z[0], &z[1])
         Matrix3f box;
         box.fill(0.0);
@@ -31,7 +31,10 @@
 
 #include <string>
 #include <fstream>
+#include <vector>
+#include <string_view>
 #include "pteros/core/file_handler.h"
+#include "text_reader.h"
 
 namespace pteros {
 
@@ -51,14 +54,16 @@ public:
 
 protected:
 
+    // Used for writing
     std::fstream f;
 
+    // Used for reading
+    TextReader text;
+    // Atom lines of current frame
+    std::vector<std::string_view> lines;
+
     virtual bool do_read(System *sys, Frame *frame, const FileContent& what);
     virtual void do_write(const Selection &sel, const FileContent& what);
 };
 
 }
-
-
-
-
@@ -0,0 +1,101 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "mapped_file.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+
+using namespace std;
+using namespace pteros;
+
+// Size of read-ahead window
+static const int64_t readahead_size = 32*1024*1024;
+
+bool MappedFile::open(const string& fname)
+{
+    close();
+#ifndef _WIN32
+    int fd = ::open(fname.c_str(),O_RDONLY);
+    if(fd<0) return false;
+
+    struct stat st;
+    if(fstat(fd,&st)!=0 || st.st_size==0 || !S_ISREG(st.st_mode)){
+        ::close(fd);
+        return false;
+    }
+
+    void* p = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    // Mapping stays valid after closing the descriptor
+    ::close(fd);
+    if(p==MAP_FAILED) return false;
+
+    ptr = (const char*)p;
+    sz = st.st_size;
+    ahead = 0;
+    madvise(p,sz,MADV_SEQUENTIAL);
+    will_need(0);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+    if(ptr) munmap((void*)ptr,sz);
+#endif
+    ptr = nullptr;
+    sz = 0;
+}
+
+void MappedFile::will_need(int64_t pos)
+{
+#ifndef _WIN32
+    // Prefetch next window when half of current one is consumed
+    if(!ptr || pos<0 || pos>=sz) return;
+    bool inside = (pos>=ahead-readahead_size && pos<ahead);
+    if(inside && (ahead==sz || pos<ahead-readahead_size/2)) return;
+    // Should start at page boundary
+    int64_t page = sysconf(_SC_PAGESIZE);
+    int64_t b = pos/page*page;
+    int64_t e = min(sz,pos+readahead_size);
+    madvise((void*)(ptr+b),e-b,MADV_WILLNEED);
+    ahead = e;
+#endif
+}
+
+
+
@@ -0,0 +1,73 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace pteros {
+
+/**
+* Read-only memory mapping of the whole file.
+* Readers parse the mapped pages directly without reading them into
+* intermediate buffers. The kernel is asked to read the file sequentially
+* and the window ahead of current position is prefetched explicitly.
+* If the file can't be mapped (empty file, unsupported platform or file system)
+* open() returns false and the caller should use usual file IO.
+*/
+class MappedFile {
+public:
+    MappedFile(): ptr(nullptr), sz(0), ahead(0) {}
+    ~MappedFile(){ close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /// Maps the file, returns false on failure
+    bool open(const std::string& fname);
+    void close();
+
+    bool is_open() const { return ptr!=nullptr; }
+    const char* data() const { return ptr; }
+    int64_t size() const { return sz; }
+
+    /// Prefetches the read-ahead window starting at pos if it is not prefetched yet
+    void will_need(int64_t pos);
+
+private:
+    const char* ptr;
+    int64_t sz;
+    int64_t ahead; // End of prefetched region
+};
+
+}
+
+
+
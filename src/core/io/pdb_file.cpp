@@ -30,7 +30,10 @@
 #include "pdb_file.h"
 #include "molfile_plugin.h"
 #include "pteros/core/pteros_error.h"
-#include <iomanip>
+#include "pteros/core/utilities.h"
+#include "../molfile_plugins/periodic_table.h"
+#include "system_builder.h"
+#include <unordered_map>
 
 using namespace std;
 using namespace pteros;
@@ -41,5 +44,175 @@ PdbFile::PdbFile(string &fname): VmdMolfilePluginWrapper(fname)
    plugin = molfile_plugins["pdb"];
 }
 
+void PdbFile::open(char open_mode)
+{
+    // Plugin is used for writing only
+    if(open_mode!='r'){
+        VmdMolfilePluginWrapper::open(open_mode);
+        return;
+    }
+
+    mode = open_mode;
+    if(!text.open(fname)) throw PterosError("Can't open file '{}'!",fname);
+
+    // Number of atoms is given by the first model
+    string_view cryst1;
+    read_model(cryst1);
+    natoms = lines.size();
+    if(natoms==0) throw PterosError("PDB file '{}' contains no atoms!",fname);
+    text.seek(0);
+}
+
+void PdbFile::close()
+{
+    text.close();
+    VmdMolfilePluginWrapper::close();
+}
+
+namespace {
+
+inline bool starts_with(string_view s, string_view prefix){
+    return s.substr(0,prefix.size())==prefix;
+}
+
+// Removes leading and trailing spaces from PDB fields
+inline string_view trim_spaces(string_view s){
+    size_t b = s.find_first_not_of(' ');
+    if(b==string_view::npos) return string_view();
+    return s.substr(b,s.find_last_not_of(' ')-b+1);
+}
+
+struct PdbElement {
+    int atomic_number;
+    float mass;
+};
+
+// Element field is looked up once for each distinct string as well
+struct PdbNameCache: public NameCache {
+    unordered_map<string_view,PdbElement> elements;
 
+    const PdbElement& element(string_view s){
+        auto it = elements.find(s);
+        if(it==elements.end()){
+            char buf[3] = {0,0,0};
+            s.copy(buf,2);
+            PdbElement el;
+            el.atomic_number = get_pte_idx_from_string(buf);
+            el.mass = el.atomic_number ? get_pte_mass(el.atomic_number) : 0.0;
+            it = elements.emplace(s,el).first;
+        }
+        return it->second;
+    }
+};
 
+}
+
+void PdbFile::read_model(string_view &cryst1)
+{
+    lines.clear();
+    while(!text.at_end()){
+        string_view line = text.next_line();
+        if(starts_with(line,"ATOM ") || starts_with(line,"HETATM")){
+            lines.push_back(line);
+        } else if(starts_with(line,"CRYST1")){
+            cryst1 = line;
+        } else if(starts_with(line,"END")){
+            // Any END* record, including ENDMDL
+            break;
+        }
+    }
+}
+
+bool PdbFile::do_read(System *sys, Frame *frame, const FileContent &what){
+    // Structure and coordinates are taken from the same model,
+    // so reading the structure alone doesn't move to the next model
+    size_t pos = text.tell();
+    string_view cryst1;
+    read_model(cryst1);
+    // Extra atoms in the model are ignored
+    int n = min(natoms,int(lines.size()));
+
+    if(what.atoms()){
+        // READ STRUCTURE:
+        SystemBuilder builder(sys);
+
+        if(sys->num_atoms()>0)
+            throw PterosError("Can't read structure to the system, which is not empty!");
+
+        builder.allocate_atoms(n);
+
+        #pragma omp parallel if(n>parallel_parse_threshold)
+        {
+            PdbNameCache cache;
+
+            #pragma omp for schedule(static)
+            for(int i=0; i<n; ++i){
+                string_view line = lines[i];
+                Atom& at = builder.atom(i);
+
+                const ParsedName& name = cache.name(trim_spaces(fixed_field(line,12,4)));
+                at.name = name.str;
+                at.resname = cache.resname(trim_spaces(fixed_field(line,17,4)));
+                at.chain = line.size()>21 ? line[21] : ' ';
+                at.resid = parse_int(fixed_field(line,22,4));
+                at.occupancy = parse_double(fixed_field(line,54,6));
+                at.beta = parse_double(fixed_field(line,60,6));
+
+                const PdbElement& el = cache.element(fixed_field(line,76,2));
+                // Element record is often absent, so guess the element
+                // from atom name if it is not recognized
+                if(el.mass>0){
+                    at.atomic_number = el.atomic_number;
+                    at.mass = el.mass;
+                } else {
+                    at.atomic_number = name.atomic_number;
+                    at.mass = name.mass;
+                }
+            }
+        }
+
+        sys->assign_resindex();
+    }
+
+    if(what.coord() || what.traj()){
+        // READ FRAME:
+        // Incomplete model at the end of file
+        if(int(lines.size())<natoms) return false;
+
+        frame->coord.resize(natoms);
+
+        #pragma omp parallel for schedule(static) if(natoms>parallel_parse_threshold)
+        for(int i=0; i<natoms; ++i){
+            string_view line = lines[i];
+            Vector3f& c = frame->coord[i];
+            c(0) = parse_double(fixed_field(line,30,8));
+            c(1) = parse_double(fixed_field(line,38,8));
+            c(2) = parse_double(fixed_field(line,46,8));
+            // Angstroms to nm
+            c /= 10.0;
+        }
+
+        // Convert box to our format
+        Matrix3f b;
+        b.fill(0.0);
+        if(!cryst1.empty()){
+            float A = parse_double(fixed_field(cryst1,6,9));
+            float B = parse_double(fixed_field(cryst1,15,9));
+            float C = parse_double(fixed_field(cryst1,24,9));
+            float alpha = parse_double(fixed_field(cryst1,33,7));
+            float beta = parse_double(fixed_field(cryst1,40,7));
+            float gamma = parse_double(fixed_field(cryst1,47,7));
+            // Only convert if all three vectors are non-zero
+            if(A!=0 && B!=0 && C!=0) box_from_vmd_rep(A,B,C,alpha,beta,gamma,b);
+        }
+        frame->box.set_matrix(b);
+
+        frame->time = 0;
+
+        return true;
+    }
+
+    // Only structure is read
+    text.seek(pos);
+    return false;
+}
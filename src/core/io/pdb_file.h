@@ -29,14 +29,18 @@
 #pragma once
 
 #include "vmd_molfile_plugin_wrapper.h"
+#include "text_reader.h"
+#include <vector>
 
 namespace pteros {
 
-/// Use VMD plugin for PDB
+/// PDB files are parsed directly, VMD plugin is used for writing
 class PdbFile: public VmdMolfilePluginWrapper {
 public:    
 
     PdbFile(std::string& fname);
+    virtual void open(char open_mode) override;
+    virtual void close() override;
 
     virtual FileContent get_content_type() const {        
         return FileContent()
@@ -44,11 +48,16 @@ public:
                 .coord(true)
                 .traj(true);
     }
-};
-
-}
-
-
 
+protected:
+    virtual bool do_read(System *sys, Frame *frame, const FileContent& what) override;
 
+private:
+    TextReader text;
+    // ATOM and HETATM records of current model
+    std::vector<std::string_view> lines;
+    // Reads records until the end of the model
+    void read_model(std::string_view& cryst1);
+};
 
+}
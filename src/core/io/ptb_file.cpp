@@ -0,0 +1,574 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "ptb_file.h"
+#include "system_builder.h"
+#include "pteros/core/pteros_error.h"
+#include "pteros/core/logging.h"
+#include "pteros/core/selection.h"
+#include <cstring>
+#include <iterator>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+namespace {
+
+const char ptb_magic[8] = {'P','T','E','R','O','S','B','N'};
+// Version 2 stores offsets of sections after the header
+const uint32_t ptb_version = 2;
+// Written in native order, so it is read back as is only if the order matches
+const uint32_t ptb_byte_order = 0x01020304;
+// "FRME" in little-endian
+const uint32_t ptb_frame_marker = 0x454d5246;
+
+enum { ptb_has_ff = 1 };
+enum { ptb_frame_vel = 1, ptb_frame_force = 2 };
+
+struct PtbHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t natoms;
+    uint32_t flags;
+    uint32_t nstrings;
+    uint32_t reserved;
+};
+
+// Follows the header since version 2
+struct PtbSections {
+    int64_t ff_pos;
+    int64_t frames_pos;
+};
+
+// Strings are indexes in the string table
+struct PtbAtom {
+    int32_t resid;
+    uint32_t name, resname, tag, type_name;
+    float occupancy, beta;
+    int32_t resindex, atomic_number;
+    float mass, charge;
+    int32_t type;
+    char chain;
+    char pad[3];
+};
+
+struct PtbFrameHeader {
+    uint32_t marker;
+    uint32_t flags;
+    float time;
+    float box[9];
+};
+
+static_assert(sizeof(PtbHeader)==32, "Unexpected PTB header layout");
+static_assert(sizeof(PtbSections)==16, "Unexpected PTB sections layout");
+static_assert(sizeof(PtbAtom)==52, "Unexpected PTB atom layout");
+static_assert(sizeof(PtbFrameHeader)==48, "Unexpected PTB frame layout");
+
+// All records are padded to 4 bytes
+inline size_t padded(size_t n){ return (n+3) & ~size_t(3); }
+
+template<class T>
+void put(ofstream& f, const T* p, size_t n = 1){
+    f.write((const char*)p, n*sizeof(T));
+}
+
+template<class T>
+void put_value(ofstream& f, T v){
+    put(f,&v);
+}
+
+void put_string(ofstream& f, const string& s){
+    static const char zeros[4] = {0,0,0,0};
+    put_value<uint32_t>(f,s.size());
+    f.write(s.data(),s.size());
+    f.write(zeros,padded(s.size())-s.size());
+}
+
+// Writes coordinates of selected atoms by runs of consecutive atoms
+void put_vectors(ofstream& f, const vector<Vector3f>& v, const vector<Vector2i>& runs){
+    for(const auto& r: runs) put(f, v[r(0)].data(), 3*(r(1)-r(0)+1));
+}
+
+}
+
+PtbFile::PtbFile(string &fname): FileHandlerRandomAccess(fname),
+    header_written(false), data(nullptr), size(0), pos(0),
+    atoms_pos(0), ff_pos(0), frames_pos(0), flags(0)
+{
+}
+
+void PtbFile::open(char open_mode)
+{
+    if(open_mode!='r'){
+        out.open(fname, ios::out|ios::binary);
+        if(!out) throw PterosError("Can't open PTB file '{}' for writing",fname);
+        return;
+    }
+
+    if(mapped.open(fname)){
+        data = mapped.data();
+        size = mapped.size();
+    } else {
+        ifstream in(fname,ios_base::in|ios_base::binary);
+        if(!in) throw PterosError("Can't open PTB file '{}' for reading",fname);
+        buf.assign(istreambuf_iterator<char>(in),istreambuf_iterator<char>());
+        data = buf.data();
+        size = buf.size();
+    }
+
+    PtbHeader h;
+    pos = 0;
+    get(&h,pos);
+    if(memcmp(h.magic,ptb_magic,8)) throw PterosError("File '{}' is not a PTB file",fname);
+    if(h.byte_order!=ptb_byte_order) throw PterosError("PTB file '{}' has incompatible byte order",fname);
+    if(h.version>ptb_version)
+        throw PterosError("PTB file '{}' has version {}, only versions up to {} are supported",fname,h.version,ptb_version);
+    natoms = h.natoms;
+    flags = h.flags;
+    if(natoms<0) throw PterosError("PTB file '{}' is corrupted: {} atoms",fname,natoms);
+
+    PtbSections sec;
+    if(h.version>=2) get(&sec,pos);
+
+    // String table is interned once
+    check_fits(pos,h.nstrings,sizeof(uint32_t));
+    strings.resize(h.nstrings);
+    for(auto& s: strings){
+        uint32_t len;
+        get(&len,pos);
+        check_fits(pos,len,1);
+        s = InternedString(string_view(data+pos,len));
+        pos += padded(len);
+    }
+
+    atoms_pos = pos;
+    check_fits(pos,natoms,sizeof(PtbAtom));
+    pos += int64_t(natoms)*sizeof(PtbAtom);
+    ff_pos = pos;
+
+    if(h.version>=2){
+        if(sec.ff_pos!=ff_pos || sec.frames_pos<ff_pos || sec.frames_pos>size
+           || (!(flags & ptb_has_ff) && sec.frames_pos!=ff_pos))
+            throw PterosError("PTB file '{}' has corrupted section offsets",fname);
+        frames_pos = sec.frames_pos;
+    } else {
+        if(flags & ptb_has_ff){
+            // Skip the force field to find the frames
+            ForceField ff;
+            read_force_field(ff);
+        }
+        frames_pos = pos;
+    }
+
+    pos = frames_pos;
+}
+
+void PtbFile::close()
+{
+    if(out.is_open()) out.close();
+    mapped.close();
+    buf.clear();
+    data = nullptr;
+    size = 0;
+}
+
+void PtbFile::check_fits(int64_t at, uint64_t n, size_t elem_size) const
+{
+    // Written to avoid overflow for corrupted counts
+    if(at<0 || at>size || n>uint64_t(size-at)/elem_size)
+        throw PterosError("PTB file '{}' is truncated or corrupted at offset {}",fname,at);
+}
+
+template<class T>
+void PtbFile::get(T *dest, int64_t &at, size_t n) const
+{
+    check_fits(at,n,sizeof(T));
+    memcpy(dest,data+at,n*sizeof(T));
+    at += padded(n*sizeof(T));
+}
+
+template<class T, int N>
+void PtbFile::get(Eigen::Matrix<T,N,1> *dest, int64_t &at, size_t n) const
+{
+    static_assert(sizeof(Eigen::Matrix<T,N,1>)==N*sizeof(T),"Eigen vector is padded");
+    get(reinterpret_cast<T*>(dest),at,N*n);
+}
+
+int64_t PtbFile::frame_size(int64_t at, float *time) const
+{
+    if(at+int64_t(sizeof(PtbFrameHeader))>size) return 0;
+    PtbFrameHeader h;
+    memcpy(&h,data+at,sizeof(h));
+    if(h.marker!=ptb_frame_marker) throw PterosError("PTB file '{}' is corrupted at offset {}",fname,at);
+    int nvec = 1 + bool(h.flags & ptb_frame_vel) + bool(h.flags & ptb_frame_force);
+    int64_t sz = sizeof(PtbFrameHeader) + int64_t(nvec)*natoms*sizeof(Vector3f);
+    // Incomplete last frame
+    if(at+sz>size) return 0;
+    if(time) *time = h.time;
+    return sz;
+}
+
+void PtbFile::read_force_field(ForceField &ff)
+{
+    int32_t n, rows, cols;
+    uint32_t m;
+
+    // Counts are checked against the file size before allocating memory
+    get(&n,pos);
+    if(n<0) throw PterosError("PTB file '{}' is corrupted: force field of {} atoms",fname,n);
+    check_fits(pos,n,sizeof(uint32_t));
+    ff.natoms = n;
+
+    // Exclusions as the number of excluded atoms followed by their indexes
+    ff.exclusions.resize(n);
+    vector<int32_t> tmp;
+    for(auto& ex: ff.exclusions){
+        get(&m,pos);
+        check_fits(pos,m,sizeof(int32_t));
+        tmp.resize(m);
+        get(tmp.data(),pos,m);
+        ex.clear();
+        ex.insert(tmp.begin(),tmp.end());
+    }
+
+    for(MatrixXf* mat: {&ff.LJ_C6, &ff.LJ_C12}){
+        get(&rows,pos); get(&cols,pos);
+        if(rows<0 || cols<0) throw PterosError("PTB file '{}' is corrupted: LJ matrix {}x{}",fname,rows,cols);
+        check_fits(pos,uint64_t(rows)*cols,sizeof(float));
+        mat->resize(rows,cols);
+        get(mat->data(),pos,mat->size());
+    }
+
+    get(&m,pos);
+    check_fits(pos,m,sizeof(Vector2f));
+    ff.LJ14_interactions.resize(m);
+    get(ff.LJ14_interactions.data(),pos,m);
+
+    get(&m,pos);
+    check_fits(pos,2*uint64_t(m),sizeof(int32_t));
+    tmp.resize(2*m);
+    get(tmp.data(),pos,2*m);
+    ff.LJ14_pairs.clear();
+    ff.LJ14_pairs.reserve(m);
+    for(uint32_t i=0; i<m; ++i) ff.LJ14_pairs[tmp[2*i]] = tmp[2*i+1];
+
+    get(&ff.fudgeQQ,pos);
+    get(&ff.rcoulomb,pos);
+    get(&ff.epsilon_r,pos);
+    get(&ff.epsilon_rf,pos);
+    get(&ff.rcoulomb_switch,pos);
+    get(&ff.rvdw_switch,pos);
+    get(&ff.rvdw,pos);
+
+    for(string* s: {&ff.coulomb_type, &ff.coulomb_modifier, &ff.vdw_type, &ff.vdw_modifier}){
+        get(&m,pos);
+        check_fits(pos,m,1);
+        s->assign(data+pos,m);
+        pos += padded(m);
+    }
+
+    get(&m,pos);
+    check_fits(pos,m,sizeof(Vector2i));
+    ff.bonds.resize(m);
+    get(ff.bonds.data(),pos,m);
+
+    get(&m,pos);
+    check_fits(pos,m,sizeof(Vector2i));
+    ff.molecules.resize(m);
+    get(ff.molecules.data(),pos,m);
+}
+
+bool PtbFile::do_read(System *sys, Frame *frame, const FileContent &what){
+    if(what.atoms()){
+        SystemBuilder builder(sys);
+
+        if(sys->num_atoms()>0)
+            throw PterosError("Can't read structure to the system, which is not empty!");
+
+        builder.allocate_atoms(natoms);
+        const char* p = data+atoms_pos;
+        PtbAtom a;
+        for(int i=0; i<natoms; ++i, p+=sizeof(PtbAtom)){
+            memcpy(&a,p,sizeof(PtbAtom));
+            Atom& at = builder.atom(i);
+            at.resid = a.resid;
+            at.name = strings.at(a.name);
+            at.resname = strings.at(a.resname);
+            at.tag = strings.at(a.tag);
+            at.type_name = strings.at(a.type_name);
+            at.occupancy = a.occupancy;
+            at.beta = a.beta;
+            at.resindex = a.resindex;
+            at.atomic_number = a.atomic_number;
+            at.mass = a.mass;
+            at.charge = a.charge;
+            at.type = a.type;
+            at.chain = a.chain;
+        }
+    }
+
+    if(what.top() && (flags & ptb_has_ff)){
+        int64_t cur = pos;
+        pos = ff_pos;
+        ForceField& ff = sys->get_force_field();
+        read_force_field(ff);
+        if(pos!=frames_pos) throw PterosError("PTB file '{}' has corrupted force field",fname);
+        pos = cur;
+        ff.setup_kernels();
+        ff.ready = true;
+    }
+
+    if(what.coord() || what.traj()){
+        int64_t sz = frame_size(pos);
+        if(!sz) return false; // End of file
+
+        PtbFrameHeader h;
+        get(&h,pos);
+        frame->time = h.time;
+        frame->box.set_matrix(Map<Matrix3f>(h.box));
+
+        frame->coord.resize(natoms);
+        get(frame->coord.data(),pos,natoms);
+        if(h.flags & ptb_frame_vel){
+            frame->vel.resize(natoms);
+            get(frame->vel.data(),pos,natoms);
+        } else {
+            frame->vel.clear();
+        }
+        if(h.flags & ptb_frame_force){
+            frame->force.resize(natoms);
+            get(frame->force.data(),pos,natoms);
+        } else {
+            frame->force.clear();
+        }
+    }
+
+    return true;
+}
+
+void PtbFile::write_header(const Selection &sel, const FileContent &what)
+{
+    const System& sys = *sel.get_system();
+    const ForceField& ff = sys.get_force_field();
+    // Force field indexes refer to the whole system
+    bool with_ff = what.top() && ff.ready && sel.size()==sys.num_atoms();
+
+    // String table, empty string is always the first
+    vector<InternedString> strs {InternedString()};
+    unordered_map<uint32_t,uint32_t> str_index {{0,0}};
+    auto index_of = [&](const InternedString& s){
+        auto it = str_index.find(s.get_id());
+        if(it!=str_index.end()) return it->second;
+        strs.push_back(s);
+        return str_index[s.get_id()] = strs.size()-1;
+    };
+
+    vector<PtbAtom> atoms(sel.size());
+    for(int i=0; i<sel.size(); ++i){
+        const Atom& at = sel.atom(i);
+        PtbAtom& a = atoms[i];
+        memset(&a,0,sizeof(a));
+        a.resid = at.resid;
+        a.name = index_of(at.name);
+        a.resname = index_of(at.resname);
+        a.tag = index_of(at.tag);
+        a.type_name = index_of(at.type_name);
+        a.occupancy = at.occupancy;
+        a.beta = at.beta;
+        a.resindex = at.resindex;
+        a.atomic_number = at.atomic_number;
+        a.mass = at.mass;
+        a.charge = at.charge;
+        a.type = at.type;
+        a.chain = at.chain;
+    }
+
+    PtbHeader h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,ptb_magic,8);
+    h.version = ptb_version;
+    h.byte_order = ptb_byte_order;
+    h.natoms = sel.size();
+    h.flags = with_ff ? ptb_has_ff : 0;
+    h.nstrings = strs.size();
+    put(out,&h);
+    // Offsets of sections are written when they are known
+    int64_t sections_pos = out.tellp();
+    PtbSections sec = {0,0};
+    put(out,&sec);
+
+    for(const auto& s: strs) put_string(out,s.str());
+    put(out,atoms.data(),atoms.size());
+    sec.ff_pos = out.tellp();
+
+    if(with_ff){
+        put_value<int32_t>(out,ff.natoms);
+        vector<int32_t> tmp;
+        for(const auto& ex: ff.exclusions){
+            // Sorted for reproducible files
+            tmp.assign(ex.begin(),ex.end());
+            sort(tmp.begin(),tmp.end());
+            put_value<uint32_t>(out,tmp.size());
+            put(out,tmp.data(),tmp.size());
+        }
+
+        for(const MatrixXf* m: {&ff.LJ_C6, &ff.LJ_C12}){
+            put_value<int32_t>(out,m->rows());
+            put_value<int32_t>(out,m->cols());
+            put(out,m->data(),m->size());
+        }
+
+        put_value<uint32_t>(out,ff.LJ14_interactions.size());
+        put(out,ff.LJ14_interactions.data(),ff.LJ14_interactions.size());
+
+        vector<pair<int32_t,int32_t>> pairs(ff.LJ14_pairs.begin(),ff.LJ14_pairs.end());
+        sort(pairs.begin(),pairs.end());
+        put_value<uint32_t>(out,pairs.size());
+        for(const auto& pr: pairs){
+            put_value<int32_t>(out,pr.first);
+            put_value<int32_t>(out,pr.second);
+        }
+
+        for(float v: {ff.fudgeQQ, ff.rcoulomb, ff.epsilon_r, ff.epsilon_rf,
+                      ff.rcoulomb_switch, ff.rvdw_switch, ff.rvdw}){
+            put_value<float>(out,v);
+        }
+
+        for(const string* s: {&ff.coulomb_type, &ff.coulomb_modifier, &ff.vdw_type, &ff.vdw_modifier}){
+            put_string(out,*s);
+        }
+
+        put_value<uint32_t>(out,ff.bonds.size());
+        put(out,ff.bonds.data(),ff.bonds.size());
+        put_value<uint32_t>(out,ff.molecules.size());
+        put(out,ff.molecules.data(),ff.molecules.size());
+    }
+
+    sec.frames_pos = out.tellp();
+    out.seekp(sections_pos);
+    put(out,&sec);
+    out.seekp(sec.frames_pos);
+
+    natoms = sel.size();
+    header_written = true;
+}
+
+void PtbFile::do_write(const Selection &sel, const FileContent &what){
+    if(!header_written){
+        if(!what.atoms()) throw PterosError("Atoms should be written to PTB file before frames!");
+        write_header(sel,what);
+    }
+
+    if(what.traj()){
+        if(sel.size()!=natoms)
+            throw PterosError("PTB file '{}' contains {} atoms, but the frame of {} atoms is written",fname,natoms,sel.size());
+
+        const Frame& fr = sel.get_system()->frame(sel.get_frame());
+        PtbFrameHeader h;
+        h.marker = ptb_frame_marker;
+        h.flags = (fr.has_vel() ? ptb_frame_vel : 0) | (fr.has_force() ? ptb_frame_force : 0);
+        h.time = fr.time;
+        Map<Matrix3f>(h.box) = fr.box.get_matrix();
+        put(out,&h);
+
+        auto runs = sel.get_index_runs();
+        put_vectors(out,fr.coord,runs);
+        if(fr.has_vel()) put_vectors(out,fr.vel,runs);
+        if(fr.has_force()) put_vectors(out,fr.force,runs);
+    }
+
+    if(!out) throw PterosError("Error writing PTB file '{}'",fname);
+}
+
+int PtbFile::skip_frames(int n)
+{
+    for(int i=0; i<n; ++i){
+        int64_t sz = frame_size(pos);
+        if(!sz) return i;
+        pos += sz;
+    }
+    return n;
+}
+
+const FrameIndex &PtbFile::get_index()
+{
+    if(!index.is_ready()){
+        // Scanning frame headers is as fast as reading the sidecar
+        int64_t at = frames_pos;
+        index.build(fname,
+                    [this,&at](float& t){
+                        int64_t sz = frame_size(at,&t);
+                        at += sz;
+                        return sz>0;
+                    },
+                    [&at](){ return at; },
+                    false);
+    }
+    return index;
+}
+
+vector<int64_t> PtbFile::get_frame_offsets()
+{
+    return get_index().get_offsets();
+}
+
+void PtbFile::seek_offset(int64_t offset)
+{
+    if(offset<frames_pos || offset>size) throw PterosError("Error seeking to offset {}",offset);
+    pos = offset;
+}
+
+int64_t PtbFile::tell_offset()
+{
+    return pos;
+}
+
+void PtbFile::seek_frame(int fr)
+{
+    seek_offset(get_index().frame_offset(fr));
+}
+
+void PtbFile::seek_time(float t)
+{
+    seek_offset(get_index().time_offset(t));
+}
+
+void PtbFile::tell_current_frame_and_time(int &step, float &t)
+{
+    get_index().frame_and_time(pos,step,t);
+}
+
+void PtbFile::tell_last_frame_and_time(int &step, float &t)
+{
+    get_index().last_frame_and_time(step,t);
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include "pteros/core/file_handler.h"
+#include "pteros/core/atom.h"
+#include "pteros/core/force_field.h"
+#include "frame_index.h"
+#include "mapped_file.h"
+
+namespace pteros {
+
+/**
+* Native binary format of Pteros (.ptb).
+* Stores atoms, force field (if present) and any number of frames,
+* so the System is restored without parsing and guessing anything.
+* The file is versioned and uses native little-endian layout of fixed-size
+* records, so it is read directly from mapped memory.
+* Layout: header, offsets of sections, string table, atoms, force field, frames.
+* All counts are checked against the file size, so corrupted files give an error.
+*/
+class PtbFile: public FileHandlerRandomAccess {
+public:
+    PtbFile(std::string& fname);
+    virtual void open(char open_mode);
+    virtual void close();
+
+    virtual FileContent get_content_type() const {
+        return FileContent()
+                .atoms(true)
+                .traj(true)
+                .top(true)
+                .rand(true);
+    }
+
+    virtual int skip_frames(int n) override;
+    virtual std::vector<int64_t> get_frame_offsets() override;
+    virtual void seek_offset(int64_t offset) override;
+    virtual int64_t tell_offset() override;
+
+protected:
+    virtual bool do_read(System *sys, Frame *frame, const FileContent& what);
+    virtual void do_write(const Selection &sel, const FileContent& what);
+
+    virtual void seek_frame(int fr) override;
+    virtual void seek_time(float t) override;
+    virtual void tell_current_frame_and_time(int& step, float& t) override;
+    virtual void tell_last_frame_and_time(int& step, float& t) override;
+
+private:
+    // Used for writing
+    std::ofstream out;
+    bool header_written;
+
+    // File is read from mapped memory or from the buffer if it can't be mapped
+    MappedFile mapped;
+    std::string buf;
+    const char* data;
+    int64_t size;
+    // Current reading position
+    int64_t pos;
+    // Positions of sections
+    int64_t atoms_pos, ff_pos, frames_pos;
+    uint32_t flags;
+    std::vector<InternedString> strings;
+
+    // Built on first random access
+    FrameIndex index;
+    const FrameIndex& get_index();
+
+    // Throws if n elements of given size don't fit into the file at given position
+    void check_fits(int64_t at, uint64_t n, size_t elem_size) const;
+    // Reads value at given position with bounds check
+    template<class T>
+    void get(T* dest, int64_t& at, size_t n = 1) const;
+    // Fixed-size Eigen vectors are read as arrays of scalars
+    template<class T, int N>
+    void get(Eigen::Matrix<T,N,1>* dest, int64_t& at, size_t n = 1) const;
+    // Size of the frame at given position or 0 at the end of file
+    int64_t frame_size(int64_t at, float* time = nullptr) const;
+
+    void write_header(const Selection& sel, const FileContent& what);
+    void read_force_field(ForceField& ff);
+};
+
+}
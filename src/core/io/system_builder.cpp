@@ -34,21 +34,23 @@ using namespace pteros;
 
 SystemBuilder::~SystemBuilder()
 {
-
+    // Atoms were modified
+    sys->release_references();
+    ++sys->topo_revision;
 }
 
 void SystemBuilder::allocate_atoms(int n){
-    sys->atoms.resize(n);
+    atoms.resize(n);
 }
 
 void SystemBuilder::set_atom(int i, const Atom &at){
-    sys->atoms[i] = at;
+    atoms[i] = at;
 }
 
 Atom& SystemBuilder::atom(int i){
-    return sys->atoms[i];
+    return atoms[i];
 }
 
 void SystemBuilder::add_atom(const Atom &at){
-    sys->atoms.push_back(at);
+    atoms.push_back(at);
 }
@@ -38,8 +38,8 @@ namespace pteros {
 // In order to access internals of the System we define special access class
 class SystemBuilder {
 public:
-    SystemBuilder(System& s): sys(&s) {}
-    SystemBuilder(System* s): sys(s) {}
+    SystemBuilder(System& s): sys(&s), atoms(s.atoms.detached()) {}
+    SystemBuilder(System* s): sys(s), atoms(s->atoms.detached()) {}
     // When destroyed builer calls assign_resindex() and duing other preparations
     ~SystemBuilder();
 
@@ -49,6 +49,8 @@ public:
     void add_atom(const Atom& at);
 private:
     System* sys;
+    // Atoms of the system, which are not shared while building
+    std::vector<Atom>& atoms;
 };
 
 } // namespace
@@ -0,0 +1,80 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "text_reader.h"
+#include "pteros/core/utilities.h"
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+using namespace pteros;
+
+
+bool TextReader::open(const string &fname)
+{
+    if(mapped.open(fname)){
+        start = mapped.data();
+        end = start+mapped.size();
+    } else {
+        ifstream in(fname,ios_base::in|ios_base::binary);
+        if(!in) return false;
+        buf.assign(istreambuf_iterator<char>(in),istreambuf_iterator<char>());
+        start = buf.data();
+        end = start+buf.size();
+    }
+    cur = start;
+    return true;
+}
+
+void TextReader::close()
+{
+    mapped.close();
+    buf.clear();
+    cur = end = start = nullptr;
+}
+
+const ParsedName &NameCache::name(string_view s)
+{
+    auto it = names.find(s);
+    if(it==names.end()){
+        ParsedName n;
+        n.str = InternedString(s);
+        get_element_from_atom_name(n.str, n.atomic_number, n.mass);
+        if(by_element_name) n.atomic_number = get_element_number(n.str);
+        it = names.emplace(s,n).first;
+    }
+    return it->second;
+}
+
+const InternedString &NameCache::resname(string_view s)
+{
+    auto it = resnames.find(s);
+    if(it==resnames.end()) it = resnames.emplace(s,InternedString(s)).first;
+    return it->second;
+}
@@ -0,0 +1,175 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include "pteros/core/interned_string.h"
+#include "mapped_file.h"
+
+namespace pteros {
+
+/**
+* Line-by-line access to the text file, which is mapped to memory
+* or read into the buffer at once if it can't be mapped.
+* Lines are returned as views into the file data, so nothing is copied.
+*/
+class TextReader {
+public:
+    TextReader(): cur(nullptr), end(nullptr), start(nullptr) {}
+
+    TextReader(const TextReader&) = delete;
+    TextReader& operator=(const TextReader&) = delete;
+
+    /// Returns false if the file can't be opened
+    bool open(const std::string& fname);
+    void close();
+
+    /// Returns next line without line end or empty line at the end of file
+    std::string_view next_line(){
+        if(cur>=end) return std::string_view();
+        const char* e = (const char*)memchr(cur,'\n',end-cur);
+        if(!e) e = end;
+        std::string_view line(cur,e-cur);
+        cur = (e<end) ? e+1 : end;
+        // Windows line ends
+        if(!line.empty() && line.back()=='\r') line.remove_suffix(1);
+        return line;
+    }
+
+    bool at_end() const { return cur>=end; }
+    /// Current position from the beginning of the file
+    size_t tell() const { return cur-start; }
+    void seek(size_t pos){ cur = start+pos; }
+
+private:
+    MappedFile mapped;
+    std::string buf;
+    const char* cur;
+    const char* end;
+    const char* start;
+};
+
+
+// Parsing of huge files is split between threads
+const int parallel_parse_threshold = 20000;
+
+/// Atom name with the element guessed from it
+struct ParsedName {
+    InternedString str;
+    int atomic_number;
+    float mass;
+};
+
+/**
+* Names are interned and elements are guessed once for each distinct name.
+* Each thread has its own cache, so no locking is needed for repeated names.
+* Views used as keys should point to the file data, which outlives the cache.
+*/
+class NameCache {
+public:
+    /// If by_element_name is set the atomic number is taken from get_element_number()
+    /// instead of get_element_from_atom_name(), the mass is guessed in both cases.
+    NameCache(bool by_element_name = false): by_element_name(by_element_name) {}
+
+    const ParsedName& name(std::string_view s);
+    const InternedString& resname(std::string_view s);
+
+private:
+    bool by_element_name;
+    std::unordered_map<std::string_view,ParsedName> names;
+    std::unordered_map<std::string_view,InternedString> resnames;
+};
+
+
+// Parsing of fixed-column text records.
+// Numbers are parsed in place without copying the fields to temporary strings.
+
+/// Field of fixed-width record clipped to the actual line length
+inline std::string_view fixed_field(std::string_view line, size_t pos, size_t len){
+    if(pos>=line.size()) return std::string_view();
+    return line.substr(pos,len);
+}
+
+/// Removes leading and trailing whitespace
+inline std::string_view trim_view(std::string_view s){
+    size_t b = 0, e = s.size();
+    while(b<e && std::isspace((unsigned char)s[b])) ++b;
+    while(e>b && std::isspace((unsigned char)s[e-1])) --e;
+    return s.substr(b,e-b);
+}
+
+/// Same result as atoi() for the field
+inline int parse_int(std::string_view s){
+    size_t i = 0, n = s.size();
+    while(i<n && std::isspace((unsigned char)s[i])) ++i;
+    bool neg = false;
+    if(i<n && (s[i]=='-' || s[i]=='+')) neg = (s[i++]=='-');
+    long v = 0;
+    for(; i<n && s[i]>='0' && s[i]<='9'; ++i) v = v*10 + (s[i]-'0');
+    return int(neg ? -v : v);
+}
+
+/// Same result as atof() for the field.
+/// Usual fixed-point numbers are parsed directly, anything else goes to strtod.
+inline double parse_double(std::string_view s){
+    static const double pow10[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,
+                                   1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18};
+    size_t i = 0, n = s.size();
+    while(i<n && std::isspace((unsigned char)s[i])) ++i;
+    bool neg = false;
+    if(i<n && (s[i]=='-' || s[i]=='+')) neg = (s[i++]=='-');
+    uint64_t mant = 0;
+    int ndig = 0, nfrac = 0;
+    for(; i<n && s[i]>='0' && s[i]<='9'; ++i, ++ndig) mant = mant*10 + (s[i]-'0');
+    if(i<n && s[i]=='.'){
+        for(++i; i<n && s[i]>='0' && s[i]<='9'; ++i, ++ndig, ++nfrac) mant = mant*10 + (s[i]-'0');
+    }
+    // Exponents, hex, inf, nan or too many digits for exact mantissa
+    if(ndig>15 || (i<n && std::isalpha((unsigned char)s[i]))){
+        char tmp[64];
+        size_t len = std::min(s.size(),sizeof(tmp)-1);
+        memcpy(tmp,s.data(),len);
+        tmp[len] = '\0';
+        return strtod(tmp,nullptr);
+    }
+    if(ndig==0) return 0.0;
+    // Both operands are exact, so the division is correctly rounded as in strtod
+    double v = double(mant)/pow10[nfrac];
+    return neg ? -v : v;
+}
+
+}
@@ -33,6 +33,7 @@
 #include "pteros/core/logging.h"
 #include "gromacs_utils.h"
 #include "xdr_utils.h"
+#include "xdr_seek.h"
 
 using namespace std;
 using namespace pteros;
@@ -41,7 +42,11 @@ using namespace Eigen;
 
 void TrrFile::open(char open_mode)
 {    
-    handle = xdrfile_open(fname.c_str(),&open_mode);
+    // Map the file for reading if possible
+    if(open_mode=='r' && mapped.open(fname))
+        handle = xdrfile_open_mem(mapped.data(),mapped.size());
+    else
+        handle = xdrfile_open(fname.c_str(),&open_mode);
 
     if(!handle) throw PterosError("Unable to open TRR file {}", fname);
 
@@ -59,8 +64,6 @@ TrrFile::~TrrFile()
 
 
 bool TrrFile::do_read(System *sys, Frame *frame, const FileContent &what){
-    bool has_x, has_v, has_f, ok;
-
     if(step<0){
         // Read header only once on first step
         int xsz,vsz,fsz;
@@ -93,11 +96,70 @@ bool TrrFile::do_read(System *sys, Frame *frame, const FileContent &what){
     }
 
     float lambda;
-    ok = read_trr(handle,natoms,&step,&frame->time,&lambda,box,x,v,f);
+    mapped.will_need(xdr_tell(handle));
+    int ret = read_trr(handle,natoms,&step,&frame->time,&lambda,box,x,v,f);
+    if(ret == exdrENDOFFILE) return false; // End of file
+    if(ret != exdrOK){
+        LOG()->warn("TRR frame {} is corrupted!",step);
+        return false;
+    }
 
     // Get box
-    if(ok) gmx_box_to_pteros(box,frame->box);
-    return ok;
+    gmx_box_to_pteros(box,frame->box);
+    return true;
+}
+
+int TrrFile::skip_frames(int n)
+{
+    return xdr_trr_skip_frames(handle,n);
+}
+
+const FrameIndex& TrrFile::get_index()
+{
+    if(!index.is_ready()){
+        int64_t pos = xdr_tell(handle);
+        xdr_seek(handle,0,SEEK_SET);
+        index.build(fname,
+                    [this](float& t){ return xdr_trr_skip_frame(handle,&t)==exdrOK; },
+                    [this](){ return xdr_tell(handle); });
+        xdr_seek(handle,pos,SEEK_SET);
+    }
+    return index;
+}
+
+vector<int64_t> TrrFile::get_frame_offsets()
+{
+    return get_index().get_offsets();
+}
+
+void TrrFile::seek_offset(int64_t offset)
+{
+    if(xdr_seek(handle,offset,SEEK_SET)) throw PterosError("Error seeking to offset {}",offset);
+}
+
+int64_t TrrFile::tell_offset()
+{
+    return xdr_tell(handle);
+}
+
+void TrrFile::seek_frame(int fr)
+{
+    seek_offset(get_index().frame_offset(fr));
+}
+
+void TrrFile::seek_time(float t)
+{
+    seek_offset(get_index().time_offset(t));
+}
+
+void TrrFile::tell_current_frame_and_time(int &step, float &t)
+{
+    get_index().frame_and_time(xdr_tell(handle),step,t);
+}
+
+void TrrFile::tell_last_frame_and_time(int &step, float &t)
+{
+    get_index().last_frame_and_time(step,t);
 }
 
 void TrrFile::do_write(const Selection &sel, const FileContent &what)
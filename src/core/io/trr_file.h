@@ -30,33 +30,52 @@
 #pragma once
 
 #include "pteros/core/file_handler.h"
+#include "frame_index.h"
+#include "mapped_file.h"
 #include "xdrfile.h"
 #include "xdrfile_trr.h"
 
 namespace pteros {
 
 
-class TrrFile: public FileHandler {
+class TrrFile: public FileHandlerRandomAccess {
 public:
-    TrrFile(std::string& fname): FileHandler(fname), handle(nullptr) {}
+    TrrFile(std::string& fname): FileHandlerRandomAccess(fname), handle(nullptr), has_x(false), has_v(false), has_f(false) {}
     virtual void open(char open_mode);
     virtual ~TrrFile();
 
     virtual FileContent get_content_type() const {
         return FileContent()
-                .traj(true);
+                .traj(true).rand(true);
     }
 
+    virtual int skip_frames(int n) override;
+    virtual std::vector<int64_t> get_frame_offsets() override;
+    virtual void seek_offset(int64_t offset) override;
+    virtual int64_t tell_offset() override;
+
 protected:
 
     virtual void do_write(const Selection &sel, const FileContent& what);
     virtual bool do_read(System *sys, Frame *frame, const FileContent& what);
 
+    virtual void seek_frame(int fr) override;
+    virtual void seek_time(float t) override;
+    virtual void tell_current_frame_and_time(int& step, float& t) override;
+    virtual void tell_last_frame_and_time(int& step, float& t) override;
+
 private:
     // for xdrfile
     XDRFILE* handle;
     matrix box;
     int step;
+    // Content of frames
+    bool has_x, has_v, has_f;
+    // Mapped file for reading
+    MappedFile mapped;
+    // Built on first random access
+    FrameIndex index;
+    const FrameIndex& get_index();
 };
 
 }
@@ -34,6 +34,10 @@
 #include "pteros/core/file_handler.h"
 #include "molfile_plugin.h"
 
+/// Converts VMD unit cell (lengths in Angstroms, angles in degrees) to the box in nm
+void box_from_vmd_rep(float fa, float fb, float fc,
+                      float alpha, float beta, float gamma, Eigen::Matrix3f& box);
+
 namespace pteros {
 
 /// Generic API for reading and writing any molecule file formats
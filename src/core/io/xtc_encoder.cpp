@@ -0,0 +1,149 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "xtc_encoder.h"
+#include "xdrfile_xtc.h"
+#include "pteros/core/pteros_error.h"
+
+using namespace std;
+using namespace pteros;
+
+
+XtcJob::XtcJob(): step(0), time(0), done(false), ok(false)
+{
+    out = xdrfile_open_mem_write();
+    if(!out) throw PterosError("Unable to allocate XTC compression buffer");
+}
+
+XtcJob::~XtcJob()
+{
+    xdrfile_close(out);
+}
+
+
+bool XtcEncoder::supported()
+{
+    XDRFILE* f = xdrfile_open_mem_write();
+    if(!f) return false;
+    xdrfile_close(f);
+    return true;
+}
+
+XtcEncoder::XtcEncoder(XDRFILE *file, float prec, int nthreads):
+    file(file), prec(prec), stop(false)
+{
+    if(nthreads<1) nthreads = 1;
+    // Enough frames to keep all workers busy while the front one is written
+    max_in_flight = 2*nthreads;
+    for(int i=0; i<nthreads; ++i) workers.emplace_back(&XtcEncoder::worker,this);
+}
+
+XtcEncoder::~XtcEncoder()
+{
+    {
+        lock_guard<mutex> lock(mut);
+        stop = true;
+    }
+    cond_work.notify_all();
+    for(auto& w: workers) w.join();
+}
+
+XtcJob &XtcEncoder::next_job()
+{
+    write_completed(int(in_flight.size())>=max_in_flight);
+
+    if(free_jobs.empty()){
+        cur.reset(new XtcJob);
+    } else {
+        cur = std::move(free_jobs.back());
+        free_jobs.pop_back();
+    }
+    return *cur;
+}
+
+void XtcEncoder::submit()
+{
+    cur->done = false;
+    {
+        lock_guard<mutex> lock(mut);
+        pending.push_back(cur.get());
+        in_flight.push_back(std::move(cur));
+    }
+    cond_work.notify_one();
+}
+
+void XtcEncoder::flush()
+{
+    while(!in_flight.empty()) write_completed(true);
+}
+
+void XtcEncoder::worker()
+{
+    unique_lock<mutex> lock(mut);
+    while(true){
+        cond_work.wait(lock, [this]{ return stop || !pending.empty(); });
+        if(pending.empty()) return; // Stopped and nothing to do
+
+        XtcJob* job = pending.front();
+        pending.pop_front();
+        lock.unlock();
+
+        xdrfile_mem_clear(job->out);
+        bool ok = write_xtc(job->out, job->x.size()/3, job->step, job->time,
+                            job->box, (rvec*)job->x.data(), prec) == exdrOK;
+
+        lock.lock();
+        job->ok = ok;
+        job->done = true;
+        cond_done.notify_all();
+    }
+}
+
+void XtcEncoder::write_completed(bool wait_front)
+{
+    unique_lock<mutex> lock(mut);
+    if(wait_front && !in_flight.empty())
+        cond_done.wait(lock, [this]{ return in_flight.front()->done; });
+
+    while(!in_flight.empty() && in_flight.front()->done){
+        auto job = std::move(in_flight.front());
+        in_flight.pop_front();
+        // Only this thread touches completed jobs, so the file is written without the lock
+        lock.unlock();
+
+        long long size;
+        const char* data = xdrfile_mem_data(job->out,&size);
+        bool ok = job->ok && xdrfile_write_opaque(const_cast<char*>(data),size,file)==size;
+        int step = job->step;
+
+        lock.lock();
+        free_jobs.push_back(std::move(job));
+        if(!ok) throw PterosError("Unable to write XTC frame {}", step);
+    }
+}
@@ -0,0 +1,107 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "xdrfile.h"
+
+namespace pteros {
+
+/// Frame prepared for XTC compression
+struct XtcJob {
+    XtcJob();
+    ~XtcJob();
+
+    std::vector<float> x; // 3*natoms coordinates
+    matrix box;
+    int step;
+    float time;
+    // Compressed frame
+    XDRFILE* out;
+    bool done;
+    bool ok;
+};
+
+/**
+* Compresses XTC frames in worker threads and writes them to the file in order.
+* Caller fills the job returned by next_job() and passes it to submit().
+* Compression of submitted frames runs in parallel while completed frames
+* are written by the caller thread, so compression overlaps with file IO.
+* The number of frames in flight is bounded, so memory usage does not grow.
+*/
+class XtcEncoder {
+public:
+    XtcEncoder(XDRFILE* file, float prec, int nthreads);
+    ~XtcEncoder();
+
+    XtcEncoder(const XtcEncoder&) = delete;
+    XtcEncoder& operator=(const XtcEncoder&) = delete;
+
+    /// Returns false if in-memory compression is not available in this build of xdrfile
+    static bool supported();
+
+    /// Returns free job for the next frame. Completed frames are written meanwhile.
+    XtcJob& next_job();
+    /// Queues the job returned by next_job() for compression
+    void submit();
+    /// Waits for all queued frames and writes them
+    void flush();
+
+private:
+    XDRFILE* file;
+    float prec;
+    int max_in_flight;
+
+    std::vector<std::thread> workers;
+    std::mutex mut;
+    std::condition_variable cond_work, cond_done;
+    bool stop;
+
+    // Submitted jobs in the order of frames
+    std::deque<std::unique_ptr<XtcJob>> in_flight;
+    // Jobs waiting for a worker
+    std::deque<XtcJob*> pending;
+    // Recycled jobs
+    std::vector<std::unique_ptr<XtcJob>> free_jobs;
+    // Job returned by next_job()
+    std::unique_ptr<XtcJob> cur;
+
+    void worker();
+    // Writes completed jobs from the front of the queue, waits for front job if wait_front is set
+    void write_completed(bool wait_front);
+};
+
+}
@@ -33,54 +33,37 @@
 #include "pteros/core/pteros_error.h"
 #include "pteros/core/logging.h"
 #include "gromacs_utils.h"
+#include "xdr_seek.h"
+#include "pteros/core/thread_pool.h"
+#include <cstring>
 
 using namespace std;
 using namespace pteros;
 using namespace Eigen;
 
+// Upper limit of XTC compression threads. Each thread keeps two frames in flight,
+// so the limit bounds the memory used for large systems. Frames are written by
+// the calling thread only, so more compression threads do not make writing faster
+// once the caller is busy writing all the time.
+static const int max_encoder_threads = 4;
+
 
 void XtcFile::open(char open_mode)
 {
-    bool bOk;
-    handle = xdrfile_open(fname.c_str(),&open_mode);
+    // Map the file for reading if possible
+    if(open_mode=='r' && mapped.open(fname))
+        handle = xdrfile_open_mem(mapped.data(),mapped.size());
+    else
+        handle = xdrfile_open(fname.c_str(),&open_mode);
 
     if(!handle) throw PterosError("Unable to open XTC file {}", fname);
 
-    // Extract number of atoms
-    int ok = xdr_xtc_get_natoms(handle,&natoms);
-    if(!ok) throw PterosError("Can't read XTC number of atoms");
-
     if(open_mode=='r'){
-        // XTC file contains step number in terms of simulation steps, not saved frames
-        // So we have to extract conversion factor
-        int next = xtc_get_next_frame_number(handle,natoms);
-        int cur = xtc_get_current_frame_number(handle,natoms,&bOk);
-        if(cur<0 || next<0 || !bOk) throw PterosError("Can't detect number of steps per frame");
-        steps_per_frame = next-cur;
-
-        // Get total number of frames in the trajectory
-        num_frames = xdr_xtc_get_last_frame_number(handle,natoms,&bOk);
-
-        if(!bOk) throw PterosError("Can't get number of frames");
-        if(num_frames<0){
-            LOG()->warn("Weird XTC file: negative number of frames returned ({})!",num_frames);
-            LOG()->warn("Random access operations disabled on this trajectory.");
-            content.rand(false);
-        }
-        num_frames /= steps_per_frame;
-
-        // Get time step
-        dt = xdr_xtc_estimate_dt(handle,natoms,&bOk);
-        if(!bOk) throw PterosError("Can't get time step");
-
-        max_t = xdr_xtc_get_last_frame_time(handle,natoms,&bOk);
-        if(!bOk || max_t<0) throw PterosError("Can't get last frame time");
-
-        LOG()->debug("There are {} frames, max_t= {}, dt={}",num_frames,max_t,dt);
+        // Extract number of atoms
+        int ok = xdr_xtc_get_natoms(handle,&natoms);
+        if(!ok) throw PterosError("Can't read XTC number of atoms");
     }
 
-    if(!handle) throw PterosError("Unable to open XTC file {}", fname);
-
     // Prepare the box just in case
     init_gmx_box(box);
 
@@ -88,9 +71,34 @@ void XtcFile::open(char open_mode)
     step = (open_mode=='r') ? -1 : 0;
 }
 
+void XtcFile::close()
+{
+    // File is closed even if writing of queued frames fails
+    struct CloseGuard {
+        XtcFile* f;
+        ~CloseGuard(){
+            if(f->handle){
+                xdrfile_close(f->handle);
+                f->handle = nullptr;
+            }
+            f->mapped.close();
+        }
+    } guard{this};
+
+    if(encoder){
+        // Queued frames are written before closing
+        auto enc = std::move(encoder);
+        enc->flush();
+    }
+}
+
 XtcFile::~XtcFile()
 {
-    if(handle) xdrfile_close(handle);
+    try {
+        close();
+    } catch(const std::exception& e) {
+        LOG()->error(e.what());
+    }
 }
 
 bool XtcFile::do_read(System *sys, Frame *frame, const FileContent &what){
@@ -98,6 +106,7 @@ bool XtcFile::do_read(System *sys, Frame *frame, const FileContent &what){
     int ret;
 
     frame->coord.resize(natoms);
+    mapped.will_need(xdr_tell(handle));
     ret = read_xtc(handle,natoms,&step,&frame->time,box, (rvec*)frame->coord.data(), &prec);
     if(ret == exdrENDOFFILE) return false; // End of file
     if(ret != exdrOK){
@@ -115,52 +124,102 @@ bool XtcFile::do_read(System *sys, Frame *frame, const FileContent &what){
 }
 
 
+int XtcFile::skip_frames(int n)
+{
+    return xdr_xtc_skip_frames(handle,natoms,n);
+}
+
+const FrameIndex& XtcFile::get_index()
+{
+    if(!index.is_ready()){
+        int64_t pos = xdr_tell(handle);
+        xdr_seek(handle,0,SEEK_SET);
+        index.build(fname,
+                    [this](float& t){ return xdr_xtc_skip_frame(handle,natoms,&t)==exdrOK; },
+                    [this](){ return xdr_tell(handle); });
+        xdr_seek(handle,pos,SEEK_SET);
+    }
+    return index;
+}
+
+vector<int64_t> XtcFile::get_frame_offsets()
+{
+    return get_index().get_offsets();
+}
+
+void XtcFile::seek_offset(int64_t offset)
+{
+    if(xdr_seek(handle,offset,SEEK_SET)) throw PterosError("Error seeking to offset {}",offset);
+}
+
+int64_t XtcFile::tell_offset()
+{
+    return xdr_tell(handle);
+}
+
 void XtcFile::seek_frame(int fr)
 {
-    if(fr>=num_frames) throw PterosError("Can't seek to frame {}, there are {} frames in this file",fr,num_frames);
-    int ret = xdr_xtc_seek_frame(fr*steps_per_frame,handle,natoms);
-    if(ret<0) throw PterosError("Error seeking to frame {}",fr);
+    seek_offset(get_index().frame_offset(fr));
 }
 
 void XtcFile::seek_time(float t)
 {
-    if(t<0 || t>max_t) throw PterosError("Can't seek to time {}, last time is {}",t,max_t);
-    // We assume equally spaced frames in the trajectory. It's much faster
-    int ret = xdr_xtc_seek_frame(ceil(t/dt)*steps_per_frame,handle,natoms);
-    //int ret = xdr_xtc_seek_time(t,handle,natoms,false);
-    if(ret<0) throw PterosError("Can't seek to time {}",t);
+    seek_offset(get_index().time_offset(t));
 }
 
 void XtcFile::tell_current_frame_and_time(int &step, float &t)
 {
-    bool bOk;
-    int ret = xtc_get_current_frame_number(handle,natoms,&bOk);
-    if(!bOk || ret<0) throw PterosError("Can't get current frame number");
-    step = ret/steps_per_frame;
-    t = xtc_get_current_frame_time(handle,natoms,&bOk);
-    if(!bOk || t<0) throw PterosError("Can't get current frame time");
+    get_index().frame_and_time(xdr_tell(handle),step,t);
 }
 
 void XtcFile::tell_last_frame_and_time(int &step, float &t)
 {
-    step = num_frames;
-    t = max_t;
+    get_index().last_frame_and_time(step,t);
+}
+
+void XtcFile::set_precision(float prec)
+{
+    if(prec<=0) throw PterosError("XTC precision should be positive, not {}",prec);
+    if(encoder) throw PterosError("XTC precision should be set before writing");
+    precision = prec;
 }
 
 void XtcFile::do_write(const Selection &sel, const FileContent &what)
 {
-    // Set box
-    pteros_box_to_gmx(sel.box(),box);
     const Frame& fr = sel.get_system()->frame(sel.get_frame());
-    // We need local storage, not temporary, since we pass a pointer
-    auto matr = sel.get_xyz();
-    rvec* x = (rvec*)matr.data(); // Pointer to storage
-
-    int ret = write_xtc(handle,sel.size(),step,fr.time,box,x,1000);
-    if(ret!=exdrOK) throw PterosError("Unable to write XTC frame {}", step);
 
-    ++step;
-}
+    // Encoder is started on first frame, when precision is already set.
+    // Compression overlaps with writing even if there is only one core.
+    if(step==0 && XtcEncoder::supported()){
+        // Number of threads is limited by the pool settings (PTEROS_NUM_THREADS)
+        int nthreads = std::min(max_encoder_threads,ThreadPool::instance().get_num_threads());
+        encoder.reset(new XtcEncoder(handle,precision,std::max(1,nthreads)));
+    }
 
+    if(!encoder){
+        // Serial writing
+        pteros_box_to_gmx(fr.box,box);
+        auto matr = sel.get_xyz();
+        int ret = write_xtc(handle,sel.size(),step,fr.time,box,(rvec*)matr.data(),precision);
+        if(ret!=exdrOK) throw PterosError("Unable to write XTC frame {}", step);
+        ++step;
+        return;
+    }
 
+    XtcJob& job = encoder->next_job();
+    pteros_box_to_gmx(fr.box,job.box);
+    job.step = step;
+    job.time = fr.time;
+
+    // Gather coordinates by runs of consecutive atoms directly from the frame
+    job.x.resize(3*sel.size());
+    float* dest = job.x.data();
+    for(const auto& r: sel.get_index_runs()){
+        int n = r(1)-r(0)+1;
+        memcpy(dest, fr.coord[r(0)].data(), 3*n*sizeof(float));
+        dest += 3*n;
+    }
 
+    encoder->submit();
+    ++step;
+}
@@ -30,6 +30,10 @@
 #pragma once
 
 #include "pteros/core/file_handler.h"
+#include "frame_index.h"
+#include "mapped_file.h"
+#include "xtc_encoder.h"
+#include <memory>
 
 #include "xdrfile.h"
 #include "xdrfile_xtc.h"
@@ -39,14 +43,21 @@ namespace pteros {
 
 class XtcFile: public FileHandlerRandomAccess {
 public:
-    XtcFile(std::string& fname): FileHandlerRandomAccess(fname), handle(nullptr), content(FileContent().traj(true).rand(true)) {}
+    XtcFile(std::string& fname): FileHandlerRandomAccess(fname), handle(nullptr), precision(1000), content(FileContent().traj(true).rand(true)) {}
     virtual void open(char open_mode);
+    virtual void close() override;
     virtual ~XtcFile();
 
     virtual FileContent get_content_type() const {
         return content;
     }
 
+    virtual int skip_frames(int n) override;
+    virtual std::vector<int64_t> get_frame_offsets() override;
+    virtual void seek_offset(int64_t offset) override;
+    virtual int64_t tell_offset() override;
+    virtual void set_precision(float prec) override;
+
 protected:
 
     virtual void do_write(const Selection &sel, const FileContent& what) override;
@@ -62,10 +73,15 @@ private:
     XDRFILE* handle;
     matrix box;
     int step;
-    int steps_per_frame;
-    int64_t num_frames;
-    float dt, max_t;
+    float precision;
     FileContent content;
+    // Mapped file for reading
+    MappedFile mapped;
+    // Built on first random access
+    FrameIndex index;
+    const FrameIndex& get_index();
+    // Compresses frames in parallel when writing
+    std::unique_ptr<XtcEncoder> encoder;
 };
 
 }
@@ -31,13 +31,14 @@
 #include <algorithm>
 #include <set>
 #include <map>
-#include <regex>
+#include <utility>
 #include "pteros/core/atom.h"
 #include "pteros/core/selection.h"
 #include "pteros/core/system.h"
 #include "pteros/core/pteros_error.h"
 #include "pteros/core/distance_search.h"
 #include "selection_parser.h"
+#include "selection_cache.h"
 #include "pteros/core/file_handler.h"
 #include "pteros/core/utilities.h"
 
@@ -51,6 +52,8 @@
 #include <Eigen/Dense>
 
 #include "selection_macro.h"
+#include "index_runs.h"
+#include "topology_tables.h"
 #include "pteros/core/logging.h"
 
 // DSSP
@@ -63,23 +66,40 @@ using namespace Eigen;
 
 
 void Selection::allocate_parser(){
+    // Look for the same selection in the cache of the system
+    SelectionCache& cache = *system->sel_cache;
+    SelectionCache::Entry entry;
+    uint64_t rev;
+    if(cache.find(*system,sel_text,entry,rev)){
+        if(entry.parser){
+            parser = entry.parser;
+            apply();
+        } else {
+            parser.reset();
+            _index = entry.index;
+        }
+        return;
+    }
+
     // Parse selection here
     // Parser is heavy object, so if selection is not persistent
     // we will delete it after parsing is complete
-    parser.reset(new SelectionParser);
+    parser = std::make_shared<SelectionParser>();
     parser->create_ast(sel_text,system);
     parser->apply_ast(frame, _index);
     if(!parser->has_coord){
         parser.reset();
+        entry.index = _index;
+    } else {
+        entry.parser = parser;
     }
+    cache.add(*system,sel_text,rev,std::move(entry));
 }
 
 void Selection::sort_and_remove_duplicates()
 {
     if(_index.size()){
-        sort(_index.begin(),_index.end());
-        vector<int>::iterator it = unique(_index.begin(), _index.end());
-        _index.resize( it - _index.begin() );
+        index_sort_unique(_index);
         if(_index[0]<0) throw PterosError("Negative index {} present in Selection!",_index[0]);
     } else {
         LOG()->debug("Selection '{}' is empty! Any call of its methods (except size()) will crash your program!", sel_text);
@@ -93,11 +113,44 @@ Selection::Selection(){
     frame = 0;
 };
 
-void expand_macro(string& str){    
-    for(int i=0;i<selection_macro.size()/2;++i){
-        std::regex e(selection_macro[2*i]);
-        str = std::regex_replace(str,e,selection_macro[2*i+1]);
+// Replaces macro names by their definitions.
+// Only whole words outside of quoted regexes are expanded.
+void expand_macro(string& str){
+    string res;
+    res.reserve(str.size());
+
+    auto is_word_char = [](char c){ return isalnum((unsigned char)c) || c=='_'; };
+
+    size_t i = 0;
+    while(i<str.size()){
+        char c = str[i];
+        if(c=='\'' || c=='"'){
+            // Copy quoted regex as is
+            size_t e = str.find(c,i+1);
+            e = (e==string::npos) ? str.size() : e+1;
+            res.append(str,i,e-i);
+            i = e;
+        } else if(is_word_char(c)){
+            size_t e = i;
+            while(e<str.size() && is_word_char(str[e])) ++e;
+            string_view word(str.data()+i,e-i);
+            bool found = false;
+            for(size_t m=0;m<selection_macro.size()/2;++m){
+                if(word == selection_macro[2*m]){
+                    res += selection_macro[2*m+1];
+                    found = true;
+                    break;
+                }
+            }
+            if(!found) res.append(word);
+            i = e;
+        } else {
+            res += c;
+            ++i;
+        }
     }
+
+    str.swap(res);
 }
 
 // Main constructor
@@ -199,6 +252,7 @@ Selection::Selection(const System& sys,
     system = const_cast<System*>(&sys);
     // call callback
     callback(*system,frame,_index);
+    sort_and_remove_duplicates();
 }
 
 // Destructor
@@ -211,9 +265,9 @@ void Selection::append(const Selection &sel){
     if(!sel.system) throw PterosError("Can't append selection with undefined system!");
     if(sel.system!=system) throw PterosError("Can't append atoms from other system!");
 
-    copy(sel._index.begin(),sel._index.end(),back_inserter(_index));
-
-    sort_and_remove_duplicates();
+    vector<int> tmp;
+    index_union(_index,sel._index,tmp);
+    _index.swap(tmp);
 
     sel_text = "";
     parser.reset();
@@ -223,10 +277,8 @@ void Selection::append(int ind){
     if(!system) throw PterosError("Can't append to selection with undefined system!");
     if(ind<0 || ind>=system->num_atoms()) throw PterosError("Appended index is out of range!");
 
-    if(find(_index.begin(),_index.end(),ind)==_index.end()){
-        _index.push_back(ind);
-        sort(_index.begin(),_index.end());
-    }
+    auto it = lower_bound(_index.begin(),_index.end(),ind);
+    if(it==_index.end() || *it!=ind) _index.insert(it,ind);
 
     sel_text = "";
     parser.reset();
@@ -253,18 +305,16 @@ void Selection::append(const std::vector<Selection> &sel_vec)
 void Selection::remove(const Selection &sel)
 {
     vector<int> tmp;
-    set_difference(_index.begin(),_index.end(),
-                   sel.index_begin(),sel.index_end(),back_inserter(tmp));
-    _index = tmp;
+    index_difference(_index,sel._index,tmp);
+    _index.swap(tmp);
     sel_text = "";
     parser.reset();
 }
 
 void Selection::remove(int ind)
 {
-    vector<int> tmp;
-    remove_copy(_index.begin(),_index.end(),back_inserter(tmp),ind);
-    _index = tmp;
+    auto it = lower_bound(_index.begin(),_index.end(),ind);
+    if(it!=_index.end() && *it==ind) _index.erase(it);
     sel_text = "";
     parser.reset();
 }
@@ -273,24 +323,10 @@ void Selection::invert()
 {
     // Not textual
     sel_text = "";
-    auto old_ind = _index;
-    _index.clear();
-    _index.reserve(system->num_atoms()-old_ind.size()+1);
-    // Assign index
-    // We can speed up negation a bit by filling only the "gaps"
-    int n = old_ind.size();
-    int i,j;
-
-    if(n!=0){
-
-        for(j=0;j<old_ind[0];++j) _index.push_back(j); //Before first
-        for(i=1;i<n;++i)
-            for(j=old_ind[i-1]+1;j<old_ind[i];++j) _index.push_back(j); // between any two
-        for(j=old_ind[n-1]+1;j<system->num_atoms();++j) _index.push_back(j); // after last
-
-    } else {
-        for(j=0;j<system->num_atoms();++j) _index.push_back(j); //All
-    }
+    // Only the gaps between runs are filled
+    vector<int> tmp;
+    index_complement(_index,system->num_atoms(),tmp);
+    _index.swap(tmp);
 }
 
 void Selection::set_system(const System &sys){
@@ -499,10 +535,8 @@ Selection& Selection::operator=(const Selection& other){
     // Add to new parent
     system = other.system;
 
-    if(other.parser){
-        parser.reset(new SelectionParser);
-        *parser = *(other.parser);
-    };
+    // Parser is shared
+    parser = other.parser;
 
     return *this;
 }
@@ -525,20 +559,8 @@ Selection Selection::operator~() const {
     res.frame = frame;
     // Not textual
     res.sel_text = "";
-    // Assign index
-    // We can speed up negation a bit by filling only the "gaps"
-    int n = _index.size();
-    int i,j;
-    if(n!=0){
-        res._index.reserve(system->num_atoms()-n);
-        for(j=0;j<_index[0];++j) res._index.push_back(j); //Before first
-        for(i=1;i<n;++i)
-            for(j=_index[i-1]+1;j<_index[i];++j) res._index.push_back(j); // between any two
-        for(j=_index[n-1]+1;j<system->num_atoms();++j) res._index.push_back(j); // after last
-    } else {
-        res._index.resize(system->num_atoms());
-        for(j=0;j<system->num_atoms();++j) res._index[j] = j; //All
-    }
+    // Only the gaps between runs are filled
+    index_complement(_index,system->num_atoms(),res._index);
     return res;
 }
 
@@ -556,9 +578,7 @@ Selection operator|(const Selection &sel1, const Selection &sel2){
     // Set frame
     res.frame = sel1.frame;
     // Combine indexes
-    std::set_union(sel1._index.begin(),sel1._index.end(),
-                   sel2._index.begin(),sel2._index.end(),
-                   back_inserter(res._index));
+    index_union(sel1._index,sel2._index,res._index);
     return res;
 }
 
@@ -574,9 +594,7 @@ Selection operator&(const Selection &sel1, const Selection &sel2){
     // Set frame
     res.frame = sel1.frame;
     // Combine indexes
-    std::set_intersection(sel1._index.begin(),sel1._index.end(),
-                          sel2._index.begin(),sel2._index.end(),
-                          back_inserter(res._index));
+    index_intersection(sel1._index,sel2._index,res._index);
     return res;
 }
 
@@ -595,9 +613,7 @@ Selection operator-(const Selection &sel1, const Selection &sel2)
     res.sel_text = "";
     res.parser.reset();
     res.frame = sel1.frame;
-    std::set_difference(sel1._index.begin(),sel1._index.end(),
-                        sel2._index.begin(),sel2._index.end(),
-                        back_inserter(res._index));
+    index_difference(sel1._index,sel2._index,res._index);
     return res;
 }
 
@@ -639,12 +655,8 @@ Selection::Selection(const Selection& other){
     // Add to new parent
     system = other.system;
 
-    // If parser in sel is persistent, allocate it
-    if(other.parser){
-        //parser.reset(new Selection_parser);
-        //*parser = *(other.parser);
-        update(); // Needed to update internal references in parse AST
-    }
+    // Parser is shared, no need to parse selection again
+    parser = other.parser;
 }
 
 // Update selection (re-parse selection text if it exists)
@@ -655,11 +667,20 @@ void Selection::update(){
 // Re-apply AST tree for coordinate-dependent selections
 void Selection::apply(){
     if(parser){
-        // If parser is persistent, do quick eval using ast tree
+        // Parser keeps evaluation state, so shared parser is copied first
+        if(parser.use_count()>1) parser = std::make_shared<SelectionParser>(*parser);
+        // If parser is persistent, do quick eval using compiled program
         parser->apply_ast(frame, _index);
     }
 }
 
+void Selection::set_within_skin(float skin){
+    if(parser){
+        if(parser.use_count()>1) parser = std::make_shared<SelectionParser>(*parser);
+        parser->set_within_skin(skin);
+    }
+}
+
 void Selection::set_frame(int fr){
     if(fr<0 || fr >= system->num_frames())
         throw PterosError("Invalid frame {} to set! Valid range is 0:", fr, system->num_frames());
@@ -691,7 +712,7 @@ vector<T> Selection::get_##prop() const { \
     int i,n; \
     n = _index.size(); \
     tmp.resize(n); \
-    for(i=0; i<n; ++i) tmp[i] = system->atoms[_index[i]].prop; \
+    for(i=0; i<n; ++i) tmp[i] = csys()->atoms[_index[i]].prop; \
     return tmp; \
 } \
 
@@ -702,7 +723,7 @@ vector<T> Selection::get_##prop(bool unique) const { \
     int i,n; \
     n = _index.size(); \
     tmp.resize(n); \
-    for(i=0; i<n; ++i) tmp[i] = system->atoms[_index[i]].prop; \
+    for(i=0; i<n; ++i) tmp[i] = csys()->atoms[_index[i]].prop; \
     if(unique){ \
         vector<T> res; \
         sort(tmp.begin(),tmp.end()); \
@@ -717,13 +738,17 @@ vector<T> Selection::get_##prop(bool unique) const { \
 void Selection::set_##prop(const vector<T>& data){ \
     int i,n; \
     n = _index.size(); \
-    if(data.size()!=n) throw PterosError("Invalid data size {} for selection of size {}", data.size(),n); \
-    for(i=0; i<n; ++i) system->atoms[_index[i]].prop = data[i]; \
+    if(int(data.size())!=n) throw PterosError("Invalid data size {} for selection of size {}", data.size(),n); \
+    System::TopologyChange change(*system); \
+    vector<Atom>& at = system->atoms.detached(); \
+    for(i=0; i<n; ++i) at[_index[i]].prop = data[i]; \
 } \
 void Selection::set_##prop(T data){ \
     int i,n; \
     n = _index.size(); \
-    for(i=0; i<n; ++i) system->atoms[_index[i]].prop = data; \
+    System::TopologyChange change(*system); \
+    vector<Atom>& at = system->atoms.detached(); \
+    for(i=0; i<n; ++i) at[_index[i]].prop = data; \
 }
 
 
@@ -859,7 +884,7 @@ void Selection::set_force(pteros::MatrixXf_const_ref data){
 
 float Selection::get_total_charge() const {
     float q = 0.0;
-    for(int i=0; i<size(); ++i) q += system->atoms[_index[i]].charge;
+    for(int i=0; i<size(); ++i) q += csys()->atoms[_index[i]].charge;
     return q;
 }
 
@@ -907,6 +932,90 @@ void Selection::process_pbc_atom(int& a) const {
 }
 
 
+//------------------------------------------------------------------------
+// Kernels for spans of consecutive atoms.
+// Packed coordinates of 8 atoms (24 floats) are processed at once,
+// so x,y,z always stay at the same positions in the accumulators
+// and the loops are vectorized without gathering by index.
+//------------------------------------------------------------------------
+namespace {
+
+typedef Array<float,24,1> Block8;
+
+// Max number of atoms in one span
+const int span_size = 4096;
+
+// Sum of n packed coordinates
+Vector3f coord_sum(const float* p, int n){
+    int nb = n/8;
+    Block8 acc(Block8::Zero());
+    for(int k=0; k<nb; ++k) acc += Map<const Block8>(p+24*k);
+    Vector3f res = Map<const Matrix<float,3,8>>(acc.data()).rowwise().sum();
+    for(int i=nb*8; i<n; ++i) res += Map<const Vector3f>(p+3*i);
+    return res;
+}
+
+// Sum of squared distances between n packed coordinates
+float coord_sqdist(const float* p1, const float* p2, int n){
+    int nb = n/8;
+    Block8 acc(Block8::Zero());
+    for(int k=0; k<nb; ++k) acc += (Map<const Block8>(p1+24*k)-Map<const Block8>(p2+24*k)).square();
+    float res = acc.sum();
+    for(int i=nb*8; i<n; ++i) res += (Map<const Vector3f>(p1+3*i)-Map<const Vector3f>(p2+3*i)).squaredNorm();
+    return res;
+}
+
+// Updates min and max with n packed coordinates
+void coord_minmax(const float* p, int n, Vector3f_ref min, Vector3f_ref max){
+    int nb = n/8;
+    Block8 bmin(Block8::Constant(1e10)), bmax(Block8::Constant(-1e10));
+    for(int k=0; k<nb; ++k){
+        bmin = bmin.min(Map<const Block8>(p+24*k));
+        bmax = bmax.max(Map<const Block8>(p+24*k));
+    }
+    min = min.cwiseMin(Map<const Matrix<float,3,8>>(bmin.data()).rowwise().minCoeff());
+    max = max.cwiseMax(Map<const Matrix<float,3,8>>(bmax.data()).rowwise().maxCoeff());
+    for(int i=nb*8; i<n; ++i){
+        min = min.cwiseMin(Map<const Vector3f>(p+3*i));
+        max = max.cwiseMax(Map<const Vector3f>(p+3*i));
+    }
+}
+
+// Adds v to n packed coordinates
+void coord_translate(float* p, int n, Vector3f_const_ref v){
+    int nb = n/8;
+    Block8 vv;
+    for(int j=0; j<8; ++j) vv.segment<3>(3*j) = v;
+    for(int k=0; k<nb; ++k) Map<Block8>(p+24*k) += vv;
+    for(int i=nb*8; i<n; ++i) Map<Vector3f>(p+3*i) += v;
+}
+
+// Cuts the range of atoms into spans {first,size}
+void add_spans(int first, int n, vector<Vector2i>& spans){
+    for(int i=0; i<n; i+=span_size) spans.emplace_back(first+i,std::min(span_size,n-i));
+}
+
+} // namespace
+
+
+vector<Vector2i> Selection::get_index_runs() const
+{
+    vector<Vector2i> runs;
+    index_to_runs(_index,runs);
+    return runs;
+}
+
+bool Selection::get_spans(std::vector<Vector2i> &spans) const
+{
+    spans.clear();
+    // Runs should be at least 8 atoms long on average
+    vector<Vector2i> runs;
+    if(_index.empty() || !index_to_runs(_index,runs,_index.size()/8)) return false;
+    for(auto& r: runs) add_spans(r(0),r(1)-r(0)+1,spans);
+    return true;
+}
+
+
 // Center of geometry
 Vector3f Selection::center(bool mass_weighted, Array3i_const_ref pbc, int pbc_atom) const {    
     int n = size();
@@ -942,11 +1051,19 @@ Vector3f Selection::center(bool mass_weighted, Array3i_const_ref pbc, int pbc_at
             if(M==0) throw PterosError("Selection has zero mass! Center of mass failed!");
             return res/M;
         } else {
+            vector<Vector2i> spans;
+            bool use_spans = get_spans(spans);
+            const auto& coord = system->traj[frame].coord;
             #pragma omp parallel
             {
                 Vector3f r(Vector3f::Zero()); // local to omp thread
-                #pragma omp for nowait
-                for(i=0; i<n; ++i) r += xyz(i);
+                if(use_spans){
+                    #pragma omp for nowait
+                    for(i=0; i<int(spans.size()); ++i) r += coord_sum(coord[spans[i](0)].data(),spans[i](1));
+                } else {
+                    #pragma omp for nowait
+                    for(i=0; i<n; ++i) r += xyz(i);
+                }
                 #pragma omp critical
                 {
                     res += r;
@@ -1059,6 +1176,13 @@ Vector3f Selection::center(const std::vector<float> &weights, Array3i_const_ref
 // Plain translation
 void Selection::translate(Vector3f_const_ref v){
     int i,n = _index.size();
+    vector<Vector2i> spans;
+    if(get_spans(spans)){
+        auto& coord = system->traj[frame].coord;
+        #pragma omp parallel for
+        for(i=0; i<int(spans.size()); ++i) coord_translate(coord[spans[i](0)].data(),spans[i](1),v);
+        return;
+    }
     #pragma omp parallel for
     for(i=0; i<n; ++i) xyz(i) += v;
 }
@@ -1087,6 +1211,16 @@ float Selection::rmsd(int fr1, int fr2) const{
        fr2<0 || fr2>=system->num_frames())
         throw PterosError("RMSD requested for frames {}:{} while the valid range is 0:{}", fr1,fr2,system->num_frames()-1);
 
+    vector<Vector2i> spans;
+    if(get_spans(spans)){
+        const auto& coord1 = system->traj[fr1].coord;
+        const auto& coord2 = system->traj[fr2].coord;
+        #pragma omp parallel for reduction(+:res)
+        for(int i=0; i<int(spans.size()); ++i)
+            res += coord_sqdist(coord1[spans[i](0)].data(),coord2[spans[i](0)].data(),spans[i](1));
+        return sqrt(res/n);
+    }
+
     #pragma omp parallel for reduction(+:res)
     for(int i=0; i<n; ++i)
         res += (xyz(i,fr1)-xyz(i,fr2)).squaredNorm();
@@ -1105,6 +1239,19 @@ float Selection::rmsd(int fr) const {
 // Apply transformation
 void Selection::apply_transform(const Affine3f &t){
     int n = size();    
+    vector<Vector2i> spans;
+    if(get_spans(spans)){
+        // No indirection through index
+        Matrix3f m = t.linear();
+        Vector3f v = t.translation();
+        auto& coord = system->traj[frame].coord;
+        #pragma omp parallel for
+        for(int k=0; k<int(spans.size()); ++k){
+            Vector3f* p = &coord[spans[k](0)];
+            for(int i=0; i<spans[k](1); ++i) p[i] = m*p[i]+v;
+        }
+        return;
+    }
     #pragma omp parallel for
     for(int i=0; i<n; ++i){        
         xyz(i) = t * xyz(i);
@@ -1148,7 +1295,7 @@ Vector2f non_bond_energy(const Selection& sel1,
 
     float d;
     if(cutoff==0){
-        d = sel1.get_system()->get_force_field().get_cutoff();
+        d = std::as_const(*sel1.get_system()).get_force_field().get_cutoff();
     } else {
         d = cutoff;
     }
@@ -1179,6 +1326,17 @@ float rmsd(const Selection& sel1, int fr1, const Selection& sel2, int fr2){
         throw PterosError("RMSD requested for frames {}:{} while the valid range is {}:{}",
                           fr1,fr2,sel1.system->num_frames()-1,sel2.system->num_frames()-1);
 
+    if(n1>0 && sel1.is_contiguous() && sel2.is_contiguous()){
+        // Both are single runs, which are cut to the spans of local indexes
+        const float* p1 = sel1.xyz_ptr(0,fr1)->data();
+        const float* p2 = sel2.xyz_ptr(0,fr2)->data();
+        vector<Vector2i> spans;
+        add_spans(0,n1,spans);
+        #pragma omp parallel for reduction(+:res)
+        for(int i=0; i<int(spans.size()); ++i)
+            res += coord_sqdist(p1+3*spans[i](0),p2+3*spans[i](0),spans[i](1));
+        return sqrt(res/n1);
+    }
 
     #pragma omp parallel for reduction(+:res)
     for(int i=0; i<n1; ++i)
@@ -1224,12 +1382,20 @@ Affine3f fit_transform(const Selection& sel1, const Selection& sel2){
 
     //Calculate the matrix U
     u.fill(0.0);
+    // Contiguous coordinates are accessed without indirection through index
+    const Vector3f* c1 = sel1.is_contiguous() ? sel1.xyz_ptr(0) : nullptr;
+    const Vector3f* c2 = sel2.is_contiguous() ? sel2.xyz_ptr(0) : nullptr;
     #pragma omp parallel
     {
         Matrix3f _u(Matrix3f::Zero());
-        #pragma omp for nowait
-        for(i=0;i<N;++i) // Over atoms in selection
-            _u += sel1.xyz(i)*sel2.xyz(i).transpose()*sel1.mass(i);
+        if(c1 && c2){
+            #pragma omp for nowait
+            for(i=0;i<N;++i) _u += c1[i]*c2[i].transpose()*sel1.mass(i);
+        } else {
+            #pragma omp for nowait
+            for(i=0;i<N;++i) // Over atoms in selection
+                _u += sel1.xyz(i)*sel2.xyz(i).transpose()*sel1.mass(i);
+        }
         #pragma omp critical
         {
             u += _u;
@@ -1298,7 +1464,7 @@ Vector2f Selection::non_bond_energy(float cutoff, bool pbc) const
 {
     float d;
     if(cutoff==0){
-        d = system->get_force_field().get_cutoff();
+        d = csys()->get_force_field().get_cutoff();
     } else {
         d = cutoff;
     }
@@ -1361,17 +1527,35 @@ void Selection::fit(int fr1, int fr2){
 }
 
 void Selection::minmax(Vector3f_ref min, Vector3f_ref max) const {
-    int i,n,j;
-    Vector3f* p;
+    int i,n;
     n = _index.size();
 
+    vector<Vector2i> spans;
+    if(get_spans(spans)){
+        const auto& coord = system->traj[frame].coord;
+        min.fill(1e10);
+        max.fill(-1e10);
+        #pragma omp parallel
+        {
+            Vector3f lmin(min), lmax(max); // local to omp thread
+            #pragma omp for nowait
+            for(i=0; i<int(spans.size()); ++i) coord_minmax(coord[spans[i](0)].data(),spans[i](1),lmin,lmax);
+            #pragma omp critical
+            {
+                min = min.cwiseMin(lmin);
+                max = max.cwiseMax(lmax);
+            }
+        }
+        return;
+    }
+
     float x_min, y_min, z_min, x_max, y_max, z_max;
     x_min = y_min = z_min = 1e10;
     x_max = y_max = z_max = -1e10;
 
     #pragma omp parallel for reduction(min:x_min,y_min,z_min) reduction(max:x_max,y_max,z_max)
     for(i=0; i<n; ++i){
-        p = xyz_ptr(i);
+        const Vector3f* p = xyz_ptr(i);
         if((*p)(0)<x_min) x_min = (*p)(0);
         if((*p)(0)>x_max) x_max = (*p)(0);
         if((*p)(1)<y_min) y_min = (*p)(1);
@@ -1394,7 +1578,7 @@ void Selection::minmax(Vector3f_ref min, Vector3f_ref max) const {
 // IO functions
 //###############################################
 
-void Selection::write(string fname, int b, int e) const {
+void Selection::write(string fname, int b, int e, float prec) const {
     // -1 has special meaning
     if(b==-1) b=get_frame(); // current frame
     if(e==-1) e=system->num_frames()-1; // last frame
@@ -1406,6 +1590,7 @@ void Selection::write(string fname, int b, int e) const {
     if(e<b) throw PterosError("Last frame {} before first one {} for writing!",e,b);
 
     auto f = FileHandler::open(fname,'w');
+    if(prec>0) f->set_precision(prec);
 
     if(!(f->get_content_type().traj()) && e!=b){
         throw PterosError("Can't write the range of frames to structure file!");
@@ -1420,6 +1605,8 @@ void Selection::write(string fname, int b, int e) const {
         f->write(*this,f->get_content_type());
     }
     const_cast<Selection*>(this)->set_frame(cur_fr);
+    // Report errors of buffered writing
+    f->close();
 }
 
 void Selection::write(const std::unique_ptr<FileHandler> &handler, FileContent what, int b, int e) const
@@ -1531,27 +1718,32 @@ std::vector<std::vector<int>> Selection::get_internal_bonds(float d, bool period
 void Selection::each_residue(std::vector<Selection>& sel) const {            
     sel.clear();
 
-    // Resindexes are contigous, so for each atom we search forward and backward to find
-    // all atoms of enclosing residue.
+    auto tab = csys()->topology_tables();
 
-    // Set of residues, which are already searched
-    set<int> used;
+    // Residues of selected atoms in the order of appearance
+    vector<int> res;
+    for(int i: _index){
+        int r = tab->atom_residue[i];
+        if(res.empty() || r!=res.back()) res.push_back(r);
+    }
 
-    int b,e; // Begin and end of current residue
-    int ind;
-    for(int i=0; i<size(); ++i){
-        // Skip used
-        ind = resindex(i);
-        if(used.count(ind)) continue;
-        // Starting global index
-        b = e = index(i);
-        // Go backward
-        while( b-1>=0 && system->atoms[b-1].resindex == ind){ --b; };
-        // Go forward
-        while( e+1<system->atoms.size() && system->atoms[e+1].resindex == ind){ ++e; };
-        sel.emplace_back(*system,b,e);
-        // Mark as used
-        used.insert(ind);
+    // Residue may appear twice only if its atoms are not contiguous
+    // or resindexes are not ordered, which is rare
+    if(adjacent_find(res.begin(),res.end(),greater_equal<int>())!=res.end()){
+        vector<char> used(tab->num_residues(),0);
+        int k = 0;
+        for(int r: res) if(!used[r]){ used[r] = 1; res[k++] = r; }
+        res.resize(k);
+    }
+
+    for(int r: res){
+        if(tab->residue_contiguous(r)){
+            sel.emplace_back(*system,tab->residue_first(r),tab->residue_last(r));
+        } else {
+            vector<int> ind(tab->residue_atoms.begin()+tab->residue_begin[r],
+                            tab->residue_atoms.begin()+tab->residue_begin[r+1]);
+            sel.emplace_back(*system,ind);
+        }
     }
 }
 
@@ -1692,43 +1884,45 @@ void Selection::split_by_connectivity(float d, std::vector<Selection> &res, bool
 }
 
 
+namespace {
+
+// Splits sorted index into parts with the same group, groups<0 are skipped.
+// Parts are ordered by group.
+void split_by_group(const System& sys, const vector<int>& index, const vector<int>& group, vector<Selection>& res){
+    vector<pair<int,int>> ga; // group, atom
+    ga.reserve(index.size());
+    for(int i: index) if(group[i]>=0) ga.emplace_back(group[i],i);
+    // Groups are ordered already unless they are not contiguous
+    if(!is_sorted(ga.begin(),ga.end())) sort(ga.begin(),ga.end());
+
+    vector<int> part;
+    for(size_t b=0; b<ga.size();){
+        part.clear();
+        size_t e = b;
+        while(e<ga.size() && ga[e].first==ga[b].first) part.push_back(ga[e++].second);
+        if(part.back()-part.front()+1 == int(part.size()))
+            res.emplace_back(sys,part.front(),part.back());
+        else
+            res.emplace_back(sys,part);
+        b = e;
+    }
+}
+
+}
+
 void Selection::split_by_residue(std::vector<Selection> &res)
 {
     // We split selection into several by resindex
     res.clear();
-    // Map of resindexes to indexs in selections
-    map<int,vector<int> > m;
-    for(int i=0; i<size(); ++i){
-        m[resindex(i)].push_back(index(i));
-    }
-    // Create selections
-    map<int,vector<int> >::iterator it;
-    for(it=m.begin();it!=m.end();it++){
-        res.emplace_back(*system, it->second.begin(), it->second.end());
-    }
+    split_by_group(*system,_index,csys()->topology_tables()->atom_residue,res);
 }
 
 void Selection::split_by_molecule(std::vector<Selection> &res)
 {
-    if(!system->force_field.ready) throw PterosError("Can't split by molecule: no topology!");
+    if(!csys()->force_field->ready) throw PterosError("Can't split by molecule: no topology!");
 
-    map<int,vector<int>> m;
-    int bmol = 0;
-    for(int i=0;i<size();++i){
-        // Find molecule for this atom
-        for(int j=bmol; j<system->force_field.molecules.size(); ++j){
-            if(_index[i]>=system->force_field.molecules[j](0) && _index[i]<=system->force_field.molecules[j](1)){
-                bmol=j;
-                m[j].push_back(_index[i]);
-            }
-        }
-    }
-
-    // Create selections
-    map<int,vector<int> >::iterator it;
-    for(it=m.begin();it!=m.end();it++){
-        res.emplace_back(*system, it->second.begin(), it->second.end());
-    }
+    res.clear();
+    split_by_group(*system,_index,csys()->topology_tables()->atom_molecule,res);
 }
 
 void Selection::split_by_chain(std::vector<Selection> &chains)
@@ -1738,7 +1932,7 @@ void Selection::split_by_chain(std::vector<Selection> &chains)
     // Map of resindexes to indexs in selections
     map<char,vector<int> > m;
     for(int i=0; i<size(); ++i){
-        m[chain(i)].push_back(index(i));
+        m[csys()->atoms[_index[i]].chain].push_back(index(i));
     }
     // Create selections
     map<char,vector<int> >::iterator it;
@@ -1765,9 +1959,10 @@ void Selection::split_by_contiguous_residue(std::vector<Selection> &parts)
 {
     parts.clear();
     // Start first contiguous part
+    const Selection& sel = *this; // Read-only access to atoms
     int b = 0, i = 0;
     while(i<size()){
-        while(i+1<size() && (resindex(i+1)==resindex(i)+1 || resindex(i+1)==resindex(i)) ) ++i;
+        while(i+1<size() && (sel.resindex(i+1)==sel.resindex(i)+1 || sel.resindex(i+1)==sel.resindex(i)) ) ++i;
         // Part finished
         parts.emplace_back(*system,_index[b],_index[i]);
         b = i+1;
@@ -2174,8 +2369,8 @@ float Selection::sasa(float probe_r, vector<float> *area_per_atom, int n_sphere_
 
 
 void Selection::get_local_bonds_from_topology(vector<vector<int>>& con) const {
-    if(!system->force_field.ready) throw PterosError("No topology!");
-    if(system->force_field.bonds.size()==0) throw PterosError("No bonds in topology!");
+    if(!csys()->force_field->ready) throw PterosError("No topology!");
+    if(csys()->force_field->bonds.size()==0) throw PterosError("No bonds in topology!");
 
     con.clear();
     con.resize(size());
@@ -2186,9 +2381,9 @@ void Selection::get_local_bonds_from_topology(vector<vector<int>>& con) const {
     auto bit = std::begin(_index);    
     auto eit = std::end(_index);
 
-    for(int i=0;i<system->force_field.bonds.size();++i){
-        a1 = system->force_field.bonds[i](0);
-        a2 = system->force_field.bonds[i](1);
+    for(int i=0;i<int(csys()->force_field->bonds.size());++i){
+        a1 = csys()->force_field->bonds[i](0);
+        a2 = csys()->force_field->bonds[i](1);
         if(a1>=bind && a1<=eind && a2>=bind && a2<=eind){
             auto it1 = std::find(bit,eit,a1);
             auto it2 = std::find(it1,eit,a2);
@@ -0,0 +1,107 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "selection_cache.h"
+#include "selection_parser.h"
+#include "pteros/core/system.h"
+
+using namespace std;
+using namespace pteros;
+
+// Limits of the cache size
+static const size_t max_entries = 256;
+static const size_t max_stored = 1<<22;
+
+bool SelectionCache::find(System &sys, const string &text, Entry &entry, uint64_t &rev)
+{
+    lock_guard<mutex> lock(mut);
+    check_revision(sys);
+    rev = revision;
+    // Atoms could be modified through references
+    if(rev==0) return false;
+    auto it = entries.find(normalize(text));
+    if(it==entries.end()) return false;
+    entry = it->second;
+    return true;
+}
+
+void SelectionCache::add(System &sys, const string &text, uint64_t rev, Entry entry)
+{
+    lock_guard<mutex> lock(mut);
+    check_revision(sys);
+    // System was modified while selection was evaluated
+    if(rev==0 || rev!=revision) return;
+
+    if(entries.size()>=max_entries || stored+entry.index.size()>max_stored){
+        entries.clear();
+        stored = 0;
+    }
+    stored += entry.index.size();
+    entries[normalize(text)] = std::move(entry);
+}
+
+void SelectionCache::clear()
+{
+    lock_guard<mutex> lock(mut);
+    entries.clear();
+    stored = 0;
+}
+
+void SelectionCache::check_revision(System &sys)
+{
+    uint64_t rev = sys.topology_revision();
+    if(rev!=revision){
+        revision = rev;
+        entries.clear();
+        stored = 0;
+    }
+}
+
+// Whitespace outside of quotes is collapsed
+string SelectionCache::normalize(const string &text)
+{
+    string res;
+    res.reserve(text.size());
+    char quote = 0;
+    for(char c: text){
+        if(quote){
+            if(c==quote) quote = 0;
+            res += c;
+        } else if(c=='\'' || c=='"'){
+            quote = c;
+            res += c;
+        } else if(isspace((unsigned char)c)){
+            if(!res.empty() && res.back()!=' ') res += ' ';
+        } else {
+            res += c;
+        }
+    }
+    if(!res.empty() && res.back()==' ') res.pop_back();
+    return res;
+}
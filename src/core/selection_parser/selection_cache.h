@@ -0,0 +1,84 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+namespace pteros {
+
+class System;
+class SelectionParser;
+
+/**
+*   Cache of text selections of the System.
+*   Coordinate-independent selections are stored as resulting indexes,
+*   coordinate-dependent ones as compiled parsers, which are shared
+*   by all selections with the same text.
+*   All entries are dropped when atoms or force field of the system are modified.
+*   Nothing is cached while mutable references to atoms or force field could be alive.
+*   Subselections are not cached since they depend on the parent.
+*/
+class SelectionCache {
+public:
+    struct Entry {
+        std::vector<int> index;
+        std::shared_ptr<SelectionParser> parser;
+    };
+
+    SelectionCache(): revision(0), stored(0) {}
+
+    /// Looks for the entry with given selection text.
+    /// Current revision of the system is returned in rev and should be passed to add().
+    bool find(System& sys, const std::string& text, Entry& entry, uint64_t& rev);
+
+    /// Adds entry if the system was not modified since the call to find()
+    void add(System& sys, const std::string& text, uint64_t rev, Entry entry);
+
+    /// Removes all entries
+    void clear();
+
+private:
+    std::mutex mut;
+    // Revision of atoms and force field
+    uint64_t revision;
+    std::unordered_map<std::string,Entry> entries;
+    // Total size of stored indexes
+    size_t stored;
+
+    void check_revision(System& sys);
+    static std::string normalize(const std::string& text);
+};
+
+}
@@ -28,15 +28,17 @@
 
 
 #include "selection_parser.h"
+#include "../topology_tables.h"
 #include "pteros/core/system.h"
 #include "pteros/core/selection.h"
 #include "pteros/core/logging.h"
 #include "pteros/core/pteros_error.h"
 #include "pteros/core/distance_search.h"
 #include <Eigen/Core>
-#include <unordered_set>
-#include <regex>
-#include <list>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstring>
 
 using namespace std;
 using namespace pteros;
@@ -148,6 +150,185 @@ Pteros_PEG_parser _parser(R"(
 //===============================================
 
 
+//===============================================
+// Atom masks
+
+void AtomMask::set_range(int b, int e){
+    if(b>e) return;
+    int wb = b>>6;
+    int we = e>>6;
+    uint64_t mb = ~uint64_t(0) << (b&63);
+    uint64_t me = ~uint64_t(0) >> (63-(e&63));
+    if(wb==we){
+        words[wb] |= mb & me;
+        return;
+    }
+    words[wb] |= mb;
+    for(int w=wb+1;w<we;++w) words[w] = ~uint64_t(0);
+    words[we] |= me;
+}
+
+bool AtomMask::any_in_range(int b, int e) const {
+    if(b>e) return false;
+    int wb = b>>6;
+    int we = e>>6;
+    uint64_t mb = ~uint64_t(0) << (b&63);
+    uint64_t me = ~uint64_t(0) >> (63-(e&63));
+    if(wb==we) return words[wb] & mb & me;
+    if(words[wb] & mb) return true;
+    for(int w=wb+1;w<we;++w) if(words[w]) return true;
+    return words[we] & me;
+}
+
+void AtomMask::from_index(const std::vector<int>& ind, int n){
+    reset(n);
+    for(int i: ind) set(i);
+}
+
+void AtomMask::to_index(std::vector<int>& ind) const {
+    ind.clear();
+    for(size_t w=0;w<words.size();++w){
+        uint64_t bits = words[w];
+        while(bits){
+            ind.push_back(w*64+__builtin_ctzll(bits));
+            bits &= bits-1;
+        }
+    }
+}
+
+//===============================================
+// Patterns
+
+StrPattern::StrPattern(const std::string &pattern){
+    use_regex = !parse(pattern);
+    if(use_regex) regex = std::regex(pattern);
+}
+
+// Translates the pattern into the sequence of character sets with repetition counts.
+// Returns false if pattern contains anything else.
+bool StrPattern::parse(const std::string &p){
+    // Adds escaped character or class. Negated classes are built separately
+    // since the set could already contain other characters of [...]
+    auto add_escaped = [](char c, std::bitset<256>& res){
+        std::bitset<256> set;
+        switch(c){
+        case 'd': case 'D':
+            for(int ch='0';ch<='9';++ch) set.set(ch);
+            break;
+        case 'w': case 'W':
+            for(int ch='0';ch<='9';++ch) set.set(ch);
+            for(int ch='a';ch<='z';++ch) set.set(ch);
+            for(int ch='A';ch<='Z';++ch) set.set(ch);
+            set.set('_');
+            break;
+        case 's': case 'S':
+            for(char ch: std::string(" \t\n\r\f\v")) set.set((unsigned char)ch);
+            break;
+        default:
+            if(isalnum((unsigned char)c)) return false; // Unknown escape
+            res.set((unsigned char)c);
+            return true;
+        }
+        if(isupper((unsigned char)c)) set.flip();
+        res |= set;
+        return true;
+    };
+
+    int n = p.size();
+    int i = 0;
+    while(i<n){
+        Item it;
+        it.min_rep = it.max_rep = 1;
+        char c = p[i];
+
+        if(c == '.'){
+            it.chars.set();
+            it.chars.reset('\n');
+            ++i;
+        } else if(c == '\\'){
+            if(i+1>=n || !add_escaped(p[i+1],it.chars)) return false;
+            i += 2;
+        } else if(c == '['){
+            ++i;
+            bool negate = false;
+            if(i<n && p[i]=='^'){
+                negate = true;
+                ++i;
+            }
+            while(i<n && p[i]!=']'){
+                if(p[i]=='\\'){
+                    if(i+1>=n || !add_escaped(p[i+1],it.chars)) return false;
+                    i += 2;
+                } else if(p[i]=='[') {
+                    return false; // Named classes
+                } else if(i+2<n && p[i+1]=='-' && p[i+2]!=']'){
+                    for(int ch=(unsigned char)p[i]; ch<=(unsigned char)p[i+2]; ++ch) it.chars.set(ch);
+                    i += 3;
+                } else {
+                    it.chars.set((unsigned char)p[i]);
+                    ++i;
+                }
+            }
+            if(i>=n) return false; // No closing bracket
+            ++i;
+            if(negate) it.chars.flip();
+        } else if(c == '^' && i == 0){
+            // Whole string is always matched
+            ++i;
+            continue;
+        } else if(c == '$' && i == n-1){
+            ++i;
+            continue;
+        } else if(strchr("()|{}*+?^$",c)){
+            return false;
+        } else {
+            it.chars.set((unsigned char)c);
+            ++i;
+        }
+
+        // Quantifier
+        if(i<n){
+            if(p[i]=='*'){
+                it.min_rep = 0;
+                it.max_rep = -1;
+                ++i;
+            } else if(p[i]=='+'){
+                it.max_rep = -1;
+                ++i;
+            } else if(p[i]=='?'){
+                it.min_rep = 0;
+                ++i;
+            }
+            // Lazy and repeated quantifiers
+            if(i<n && strchr("*+?{",p[i])) return false;
+        }
+
+        items.push_back(it);
+    }
+    return true;
+}
+
+bool StrPattern::match(std::string_view s) const {
+    if(use_regex) return std::regex_match(s.begin(),s.end(),regex);
+    return match_from(0,s,0);
+}
+
+bool StrPattern::match_from(int k, std::string_view s, int pos) const {
+    if(k == int(items.size())) return pos == int(s.size());
+
+    // Greedy repetition with backtracking
+    const Item& it = items[k];
+    int lim = s.size()-pos;
+    if(it.max_rep>=0) lim = std::min(lim,it.max_rep);
+    int n = 0;
+    while(n<lim && it.chars[(unsigned char)s[pos+n]]) ++n;
+    for(int r=n; r>=it.min_rep; --r)
+        if(match_from(k+1,s,pos+r)) return true;
+    return false;
+}
+
+//===============================================
+
 bool is_node_coordinate_dependent(const std::shared_ptr<MyAst>& node){
     using namespace peg::udl;
 
@@ -167,8 +348,18 @@ bool is_node_coordinate_dependent(const std::shared_ptr<MyAst>& node){
 
 SelectionParser::SelectionParser(std::vector<int> *subset):
     has_coord(false),
+    sys(nullptr),
+    Natoms(0),
+    frame(0),
     starting_subset(subset),
-    sys(nullptr)
+    index_shift(0),
+    out(nullptr),
+    depth(0),
+    max_depth(0),
+    max_lanes(0),
+    base_domain(1),
+    sp(0),
+    within_skin(0.1)
 {
 
 }
@@ -187,52 +378,54 @@ void set_coord_dependence(const std::shared_ptr<MyAst>& node){
     }
 }
 
-
-void SelectionParser::optimize_numeric(std::shared_ptr<MyAst>& node){
+// True if numeric node does not depend on atom properties
+bool is_numeric_constant(const std::shared_ptr<MyAst>& node){
     using namespace peg::udl;
 
-    // optimize arithmetics    
-    switch(node->tag) {
+    switch(node->tag){
+    case "INTEGER"_:
+    case "FLOAT"_:
+    case "NUM_OPERATOR"_:
+        return true;
+    case "UNARY_MINUS"_:
     case "NUM_EXPR_SEQ"_:
-        // If not-coord dependent just optimize
-        if(!node->is_coord_dependent){
-            // Replace with float node
-            node = std::make_shared<MyAst>("",0,0,"FLOAT", fmt::format("{}", get_numeric(node)(0)));
-            node->is_coord_dependent = false; // Keep correct flag just in case
-        }
-        break;
+        for(auto& child: node->nodes)
+            if(!is_numeric_constant(child)) return false;
+        return true;
+    default:
+        return false;
     }
-
-    // Recurse into children
-    for(auto& child: node->nodes) optimize_numeric(child);
 }
 
-
-void SelectionParser::precompute(std::shared_ptr<MyAst>& node){
+float eval_numeric_constant(const std::shared_ptr<MyAst>& node){
     using namespace peg::udl;
 
     switch(node->tag){
-    case "NUM_COMP"_:
-    case "STR_KEYWORD_EXPR"_:
-    case "INT_KEYWORD_EXPR"_:
-    case "LOGICAL_SEQ"_:
-    case "LOGICAL_OPERAND"_:
-    case "ALL"_:
-    case "WITHIN_EXPR"_:
-    case "BY"_:
-    case "NOT"_:
-        if(!node->is_coord_dependent){
-            //cout << "precomputing " << node->name << endl;
-            auto new_node = std::make_shared<MyAst>("",0,0,"PRE","");
-            eval_node(node, new_node->precomputed);
-            node = new_node;
-        } else if(!node->nodes.empty()) {
-            // Try children, some of them could be coord-independent
-            for(auto& child: node->nodes) precompute(child);
+    case "INTEGER"_:
+        return stol(string(node->token));
+    case "FLOAT"_:
+        return stof(string(node->token));
+    case "UNARY_MINUS"_:
+        return -eval_numeric_constant(node->nodes[0]);
+    case "NUM_EXPR_SEQ"_: {
+        float a = eval_numeric_constant(node->nodes[0]);
+        float b = eval_numeric_constant(node->nodes[2]);
+        const auto& op = node->nodes[1]->token;
+        if(op == "+") return a+b;
+        if(op == "-") return a-b;
+        if(op == "*") return a*b;
+        if(op == "/"){
+            if(b==0.0) throw PterosError("Division by zero in selection!");
+            return a/b;
         }
+        return std::pow(a,b);
+    }
+    default:
+        throw PterosError("Wrong numeric node!");
     }
 }
 
+
 void SelectionParser::create_ast(string& sel_str, System* system){
     if (_parser.parse(sel_str.c_str(), tree)) {
         tree = _parser.optimize_ast(tree);
@@ -246,21 +439,35 @@ void SelectionParser::create_ast(string& sel_str, System* system){
     sys = system;
     Natoms = sys->num_atoms();
 
-    if(starting_subset)
-        current_subset = starting_subset;
-    else
-        current_subset = nullptr;
+    // Atoms allowed in selection
+    all_atoms.reset(Natoms);
+    all_atoms.set_range(0,Natoms-1);
+    if(starting_subset){
+        root.from_index(*starting_subset,Natoms);
+        // Indexes in subselection are local
+        if(starting_subset->size()) index_shift = (*starting_subset)[0];
+    } else {
+        root = all_atoms;
+    }
+
+    // Compile the tree. If selection is coordinate-dependent its
+    // pure parts go to the setup code, which is executed only once.
+    out = &code;
+    depth = max_depth = max_lanes = 0;
+    compile(tree);
+    // AST is not needed anymore
+    tree.reset();
 
-    // Optimize numeric values in the tree
-    optimize_numeric(tree);
+    stack.resize(max_depth);
+    lanes.resize(max_lanes);
 
-    // proceed with optimizing pure nodes to precomputed if needed
-    if(has_coord) precompute(tree);
+    if(setup_code.size()) run(setup_code);
 }
 
 void SelectionParser::apply_ast(size_t fr, vector<int>& result){
     frame = fr;
-    eval_node(tree,result);
+    run(code);
+    stack[0].to_index(result);
 }
 
 
@@ -283,159 +490,127 @@ Eigen::Vector3i process_pbc(const std::shared_ptr<MyAst> &node){
     return ret;
 }
 
-void SelectionParser::eval_node(const std::shared_ptr<MyAst> &node, std::vector<int>& result){
+//===============================================
+// Compilation
+
+// Comparison operators
+enum {CMP_EQ, CMP_NE, CMP_LT, CMP_GT, CMP_LE, CMP_GE};
+
+int comparison_code(std::string_view c){
+    if(c == "=" || c == "==") return CMP_EQ;
+    if(c == "!=" || c == "<>") return CMP_NE;
+    if(c == "<") return CMP_LT;
+    if(c == ">") return CMP_GT;
+    if(c == "<=") return CMP_LE;
+    return CMP_GE;
+}
+
+void SelectionParser::emit(SelOp op, int a, int b, int c, int d, float f){
+    out->push_back({op,a,b,c,d,f});
+
+    // Track the depth of mask stack
+    switch(op){
+    case SelOp::LOAD:
+    case SelOp::ALL:
+    case SelOp::STR:
+    case SelOp::INT:
+    case SelOp::NUM_COMP:
+        ++depth;
+        break;
+    case SelOp::STORE:
+    case SelOp::OR:
+    case SelOp::AND_END:
+    case SelOp::CENTER:
+        --depth;
+        break;
+    case SelOp::WITHIN:
+        if(c>=0) ++depth; // Within from point does not consume the mask
+        break;
+    default:
+        break;
+    }
+    max_depth = std::max(max_depth,depth);
+}
+
+int SelectionParser::add_pbc(const Eigen::Vector3i &pbc){
+    pbcs.push_back(pbc);
+    return pbcs.size()-1;
+}
+
+int SelectionParser::add_numeric(const std::shared_ptr<MyAst> &node){
+    vector<SelInstr> prog;
+    compile_numeric(node,prog);
+    num_code.push_back(std::move(prog));
+    return num_code.size()-1;
+}
+
+void SelectionParser::compile(std::shared_ptr<MyAst> &node){
     using namespace peg::udl;
 
-    result.clear();
+    // Pure parts of coordinate-dependent selection are evaluated once
+    // and their results are loaded from register for each frame
+    if(has_coord && !node->is_coord_dependent && out==&code){
+        int saved_depth = depth;
+        out = &setup_code;
+        depth = 0;
+        if(base_domain==0) emit(SelOp::DOMAIN_PUSH,0);
+        compile(node);
+        if(base_domain==0) emit(SelOp::DOMAIN_POP);
+        int reg = regs.size();
+        regs.emplace_back();
+        emit(SelOp::STORE,reg);
+        out = &code;
+        depth = saved_depth;
+        emit(SelOp::LOAD,reg);
+        return;
+    }
 
-    //==========================
-    // Here evaluation starts
-    //==========================
     switch(node->tag){
-    //---------------------------------------------------------------------------
-    case "PRE"_:
-        // Precomputed nodes are created during optimization stage
-        result = node->precomputed;
-        break;
-
     //---------------------------------------------------------------------------
     case "NUM_COMP"_:
     {
-        vector<string> c; // comparison operators
-        vector<std::function<float(int)>> op; // comparison operands
-        vector<std::function<bool(float,float)>> comparison; // Function(s) to evaluate
-
-        if(node->nodes.size() == 3){ // simple
-            c.resize(1);
-            op.resize(2);
-            comparison.resize(1);
-
-            c[0]  = node->nodes[1]->token;
-            op[0] = get_numeric(node->nodes[0]);
-            op[1] = get_numeric(node->nodes[2]);
-
-        } else { // chained
-            c.resize(2);
-            op.resize(3);
-            comparison.resize(2);
-
-            c[0]  = node->nodes[1]->token;
-            c[1]  = node->nodes[3]->token;
-            op[0] = get_numeric(node->nodes[0]);
-            op[1] = get_numeric(node->nodes[2]);
-            op[2] = get_numeric(node->nodes[4]);
-        }
-
-        for(int i=0;i<c.size();++i){
-            if(c[i] == "=" || c[i]== "=="){
-                comparison[i] = [](float a, float b){ return a==b; };
-            } else if (c[i] == "!=" || c[i]=="<>"){
-                comparison[i] = [](float a, float b){ return a!=b; };
-            } else if (c[i] == "<"){
-                comparison[i] = [](float a, float b){ return a<b; };
-            } else if (c[i] == ">"){
-                comparison[i] = [](float a, float b){ return a>b; };
-            } else if (c[i] == "<="){
-                comparison[i] = [](float a, float b){ return a<=b; };
-            } else if (c[i] == ">="){
-                comparison[i] = [](float a, float b){ return a>=b; };
-            }
-        }
-
-        if(!current_subset) {
-            if(node->nodes.size() == 3){ // simple
-                for(int at=0;at<Natoms;++at)
-                    if( comparison[0](op[0](at),op[1](at)) ) result.push_back(at);
-            } else { // chained
-                for(int at=0;at<Natoms;++at)
-                    if( comparison[0](op[0](at),op[1](at)) && comparison[1](op[1](at),op[2](at)) ) result.push_back(at);
-            }
-        } else {
-            if(node->nodes.size() == 3){ // simple
-                for(int at: *current_subset)
-                    if( comparison[0](op[0](at),op[1](at)) ) result.push_back(at);
-            } else { // chained
-                for(int at: *current_subset)
-                    if( comparison[0](op[0](at),op[1](at)) && comparison[1](op[1](at),op[2](at)) ) result.push_back(at);
-            }
+        // All operands are computed by single numeric program
+        vector<SelInstr> prog;
+        compile_numeric(node->nodes[0],prog);
+        compile_numeric(node->nodes[2],prog);
+        int c1 = comparison_code(node->nodes[1]->token);
+        int c2 = -1;
+        if(node->nodes.size() == 5){ // chained
+            compile_numeric(node->nodes[4],prog);
+            c2 = comparison_code(node->nodes[3]->token);
         }
-
+        num_code.push_back(std::move(prog));
+        emit(SelOp::NUM_COMP,num_code.size()-1,c1,c2);
         break;
     }
 
     //---------------------------------------------------------------------------
     case "STR_KEYWORD_EXPR"_:
     {
-        std::function<bool(int,const string&)> comp_func_str;
-        std::function<bool(int,const std::regex&)> comp_func_regex;
-
         const auto& keyword = node->nodes[0]->token;
 
-        if(keyword == "name"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].name == str; };
-            comp_func_regex = [this](int at, const std::regex& reg){ return std::regex_match(sys->atoms[at].name.c_str(),reg); };
+        StrMatch m;
+        if(keyword == "chain"){
+            m.field = nullptr;
+        } else if(keyword == "name"){
+            m.field = &Atom::name;
         } else if(keyword == "type"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].type_name == str; };
-            comp_func_regex = [this](int at, const std::regex& reg){ return std::regex_match(sys->atoms[at].type_name.c_str(),reg); };
+            m.field = &Atom::type_name;
         } else if(keyword == "resname"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].resname == str; };
-            comp_func_regex = [this](int at, const std::regex& reg){ return std::regex_match(sys->atoms[at].resname.c_str(),reg); };
-        } else if(keyword == "tag"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].tag== str; };
-            comp_func_regex = [this](int at, const std::regex& reg){ return std::regex_match(sys->atoms[at].tag.c_str(),reg); };
-        } else if(keyword == "chain"){
-            comp_func_str = [this](int at, const string& str){ return sys->atoms[at].chain == str[0]; };
-            comp_func_regex = [this](int at, const std::regex& reg){
-                string s(" ");
-                s[0] = sys->atoms[at].chain;
-                return std::regex_match(s.c_str(),reg);
-            };
-        }
-
-        list<string> str_values;
-        list<std::regex> regex_values;
-        for(int i=1;i<node->nodes.size();++i){
-            if(node->nodes[i]->name=="STR")
-                str_values.emplace_back(node->nodes[i]->token);
-            else
-                regex_values.emplace_back(string(node->nodes[i]->token));
-        }
-
-        // Loop body
-        auto body = [&](int at){
-            // Cycle over regex values
-            bool reg_found = false;
-            for(const auto& reg: regex_values){
-                if(comp_func_regex(at,reg)){
-                    result.push_back(at);
-                    reg_found = true;
-                    break;
-                }
-            }
-
-            // If at least one regex matched no need to proceed with strings
-            if(reg_found) return;
-
-            // Cycle over string values
-            for(const auto& str: str_values){
-                if(comp_func_str(at,str)){
-                    result.push_back(at);
-                    break;
-                }
-            }
-        };
-
-        if(!current_subset){
-            for(int at=0;at<Natoms;++at) body(at);
+            m.field = &Atom::resname;
         } else {
-            for(int at: *current_subset) body(at);
+            m.field = &Atom::tag;
         }
 
-        // Sort unique
-        sort(result.begin(),result.end());
-        vector<int>::iterator it = unique(result.begin(), result.end());
-        result.resize( it - result.begin() );
+        for(size_t i=1;i<node->nodes.size();++i){
+            if(node->nodes[i]->name=="STR")
+                m.strings.emplace_back(node->nodes[i]->token);
+            else
+                m.regexes.emplace_back(string(node->nodes[i]->token));
+        }
 
+        str_match.push_back(std::move(m));
+        emit(SelOp::STR,str_match.size()-1);
         break;
     }
 
@@ -443,83 +618,29 @@ void SelectionParser::eval_node(const std::shared_ptr<MyAst> &node, std::vector<
     case "INT_KEYWORD_EXPR"_:
     {
         const auto& keyword = node->nodes[0]->token;
-        int Nchildren = node->nodes.size(); // Get number of children
-
-        // If starting subset is present than this is a subselection and
-        // we have to interpret indexes as local indexes!
-        if(keyword == "index") {
-            // Cycle over children
-            for(int i=1;i<Nchildren;++i){
-                if(node->nodes[i]->name == "INTEGER") {
-                    int k = node->nodes[i]->token_to_number<int>();
-                    // Shift to local index for subselection if needed
-                    if(starting_subset) k+=(*starting_subset)[0];
-                    // We have to check the range here
-                    if(k>=0 && k<Natoms)
-                        result.push_back(k);
-                } else {
-                    // this is a range, not an integer
-                    int i1 = node->nodes[i]->nodes[0]->token_to_number<int>();
-                    int i2 = node->nodes[i]->nodes[1]->token_to_number<int>();
-                    // Shift to local index for subselection if needed
-                    if(starting_subset){
-                        i1+=(*starting_subset)[0];
-                        i2+=(*starting_subset)[0];
-                    }
-                    for(int k=i1;k<=i2;++k)                        
-                        // We have to check the range here
-                        if(k>=0 && k<Natoms)
-                            result.push_back(k);
-                }
-            }
-
-        } else { // resid or resindex
-
-            // Make lists
-            vector<int> int_list;
-            vector<int> range_list;
-            for(int i=1;i<Nchildren;++i){
-                if(node->nodes[i]->name == "INTEGER") {
-                    int_list.push_back(node->nodes[i]->token_to_number<int>());
-                } else {
-                    range_list.push_back(node->nodes[i]->nodes[0]->token_to_number<int>());
-                    range_list.push_back(node->nodes[i]->nodes[1]->token_to_number<int>());
-                }
-            }
-
-            // Comparison function
-            std::function<bool(int,int)> comp_func;
-            if(keyword == "resid"){
-                comp_func = [this](int at, int k){ return sys->atoms[at].resid == k; };
-            } else if(keyword == "resindex"){
-                comp_func = [this](int at, int k){ return sys->atoms[at].resindex == k; };
-            }
 
-            // Loop body
-            auto body = [&](int at){
-                // Individual numbers
-                for(int k: int_list)
-                    if(comp_func(at,k)) result.push_back(at);
-                // Ranges
-                for(int i=0;i<range_list.size();i+=2){ // Itarage by pair
-                    for(int k=range_list[i];k<=range_list[i+1];++k){ // Inside range
-                        if(comp_func(at,k)) result.push_back(at);
-                    }
-                }
-            };
+        IntMatch m;
+        if(keyword == "index"){
+            m.kind = 0;
+        } else if(keyword == "resid"){
+            m.kind = 1;
+        } else {
+            m.kind = 2;
+        }
 
-            // Do loop
-            if(!current_subset){
-                for(int at=0;at<Natoms;++at) body(at);
+        // Single numbers are stored as ranges
+        for(size_t i=1;i<node->nodes.size();++i){
+            if(node->nodes[i]->name == "INTEGER") {
+                int k = node->nodes[i]->token_to_number<int>();
+                m.ranges.emplace_back(k,k);
             } else {
-                for(int at: *current_subset) body(at);
+                m.ranges.emplace_back(node->nodes[i]->nodes[0]->token_to_number<int>(),
+                                      node->nodes[i]->nodes[1]->token_to_number<int>());
             }
-        } // index if
-
-        sort(result.begin(),result.end());
-        vector<int>::iterator it = unique(result.begin(), result.end());
-        result.resize( it - result.begin() );
+        }
 
+        int_match.push_back(std::move(m));
+        emit(SelOp::INT,int_match.size()-1);
         break;
     }
 
@@ -527,10 +648,9 @@ void SelectionParser::eval_node(const std::shared_ptr<MyAst> &node, std::vector<
     case "LOGICAL_SEQ"_:
     {
         if(node->nodes[1]->token == "or") {
-            vector<int> res1,res2;
-            eval_node(node->nodes[0],res1);
-            eval_node(node->nodes[2],res2);
-            std::set_union(res1.begin(),res1.end(),res2.begin(),res2.end(),back_inserter(result));
+            compile(node->nodes[0]);
+            compile(node->nodes[2]);
+            emit(SelOp::OR);
 
         } else if(node->nodes[1]->token == "and") {
             // Optimize to put pure node first
@@ -539,117 +659,39 @@ void SelectionParser::eval_node(const std::shared_ptr<MyAst> &node, std::vector<
 
             if(pure2 && !pure1) std::swap(node->nodes[0],node->nodes[2]);
 
-            vector<int> res1,res2;
-            eval_node(node->nodes[0],res1);
-            current_subset = &res1; // Set subset for second
-            eval_node(node->nodes[2],res2); // Is using filled current subset
-
-            std::set_intersection(res1.begin(),res1.end(),res2.begin(),res2.end(),back_inserter(result));
-
-            // Reset subset
-            if(starting_subset){
-                current_subset = starting_subset;
-            } else {
-                current_subset = nullptr;
-            }
+            // Second operand is only evaluated for atoms selected by the first one
+            compile(node->nodes[0]);
+            emit(SelOp::AND_BEGIN);
+            compile(node->nodes[2]);
+            emit(SelOp::AND_END);
         }
-
         break;
     }
 
     //---------------------------------------------------------------------------
     case "NOT"_:
-    {
-        vector<int> res;
-        eval_node(node->nodes[0],res);
-
-        if(!current_subset){
-            vector<int> v(Natoms);
-            for(int i=0;i<Natoms;++i) v[i]=i;
-            std::set_difference(v.begin(),v.end(), res.begin(),res.end(), back_inserter(result));
-        } else {
-            // For subset
-            std::set_difference(current_subset->begin(),current_subset->end(), res.begin(),res.end(), back_inserter(result));
-        }
+        compile(node->nodes[0]);
+        emit(SelOp::NOT);
         break;
-    }
 
     //---------------------------------------------------------------------------
     case "BY"_:
     {
-        // Evaluate inner
-        vector<int> res;
-        eval_node(node->nodes[1],res);
-
-        if(node->nodes[0]->token == "residue"){
-            // First make a set of resids we need to search
-            std::unordered_set<int> resind;
-            for(auto at: res) resind.insert(sys->atoms[at].resindex);
-
-            // Now cycle over all atoms in the starting subset if present (not current subset!!!)
-            if(starting_subset){
-                for(int at: *starting_subset) // over starting subset
-                    if(resind.count(sys->atoms[at].resindex)) result.push_back(at);
-            } else {
-                for(int at=0;at<Natoms;++at) // over all atoms
-                    if(resind.count(sys->atoms[at].resindex)) result.push_back(at);
-            }
-            std::sort(result.begin(),result.end());
-
-        } else if(node->nodes[0]->token == "chain") {
-            // First make a set of chains we need to search
-            std::unordered_set<char> chains;
-            for(auto at: res) chains.insert(sys->atoms[at].chain);
-
-            // Now cycle over all atoms in the starting subset if present (not current subset!!!)
-            if(starting_subset){
-                for(int at: *starting_subset) // over starting subset
-                    if(chains.count(sys->atoms[at].chain)) result.push_back(at);
-            } else {
-                for(int at=0;at<Natoms;++at) // over all atoms
-                    if(chains.count(sys->atoms[at].chain)) result.push_back(at);
-            }
-            std::sort(result.begin(),result.end());
-
-        } else if(node->nodes[0]->token == "mol") {
-            if(!sys->force_field.ready) throw PterosError("Can't select by molecule: no topology!");
-
-            // set of mols we need to include
-            std::unordered_set<int> mols;
-
-            // go over res and add mol is we need it
-            for(auto at: res){
-                // Cycle over all molecules in the system
-                for(int j=0; j<sys->force_field.molecules.size(); ++j){ // Over molecules
-                    if(at>=sys->force_field.molecules[j](0) && at<=sys->force_field.molecules[j](1)){
-                        mols.insert(j);
-                        break;
-                    }
-                }
-            }
-
-            // Now add all chosen molecules
-            for(int m: mols)
-                for(int at=sys->force_field.molecules[m](0); at<=sys->force_field.molecules[m](1); ++at)
-                    result.push_back(at);
-
-            // Sort and restrict to starting subset (!) if needed
-            sort(result.begin(),result.end());
-            if(starting_subset)
-                std::set_intersection(result.begin(),result.end(),
-                                      starting_subset->begin(),starting_subset->end(),
-                                      back_inserter(result));
-
-        } // mol
-
+        compile(node->nodes[1]);
+        const auto& what = node->nodes[0]->token;
+        if(what == "residue"){
+            emit(SelOp::BY,0);
+        } else if(what == "chain"){
+            emit(SelOp::BY,1);
+        } else {
+            emit(SelOp::BY,2);
+        }
         break;
     }
 
     //---------------------------------------------------------------------------
     case "ALL"_:
-        result.resize(Natoms);
-        for(int at=0;at<Natoms;++at) result[at] = at;
-
+        emit(SelOp::ALL);
         break;
 
     //---------------------------------------------------------------------------
@@ -661,51 +703,34 @@ void SelectionParser::eval_node(const std::shared_ptr<MyAst> &node, std::vector<
         // Child 0 is always a cutoff
         // Numeric expression should not be coord dependent!
         if(node->nodes[0]->is_coord_dependent) throw PterosError("Within cutoff can't depend on atomic coordinates!");
-        float cutoff = get_numeric(node->nodes[0])(0);
-
-        // Child 1 could be either PBC or SELF
-        if(node->nodes[1]->tag == "PBC"_){
-            pbc = process_pbc(node->nodes[1]);
-            // Check next for self
-            if(node->nodes[2]->tag == "SELF"_){
-                if(node->nodes[2]->token == "self") include_self = true;
-            }
-        } else if(node->nodes[1]->tag == "SELF"_) {
-            if(node->nodes[1]->token == "self") include_self = true;
-            // Check next for pbc
-            if(node->nodes[2]->tag == "PBC"_){
-                pbc = process_pbc(node->nodes[2]);
+        if(!is_numeric_constant(node->nodes[0])) throw PterosError("Within cutoff should be a number!");
+        float cutoff = eval_numeric_constant(node->nodes[0]);
+
+        // Optional PBC and SELF go before the last child
+        for(size_t i=1;i<node->nodes.size()-1;++i){
+            if(node->nodes[i]->tag == "PBC"_){
+                pbc = process_pbc(node->nodes[i]);
+            } else if(node->nodes[i]->tag == "SELF"_){
+                include_self = (node->nodes[i]->token == "self");
             }
         }
 
-        // Prepare first (outer) selection
-        Selection dum1(*sys);
-        if(!current_subset){
-            // We are NOT limited by subspace
-            dum1._index.resize(Natoms);
-            for(int i=0;i<Natoms;++i) dum1._index[i] = i;
-        } else {
-            // We are limited by subspace
-            dum1._index = *current_subset;
-        }
-        dum1.set_frame(frame);
-
         if(node->nodes.back()->tag == "VEC3"_){
-            // Distance from point (with abs indexes!)
-            DistanceSearchWithin searcher(cutoff,dum1,true,pbc);
-            Eigen::Vector3f point = get_vector(node->nodes.back());
-            searcher.search_within(point,result);
+            // Distance from point
+            int reg = compile_vector(node->nodes.back());
+            emit(SelOp::WITHIN,add_pbc(pbc),include_self,reg,0,cutoff);
         } else {
             // Distance between selections
-            // Prepare second (inner) selection
-            Selection dum2(*sys);
-            // Result is returned directly into the index array of selection dum2
-            // thus no additional copying
-            eval_node(node->nodes.back(),dum2._index);
-            dum2.set_frame(frame);
-            search_within(cutoff,dum1,dum2,result,include_self,pbc);
+            // Inner selection is not limited by current subset
+            int saved_base = base_domain;
+            base_domain = 1;
+            emit(SelOp::DOMAIN_PUSH,1);
+            compile(node->nodes.back());
+            emit(SelOp::DOMAIN_POP);
+            base_domain = saved_base;
+            within_state.emplace_back();
+            emit(SelOp::WITHIN,add_pbc(pbc),include_self,-1,within_state.size()-1,cutoff);
         }
-
         break;
     }
 
@@ -715,181 +740,136 @@ void SelectionParser::eval_node(const std::shared_ptr<MyAst> &node, std::vector<
     } // case
 }
 
-//returns a 3-vector
-Eigen::Vector3f SelectionParser::get_vector(const std::shared_ptr<MyAst> &node)
+// Returns register, which will contain the vector
+int SelectionParser::compile_vector(const std::shared_ptr<MyAst> &node)
 {
     using namespace peg::udl;
 
     switch(node->tag){
     //---------------------------------------------------------------------------
     case "VEC3"_: {
-        if(node->nodes.size() == 3){
-            // Get 3 floats
-            Eigen::Vector3f v;
-            v(0) = node->nodes[0]->token_to_number<float>();
-            v(1) = node->nodes[1]->token_to_number<float>();
-            v(2) = node->nodes[2]->token_to_number<float>();
-            return v;
-        } else if(node->nodes.size() == 1) {
-            // Recurse inside
-            return get_vector(node->nodes[0]);
+        if(node->nodes.size() == 1) return compile_vector(node->nodes[0]); // Recurse inside
+
+        // Get 3 floats
+        Eigen::Vector3f v;
+        for(int i=0;i<3;++i){
+            if(!is_numeric_constant(node->nodes[i])) throw PterosError("Vector components should be numbers!");
+            v(i) = eval_numeric_constant(node->nodes[i]);
         }
+        vecs.push_back(v);
+        return vecs.size()-1;
     }
 
     //---------------------------------------------------------------------------
     case "CENTER"_: {
-        auto pbc = noPBC;
-        std::function<float(int)> weight_func;
-
-        // Child 0 could be either PBC or WEIGHT
-        if(node->nodes[0]->tag == "PBC"_){
-            pbc = process_pbc(node->nodes[0]);
-            // Check next for weight
-            if(node->nodes[1]->tag == "WEIGHT"_){
-                weight_func = get_numeric(node->nodes[1]);
-            }
-        } else if(node->nodes[0]->tag == "WEIGHT"_) {
-            weight_func = get_numeric(node->nodes[0]);
-            // Check next for pbc
-            if(node->nodes[1]->tag == "PBC"_){
-                pbc = process_pbc(node->nodes[1]);
+        Vector3i pbc = noPBC;
+        int weight = -1;
+
+        // Optional PBC and WEIGHT go before the last child
+        for(size_t i=0;i<node->nodes.size()-1;++i){
+            if(node->nodes[i]->tag == "PBC"_){
+                pbc = process_pbc(node->nodes[i]);
+            } else if(node->nodes[i]->tag == "WEIGHT"_){
+                weight = add_numeric(node->nodes[i]->nodes[0]);
             }
         }
 
-        // Create selection to get the center of
-        Selection sel(*sys);
-        // We have to ignore current subset here!
-        // Reset subset
-        auto old_subset = current_subset;
-        current_subset = nullptr;
-        // Evaluate last node directly to selection
-        eval_node(node->nodes.back(), sel._index);
-        // Set current frame for selection
-        sel.set_frame(frame);
-
-        Eigen::Vector3f res;
-        if(weight_func){
-            // Create vector of weights if nedded
-            vector<float> w(sel.size());
-            for(int i=0;i<sel.size();++i) w[i] = weight_func(sel.index(i));
-            res = sel.center(w,pbc);
-        } else {
-            // N0 weights
-            res = sel.center(false,pbc);
-        }
-
-        // Reset subset
-        current_subset = old_subset;
-        return res;
+        // Current subset is ignored for the selection we get the center of
+        int saved_base = base_domain;
+        base_domain = 0;
+        emit(SelOp::DOMAIN_PUSH,0);
+        compile(node->nodes.back());
+        emit(SelOp::DOMAIN_POP);
+        base_domain = saved_base;
+
+        int reg = vecs.size();
+        vecs.emplace_back(0,0,0);
+        emit(SelOp::CENTER,reg,weight,add_pbc(pbc));
+        return reg;
     }
 
     //---------------------------------------------------------------------------
     default:
         throw PterosError("Unknown node {}!",node->name);
     } //case
-
 }
 
-// Returns callable, which returns value for numeric node for atom at
-std::function<float(int)> SelectionParser::get_numeric(const std::shared_ptr<MyAst> &node){
+// Appends code, which puts the value of numeric node for each atom in the block
+// onto the stack of lanes
+void SelectionParser::compile_numeric(const std::shared_ptr<MyAst> &node, std::vector<SelInstr>& prog){
     using namespace peg::udl;
 
+    auto add = [&prog](SelOp op, int a=0, int b=0, int c=0, float f=0){
+        prog.push_back({op,a,b,c,0,f});
+    };
+
     switch(node->tag){
     //---------------------------------------------------------------------------
     case "INTEGER"_:
-    {
-        float val = stol(string(node->token));
-        return [val](int at){ return val; };
-    }
-    //---------------------------------------------------------------------------
+        add(SelOp::N_CONST,0,0,0,stol(string(node->token)));
+        break;
     case "FLOAT"_:
-    {
-        float val = stof(string(node->token));
-        return [val](int at){ return val; };
-    }
+        add(SelOp::N_CONST,0,0,0,stof(string(node->token)));
+        break;
     //---------------------------------------------------------------------------
     case "X"_:
-        if(node->nodes.empty())
-            return [this](int at){ return sys->traj[frame].coord[at](0); };
-        else {
-            float x = get_vector(node->nodes[0])[0];
-            return [x](int at){ return x; };
-        }
-    //---------------------------------------------------------------------------
     case "Y"_:
-        if(node->nodes.empty())
-            return [this](int at){ return sys->traj[frame].coord[at](1); };
-        else {
-            float y = get_vector(node->nodes[0])[1];
-            return [y](int at){ return y; };
-        }
-    //---------------------------------------------------------------------------
     case "Z"_:
-        if(node->nodes.empty())
-            return [this](int at){ return sys->traj[frame].coord[at](2); };
-        else {
-            float z = get_vector(node->nodes[0])[2];
-            return [z](int at){ return z; };
+    {
+        int dim = (node->tag=="X"_) ? 0 : ((node->tag=="Y"_) ? 1 : 2);
+        if(node->nodes.empty()){
+            add(SelOp::N_COORD,dim);
+        } else {
+            add(SelOp::N_VEC_COMP,compile_vector(node->nodes[0]),dim);
         }
+        break;
+    }
     //---------------------------------------------------------------------------
-    case "BETA"_:
-        return [this](int at){ return sys->atoms[at].beta; };
-    //---------------------------------------------------------------------------
-    case "OCC"_:
-        return [this](int at){ return sys->atoms[at].occupancy; };
-    //---------------------------------------------------------------------------
-    case "INDEX"_:
-        return [](int at){ return at; };
-    //---------------------------------------------------------------------------
-    case "RESINDEX"_:
-        return [this](int at){ return sys->atoms[at].resindex; };
-    //---------------------------------------------------------------------------
-    case "RESID"_:
-        return [this](int at){ return sys->atoms[at].resid; };
-    //---------------------------------------------------------------------------
-    case "MASS"_:
-        return [this](int at){ return sys->atoms[at].mass; };
-    //---------------------------------------------------------------------------
-    case "CHARGE"_:
-        return [this](int at){ return sys->atoms[at].charge; };
+    case "BETA"_:     add(SelOp::N_BETA); break;
+    case "OCC"_:      add(SelOp::N_OCC); break;
+    case "INDEX"_:    add(SelOp::N_INDEX); break;
+    case "RESINDEX"_: add(SelOp::N_RESINDEX); break;
+    case "RESID"_:    add(SelOp::N_RESID); break;
+    case "MASS"_:     add(SelOp::N_MASS); break;
+    case "CHARGE"_:   add(SelOp::N_CHARGE); break;
     //---------------------------------------------------------------------------
     // Compounds
     case "UNARY_MINUS"_:
-    {
-        auto func = get_numeric(node->nodes[0]);
-        return [func](int at){ return -func(at); };
-    }
+        // Expressions, which do not depend on atoms, are evaluated once
+        if(is_numeric_constant(node)){
+            add(SelOp::N_CONST,0,0,0,eval_numeric_constant(node));
+            break;
+        }
+        compile_numeric(node->nodes[0],prog);
+        add(SelOp::N_NEG);
+        break;
     //---------------------------------------------------------------------------
     case "NUM_EXPR_SEQ"_:
     {        
-        std::function<float(int)> operand1,operand2;
-        std::function<float(float,float)> op;
-
-        operand1 = get_numeric(node->nodes[0]);
-        operand2 = get_numeric(node->nodes[2]);
-
-        if(node->nodes[1]->token == "+")
-            op= [](float a,float b){ return a+b; };
-        else if(node->nodes[1]->token == "-")
-            op= [](float a,float b){ return a-b; };
-        else if(node->nodes[1]->token == "*")
-            op= [](float a,float b){ return a*b; };
-        else if(node->nodes[1]->token == "/")
-            op= [](float a,float b){
-                if(b==0.0) throw PterosError("Division by zero in selection!");
-                return a/b;
-            };            
-        else if(node->nodes[1]->token == "^")
-            op = [](float a,float b){ return std::pow(a,b); };
-
-        return [operand1,operand2,op](int at){
-            return op(operand1(at),operand2(at));
-        };
+        if(is_numeric_constant(node)){
+            add(SelOp::N_CONST,0,0,0,eval_numeric_constant(node));
+            break;
+        }
+        compile_numeric(node->nodes[0],prog);
+        compile_numeric(node->nodes[2],prog);
+
+        const auto& op = node->nodes[1]->token;
+        if(op == "+")
+            add(SelOp::N_ADD);
+        else if(op == "-")
+            add(SelOp::N_SUB);
+        else if(op == "*")
+            add(SelOp::N_MUL);
+        else if(op == "/")
+            add(SelOp::N_DIV);
+        else if(op == "^")
+            add(SelOp::N_POW);
+        break;
     }
     //---------------------------------------------------------------------------
     case "DIST_EXPR"_:
     {
-        Array3i pbc = noPBC;
+        Vector3i pbc = noPBC;
         int offset = 0;
 
         // Process PBC if present
@@ -904,112 +884,702 @@ std::function<float(int)> SelectionParser::get_numeric(const std::shared_ptr<MyA
         switch(inner->tag){
 
         case "VEC3"_: { // from point
-            Eigen::Vector3f p = get_vector(inner);
-
-            // Return distance
-            if((pbc!=0).any()){
-                return [this,p](int at){
-                    return sys->box(frame).distance(p, sys->traj[frame].coord[at]);
-                };
-            } else {
-                return [this,p](int at){
-                    return (p - sys->traj[frame].coord[at]).norm();
-                };
-            }
-
+            add(SelOp::N_DIST_POINT,compile_vector(inner),add_pbc(pbc));
             break;
         }
 
         case "VECTOR"_: { // from vector
-            Eigen::Vector3f p,dir;
+            int p = compile_vector(inner->nodes[0]);
+            int p2 = compile_vector(inner->nodes[1]);
+            int dir = vecs.size();
+            vecs.emplace_back(0,0,0);
             if(inner->choice == 0){ // Two points
-                p = get_vector(inner->nodes[0]);
-                dir = (get_vector(inner->nodes[1]) - p).normalized();
+                emit(SelOp::VEC_DIR,dir,p,p2);
             } else { // point and direction
-                p = get_vector(inner->nodes[0]);
-                dir = get_vector(inner->nodes[1]).normalized();
-            }
-
-            if((pbc.array()!=0).any()){ // periodic
-                return [this,p,dir,pbc](int at){
-                    Eigen::Vector3f atom = sys->traj[frame].coord[at];
-                    // Get vector from p to current atom
-                    Eigen::Vector3f v = atom - p;
-                    // Project v onto dir
-                    v = (v.dot(dir)/dir.squaredNorm())*dir;
-                    // Get the end point of projection
-                    v += p;
-                    // Return periodic distance between atom and v
-                    return sys->box(frame).distance(atom, v, pbc);
-                };
-            } else { // nonperiodic
-                return [this,p,dir,pbc](int at){
-                    Eigen::Vector3f atom = sys->traj[frame].coord[at];
-                    // Get vector from p to current atom
-                    Eigen::Vector3f v = atom - p;
-                    // Project v onto dir
-                    v = (v.dot(dir)/dir.squaredNorm())*dir;
-                    // Get the end point of projection
-                    v += p;
-                    // Return distance between atom and v
-                    return (atom-v).norm();
-                };
+                emit(SelOp::VEC_NORMALIZE,dir,p2);
             }
-
+            add(SelOp::N_DIST_LINE,p,dir,add_pbc(pbc));
             break;
         }
 
         case "PLANE"_: { // From plane
-            Eigen::Vector3f p,dir;
+            int p = compile_vector(inner->nodes[0]);
+            int dir = vecs.size();
+            vecs.emplace_back(0,0,0);
             if(inner->choice == 0){ // point and normal
-                p = get_vector(inner->nodes[0]);
-                dir = get_vector(inner->nodes[1]).normalized();
+                emit(SelOp::VEC_NORMALIZE,dir,compile_vector(inner->nodes[1]));
             } else { // 3 points
-                p = get_vector(inner->nodes[0]);
-                Eigen::Vector3f vec1 = get_vector(inner->nodes[1])-p;
-                Eigen::Vector3f vec2 = get_vector(inner->nodes[2])-p;
-                dir = vec1.cross(vec2).normalized();
+                int p2 = compile_vector(inner->nodes[1]);
+                int p3 = compile_vector(inner->nodes[2]);
+                emit(SelOp::VEC_NORMAL3,dir,p,p2,p3);
             }
+            add(SelOp::N_DIST_PLANE,p,dir,add_pbc(pbc));
+            break;
+        }
 
-            if((pbc.array()!=0).any()){ // periodic
-                return [this,p,dir,pbc](int at){
-                    Eigen::Vector3f atom = sys->traj[frame].coord[at];
-                    // Get vector from p to current atom
-                    Eigen::Vector3f v = atom - p;
-                    // Project v onto dir
-                    v = (v.dot(dir)/dir.squaredNorm())*dir;
-                    // Get closest point on a plane to atom
-                    v = atom-v;
-                    // Return distance between atom and v
-                    return sys->box(frame).distance(atom, v, pbc);
-                };
-            } else { // nonperiodic
-                return [this,p,dir](int at){
-                    Eigen::Vector3f atom = sys->traj[frame].coord[at];
-                    // Get vector from p to current atom
-                    Eigen::Vector3f v = atom - p;
-                    // Project v onto dir
-                    v = (v.dot(dir)/dir.squaredNorm())*dir;
+        default:
+            throw PterosError("Wrong numeric node!");
+        } // switch
+        break;
+    } // DIST_EXPR
+    //---------------------------------------------------------------------------
+    default:
+        throw PterosError("Wrong numeric node!");
+
+    } // case
+
+    // Track the depth of lanes stack
+    int d = 0;
+    for(const auto& in: prog){
+        switch(in.op){
+        case SelOp::N_NEG:
+            break;
+        case SelOp::N_ADD:
+        case SelOp::N_SUB:
+        case SelOp::N_MUL:
+        case SelOp::N_DIV:
+        case SelOp::N_POW:
+            --d;
+            break;
+        default:
+            ++d;
+        }
+        max_lanes = std::max(max_lanes,d);
+    }
+}
+
+//===============================================
+// Evaluation
+
+template<class F>
+uint64_t compare_block(const float* a, const float* b, int n, F f){
+    uint64_t m = 0;
+    for(int i=0;i<n;++i) m |= uint64_t(f(a[i],b[i])) << i;
+    return m;
+}
+
+uint64_t compare_lanes(const float* a, const float* b, int n, int cmp){
+    switch(cmp){
+    case CMP_EQ: return compare_block(a,b,n,std::equal_to<float>());
+    case CMP_NE: return compare_block(a,b,n,std::not_equal_to<float>());
+    case CMP_LT: return compare_block(a,b,n,std::less<float>());
+    case CMP_GT: return compare_block(a,b,n,std::greater<float>());
+    case CMP_LE: return compare_block(a,b,n,std::less_equal<float>());
+    default:     return compare_block(a,b,n,std::greater_equal<float>());
+    }
+}
+
+void SelectionParser::run_numeric(const std::vector<SelInstr> &prog, int first, int n, uint64_t active){
+    int top = -1;
+    const Atom* atoms = &sys->atoms[first];
+
+    for(const auto& in: prog){
+        switch(in.op){
+        case SelOp::N_CONST: {
+            auto& r = lanes[++top];
+            for(int i=0;i<n;++i) r[i] = in.f;
+            break;
+        }
+        case SelOp::N_COORD: {
+            auto& r = lanes[++top];
+            const Vector3f* crd = sys->traj[frame].coord.data()+first;
+            for(int i=0;i<n;++i) r[i] = crd[i](in.a);
+            break;
+        }
+        case SelOp::N_VEC_COMP: {
+            auto& r = lanes[++top];
+            float v = vecs[in.a](in.b);
+            for(int i=0;i<n;++i) r[i] = v;
+            break;
+        }
+        case SelOp::N_BETA: {
+            auto& r = lanes[++top];
+            for(int i=0;i<n;++i) r[i] = atoms[i].beta;
+            break;
+        }
+        case SelOp::N_OCC: {
+            auto& r = lanes[++top];
+            for(int i=0;i<n;++i) r[i] = atoms[i].occupancy;
+            break;
+        }
+        case SelOp::N_INDEX: {
+            auto& r = lanes[++top];
+            for(int i=0;i<n;++i) r[i] = first+i;
+            break;
+        }
+        case SelOp::N_RESID: {
+            auto& r = lanes[++top];
+            for(int i=0;i<n;++i) r[i] = atoms[i].resid;
+            break;
+        }
+        case SelOp::N_RESINDEX: {
+            auto& r = lanes[++top];
+            for(int i=0;i<n;++i) r[i] = atoms[i].resindex;
+            break;
+        }
+        case SelOp::N_MASS: {
+            auto& r = lanes[++top];
+            for(int i=0;i<n;++i) r[i] = atoms[i].mass;
+            break;
+        }
+        case SelOp::N_CHARGE: {
+            auto& r = lanes[++top];
+            for(int i=0;i<n;++i) r[i] = atoms[i].charge;
+            break;
+        }
+        case SelOp::N_NEG: {
+            auto& r = lanes[top];
+            for(int i=0;i<n;++i) r[i] = -r[i];
+            break;
+        }
+        case SelOp::N_ADD: {
+            auto& a = lanes[top-1];
+            const auto& b = lanes[top--];
+            for(int i=0;i<n;++i) a[i] += b[i];
+            break;
+        }
+        case SelOp::N_SUB: {
+            auto& a = lanes[top-1];
+            const auto& b = lanes[top--];
+            for(int i=0;i<n;++i) a[i] -= b[i];
+            break;
+        }
+        case SelOp::N_MUL: {
+            auto& a = lanes[top-1];
+            const auto& b = lanes[top--];
+            for(int i=0;i<n;++i) a[i] *= b[i];
+            break;
+        }
+        case SelOp::N_DIV: {
+            auto& a = lanes[top-1];
+            const auto& b = lanes[top--];
+            // Only atoms, which are really evaluated, are checked
+            for(int i=0;i<n;++i)
+                if(b[i]==0.0 && (active>>i & 1)) throw PterosError("Division by zero in selection!");
+            for(int i=0;i<n;++i) a[i] /= b[i];
+            break;
+        }
+        case SelOp::N_POW: {
+            auto& a = lanes[top-1];
+            const auto& b = lanes[top--];
+            for(int i=0;i<n;++i) a[i] = std::pow(a[i],b[i]);
+            break;
+        }
+        case SelOp::N_DIST_POINT: {
+            auto& r = lanes[++top];
+            const Vector3f* crd = sys->traj[frame].coord.data()+first;
+            const Vector3f& p = vecs[in.a];
+            const Vector3i& pbc = pbcs[in.b];
+            if((pbc.array()!=0).any()){
+                const auto& box = sys->box(frame);
+                for(int i=0;i<n;++i) r[i] = box.distance(p,crd[i],pbc);
+            } else {
+                for(int i=0;i<n;++i) r[i] = (p-crd[i]).norm();
+            }
+            break;
+        }
+        case SelOp::N_DIST_LINE:
+        case SelOp::N_DIST_PLANE: {
+            auto& r = lanes[++top];
+            const Vector3f* crd = sys->traj[frame].coord.data()+first;
+            const Vector3f& p = vecs[in.a];
+            const Vector3f& dir = vecs[in.b];
+            const Vector3i& pbc = pbcs[in.c];
+            bool periodic = (pbc.array()!=0).any();
+            const auto& box = sys->box(frame);
+            for(int i=0;i<n;++i){
+                const Vector3f& atom = crd[i];
+                // Get vector from p to current atom
+                Vector3f v = atom - p;
+                // Project v onto dir
+                v = (v.dot(dir)/dir.squaredNorm())*dir;
+                if(in.op==SelOp::N_DIST_LINE){
+                    // Get the end point of projection
+                    v += p;
+                } else {
                     // Get closest point on a plane to atom
                     v = atom-v;
-                    // Return distance between atom and v
-                    return (atom-v).norm();
-                };
+                }
+                // Distance between atom and v
+                r[i] = periodic ? box.distance(atom, v, pbc) : (atom-v).norm();
             }
+            break;
+        }
+        default:
+            throw PterosError("Wrong numeric instruction!");
+        }
+    }
+}
 
+void SelectionParser::eval_str(StrMatch &m, AtomMask &res){
+    const auto& dom = *domains.back();
+
+    for(size_t w=0;w<dom.words.size();++w){
+        uint64_t bits = dom.words[w];
+        uint64_t r = 0;
+        while(bits){
+            int i = __builtin_ctzll(bits);
+            bits &= bits-1;
+            const Atom& at = sys->atoms[w*64+i];
+
+            // Each distinct string is matched only once
+            uint32_t key = m.field ? (at.*m.field).get_id() : (unsigned char)at.chain;
+            if(key>=m.cache.size()) m.cache.resize(key+1,0);
+            char& c = m.cache[key];
+            if(!c){
+                bool matched = false;
+                std::string_view s = m.field ? std::string_view((at.*m.field).str()) : std::string_view(&at.chain,1);
+                for(const auto& str: m.strings){
+                    // Only the first character is compared for chains
+                    if(m.field ? s==str : s[0]==str[0]){
+                        matched = true;
+                        break;
+                    }
+                }
+                if(!matched){
+                    for(const auto& reg: m.regexes){
+                        if(reg.match(s)){
+                            matched = true;
+                            break;
+                        }
+                    }
+                }
+                c = matched ? 1 : 2;
+            }
+            if(c==1) r |= uint64_t(1)<<i;
         }
-        } // switch
+        res.words[w] = r;
+    }
+}
 
+void SelectionParser::eval_int(const IntMatch &m, AtomMask &res){
+    const auto& dom = *domains.back();
 
-    } // DIST_EXPR
-    //---------------------------------------------------------------------------
-    default:
-        throw PterosError("Wrong numeric node!");
+    if(m.kind == 0) {
+        // If starting subset is present than this is a subselection and
+        // we have to interpret indexes as local indexes!
+        for(const auto& r: m.ranges)
+            res.set_range(std::max(r(0)+index_shift,0), std::min(r(1)+index_shift,Natoms-1));
+        for(size_t w=0;w<dom.words.size();++w) res.words[w] &= dom.words[w];
+        return;
+    }
 
-    } // case
+    // resid or resindex
+    for(size_t w=0;w<dom.words.size();++w){
+        uint64_t bits = dom.words[w];
+        uint64_t r = 0;
+        while(bits){
+            int i = __builtin_ctzll(bits);
+            bits &= bits-1;
+            const Atom& at = sys->atoms[w*64+i];
+            int val = (m.kind == 1) ? at.resid : at.resindex;
+            for(const auto& range: m.ranges){
+                if(val>=range(0) && val<=range(1)){
+                    r |= uint64_t(1)<<i;
+                    break;
+                }
+            }
+        }
+        res.words[w] = r;
+    }
+}
+
+void SelectionParser::set_within_skin(float skin){
+    if(skin<0) throw PterosError("Skin of within should be non-negative, not {}!",skin);
+    within_skin = skin;
+    // Classification with old skin is not valid
+    for(auto& st: within_state) st = WithinState();
 }
 
+void SelectionParser::eval_within(const SelInstr &in, AtomMask &res){
+    // Outer selection is limited by current subset, inner one is in res
+    const AtomMask& src_mask = *domains.back();
+    const Vector3i& pbc = pbcs[in.a];
+    const PeriodicBox& box = sys->traj[frame].box;
+    auto& st = within_state[in.d];
+
+    // Change of the box shifts periodic images, this uses part of the skin.
+    // Shift of the image is a combination of box vectors, so it is bounded
+    // by the sum of their changes. Any distance could change by two displacements.
+    float allowed = 0.5*within_skin;
+    if(st.valid && (pbc.array()!=0).any())
+        allowed -= 0.5*(box.get_matrix()-st.ref_box).colwise().norm().sum();
+
+    bool changed = (st.src.words!=src_mask.words || st.target.words!=res.words);
+    if(st.valid && (changed || within_moved(st.atoms,st.ref,allowed,pbc))){
+        st.valid = false;
+        if(st.n_used<2){
+            // Classification was not reused, don't do it for a while
+            st.backoff = st.backoff ? std::min(2*st.backoff,64) : 4;
+            st.n_skip = st.backoff;
+        } else {
+            st.backoff = 0;
+        }
+    }
+
+    if(!st.valid){
+        Selection src(*sys), target(*sys);
+        src_mask.to_index(src._index);
+        res.to_index(target._index);
+        src.set_frame(frame);
+        target.set_frame(frame);
+
+        // Sample of atoms shows how fast they move between evaluations
+        bool fast = changed || within_moved(st.probe,st.probe_ref,allowed,pbc);
+        if(changed){
+            st.src = src_mask;
+            st.target = res;
+            st.probe.clear();
+            for(const auto* sel: {&src,&target}){
+                int step = std::max(1,int(sel->size())/128);
+                for(int k=0;k<sel->size();k+=step) st.probe.push_back(sel->index(k));
+            }
+        }
+        const auto& crd = sys->traj[frame].coord;
+        st.probe_ref.resize(st.probe.size());
+        for(size_t k=0;k<st.probe.size();++k) st.probe_ref[k] = crd[st.probe[k]];
+
+        if(fast || st.n_skip>0 || within_skin==0 || src.size()==0 || target.size()==0){
+            // Usual search if classification is not going to be reused
+            if(st.n_skip>0) --st.n_skip;
+            search_within(in.f,src,target,tmp_index,in.b,pbc);
+            res.from_index(tmp_index,Natoms);
+            return;
+        }
+
+        within_build(st,src,target,in.f,pbc);
+    }
+    ++st.n_used;
+
+    // Only the atoms close to the cutoff are tested
+    bool periodic = (pbc.array()!=0).any();
+    const auto& crd = sys->traj[frame].coord;
+    tmp_mask = st.inside;
+    tmp_index.clear();
+    for(size_t k=0;k<st.border.size();++k){
+        const Vector3f& p = crd[st.border[k]];
+        bool tie = false;
+        for(int j=st.nb_begin[k];j<st.nb_begin[k+1];++j){
+            const Vector3f& q = crd[st.nb[j]];
+            float d = periodic ? box.distance(p,q,pbc) : (p-q).norm();
+            // Rounding errors grow with coordinates, especially when they are wrapped
+            float tol = 4e-7*(p.cwiseAbs().maxCoeff()+q.cwiseAbs().maxCoeff()) + 1e-6;
+            if(d < in.f-tol){
+                tmp_mask.set(st.border[k]);
+                tie = false;
+                break;
+            }
+            if(d <= in.f+tol) tie = true;
+        }
+        if(tie) tmp_index.push_back(st.border[k]);
+    }
+
+    if(tmp_index.size()){
+        // Distances equal to cutoff within rounding errors are computed
+        // by usual search to get exactly the same result
+        Selection tie(*sys), target(*sys);
+        tie._index = tmp_index;
+        res.to_index(target._index);
+        tie.set_frame(frame);
+        target.set_frame(frame);
+        search_within(in.f,tie,target,tmp_index,false,pbc);
+        for(int i: tmp_index) tmp_mask.set(i);
+    }
+
+    for(size_t w=0;w<res.words.size();++w){
+        if(in.b){
+            // Target atoms are within zero distance from themselves
+            res.words[w] = tmp_mask.words[w] | (res.words[w] & src_mask.words[w]);
+        } else {
+            res.words[w] = tmp_mask.words[w] & ~res.words[w];
+        }
+    }
+}
+
+bool SelectionParser::within_moved(const vector<int>& atoms, const vector<Vector3f>& ref, float allowed, Vector3i_const_ref pbc){
+    if(allowed<0 || atoms.empty()) return true;
+    float allowed2 = allowed*allowed;
+
+    bool periodic = (pbc.array()!=0).any();
+    const PeriodicBox& box = sys->traj[frame].box;
+    const auto& crd = sys->traj[frame].coord;
+    for(size_t k=0;k<atoms.size();++k){
+        float d2 = periodic ? box.distance_squared(crd[atoms[k]],ref[k],pbc)
+                            : (crd[atoms[k]]-ref[k]).squaredNorm();
+        if(d2>allowed2) return true;
+    }
+    return false;
+}
+
+void SelectionParser::within_build(WithinState &st, const Selection &src, const Selection &target, float cutoff, Vector3i_const_ref pbc){
+    // Atoms closer than cutoff-skin stay inside, atoms further
+    // than cutoff+skin stay outside, others have to be tested.
+    // Target atoms are not classified since they are included or
+    // excluded depending on self flag.
+    tmp_index.clear();
+    if(cutoff>within_skin) search_within(cutoff-within_skin,src,target,tmp_index,false,pbc);
+    st.inside.from_index(tmp_index,Natoms);
+
+    search_within(cutoff+within_skin,src,target,tmp_index,false,pbc);
+    st.border.clear();
+    for(int i: tmp_index) if(!st.inside.test(i)) st.border.push_back(i);
+
+    // Neighbours of border atoms. Cutoff is slightly larger to not lose
+    // the pairs exactly at cutoff plus skin.
+    Selection border(*sys);
+    border._index = st.border;
+    border.set_frame(frame);
+    vector<Vector2i> pairs;
+    vector<float> dist;
+    if(border.size()) search_contacts(cutoff+within_skin+1e-3,border,target,pairs,dist,true,pbc);
+
+    vector<int> slot(Natoms,-1);
+    for(size_t k=0;k<st.border.size();++k) slot[st.border[k]] = k;
+    st.nb_begin.assign(st.border.size()+1,0);
+    for(const auto& p: pairs)
+        if(p(0)!=p(1)) ++st.nb_begin[slot[p(0)]+1];
+    for(size_t k=0;k<st.border.size();++k) st.nb_begin[k+1] += st.nb_begin[k];
+    st.nb.resize(st.nb_begin.back());
+    vector<int> pos(st.nb_begin.begin(),st.nb_begin.end()-1);
+    for(const auto& p: pairs)
+        if(p(0)!=p(1)) st.nb[pos[slot[p(0)]]++] = p(1);
+
+    // Reference coordinates
+    tmp_mask = st.src;
+    for(size_t w=0;w<tmp_mask.words.size();++w) tmp_mask.words[w] |= st.target.words[w];
+    tmp_mask.to_index(st.atoms);
+    const auto& crd = sys->traj[frame].coord;
+    st.ref.resize(st.atoms.size());
+    for(size_t k=0;k<st.atoms.size();++k) st.ref[k] = crd[st.atoms[k]];
+    st.ref_box = sys->traj[frame].box.get_matrix();
+
+    st.valid = true;
+    st.n_used = 0;
+}
+
+void SelectionParser::eval_by(int kind, AtomMask &res){
+    if(kind == 0){ // residue
+        auto tab = sys->topology_tables();
+
+        // Add whole residues of selected atoms
+        tmp_mask.reset(Natoms);
+        for(size_t w=0;w<res.words.size();++w){
+            uint64_t bits = res.words[w];
+            while(bits){
+                int at = w*64+__builtin_ctzll(bits);
+                bits &= bits-1;
+                if(tmp_mask.test(at)) continue; // Residue is already added
+                int r = tab->atom_residue[at];
+                if(tab->residue_contiguous(r)){
+                    tmp_mask.set_range(tab->residue_first(r),tab->residue_last(r));
+                } else {
+                    for(int k=tab->residue_begin[r];k<tab->residue_begin[r+1];++k)
+                        tmp_mask.set(tab->residue_atoms[k]);
+                }
+            }
+        }
+
+        // Restrict to the starting subset (not current subset!!!)
+        for(size_t w=0;w<res.words.size();++w) res.words[w] = tmp_mask.words[w] & root.words[w];
+
+    } else if(kind == 1) { // chain
+        // First make a set of chains we need to search
+        bool chains[256] = {false};
+        for(size_t w=0;w<res.words.size();++w){
+            uint64_t bits = res.words[w];
+            while(bits){
+                chains[(unsigned char)sys->atoms[w*64+__builtin_ctzll(bits)].chain] = true;
+                bits &= bits-1;
+            }
+        }
 
+        // Now cycle over all atoms in the starting subset (not current subset!!!)
+        for(size_t w=0;w<root.words.size();++w){
+            uint64_t bits = root.words[w];
+            uint64_t r = 0;
+            while(bits){
+                int i = __builtin_ctzll(bits);
+                bits &= bits-1;
+                if(chains[(unsigned char)sys->atoms[w*64+i].chain]) r |= uint64_t(1)<<i;
+            }
+            res.words[w] = r;
+        }
 
+    } else { // mol
+        if(!sys->force_field->ready) throw PterosError("Can't select by molecule: no topology!");
+
+        auto tab = sys->topology_tables();
+        const auto& mols = sys->force_field->molecules;
+
+        // Add whole molecules of selected atoms
+        tmp_mask.reset(Natoms);
+        for(size_t w=0;w<res.words.size();++w){
+            uint64_t bits = res.words[w];
+            while(bits){
+                int at = w*64+__builtin_ctzll(bits);
+                bits &= bits-1;
+                int m = tab->atom_molecule[at];
+                if(m>=0 && !tmp_mask.test(at)) tmp_mask.set_range(mols[m](0),mols[m](1));
+            }
+        }
 
+        // Restrict to starting subset (!)
+        for(size_t w=0;w<res.words.size();++w) res.words[w] = tmp_mask.words[w] & root.words[w];
+    }
+}
 
+void SelectionParser::run(const std::vector<SelInstr> &prog){
+    sp = 0;
+    domains.clear();
+    domains.push_back(&root);
+
+    for(const auto& in: prog){
+        switch(in.op){
+        //---------------------------------------------------------------------------
+        case SelOp::LOAD: {
+            // Precomputed result restricted to current subset
+            const auto& dom = *domains.back();
+            const auto& reg = regs[in.a];
+            auto& res = stack[sp++];
+            res.reset(Natoms);
+            for(size_t w=0;w<dom.words.size();++w) res.words[w] = reg.words[w] & dom.words[w];
+            break;
+        }
+        case SelOp::STORE:
+            regs[in.a] = stack[--sp];
+            break;
+        //---------------------------------------------------------------------------
+        case SelOp::ALL:
+            stack[sp++] = *domains.back();
+            break;
+        //---------------------------------------------------------------------------
+        case SelOp::STR: {
+            auto& res = stack[sp++];
+            res.reset(Natoms);
+            eval_str(str_match[in.a],res);
+            break;
+        }
+        case SelOp::INT: {
+            auto& res = stack[sp++];
+            res.reset(Natoms);
+            eval_int(int_match[in.a],res);
+            break;
+        }
+        //---------------------------------------------------------------------------
+        case SelOp::NUM_COMP: {
+            // Operands are computed for blocks of 64 atoms at once and
+            // comparisons give the mask of the block directly
+            const auto& dom = *domains.back();
+            const auto& num = num_code[in.a];
+            auto& res = stack[sp++];
+            res.reset(Natoms);
+            for(size_t w=0;w<dom.words.size();++w){
+                uint64_t active = dom.words[w];
+                if(!active) continue;
+                int first = w*64;
+                int n = std::min(64,Natoms-first);
+                run_numeric(num,first,n,active);
+                uint64_t m = compare_lanes(lanes[0].data(),lanes[1].data(),n,in.b);
+                if(in.c>=0) m &= compare_lanes(lanes[1].data(),lanes[2].data(),n,in.c);
+                res.words[w] = m & active;
+            }
+            break;
+        }
+        //---------------------------------------------------------------------------
+        case SelOp::NOT: {
+            const auto& dom = *domains.back();
+            auto& res = stack[sp-1];
+            for(size_t w=0;w<dom.words.size();++w) res.words[w] = dom.words[w] & ~res.words[w];
+            break;
+        }
+        case SelOp::OR: {
+            --sp;
+            auto& res = stack[sp-1];
+            for(size_t w=0;w<res.words.size();++w) res.words[w] |= stack[sp].words[w];
+            break;
+        }
+        case SelOp::AND_BEGIN:
+            // Result of the first operand is the subset for the second
+            domains.push_back(&stack[sp-1]);
+            break;
+        case SelOp::AND_END: {
+            domains.pop_back();
+            --sp;
+            auto& res = stack[sp-1];
+            for(size_t w=0;w<res.words.size();++w) res.words[w] &= stack[sp].words[w];
+            break;
+        }
+        //---------------------------------------------------------------------------
+        case SelOp::BY:
+            eval_by(in.a,stack[sp-1]);
+            break;
+        //---------------------------------------------------------------------------
+        case SelOp::WITHIN:
+            if(in.c>=0){
+                // Distance from point (with abs indexes!)
+                Selection dum1(*sys);
+                domains.back()->to_index(dum1._index);
+                dum1.set_frame(frame);
+                tmp_index.clear();
+                DistanceSearchWithin searcher(in.f,dum1,true,pbcs[in.a]);
+                searcher.search_within(vecs[in.c],tmp_index);
+                stack[sp++].from_index(tmp_index,Natoms);
+            } else {
+                // Distance between selections
+                eval_within(in,stack[sp-1]);
+            }
+            break;
+        //---------------------------------------------------------------------------
+        case SelOp::DOMAIN_PUSH:
+            domains.push_back(in.a==0 ? &all_atoms : &root);
+            break;
+        case SelOp::DOMAIN_POP:
+            domains.pop_back();
+            break;
+        //---------------------------------------------------------------------------
+        case SelOp::CENTER: {
+            // Create selection to get the center of
+            Selection sel(*sys);
+            stack[--sp].to_index(sel._index);
+            sel.set_frame(frame);
+            const Vector3i& pbc = pbcs[in.c];
+
+            if(in.b>=0){
+                // Create vector of weights
+                vector<float> w;
+                w.reserve(sel.size());
+                const auto& mask = stack[sp];
+                for(int k=0;k<int(mask.words.size());++k){
+                    uint64_t bits = mask.words[k];
+                    if(!bits) continue;
+                    run_numeric(num_code[in.b],k*64,std::min(64,Natoms-k*64),bits);
+                    while(bits){
+                        w.push_back(lanes[0][__builtin_ctzll(bits)]);
+                        bits &= bits-1;
+                    }
+                }
+                vecs[in.a] = sel.center(w,pbc);
+            } else {
+                // No weights
+                vecs[in.a] = sel.center(false,pbc);
+            }
+            break;
+        }
+        case SelOp::VEC_DIR:
+            vecs[in.a] = (vecs[in.c] - vecs[in.b]).normalized();
+            break;
+        case SelOp::VEC_NORMALIZE:
+            vecs[in.a] = vecs[in.b].normalized();
+            break;
+        case SelOp::VEC_NORMAL3: {
+            Eigen::Vector3f vec1 = vecs[in.c]-vecs[in.b];
+            Eigen::Vector3f vec2 = vecs[in.d]-vecs[in.b];
+            vecs[in.a] = vec1.cross(vec2).normalized();
+            break;
+        }
+        //---------------------------------------------------------------------------
+        default:
+            throw PterosError("Wrong selection instruction!");
+        }
+    }
+}
@@ -31,7 +31,12 @@
 
 #include <string>
 #include <vector>
+#include <array>
 #include <memory>
+#include <regex>
+#include <bitset>
+#include <string_view>
+#include <cstdint>
 
 #include "pteros/core/system.h"
 #include "peglib.h"
@@ -41,27 +46,90 @@ namespace pteros {
 // Custom annoation for peglib ast structure
 struct MyAstAnnotation {
     bool is_coord_dependent;
-    std::vector<int> precomputed;
     float numeric_value;
 };
 
 typedef peg::AstBase<MyAstAnnotation> MyAst;
 typedef std::function<void(std::vector<int>&)> result_func_t;
 
+/// Bit mask over all atoms of the system. Bit i is set if atom i is selected.
+/// Each 64-bit word corresponds to the block of 64 consecutive atoms.
+struct AtomMask {
+    std::vector<uint64_t> words;
+
+    /// Clears the mask for n atoms. Storage is not reallocated if the size is the same.
+    void reset(int n){ words.assign((n+63)/64,0); }
+    void set(int i){ words[i>>6] |= uint64_t(1)<<(i&63); }
+    bool test(int i) const { return words[i>>6] & (uint64_t(1)<<(i&63)); }
+    /// Sets all bits in the range [b:e]
+    void set_range(int b, int e);
+    /// True if any bit in the range [b:e] is set
+    bool any_in_range(int b, int e) const;
+    void from_index(const std::vector<int>& ind, int n);
+    /// Sorted indexes of set bits
+    void to_index(std::vector<int>& ind) const;
+};
+
+/// Regular expression used in selection.
+/// Simple patterns made of literals, '.', character classes and
+/// '*', '+', '?' quantifiers are matched directly without std::regex,
+/// which is very slow. Other patterns fall back to std::regex.
+class StrPattern {
+public:
+    StrPattern(const std::string& pattern);
+    /// True if the whole string matches
+    bool match(std::string_view s) const;
+
+private:
+    struct Item {
+        std::bitset<256> chars;
+        int min_rep, max_rep; // max_rep<0 means no limit
+    };
+    std::vector<Item> items;
+    bool use_regex;
+    std::regex regex;
+
+    bool parse(const std::string& p);
+    bool match_from(int k, std::string_view s, int pos) const;
+};
+
+/// Operation codes of compiled selection program
+enum class SelOp: uint8_t {
+    // Logical operations on the stack of masks
+    LOAD, STORE, ALL, STR, INT, NUM_COMP, NOT, OR, AND_BEGIN, AND_END, BY, WITHIN,
+    DOMAIN_PUSH, DOMAIN_POP,
+    // Vector registers, computed once per frame
+    CENTER, VEC_DIR, VEC_NORMALIZE, VEC_NORMAL3,
+    // Numeric operations on blocks of atoms
+    N_CONST, N_COORD, N_VEC_COMP, N_BETA, N_OCC, N_INDEX, N_RESID, N_RESINDEX,
+    N_MASS, N_CHARGE, N_NEG, N_ADD, N_SUB, N_MUL, N_DIV, N_POW,
+    N_DIST_POINT, N_DIST_LINE, N_DIST_PLANE
+};
+
+/// Single instruction of compiled selection program.
+/// Meaning of the operands depends on operation code.
+struct SelInstr {
+    SelOp op;
+    int a, b, c, d;
+    float f;
+};
+
 /**
 *   Selection parser class.
 *   It parses selection text by means of custom recursive-descendent parser
 *   The result of parsing in the abstract syntax tree (AST)
-*   stored internally in the parser class. The tree is evaluated against the system,
-*   which holds the parser.
+*   stored internally in the parser class. The tree is compiled into
+*   flat program, which is evaluated against the system,
+*   which holds the parser. Evaluation is done on bit masks of atoms,
+*   numeric expressions are computed for blocks of 64 atoms at once.
     This class should never be used directly.
 */
 class SelectionParser{
 public:
     /** True if there are coordinate keywords in selection.
     *   If true, the parser will persist (not deleted after parsing).
-    *   As a result the AST is instantly available. If coordinates change
-    *   the AST may be evaluated against the changed coordinates by means
+    *   As a result the compiled program is instantly available. If coordinates change
+    *   the program may be evaluated against the changed coordinates by means
     *   of System.update()
     */
     bool has_coord;  //There are coordinates in selection
@@ -69,35 +137,136 @@ public:
     SelectionParser(std::vector<int>* subset = nullptr);
     /// Destructor
     virtual ~SelectionParser();
-    /// Generates AST from selection string
+    /// Generates AST from selection string and compiles it
     void create_ast(std::string& sel_str, System *system);
-    /// Apply ast to the given frame. Fills the vector passed from
+    /// Apply compiled program to the given frame. Fills the vector passed from
     /// enclosing System with selection indexes.
     void apply_ast(std::size_t fr, std::vector<int>& result);
+    /// Sets the skin (nm) used to re-evaluate within incrementally.
+    /// Zero disables incremental evaluation.
+    void set_within_skin(float skin);
 
 private:
     /// AST structure 
     std::shared_ptr<MyAst> tree;
 
     // AST evaluation stuff
-    System* sys;
+    const System* sys;
     int Natoms;
     int frame;    
 
-    void eval_node(const std::shared_ptr<MyAst> &node, std::vector<int>& result);
-    std::function<float(int)> get_numeric(const std::shared_ptr<MyAst>& node);
-    Eigen::Vector3f get_vector(const std::shared_ptr<MyAst> &node);
-
     std::vector<int>* starting_subset;
-    std::vector<int>* current_subset;
 
-    void precompute(std::shared_ptr<MyAst> &node);
-    void optimize_numeric(std::shared_ptr<MyAst> &node);
-};
+    // Compilation of the AST
+    struct StrMatch {
+        // Matched field, nullptr for chain
+        InternedString Atom::* field;
+        std::vector<std::string> strings;
+        std::vector<StrPattern> regexes;
+        // Result for each string id: 0 - unknown, 1 - match, 2 - no match.
+        // Patterns are matched once for each distinct string.
+        std::vector<char> cache;
+    };
 
-}
+    struct IntMatch {
+        // 0 - index, 1 - resid, 2 - resindex
+        int kind;
+        std::vector<Eigen::Vector2i> ranges;
+    };
 
+    /// Code, which is not coordinate-dependent. Executed once.
+    std::vector<SelInstr> setup_code;
+    /// Code executed for each frame
+    std::vector<SelInstr> code;
+    /// Numeric expressions evaluated for blocks of atoms
+    std::vector<std::vector<SelInstr>> num_code;
+    /// Results of setup code
+    std::vector<AtomMask> regs;
+    /// Constant vectors and vectors computed for current frame
+    std::vector<Eigen::Vector3f> vecs;
+    std::vector<Eigen::Vector3i> pbcs;
+    std::vector<StrMatch> str_match;
+    std::vector<IntMatch> int_match;
+    /// Atoms, which are allowed in selection (all atoms or starting subset)
+    AtomMask root;
+    AtomMask all_atoms;
+    /// Shift of local indexes in subselections
+    int index_shift;
 
+    // Code, which is currently generated and its stack depth
+    std::vector<SelInstr>* out;
+    int depth;
+    int max_depth;
+    int max_lanes;
+    // Atoms, over which current node is evaluated: 0 - all atoms, 1 - root
+    int base_domain;
 
+    void emit(SelOp op, int a=0, int b=0, int c=0, int d=0, float f=0);
+    void compile(std::shared_ptr<MyAst>& node);
+    void compile_numeric(const std::shared_ptr<MyAst>& node, std::vector<SelInstr>& prog);
+    int compile_vector(const std::shared_ptr<MyAst>& node);
+    int add_numeric(const std::shared_ptr<MyAst>& node);
+    int add_pbc(const Eigen::Vector3i& pbc);
 
+    // Evaluation state
+    std::vector<AtomMask> stack;
+    int sp;
+    std::vector<const AtomMask*> domains;
+    std::vector<std::array<float,64>> lanes;
+    std::vector<int> tmp_index;
+    AtomMask tmp_mask;
 
+    // State of within between evaluations. If atoms of both selections are
+    // the same as on previous evaluation, source atoms are classified once
+    // as inside, outside or close to the cutoff. While no atom moves further
+    // than half of the skin, only the atoms close to the cutoff are tested.
+    // Checking the motion still reads coordinates of all atoms of both
+    // selections on each evaluation, only the distance search is saved.
+    struct WithinState {
+        // Source and target atoms on previous evaluation
+        AtomMask src, target;
+        bool valid;
+        // Number of evaluations done with current classification
+        int n_used;
+        // Number of evaluations to do without classification if it is not reused
+        // because atoms move too fast or change, and current back-off length
+        int n_skip, backoff;
+        // Sample of atoms and their coordinates on previous evaluation
+        std::vector<int> probe;
+        std::vector<Eigen::Vector3f> probe_ref;
+        // Atoms of both selections and their coordinates at classification
+        std::vector<int> atoms;
+        std::vector<Eigen::Vector3f> ref;
+        Eigen::Matrix3f ref_box;
+        // Source atoms, which stay within cutoff
+        AtomMask inside;
+        // Source atoms close to the cutoff, which have to be tested,
+        // and their neighbours within cutoff plus skin
+        std::vector<int> border, nb_begin, nb;
+
+        WithinState(): valid(false), n_used(0), n_skip(0), backoff(0) {}
+        // Copy starts from scratch
+        WithinState(const WithinState&): WithinState() {}
+        WithinState& operator=(const WithinState&){
+            src.words.clear();
+            target.words.clear();
+            valid = false;
+            n_used = n_skip = backoff = 0;
+            return *this;
+        }
+    };
+    float within_skin;
+    std::vector<WithinState> within_state;
+    void eval_within(const SelInstr& in, AtomMask& res);
+    bool within_moved(const std::vector<int>& atoms, const std::vector<Eigen::Vector3f>& ref,
+                      float allowed, Vector3i_const_ref pbc);
+    void within_build(WithinState& st, const Selection& src, const Selection& target, float cutoff, Vector3i_const_ref pbc);
+
+    void run(const std::vector<SelInstr>& prog);
+    void run_numeric(const std::vector<SelInstr>& prog, int first, int n, uint64_t active);
+    void eval_str(StrMatch& m, AtomMask& res);
+    void eval_int(const IntMatch& m, AtomMask& res);
+    void eval_by(int kind, AtomMask& res);
+};
+
+}
@@ -35,6 +35,8 @@
 #include "pteros/core/file_handler.h"
 #include "pteros/core/utilities.h"
 #include "selection_parser.h"
+#include "selection_cache.h"
+#include "topology_tables.h"
 #include "pteros/core/logging.h"
 #include <utility>
 
@@ -48,17 +50,17 @@ using namespace fmt;
 #endif
 
 // Base constructor of the system class
-System::System() {
+System::System(): sel_cache(new SelectionCache), topo_revision(1) {
 
 }
 
 // Construnt system from file
-System::System(string fname) {
+System::System(string fname): sel_cache(new SelectionCache), topo_revision(1) {
     clear();
     load(fname);
 }
 
-System::System(const System& other){
+System::System(const System& other): sel_cache(new SelectionCache), topo_revision(1) {
     if(&other==this) return;
     clear();
     atoms = other.atoms;
@@ -66,7 +68,7 @@ System::System(const System& other){
     force_field = other.force_field;
 }
 
-System::System(const Selection &sel){
+System::System(const Selection &sel): sel_cache(new SelectionCache), topo_revision(1) {
     if(sel.get_system()==this) throw PterosError("Can't construct system from selection of itself!");
     append(sel);
 }
@@ -74,6 +76,7 @@ System::System(const Selection &sel){
 
 System& System::operator=(const System& other){
     if(&other==this) return *this;
+    TopologyChange change(*this);
     clear();
     atoms = other.atoms;
     traj = other.traj;
@@ -83,9 +86,10 @@ System& System::operator=(const System& other){
 
 // Clear the system (i.e. before reading new system from file)
 void System::clear(){
+    TopologyChange change(*this);
     atoms.clear();
     traj.clear();
-    force_field.clear();
+    force_field.reset();
     filter.clear();
     filter_text = "";
 }
@@ -109,8 +113,9 @@ void System::filter_atoms()
     }
 
     vector<Atom> tmp = atoms;
-    atoms.resize(filter.size());
-    for(int i=0; i<filter.size(); ++i) atoms[i] = tmp[filter[i]];
+    vector<Atom>& at = atoms.detached();
+    at.resize(filter.size());
+    for(int i=0; i<filter.size(); ++i) at[i] = tmp[filter[i]];
 }
 
 void System::filter_coord(int fr)
@@ -146,15 +151,18 @@ void System::load(string fname, int b, int e, int skip, std::function<bool(Syste
             // We have single frame. Read it directly here
             Frame fr;
             frame_append(fr);
-            f->read(this, &frame(num_frames()-1), c);
+            {
+                TopologyChange change(*this);
+                f->read(this, &frame(num_frames()-1), c);
 
-            filter_atoms();
-            filter_coord(num_frames()-1);
+                filter_atoms();
+                filter_coord(num_frames()-1);
 
-            check_num_atoms_in_last_frame(*this);
-            ++num_stored;
+                check_num_atoms_in_last_frame(*this);
+                ++num_stored;
 
-            assign_resindex();
+                assign_resindex();
+            }
 
             // Call a callback if asked
             if(on_frame) on_frame(this,num_frames()-1);            
@@ -166,6 +174,7 @@ void System::load(string fname, int b, int e, int skip, std::function<bool(Syste
             c.coord(false);
             c.traj(false);
 
+            TopologyChange change(*this);
             f->read(this, nullptr, c);
             filter_atoms();
             assign_resindex();
@@ -253,6 +262,7 @@ void System::load(string fname, int b, int e, int skip, std::function<bool(Syste
 
         } else if(f->get_content_type().top()) {
             // This is topology file, read only topology
+            TopologyChange change(*this);
             f->read(this, nullptr, FileContent().top(true) );
             // For topology filtering is not possible
             if(!filter.empty() || filter_text!="") throw PterosError("Filtering is not possible when reading topology!");
@@ -280,17 +290,21 @@ bool System::load(const std::unique_ptr<FileHandler>& handler, FileContent what,
         if(what.coord()){
             Frame fr;
             frame_append(fr);
-            handler->read(this, &frame(num_frames()-1), c);
+            {
+                TopologyChange change(*this);
+                handler->read(this, &frame(num_frames()-1), c);
 
-            filter_atoms();
-            filter_coord(num_frames()-1);
+                filter_atoms();
+                filter_coord(num_frames()-1);
 
-            check_num_atoms_in_last_frame(*this);
-            if(what.atoms()) assign_resindex();
+                check_num_atoms_in_last_frame(*this);
+                if(what.atoms()) assign_resindex();
+            }
             // Call a callback if asked
             if(on_frame) on_frame(this,num_frames()-1);
         } else {
             // Not asked for coordinates
+            TopologyChange change(*this);
             handler->read(this, nullptr, c);
             filter_coord(num_frames()-1);
             if(what.atoms()) assign_resindex();
@@ -320,9 +334,9 @@ bool System::load(const std::unique_ptr<FileHandler>& handler, FileContent what,
     return true;
 }
 
-void System::write(string fname, int b, int e) const
+void System::write(string fname, int b, int e, float prec) const
 {
-    select_all().write(fname,b,e);
+    select_all().write(fname,b,e,prec);
 }
 
 void System::write(const std::unique_ptr<FileHandler> &handler, FileContent what, int b, int e) const
@@ -474,42 +488,46 @@ void System::frame_append(const Frame& fr){
 }
 
 void System::assign_resindex(int start){
+    TopologyChange change(*this);
     if(start<0) start=0;
 
-    int curres = atoms[start].resid;
-    int curchain = atoms[start].chain;
-    string curresname = atoms[start].resname;
+    vector<Atom>& at = atoms.detached();
+    int curres = at[start].resid;
+    int curchain = at[start].chain;
+    string curresname = at[start].resname;
     int cur = 0;
-    if(start>0) cur = atoms[start].resindex;
-    for(int i=start; i<atoms.size(); ++i){
-        if( atoms[i].resid!=curres || atoms[i].chain!=curchain || atoms[i].resname!=curresname ){
+    if(start>0) cur = at[start].resindex;
+    for(int i=start; i<at.size(); ++i){
+        if( at[i].resid!=curres || at[i].chain!=curchain || at[i].resname!=curresname ){
             ++cur;
-            curres = atoms[i].resid;
-            curchain = atoms[i].chain;
-            curresname = atoms[i].resname;
+            curres = at[i].resid;
+            curchain = at[i].chain;
+            curresname = at[i].resname;
         }
-        atoms[i].resindex = cur;
+        at[i].resindex = cur;
     }
 }
 
 void System::sort_by_resindex()
 {
+    TopologyChange change(*this);
     // Make and array of indexes to shuffle
     vector<int> ind(atoms.size());
     for(int i=0;i<ind.size();++i) ind[i] = i;
+    vector<Atom>& at = atoms.detached();
     // Sort indexes
     sort(ind.begin(),ind.end(),
-       [this](int i, int j){
-        if(atom(i).resindex == atom(j).resindex){
+       [&at](int i, int j){
+        if(at[i].resindex == at[j].resindex){
             return (i<j);
         } else {
-            return (atom(i).resindex < atom(j).resindex);
+            return (at[i].resindex < at[j].resindex);
         }
        }
     );
     // Now shuffle atoms and coordinates according to indexes
-    vector<Atom> tmp(atoms); //temporary
-    for(int i=0;i<ind.size();++i) atoms[i] = tmp[ind[i]];
+    vector<Atom> tmp(at); //temporary
+    for(int i=0;i<ind.size();++i) at[i] = tmp[ind[i]];
 
     std::vector<Eigen::Vector3f> tmpv;
     for(int j=0; j<traj.size(); ++j){ // Over all frames
@@ -528,6 +546,48 @@ void System::sort_by_resindex()
     }
 }
 
+System::TopologyChange::TopologyChange(System &s): sys(s) {}
+
+System::TopologyChange::~TopologyChange()
+{
+    // References handed out before are not valid after topology change
+    sys.release_references();
+    ++sys.topo_revision;
+}
+
+void System::release_references()
+{
+    atoms.release_references();
+    force_field.release_references();
+}
+
+uint64_t System::topology_revision() const
+{
+    if(atoms.is_referenced() || force_field.is_referenced()) return 0;
+    return topo_revision;
+}
+
+std::shared_ptr<const TopologyTables> System::topology_tables() const
+{
+    uint64_t rev = topology_revision();
+    auto build = [&](){
+        auto tab = std::make_shared<TopologyTables>();
+        tab->build(atoms,force_field->molecules,force_field->ready);
+        tab->revision = rev;
+        return tab;
+    };
+
+    // Atoms could be modified through references, no caching
+    if(rev==0) return build();
+
+    lock_guard<mutex> lock(topo_mutex);
+    if(!topo_tables || topo_tables->revision!=rev){
+        // Tables are not modified in place since they could be used by others
+        topo_tables = build();
+    }
+    return topo_tables;
+}
+
 void System::clear_vel()
 {
     for(int j=0; j<traj.size(); ++j) traj[j].vel.clear();
@@ -539,6 +599,7 @@ void System::clear_force()
 }
 
 Selection System::atoms_dup(const vector<int>& ind){
+    TopologyChange change(*this);
     // Sanity check
     if(!ind.size()) throw PterosError("No atoms to duplicate!");
     for(int i=0; i<ind.size(); ++i){
@@ -558,9 +619,10 @@ Selection System::atoms_dup(const vector<int>& ind){
     }
 
     // Now add atoms
+    vector<Atom>& at = atoms.detached();
     for(int i=0; i<ind.size(); ++i){
         // Add new atom
-        atoms.push_back(atoms[ind[i]]);
+        at.push_back(at[ind[i]]);
         // Add new coordinate slot
         for(int j=0; j<traj.size(); ++j){
             traj[j].coord.push_back(traj[j].coord[ind[i]]);
@@ -574,6 +636,7 @@ Selection System::atoms_dup(const vector<int>& ind){
 }
 
 Selection System::atoms_add(const vector<Atom>& atm, const vector<Vector3f>& crd){
+    TopologyChange change(*this);
     // Sanity check
     if(!atm.size()) throw PterosError("No atoms to add!");
     if(atm.size()!=crd.size())
@@ -608,6 +671,7 @@ Selection System::atoms_add(const vector<Atom>& atm, const vector<Vector3f>& crd
 }
 
 void System::atoms_delete(const std::vector<int> &ind){
+    TopologyChange change(*this);
     int i,fr;
 
     // Sanity check
@@ -618,8 +682,9 @@ void System::atoms_delete(const std::vector<int> &ind){
     }
 
     // Mark atoms for deletion by assigning negative mass
+    vector<Atom>& at = atoms.detached();
     for(i=0;i<ind.size();++i)
-        atoms[ind[i]].mass = -1.0;
+        at[ind[i]].mass = -1.0;
 
     // Cycle over all atoms and keep only those with positive mass
     vector<pteros::Atom> tmp = atoms;
@@ -649,17 +714,19 @@ void System::atoms_delete(const std::vector<int> &ind){
 
 void System::atom_move(int i, int j)
 {
+    TopologyChange change(*this);
     // Sanity check
     if(i<0 || i>=num_atoms()) throw PterosError(format("Index of atom to move ({}}) is out of range ({}:{})!", i,0,num_atoms()));
     if(j<0 || j>=num_atoms()) throw PterosError(format("Target index to move ({}}) is out of range ({}:{}})!", j,0,num_atoms()));
     if(i==j) return; // Nothing to do
 
     // Move atom
-    auto at = atom(i);
+    vector<Atom>& atm = atoms.detached();
+    auto at = atm[i];
 
     if(i<j){
-        for(int a=i+1; a<=j; ++a) atom(a-1) = atom(a);
-        atom(j) = at;
+        for(int a=i+1; a<=j; ++a) atm[a-1] = atm[a];
+        atm[j] = at;
 
         for(int fr=0; fr<num_frames(); ++fr){
             auto tmp = xyz(i,fr);
@@ -679,8 +746,8 @@ void System::atom_move(int i, int j)
             }
         }
     } else {
-        for(int a=i-1; a>=j; --a) atom(a+1) = atom(a);
-        atom(j) = at;
+        for(int a=i-1; a>=j; --a) atm[a+1] = atm[a];
+        atm[j] = at;
 
         for(int fr=0; fr<num_frames(); ++fr){
             auto tmp = xyz(i,fr);
@@ -711,6 +778,7 @@ Selection System::atom_clone(int source)
 
 void System::atom_swap(int i, int j)
 {
+    TopologyChange change(*this);
     if(i<0 || i>=num_atoms()) throw PterosError(format("Index of atom 1 to swap ({}}) is out of range ({}:{})!", i,0,num_atoms()));
     if(j<0 || j>=num_atoms()) throw PterosError(format("Index of atom 2 to swap ({}}) is out of range ({}:{}})!", j,0,num_atoms()));
 
@@ -723,6 +791,7 @@ void System::atom_swap(int i, int j)
 
 Selection System::atom_add_1h(int target, int at1, int at2, int at3, float dist, bool pbc)
 {
+    TopologyChange change(*this);
     Selection newat = atoms_dup({target});
     newat.name(0) = "H";
     newat.mass(0) = 1.0;
@@ -754,6 +823,7 @@ Selection System::atom_add_1h(int target, int at1, int at2, int at3, float dist,
 
 Selection System::atom_add_2h(int target, int at1, int at2, float dist, bool pbc)
 {
+    TopologyChange change(*this);
     Selection newat1 = atoms_dup({target});
     newat1.name(0) = "H";
     newat1.mass(0) = 1.0;
@@ -788,6 +858,7 @@ Selection System::atom_add_2h(int target, int at1, int at2, float dist, bool pbc
 
 Selection System::atom_add_3h(int target, int at1, float dist, bool pbc)
 {
+    TopologyChange change(*this);
     Selection newat1 = atoms_dup({target});
     newat1.name(0) = "H";
     newat1.mass(0) = 1.0;
@@ -819,6 +890,7 @@ Selection System::atom_add_3h(int target, int at1, float dist, bool pbc)
 }
 
 Selection System::append(const System &sys){
+    TopologyChange change(*this);
     //Sanity check
     if(num_frames()>0 && num_frames()!=sys.num_frames())
         throw PterosError("Can't merge systems with different number of frames ({} and {})!",num_frames(),sys.num_frames());
@@ -849,6 +921,7 @@ Selection System::append(const System &sys){
 }
 
 Selection System::append(const Selection &sel, bool current_frame){
+    TopologyChange change(*this);
     //Sanity check
     if(sel.size()==0) return Selection(*this); // In case of empty selection just exit
     if(!current_frame && num_frames()>0 && num_frames()!=sel.get_system()->num_frames())
@@ -902,6 +975,7 @@ Selection System::append(const Selection &sel, bool current_frame){
 
 Selection System::append(const Atom &at, Vector3f_const_ref coord)
 {
+    TopologyChange change(*this);
     // If no frames create one
     if(num_frames()==0){
         traj.resize(1);
@@ -1065,6 +1139,7 @@ void System::remove(Selection &sel)
 
 void System::distribute(const Selection sel, Vector3i_const_ref ncopies, Matrix3f_const_ref shift)
 {
+    TopologyChange change(*this);
     if(sel.get_system()!=this) throw PterosError("distribute needs selection from the same system!");
 
     Vector3f v;
@@ -1253,7 +1328,7 @@ inline float Coulomb_en_kernel(float q1, float q2, float r_inv){
 namespace pteros {
 
 Vector2f get_energy_for_list(const vector<Vector2i>& pairs, const vector<float>& dist, const System& sys, vector<Vector2f>* pair_en){
-    ForceField& ff = const_cast<System&>(sys).get_force_field();
+    const ForceField& ff = sys.get_force_field();
     Vector2f e_total(0,0);
 
     if(pair_en) pair_en->resize(pairs.size());
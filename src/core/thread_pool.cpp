@@ -0,0 +1,309 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+
+#include "pteros/core/thread_pool.h"
+#include "pteros/core/logging.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <exception>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+using namespace pteros;
+
+// True inside the worker threads and inside parallel_for in the calling thread
+static thread_local bool inside_pool = false;
+
+class ThreadPool::ThreadPoolImpl {
+public:
+    ThreadPoolImpl(){
+        int n = 0;
+        if(const char* env = getenv("PTEROS_NUM_THREADS")) n = atoi(env);
+        num_threads = n>0 ? n : hardware_threads();
+        pin = false;
+        stop = false;
+        generation = 0;
+        n_active = 0;
+    }
+
+    ~ThreadPoolImpl(){
+        shutdown();
+    }
+
+    static int hardware_threads(){
+        int n = std::thread::hardware_concurrency();
+        return n>0 ? n : 1;
+    }
+
+    void set_num_threads(int n){
+        lock_guard<mutex> job_lock(job_mutex);
+        if(n<=0) n = hardware_threads();
+        if(n==num_threads) return;
+        shutdown();
+        num_threads = n;
+    }
+
+    void set_pinning(bool val){
+        lock_guard<mutex> job_lock(job_mutex);
+        if(val==pin) return;
+        shutdown();
+        pin = val;
+    }
+
+    void parallel_for(int N, int block, const function<void(int,int,int)>& f){
+        if(N<=0) return;
+        if(block<1) block = 1;
+        int nblocks = (N+block-1)/block;
+
+        if(num_threads==1 || nblocks==1 || inside_pool){
+            f(0,N,0);
+            return;
+        }
+
+        // If pool is used by other thread work serially
+        unique_lock<mutex> job_lock(job_mutex,try_to_lock);
+        if(!job_lock.owns_lock()){
+            f(0,N,0);
+            return;
+        }
+
+        if(workers.empty()) start();
+
+        // Initial even distribution of blocks between threads
+        for(int i=0;i<num_threads;++i){
+            ranges[i]->b = i*nblocks/num_threads;
+            ranges[i]->e = (i+1)*nblocks/num_threads;
+        }
+
+        func = &f;
+        job_size = N;
+        block_size = block;
+        error = nullptr;
+
+        {
+            lock_guard<mutex> lk(m);
+            n_active = workers.size();
+            ++generation;
+        }
+        cv_start.notify_all();
+
+        // Calling thread works as thread 0
+        inside_pool = true;
+        run_share(0);
+        inside_pool = false;
+
+        // Wait for workers
+        {
+            unique_lock<mutex> lk(m);
+            cv_done.wait(lk,[this]{return n_active==0;});
+        }
+
+        func = nullptr;
+        if(error) rethrow_exception(error);
+    }
+
+    // Atomic since they are read without locking by get_num_threads() and get_pinning()
+    atomic<int> num_threads;
+    atomic<bool> pin;
+
+private:
+    // Range of blocks owned by each thread
+    struct Range {
+        mutex m;
+        int b,e;
+    };
+
+    vector<thread> workers;
+    vector<unique_ptr<Range>> ranges;
+
+    // Serializes parallel_for calls and configuration changes
+    mutex job_mutex;
+
+    // Synchronization with workers
+    mutex m;
+    condition_variable cv_start, cv_done;
+    unsigned long generation;
+    int n_active;
+    bool stop;
+
+    // Current job
+    const function<void(int,int,int)>* func;
+    int job_size, block_size;
+    exception_ptr error;
+    mutex error_mutex;
+
+    void start(){
+        ranges.clear();
+        for(int i=0;i<num_threads;++i) ranges.emplace_back(new Range);
+
+        stop = false;
+        for(int i=1;i<num_threads;++i){
+            // Workers only react to the jobs started after their creation
+            workers.emplace_back(&ThreadPoolImpl::worker_loop,this,i,generation);
+#ifdef __linux__
+            if(pin){
+                cpu_set_t cpuset;
+                CPU_ZERO(&cpuset);
+                CPU_SET(i % hardware_threads(), &cpuset);
+                pthread_setaffinity_np(workers.back().native_handle(),sizeof(cpu_set_t),&cpuset);
+            }
+#endif
+        }
+        LOG()->debug("Thread pool started with {} threads",num_threads);
+    }
+
+    void shutdown(){
+        if(workers.empty()) return;
+        {
+            lock_guard<mutex> lk(m);
+            stop = true;
+        }
+        cv_start.notify_all();
+        for(auto& t: workers) t.join();
+        workers.clear();
+    }
+
+    void worker_loop(int id, unsigned long seen){
+        inside_pool = true;
+        while(true){
+            {
+                unique_lock<mutex> lk(m);
+                cv_start.wait(lk,[&]{return stop || generation!=seen;});
+                if(stop) return;
+                seen = generation;
+            }
+
+            run_share(id);
+
+            {
+                lock_guard<mutex> lk(m);
+                if(--n_active==0) cv_done.notify_one();
+            }
+        }
+    }
+
+    // Take next block from own range
+    bool pop_own(int id, int& blk){
+        Range& r = *ranges[id];
+        lock_guard<mutex> lk(r.m);
+        if(r.b>=r.e) return false;
+        blk = r.b++;
+        return true;
+    }
+
+    // Steal half of remaining blocks from other thread
+    bool steal(int id){
+        for(int k=1;k<num_threads;++k){
+            Range& victim = *ranges[(id+k)%num_threads];
+            int b,e;
+            {
+                lock_guard<mutex> lk(victim.m);
+                int n = victim.e-victim.b;
+                if(n<=0) continue;
+                e = victim.e;
+                b = e-(n+1)/2;
+                victim.e = b;
+            }
+            Range& own = *ranges[id];
+            lock_guard<mutex> lk(own.m);
+            own.b = b;
+            own.e = e;
+            return true;
+        }
+        return false;
+    }
+
+    void run_share(int id){
+        int blk;
+        while(pop_own(id,blk) || (steal(id) && pop_own(id,blk))){
+            int b = blk*block_size;
+            int e = std::min(job_size,b+block_size);
+            try {
+                (*func)(b,e,id);
+            } catch(...) {
+                lock_guard<mutex> lk(error_mutex);
+                if(!error) error = current_exception();
+            }
+        }
+    }
+};
+
+
+ThreadPool &ThreadPool::instance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool()
+{
+    p = unique_ptr<ThreadPoolImpl>(new ThreadPoolImpl());
+}
+
+ThreadPool::~ThreadPool()
+{
+
+}
+
+void ThreadPool::set_num_threads(int n)
+{
+    p->set_num_threads(n);
+}
+
+int ThreadPool::get_num_threads() const
+{
+    return p->num_threads;
+}
+
+void ThreadPool::set_pinning(bool pin)
+{
+    p->set_pinning(pin);
+}
+
+bool ThreadPool::get_pinning() const
+{
+    return p->pin;
+}
+
+void ThreadPool::parallel_for(int N, int block, const std::function<void (int, int, int)> &func)
+{
+    p->parallel_for(N,block,func);
+}
+
+
+
@@ -0,0 +1,86 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+#include "topology_tables.h"
+#include <algorithm>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+void TopologyTables::build(const vector<Atom> &atoms, const vector<Vector2i> &molecules, bool has_molecules)
+{
+    int N = atoms.size();
+
+    atom_residue.resize(N);
+    residue_begin.clear();
+    residue_atoms.resize(N);
+    atom_molecule.clear();
+
+    int nres = 0;
+    if(N){
+        // Numbers of residues are assigned in the order of resindexes
+        int lo = atoms[0].resindex, hi = lo;
+        for(const auto& a: atoms){
+            lo = std::min(lo,a.resindex);
+            hi = std::max(hi,a.resindex);
+        }
+
+        if(int64_t(hi)-lo < 4*int64_t(N)){
+            // Resindexes are dense (normal case), use lookup table
+            vector<int> num(hi-lo+1,-1);
+            for(const auto& a: atoms) num[a.resindex-lo] = 0;
+            for(int& n: num) if(n==0) n = nres++;
+            for(int i=0;i<N;++i) atom_residue[i] = num[atoms[i].resindex-lo];
+        } else {
+            // Sparse resindexes set by hand
+            vector<int> vals(N);
+            for(int i=0;i<N;++i) vals[i] = atoms[i].resindex;
+            sort(vals.begin(),vals.end());
+            vals.erase(unique(vals.begin(),vals.end()),vals.end());
+            nres = vals.size();
+            for(int i=0;i<N;++i)
+                atom_residue[i] = lower_bound(vals.begin(),vals.end(),atoms[i].resindex)-vals.begin();
+        }
+    }
+
+    // Count atoms in residues and fill atoms in increasing order
+    residue_begin.assign(nres+1,0);
+    for(int r: atom_residue) ++residue_begin[r+1];
+    for(int r=0;r<nres;++r) residue_begin[r+1] += residue_begin[r];
+    vector<int> pos(residue_begin.begin(),residue_begin.end()-1);
+    for(int i=0;i<N;++i) residue_atoms[pos[atom_residue[i]]++] = i;
+
+    if(has_molecules){
+        atom_molecule.assign(N,-1);
+        for(int j=0;j<int(molecules.size());++j){
+            int e = std::min(molecules[j](1),N-1);
+            for(int i=std::max(molecules[j](0),0);i<=e;++i) atom_molecule[i] = j;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is a part of
+ *
+ * ============================================
+ * ###   Pteros molecular modeling library  ###
+ * ============================================
+ *
+ * https://github.com/yesint/pteros
+ *
+ * (C) 2009-2021, Semen Yesylevskyy
+ *
+ * All works, which use Pteros, should cite the following papers:
+ *
+ *  1.  Semen O. Yesylevskyy, "Pteros 2.0: Evolution of the fast parallel
+ *      molecular analysis library for C++ and python",
+ *      Journal of Computational Chemistry, 2015, 36(19), 1480–1488.
+ *      doi: 10.1002/jcc.23943.
+ *
+ *  2.  Semen O. Yesylevskyy, "Pteros: Fast and easy to use open-source C++
+ *      library for molecular analysis",
+ *      Journal of Computational Chemistry, 2012, 33(19), 1632–1636.
+ *      doi: 10.1002/jcc.22989.
+ *
+ * This is free software distributed under Artistic License:
+ * http://www.opensource.org/licenses/artistic-license-2.0.php
+ *
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <Eigen/Core>
+#include "pteros/core/atom.h"
+
+namespace pteros {
+
+/// Index tables of residues and molecules of the system.
+/// Residues are groups of atoms with the same resindex numbered in
+/// the order of increasing resindex. Atoms of residues are stored in
+/// compressed form: atoms of residue r are residue_atoms[residue_begin[r]]
+/// to residue_atoms[residue_begin[r+1]-1] in increasing order.
+/// Tables are built by the System on demand and rebuilt after topology changes.
+struct TopologyTables {
+    /// Residue of each atom
+    std::vector<int> atom_residue;
+    std::vector<int> residue_begin;
+    std::vector<int> residue_atoms;
+    /// Molecule of each atom or -1 if atom is not in any molecule.
+    /// Empty if there is no topology.
+    std::vector<int> atom_molecule;
+    /// Revision of the system topology, for which tables are built
+    uint64_t revision;
+
+    TopologyTables(): revision(0) {}
+
+    /// Builds all tables
+    void build(const std::vector<Atom>& atoms, const std::vector<Eigen::Vector2i>& molecules, bool has_molecules);
+
+    int num_residues() const { return int(residue_begin.size())-1; }
+    int residue_size(int r) const { return residue_begin[r+1]-residue_begin[r]; }
+    /// First and last atom of residue
+    int residue_first(int r) const { return residue_atoms[residue_begin[r]]; }
+    int residue_last(int r) const { return residue_atoms[residue_begin[r+1]-1]; }
+    /// True if atoms of residue are consecutive, which is almost always the case
+    bool residue_contiguous(int r) const {
+        return residue_last(r)-residue_first(r)+1 == residue_size(r);
+    }
+};
+
+}
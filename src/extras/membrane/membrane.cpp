@@ -569,6 +569,9 @@ LipidMembrane::LipidMembrane(System *sys, const std::vector<LipidSpecies> &speci
     ind.reserve(lipids.size());
     for(auto& lip: lipids) ind.push_back(lip.mid_marker_sel.index(0));
     all_mid_sel.modify(ind);
+    // Neighbour list is set up on first use
+    mid_nlist_cutoff = 0;
+    mid_nlist_skin = 0.2;
 
     // Create groups
     groups.reserve(ngroups);
@@ -576,6 +579,14 @@ LipidMembrane::LipidMembrane(System *sys, const std::vector<LipidSpecies> &speci
     log->info("{} groups created",ngroups);
 }
 
+void LipidMembrane::set_neighbour_skin(float skin)
+{
+    if(skin<0) throw PterosError("Skin of neighbour list should be non-negative!");
+    mid_nlist_skin = skin;
+    // Set up again on next frame
+    mid_nlist_cutoff = 0;
+}
+
 void LipidMembrane::reset_groups(){
     for(auto& gr: groups){
         gr.reset();
@@ -593,7 +604,13 @@ void LipidMembrane::compute_properties(float d, bool use_external_normal, Vector
     // Get connectivity
     vector<Vector2i> bon;
     vector<float> dist;
-    search_contacts(d,all_mid_sel,bon,dist,false,fullPBC);
+    // Neighbour list is set up again if cutoff or skin changes.
+    // It is rebuilt only if markers move by more than half of the skin.
+    if(d!=mid_nlist_cutoff){
+        mid_nlist.setup(d,mid_nlist_skin,all_mid_sel,false,fullPBC);
+        mid_nlist_cutoff = d;
+    }
+    mid_nlist.search_contacts(all_mid_sel,bon,dist);
 
     // Convert the list of bonds to convenient form
     // atom ==> 1 2 3...
@@ -1,6 +1,7 @@
 #include "pteros/core/selection.h"
 #include "pteros/core/logging.h"
 #include "pteros/core/utilities.h"
+#include "pteros/core/thread_pool.h"
 #include "pteros/core/pteros_error.h"
 #include "bindings_util.h"
 #include "pteros/core/version.h"
@@ -49,6 +50,10 @@ PYBIND11_MODULE(_pteros, m) {
     ;
     m.def("set_log_level",&set_log_level);
 
+    m.def("set_num_threads",[](int n){ ThreadPool::instance().set_num_threads(n); });
+    m.def("get_num_threads",[](){ return ThreadPool::instance().get_num_threads(); });
+    m.def("set_thread_pinning",[](bool pin){ ThreadPool::instance().set_pinning(pin); });
+
     m.def("angle_between_vectors",&angle_between_vectors);
     m.def("project_vector",&project_vector);
 
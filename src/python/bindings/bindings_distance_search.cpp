@@ -28,6 +28,8 @@
 
 
 #include "pteros/core/distance_search.h"
+#include "pteros/core/neighbour_list.h"
+#include "pteros/core/pteros_error.h"
 #include "bindings_util.h"
 
 namespace py = pybind11;
@@ -125,6 +127,50 @@ void make_bindings_Distance_search(py::module& m){
                     obj->search_within(target,*res_ptr,include_self);
                     return vector_to_array<int>(res_ptr);
                 },"target"_a, "include_self"_a=true)
+
+            // Batch of points as Nx3 array. Returns CSR arrays (indexes, offsets)
+            .def("search_within_points",[](DistanceSearchWithin* obj, const MatrixXf& points)
+                {
+                    if(points.cols()!=3) throw PterosError("Array of points should be Nx3!");
+                    vector<Vector3f> pts(points.rows());
+                    for(int i=0;i<pts.size();++i) pts[i] = points.row(i).transpose();
+                    std::vector<int>* res_ptr = new std::vector<int>;
+                    std::vector<int>* offsets_ptr = new std::vector<int>;
+                    obj->search_within(pts,*res_ptr,*offsets_ptr);
+                    return py::make_tuple(vector_to_array<int>(res_ptr),vector_to_array<int>(offsets_ptr));
+                },"points"_a)
+
+            .def("any_within",&DistanceSearchWithin::any_within,"coord"_a)
+    ;
+
+    py::class_<NeighbourList>(m, "NeighbourList")
+            .def(py::init<float,float,const Selection&,bool,Vector3i_const_ref>(),
+                 "d"_a,"skin"_a,"sel"_a,"abs_ind"_a=false,"pbc"_a=fullPBC)
+            .def(py::init<float,float,const Selection&,const Selection&,bool,Vector3i_const_ref>(),
+                 "d"_a,"skin"_a,"sel1"_a,"sel2"_a,"abs_ind"_a=false,"pbc"_a=fullPBC)
+
+            .def("search_contacts",[](NeighbourList* obj, const Selection& sel)
+                {
+                    std::vector<float>* dist_vec_ptr = new std::vector<float>;
+                    std::vector<Vector2i>* pairs_ptr = new std::vector<Vector2i>;
+                    obj->search_contacts(sel,*pairs_ptr,*dist_vec_ptr);
+                    py::array m = vector_to_array<int>(reinterpret_cast<std::vector<int>*>(pairs_ptr),2*pairs_ptr->size());
+                    m.resize(vector<size_t>{pairs_ptr->size(),2});
+                    return py::make_tuple(m,vector_to_array<float>(dist_vec_ptr));
+                }, "sel"_a)
+
+            .def("search_contacts",[](NeighbourList* obj, const Selection& sel1, const Selection& sel2)
+                {
+                    std::vector<float>* dist_vec_ptr = new std::vector<float>;
+                    std::vector<Vector2i>* pairs_ptr = new std::vector<Vector2i>;
+                    obj->search_contacts(sel1,sel2,*pairs_ptr,*dist_vec_ptr);
+                    py::array m = vector_to_array<int>(reinterpret_cast<std::vector<int>*>(pairs_ptr),2*pairs_ptr->size());
+                    m.resize(vector<size_t>{pairs_ptr->size(),2});
+                    return py::make_tuple(m,vector_to_array<float>(dist_vec_ptr));
+                }, "sel1"_a, "sel2"_a)
+
+            .def("invalidate",&NeighbourList::invalidate)
+            .def_property_readonly("num_rebuilds",&NeighbourList::num_rebuilds)
     ;
 }
 
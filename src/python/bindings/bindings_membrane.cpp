@@ -75,6 +75,7 @@ void make_bindings_Membrane(py::module& m){
         .def("reset_groups",&LipidMembrane::reset_groups)
         .def("compute_averages",&LipidMembrane::compute_averages)
         .def("write_averages",&LipidMembrane::write_averages,"path"_a="")
+        .def("set_neighbour_skin",&LipidMembrane::set_neighbour_skin,"skin"_a)
 
         .def_readonly("lipids",&LipidMembrane::lipids)
     ;
@@ -37,7 +37,7 @@ using namespace Eigen;
 using namespace pybind11::literals;
 
 #define DEF_PROPERTY(_name,_dtype) \
-    .def_property(#_name, [](AtomHandler* obj){return obj->_name();}, [](AtomHandler* obj,const _dtype& val){obj->_name()=val;})
+    .def_property(#_name, [](const AtomHandler* obj){return obj->_name();}, [](AtomHandler* obj,const _dtype& val){obj->_name()=val;})
 
 void make_bindings_Selection(py::module& m){
 
@@ -103,6 +103,7 @@ void make_bindings_Selection(py::module& m){
         .def("modify", py::overload_cast<const System&,const std::vector<int>&>(&Selection::modify))
         .def("modify", py::overload_cast<const System&,const std::function<void(const System&,int,std::vector<int>&)>&,int>(&Selection::modify),"sys"_a,"callback"_a,"fr"_a=0)
         .def("apply",&Selection::apply)
+        .def("set_within_skin",&Selection::set_within_skin,"skin"_a)
         .def("update",&Selection::update)
         .def("clear",&Selection::clear)
 
@@ -263,7 +264,7 @@ void make_bindings_Selection(py::module& m){
         .def("non_bond_energy", &Selection::non_bond_energy, "cutoff"_a=0.0, "pbc"_a=true)
 
         // IO
-        .def("write", py::overload_cast<string,int,int>(&Selection::write,py::const_), "fname"_a, "b"_a=-1, "e"_a=-1)
+        .def("write", py::overload_cast<string,int,int,float>(&Selection::write,py::const_), "fname"_a, "b"_a=-1, "e"_a=-1, "prec"_a=0)
 
         // Util
         .def("is_large",&Selection::is_large)
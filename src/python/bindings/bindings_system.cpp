@@ -73,7 +73,7 @@ void make_bindings_System(py::module& m){
              "fname"_a, "b"_a=0, "e"_a=-1, "skip"_a=0, "on_frame"_a=nullptr)
 
         // Writing
-        .def("write", py::overload_cast<string,int,int>(&System::write,py::const_), "fname"_a, "b"_a=0, "e"_a=-1)
+        .def("write", py::overload_cast<string,int,int,float>(&System::write,py::const_), "fname"_a, "b"_a=0, "e"_a=-1, "prec"_a=0)
 
         // Selecting
         .def("__call__", py::overload_cast<>(&System::operator()), py::keep_alive<0,1>())
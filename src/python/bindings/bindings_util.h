@@ -38,10 +38,30 @@
 #include <pybind11/stl.h>
 #include <pybind11/eigen.h>
 #include <pybind11/operators.h>
+#include "pteros/core/interned_string.h"
 
 
 namespace py = pybind11;
 
+// Interned strings are converted to and from python str
+namespace pybind11 { namespace detail {
+    template <> struct type_caster<pteros::InternedString> {
+    public:
+        PYBIND11_TYPE_CASTER(pteros::InternedString, _("str"));
+
+        bool load(handle src, bool convert) {
+            make_caster<std::string> conv;
+            if(!conv.load(src,convert)) return false;
+            value = cast_op<std::string&>(conv);
+            return true;
+        }
+
+        static handle cast(const pteros::InternedString& src, return_value_policy policy, handle parent) {
+            return make_caster<std::string>::cast(src.str(),policy,parent);
+        }
+    };
+}}
+
 // Aux function to create py::array on top of std::vector<POD>* which owns the vector
 template<class T>
 py::array vector_to_array(std::vector<T>* ptr, size_t sz=-1){
@@ -30,6 +30,7 @@
 #include "pteros/python/compiled_plugin.h"
 #include "pteros/core/pteros_error.h"
 #include "pteros/core/distance_search.h"
+#include "pteros/core/neighbour_list.h"
 #include <fstream>
 #include <map>
 #include <set>
@@ -78,6 +79,9 @@ Options:
         If cutoff==0  uses the min of VdW and Coulommb cutoffs in the force field (if available).
     -padding, default: 0.1
         Padding added to cutoff in the case of VdW radii (cutoff=-1).
+    -skin, default: 0.1
+        Skin of the neighbour list in nm. Contacts are searched
+        from scratch only when atoms move by more than half of the skin.
     -transient <true|false>, default: false
         If true the contacts with last for single frame only are recorded.
 )";
@@ -135,6 +139,9 @@ protected:
         // Keep transient contacts lasting only 1 frame?
         keep_transient = options("transient","false").as_bool();
 
+        // Neighbour list returns global indexes
+        nlist.setup(cutoff, options("skin","0.1").as_float(), sel1, sel2, true, periodic ? fullPBC : noPBC);
+
         en_f.open(options("en_file",fmt::format("energy_{}.dat",get_id())).as_string());
     }     
 
@@ -147,8 +154,7 @@ protected:
         sel1.apply();
         sel2.apply();
 
-        Vector3i pbc = periodic ? fullPBC : noPBC;
-        search_contacts(cutoff,sel1,sel2,bon,dist_vec,true,pbc); // global indexes returned!
+        nlist.search_contacts(sel1,sel2,bon,dist_vec); // global indexes returned!
 
         Vector2f total_en(0,0);
         pair_en.resize(bon.size());
@@ -353,6 +359,7 @@ private:
     Selection sel1, sel2, all;
     float cutoff;
     bool periodic;
+    NeighbourList nlist;
     map<Vector2i,Contact,comparator> atom_contacts;
     map<Vector2i,Contact,comparator> res_contacts;
     bool keep_transient;
@@ -0,0 +1,94 @@
+/*
+ * Regression test for the SIMD distance kernels.
+ * All kernels supported by current CPU should find the same points
+ * with bitwise identical distances as the scalar kernel.
+ */
+
+#include "distance_kernels.h"
+#include <vector>
+#include <random>
+#include <string>
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+using namespace pteros;
+
+struct Points {
+    vector<float> x,y,z;
+};
+
+static Points make_points(mt19937& gen, int n, float box){
+    uniform_real_distribution<float> pos(-0.2f*box,1.2f*box);
+    Points pt;
+    for(int i=0;i<n;++i){
+        pt.x.push_back(pos(gen));
+        pt.y.push_back(pos(gen));
+        pt.z.push_back(pos(gen));
+    }
+    return pt;
+}
+
+// Runs kernel and returns false if the result differs from the scalar one
+static bool compare(DistanceKernel ref, DistanceKernel k, const Points& pt, int n,
+                    const float* p, const RectPBC* pbc, float cutoff2){
+    vector<int> h1(n), h2(n);
+    vector<float> d1(n), d2(n);
+    int n1 = ref(pt.x.data(),pt.y.data(),pt.z.data(),n,p,pbc,cutoff2,h1.data(),d1.data());
+    int n2 = k(pt.x.data(),pt.y.data(),pt.z.data(),n,p,pbc,cutoff2,h2.data(),d2.data());
+    if(n1!=n2) return false;
+    if(memcmp(h1.data(),h2.data(),n1*sizeof(int))) return false;
+    if(memcmp(d1.data(),d2.data(),n1*sizeof(float))) return false;
+    // Early exit mode
+    int e1 = ref(pt.x.data(),pt.y.data(),pt.z.data(),n,p,pbc,cutoff2,nullptr,nullptr);
+    int e2 = k(pt.x.data(),pt.y.data(),pt.z.data(),n,p,pbc,cutoff2,nullptr,nullptr);
+    return e1==e2 && e1==(n1>0);
+}
+
+int main(){
+    mt19937 gen(42);
+    // Inverse extent is exact, so points at half box give exact ties in rounding
+    const float box = 4;
+
+    auto scalar = get_distance_kernel("scalar");
+    vector<string> names;
+    for(string nm: {"sse","avx2","avx512"}){
+        if(get_distance_kernel(nm)) names.push_back(nm);
+        else printf("%s kernel is not supported, skipped\n",nm.c_str());
+    }
+
+    RectPBC full = {{box,box,box},{1/box,1/box,1/box}};
+    RectPBC xy = {{box,box,0},{1/box,1/box,0}};
+
+    int ncases = 0, failed = 0;
+    for(int n: {1,3,7,8,15,16,17,31,33,100,1001}){
+        Points pt = make_points(gen,n,box);
+        for(int trial=0;trial<20;++trial){
+            float p[3] = {pt.x[trial%n],pt.y[trial%n]+0.1f,pt.z[trial%n]};
+            if(trial==0){
+                // Point 0 is at exactly half box from p in x and y
+                pt.x[0] = 1; pt.y[0] = 1;
+                p[0] = 3; p[1] = 3;
+            }
+            for(const RectPBC* pbc: {(const RectPBC*)nullptr,(const RectPBC*)&full,(const RectPBC*)&xy}){
+                // Cutoff equal to the exact distance of some point to check ties
+                vector<int> h(n);
+                vector<float> d(n);
+                scalar(pt.x.data(),pt.y.data(),pt.z.data(),n,p,pbc,1e10f,h.data(),d.data());
+                for(float cutoff2: {0.25f, 1.0f, d[trial%n], d[n/2]}){
+                    for(auto& nm: names){
+                        ++ncases;
+                        if(!compare(scalar,get_distance_kernel(nm),pt,n,p,pbc,cutoff2)){
+                            printf("%s kernel differs: n=%d trial=%d pbc=%d cutoff2=%g\n",
+                                   nm.c_str(),n,trial,pbc==&full ? 2 : (pbc ? 1 : 0),cutoff2);
+                            ++failed;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%d of %d cases passed\n",ncases-failed,ncases);
+    return failed ? 1 : 0;
+}
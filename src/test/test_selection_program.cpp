@@ -0,0 +1,160 @@
+/*
+ * Regression test for compiled text selections.
+ * Each selection is checked against the set of atoms expected from their
+ * properties. Atoms are placed on a line along X with the step of 0.1 nm,
+ * so the distances are known exactly.
+ */
+
+#include "pteros/core/system.h"
+#include "pteros/core/selection.h"
+#include "pteros/core/pteros_error.h"
+#include <vector>
+#include <string>
+#include <functional>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+static const int N = 30;
+
+// 6 residues of 5 atoms, 3 molecules of 10 atoms, 2 chains of 15 atoms
+static System make_system(){
+    System s;
+    Frame fr;
+    fr.box = PeriodicBox(Matrix3f::Identity()*3.0);
+    s.frame_append(fr);
+    vector<Atom> atoms;
+    vector<Vector3f> coord;
+    const char* names[] = {"N","CA","CB","C","O"};
+    const float masses[] = {14,12,12,12,16};
+    for(int i=0;i<N;++i){
+        Atom at;
+        at.name = names[i%5];
+        at.mass = masses[i%5];
+        at.resid = i/5+1;
+        at.resname = (i<15) ? "ALA" : "GLY";
+        at.chain = (i<15) ? 'A' : 'B';
+        at.beta = i;
+        atoms.push_back(at);
+        coord.emplace_back(0.1f*i+0.05f,0.5f,0.5f);
+    }
+    s.atoms_add(atoms,coord);
+    s.assign_resindex();
+    ForceField& ff = s.get_force_field();
+    ff.molecules = {Vector2i(0,9),Vector2i(10,19),Vector2i(20,29)};
+    ff.ready = true;
+    return s;
+}
+
+static float x(int i){ return 0.1f*i+0.05f; }
+
+static int failed = 0;
+
+static void check(const Selection& sel, function<bool(int)> expected, const string& what){
+    vector<int> ref;
+    for(int i=0;i<N;++i) if(expected(i)) ref.push_back(i);
+    bool ok = (sel.get_index()==ref);
+    if(!ok){
+        printf("'%s': FAILED\n  got:",what.c_str());
+        for(int i: sel.get_index()) printf(" %d",i);
+        printf("\n  expected:");
+        for(int i: ref) printf(" %d",i);
+        printf("\n");
+        ++failed;
+    }
+}
+
+int main(){
+    System s = make_system();
+
+    vector<pair<string,function<bool(int)>>> table {
+        // Keywords
+        {"all",                         [](int){ return true; }},
+        {"name CA",                     [](int i){ return i%5==1; }},
+        {"name CA CB",                  [](int i){ return i%5==1 || i%5==2; }},
+        {"name 'C.*'",                  [](int i){ return i%5>=1 && i%5<=3; }},
+        {"name \"C[AB]\" O",            [](int i){ return i%5==1 || i%5==2 || i%5==4; }},
+        {"resname GLY",                 [](int i){ return i>=15; }},
+        {"chain A",                     [](int i){ return i<15; }},
+        {"resname ALA and not name N O",[](int i){ return i<15 && i%5>=1 && i%5<=3; }},
+        {"(name CA or name CB) and resid 1", [](int i){ return i==1 || i==2; }},
+        {"not resid 1-5",               [](int i){ return i>=25; }},
+        // Ranges
+        {"resid 2-3",                   [](int i){ return i>=5 && i<15; }},
+        {"resid 2 to 3 5",              [](int i){ return (i>=5 && i<15) || (i>=20 && i<25); }},
+        {"resid 1:2",                   [](int i){ return i<10; }},
+        {"index 3-7 12",                [](int i){ return (i>=3 && i<=7) || i==12; }},
+        {"resindex 0 5",                [](int i){ return i<5 || i>=25; }},
+        // Numeric comparisons
+        {"beta > 10",                   [](int i){ return i>10; }},
+        {"beta >= 10",                  [](int i){ return i>=10; }},
+        {"5 < beta <= 8",               [](int i){ return i>5 && i<=8; }},
+        {"10 > beta > 3",               [](int i){ return i>3 && i<10; }},
+        {"beta == 4 or beta = 7",       [](int i){ return i==4 || i==7; }},
+        {"beta <> 0 and beta != 1 and index < 4", [](int i){ return i==2 || i==3; }},
+        {"-beta < -27",                 [](int i){ return i>27; }},
+        {"beta/2+1 >= 3^2",             [](int i){ return i>=16; }},
+        {"beta >= 2+1",                 [](int i){ return i>=3; }},
+        {"x < 0.52",                    [](int i){ return x(i)<0.52f; }},
+        {"x < x of center of index 4 7",[](int i){ return i<=5; }},
+        // By
+        {"by residue (name CA and resid 2)", [](int i){ return i>=5 && i<10; }},
+        {"by chain index 20",           [](int i){ return i>=15; }},
+        {"by mol index 12",             [](int i){ return i>=10 && i<20; }},
+        // Within
+        {"within 0.25 of index 10",     [](int i){ return i>=8 && i<=12; }},
+        {"within 0.25 self of index 10",[](int i){ return i>=8 && i<=12; }},
+        {"within 0.1*2+0.05 of index 10", [](int i){ return i>=8 && i<=12; }},
+        {"within 0.15 pbc of index 0",  [](int i){ return i<=1 || i==29; }},
+        {"within 0.15 nopbc of index 0",[](int i){ return i<=1; }},
+        {"within 0.15 pbc noself of index 0 29", [](int i){ return i==1 || i==28; }},
+        {"within 0.15 noself pbc of index 0 29", [](int i){ return i==1 || i==28; }},
+        {"within 0.12 of 1.0 0.5 0.5",  [](int i){ return i==9 || i==10; }},
+        {"within 0.12 of center of index 2 4",  [](int i){ return i>=2 && i<=4; }},
+        // Dist
+        {"dist from 0 0.5 0.5 < 0.32",  [](int i){ return i<=2; }},
+        {"dist pbc from 0 0.5 0.5 < 0.32", [](int i){ return i<=2 || i>=27; }},
+        {"dist from plane point 1.0 0 0 normal 1 0 0 < 0.12", [](int i){ return i==9 || i==10; }},
+        // Intended changes of behaviour
+        // noself excludes the central selection
+        {"within 0.25 noself of index 10", [](int i){ return i>=8 && i<=12 && i!=10; }},
+        // Weighted center is (2*0.25+4*0.45)/6=0.383
+        {"within 0.12 of center weight beta of index 2 4", [](int i){ return i==3 || i==4; }},
+        // Expressions depending on atoms are evaluated for each atom, not for atom 0
+        {"mass*2 > 25",                 [](int i){ return i%5==0 || i%5==4; }},
+        {"beta*0+mass > 13",            [](int i){ return i%5==0 || i%5==4; }},
+    };
+
+    for(auto& t: table){
+        try {
+            check(s(t.first),t.second,t.first);
+        } catch(const std::exception& e){
+            printf("'%s': FAILED with error: %s\n",t.first.c_str(),e.what());
+            ++failed;
+        }
+    }
+    printf("%d selections checked\n",int(table.size()));
+
+    // Subselections are limited to the parent selection.
+    // Indexes in subselections are counted from the first atom of the parent.
+    Selection parent = s("resid 2-3");
+    auto in_parent = [](int i){ return i>=5 && i<15; };
+    check(parent("all"),in_parent,"all in subselection");
+    check(parent("index 0-2"),[](int i){ return i>=5 && i<=7; },"index in subselection");
+    check(parent("index 8-20"),[](int i){ return i>=13 && i<15; },"index beyond parent in subselection");
+    check(parent("not name CA"),[&](int i){ return in_parent(i) && i%5!=1; },"not in subselection");
+    check(parent("name CA"),[](int i){ return i==6 || i==11; },"name in subselection");
+    check(parent("by residue index 0"),[](int i){ return i>=5 && i<10; },"by residue in subselection");
+    check(parent("within 0.15 noself of index 2"),[](int i){ return i==6 || i==8; },"within in subselection");
+
+    // Coordinate-dependent selections are re-evaluated on apply()
+    Selection moving(s,"x < 0.52");
+    s.xyz(7) = Vector3f(0.3f,0.5f,0.5f);
+    moving.apply();
+    check(moving,[](int i){ return x(i)<0.52f || i==7; },"apply() after moving atom");
+
+    return failed ? 1 : 0;
+}
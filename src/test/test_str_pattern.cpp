@@ -0,0 +1,75 @@
+/*
+ * Regression test for the patterns of text selections.
+ * Patterns matched without std::regex should give the same result as std::regex
+ * and quoted patterns should never be changed by macro expansion.
+ */
+
+#include "selection_parser.h"
+#include "pteros/core/selection.h"
+#include <vector>
+#include <string>
+#include <regex>
+#include <cstdio>
+
+using namespace std;
+using namespace pteros;
+
+static int failed = 0;
+
+static void check(bool ok, const string& what){
+    if(!ok){
+        printf("%s: FAILED\n",what.c_str());
+        ++failed;
+    }
+}
+
+int main(){
+    // Patterns handled directly and a few falling back to std::regex
+    vector<string> patterns {
+        "H.*", "H", ".", "C.", "CA", "^CA$", "^C.*", "O.*$",
+        "C[AB]", "C[A-C]+", "[^H].*", "[^\\d]+", "[1\\W]+", "[\\DA]+", "[-\\w]+",
+        "O?H", "H\\d+", "H\\d?", "[A-Z]+\\d?", "\\w*", "\\S+", "X\\sY", "a\\.b", "a\\-b",
+        "H[0-9]*[AB]?", "C.?A", ".*A.*", "[.]",
+        // Fallback
+        "(CA|CB)", "C{2}", "H.*?", "[[:digit:]]+"
+    };
+    vector<string> names {
+        "", "H", "H1", "H12", "HA", "HB2", "CA", "CB", "CC", "CAA", "C", "C1", "CX",
+        "OH", "O", "OHH", "1", "_", "X Y", "a-b", "a.b", "axb", "A", "HA1", "N", "123", "CCA"
+    };
+
+    int ncases = 0;
+    for(auto& p: patterns){
+        StrPattern pat(p);
+        regex re(p);
+        for(auto& n: names){
+            ++ncases;
+            check(pat.match(n)==regex_match(n,re), "pattern '"+p+"' on '"+n+"'");
+        }
+    }
+    printf("%d pattern cases checked\n",ncases);
+
+    // Macros are expanded as whole words outside of quotes
+    System s;
+    s.frame_append(Frame());
+    vector<Atom> atoms;
+    vector<Eigen::Vector3f> coord;
+    for(string nm: {"water","HOH","protein","CA","H1"}){
+        Atom at;
+        at.name = nm;
+        at.resname = (nm=="HOH") ? "SOL" : "XXX";
+        atoms.push_back(at);
+        coord.emplace_back(0,0,0);
+    }
+    s.atoms_add(atoms,coord);
+
+    check(s("name 'water'").get_text()=="name 'water'", "single quoted word is not expanded");
+    check(s("name \"protein\"").get_text()=="name \"protein\"", "double quoted word is not expanded");
+    check(s("name 'water'").size()==1, "quoted word selects by name");
+    check(s("name 'water' or water").get_text()=="name 'water' or (resname HOH SOL TIP3)",
+          "unquoted word is expanded");
+    check(s("name waterX").get_text()=="name waterX", "part of the word is not expanded");
+    check(s("hydrogen").size()==2, "macro with quoted pattern"); // HOH and H1
+
+    return failed ? 1 : 0;
+}
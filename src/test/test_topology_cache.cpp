@@ -0,0 +1,133 @@
+/*
+ * Regression test for caching of text selections and residue tables
+ * and for sharing of atoms between the copies of the system.
+ * Writing through references to atoms should never give stale results,
+ * while reading should not disable sharing and caching.
+ */
+
+#include "pteros/core/system.h"
+#include "pteros/core/selection.h"
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdio>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+// 10 residues of 20 atoms each, 12 of them are CA
+static System make_system(){
+    System s;
+    s.frame_append(Frame());
+    vector<Atom> atoms;
+    vector<Vector3f> coord;
+    for(int i=0;i<200;++i){
+        Atom at;
+        at.name = (i%20<12) ? "CA" : "CB";
+        at.resname = "ALA";
+        at.resid = i/20;
+        atoms.push_back(at);
+        coord.emplace_back(0.1f*i,0,0);
+    }
+    s.atoms_add(atoms,coord);
+    s.assign_resindex();
+    return s;
+}
+
+static int failed = 0;
+
+static void check(bool ok, const string& what){
+    printf("%s: %s\n",what.c_str(),ok ? "ok" : "FAILED");
+    if(!ok) ++failed;
+}
+
+int main(){
+    {
+        // Selection evaluated while reference is alive, atom renamed after that
+        System s = make_system();
+        Atom& a = s.atom(1);
+        Selection s1(s,"name CA");
+        a.name = "QQ";
+        Selection s2(s,"name CA");
+        check(s1.size()==120 && s2.size()==119, "selection after write through held reference");
+    }
+
+    {
+        // Residue tables built while reference is alive
+        System s = make_system();
+        Atom& a = s.atom(0);
+        Selection all = s.select_all();
+        vector<Selection> res;
+        all.split_by_residue(res);
+        int n1 = res.size();
+        a.resindex = 100;
+        all.split_by_residue(res);
+        check(n1==10 && res.size()==11, "residues after write through held reference");
+        check(s("by residue index 0").size()==1, "by residue after write through held reference");
+    }
+
+    {
+        // Setters update cached selections
+        System s = make_system();
+        check(s("name CA").size()==120, "initial selection");
+        s("index 0").set_name("CB");
+        check(s("name CA").size()==119, "selection after set_name");
+        s.atoms_delete({5});
+        check(s("name CA").size()==118, "selection after atoms_delete");
+    }
+
+    {
+        // Reference taken before copying is not shared with the copy
+        System s = make_system();
+        Atom& b = s.atom(2);
+        System c = s;
+        b.name = "ALIAS";
+        check(std::as_const(c).atom(2).name=="CA" && std::as_const(s).atom(2).name=="ALIAS",
+              "reference taken before copy");
+
+        System d;
+        d = s;
+        b.name = "OTHER";
+        check(std::as_const(d).atom(2).name=="ALIAS", "reference taken before assignment");
+    }
+
+    {
+        // Without references the copies share atoms until modified
+        System s = make_system();
+        System c = s;
+        check(&std::as_const(c).atom(0)==&std::as_const(s).atom(0), "copy shares atoms");
+        c("index 0").set_name("CB");
+        check(std::as_const(s).atom(0).name=="CA" && std::as_const(c).atom(0).name=="CB",
+              "modified copy is detached");
+    }
+
+    {
+        // Reading through const accessors does not prevent sharing
+        System s = make_system();
+        Selection sel(s,"name CA");
+        const Selection& csel = sel;
+        int n = 0;
+        for(int i=0;i<csel.size();++i) if(csel.name(i)=="CA" && csel.resname(i)=="ALA") ++n;
+        const AtomHandler h = sel[12];
+        int r = std::as_const(s).atom(0).resid + csel.resid(20) + csel.atom(40).resid + h.resid();
+        vector<string> names = sel.get_name();
+        System c = s;
+        check(n==120 && r==5 && names.size()==120 && &std::as_const(c).atom(0)==&std::as_const(s).atom(0),
+              "copy shares atoms after reading");
+    }
+
+    {
+        // References are forgotten after the next topology change
+        System s = make_system();
+        s.atom(0).name = "QQ";
+        System c1 = s;
+        check(&std::as_const(c1).atom(0)!=&std::as_const(s).atom(0), "copy after write is not shared");
+        s("index 1").set_name("CB");
+        System c2 = s;
+        check(&std::as_const(c2).atom(0)==&std::as_const(s).atom(0), "copy after topology change is shared");
+        check(s("name QQ").size()==1 && s("name CA").size()==118, "selection after topology change");
+    }
+
+    return failed ? 1 : 0;
+}
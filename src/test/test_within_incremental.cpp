@@ -0,0 +1,100 @@
+/*
+ * Regression test for incremental evaluation of within.
+ * Coordinate-dependent selections re-evaluated on each frame should give
+ * the same result as the evaluation without incremental updates,
+ * including the frames where atoms or the box jump and the skin is exceeded.
+ */
+
+#include "pteros/core/system.h"
+#include "pteros/core/selection.h"
+#include "pteros/core/pteros_error.h"
+#include <vector>
+#include <string>
+#include <random>
+#include <cstdio>
+
+using namespace std;
+using namespace pteros;
+using namespace Eigen;
+
+static int failed = 0;
+
+static void check(bool ok, const string& what){
+    if(!ok){
+        printf("%s: FAILED\n",what.c_str());
+        ++failed;
+    }
+}
+
+int main(){
+    const int N = 6000;
+    const int NF = 30;
+    mt19937 gen(3);
+    uniform_real_distribution<float> pos(0,5);
+    normal_distribution<float> step(0,0.01);
+
+    System s;
+    vector<Atom> atoms(N);
+    vector<Vector3f> coord(N);
+    for(int i=0;i<N;++i){
+        coord[i] = Vector3f(pos(gen),pos(gen),pos(gen));
+        atoms[i].name = "X";
+        atoms[i].resid = i/3;
+        atoms[i].resname = ((coord[i]-Vector3f(2.5,2.5,2.5)).norm()<1) ? "PRT" : "SOL";
+    }
+    s.atoms_add(atoms,coord);
+    s.box(0) = PeriodicBox(Matrix3f::Identity()*5);
+
+    // Small steps with occasional jumps of some atoms, of all atoms and of the box
+    for(int fr=1;fr<NF;++fr){
+        s.frame_dup(fr-1);
+        for(int i=0;i<N;++i) s.xyz(i,fr) += Vector3f(step(gen),step(gen),step(gen));
+        if(fr==10) for(int i=0;i<N;i+=97) s.xyz(i,fr) += Vector3f(0.5,0,0);
+        if(fr==15) for(int i=0;i<N;++i) s.xyz(i,fr) += Vector3f(0.2,-0.1,0);
+        if(fr==20) s.box(fr) = PeriodicBox(Matrix3f::Identity()*5.1);
+    }
+
+    vector<string> texts {
+        "resname SOL and within 0.4 of resname PRT",
+        "within 0.4 pbc of resname PRT",
+        "within 0.3 noself of resname PRT",
+        "resname SOL and within 0.35 pbc noself of (resname PRT and x<2.5)",
+        "within 0.4 of index 5",
+    };
+
+    for(const auto& t: texts){
+        for(float skin: {0.1f,0.3f}){
+            Selection inc(s,t);
+            inc.set_within_skin(skin);
+            // Evaluated from scratch on each frame
+            Selection ref(s,t);
+            ref.set_within_skin(0);
+            int bad = 0;
+            for(int fr=0;fr<NF;++fr){
+                inc.set_frame(fr);
+                ref.set_frame(fr);
+                if(inc.get_index()!=ref.get_index()) ++bad;
+            }
+            check(bad==0, "'"+t+"' with skin "+to_string(skin));
+        }
+    }
+
+    // Going back and forth between distant frames forces rebuilds
+    Selection inc(s,texts[1]);
+    Selection ref(s,texts[1]);
+    ref.set_within_skin(0);
+    int bad = 0;
+    for(int fr: {0,29,1,28,10,11,12,20,19,21}){
+        inc.set_frame(fr);
+        ref.set_frame(fr);
+        if(inc.get_index()!=ref.get_index()) ++bad;
+    }
+    check(bad==0, "jumps between frames");
+
+    bool thrown = false;
+    try { inc.set_within_skin(-1); } catch(const PterosError&){ thrown = true; }
+    check(thrown, "negative skin");
+
+    printf("%d selections checked on %d frames\n",int(texts.size()),NF);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * Regression test for the fast XTC decoder.
+ * Coordinates of different kinds are compressed and decoded by the fast
+ * and the reference decoders, which should give byte-identical results.
+ */
+
+#include "xdrfile.h"
+#include <vector>
+#include <random>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+
+using namespace std;
+
+struct TestCase {
+    string name;
+    int natoms;
+    float precision;
+    vector<vector<float>> frames;
+};
+
+// Water-like molecules: clusters of three close atoms, which produce runs
+static vector<float> water(mt19937& gen, int natoms, float box){
+    uniform_real_distribution<float> pos(0,box), shift(-0.1,0.1);
+    vector<float> x(natoms*3);
+    for(int i=0;i<natoms;i+=3){
+        float c[3] = {pos(gen),pos(gen),pos(gen)};
+        for(int j=i;j<min(i+3,natoms);++j)
+            for(int d=0;d<3;++d) x[j*3+d] = c[d] + (j==i ? 0 : shift(gen));
+    }
+    return x;
+}
+
+// Uniformly distributed atoms in large box
+static vector<float> uniform(mt19937& gen, int natoms, float box){
+    uniform_real_distribution<float> pos(-box/2,box/2);
+    vector<float> x(natoms*3);
+    for(auto& v: x) v = pos(gen);
+    return x;
+}
+
+// Chain with variable step, so the size of small integers changes up and down
+static vector<float> chain(mt19937& gen, int natoms){
+    uniform_real_distribution<float> u(-1,1);
+    vector<float> x(natoms*3);
+    float step = 0.01;
+    for(int i=1;i<natoms;++i){
+        if(i%50==0) step = (i/50)%2 ? 1.0 : 0.01;
+        for(int d=0;d<3;++d) x[i*3+d] = x[(i-1)*3+d] + step*u(gen);
+    }
+    return x;
+}
+
+static bool run_case(const TestCase& tc, double& t_ref, double& t_fast){
+    const char* fname = "test_xtc_decompress.tmp";
+    XDRFILE* w = xdrfile_open(fname,"w");
+    if(!w){ printf("Can't open %s\n",fname); return false; }
+    for(auto fr: tc.frames){
+        if(xdrfile_compress_coord_float(fr.data(),tc.natoms,tc.precision,w)<0){
+            printf("%s: compression failed\n",tc.name.c_str());
+            return false;
+        }
+    }
+    xdrfile_close(w);
+
+    ifstream in(fname,ios::binary);
+    string buf((istreambuf_iterator<char>(in)),istreambuf_iterator<char>());
+    remove(fname);
+
+    XDRFILE* r1 = xdrfile_open_mem(buf.data(),buf.size());
+    XDRFILE* r2 = xdrfile_open_mem(buf.data(),buf.size());
+    vector<float> x1(tc.natoms*3), x2(tc.natoms*3);
+    bool ok = true;
+    for(int f=0;f<int(tc.frames.size());++f){
+        int n1 = tc.natoms, n2 = tc.natoms;
+        float p1 = 0, p2 = 0;
+        // Garbage in output buffers to catch unwritten values
+        fill(x1.begin(),x1.end(),-1e30f);
+        fill(x2.begin(),x2.end(),1e30f);
+
+        auto t0 = chrono::steady_clock::now();
+        int ret1 = xdrfile_decompress_coord_float_reference(x1.data(),&n1,&p1,r1);
+        auto t1 = chrono::steady_clock::now();
+        int ret2 = xdrfile_decompress_coord_float(x2.data(),&n2,&p2,r2);
+        auto t2 = chrono::steady_clock::now();
+        t_ref += chrono::duration<double>(t1-t0).count();
+        t_fast += chrono::duration<double>(t2-t1).count();
+
+        if(ret1!=ret2 || n1!=n2 || memcmp(&p1,&p2,sizeof(float))
+           || memcmp(x1.data(),x2.data(),x1.size()*sizeof(float))){
+            printf("%s: frame %d differs\n",tc.name.c_str(),f);
+            ok = false;
+            break;
+        }
+    }
+    xdrfile_close(r1);
+    xdrfile_close(r2);
+    return ok;
+}
+
+int main(){
+    mt19937 gen(42);
+    vector<TestCase> cases;
+
+    auto add = [&](string name, int natoms, float prec, auto gen_frame){
+        TestCase tc{name,natoms,prec,{}};
+        for(int f=0;f<5;++f) tc.frames.push_back(gen_frame());
+        cases.push_back(tc);
+    };
+
+    for(int n: {1,3,9,10,11,100,3001,30000}){
+        add("water "+to_string(n), n, 1000, [&]{ return water(gen,n,10); });
+        add("chain "+to_string(n), n, 1000, [&]{ return chain(gen,n); });
+    }
+    for(float prec: {10.0f,100.0f,10000.0f})
+        add("water precision "+to_string(prec), 5000, prec, [&]{ return water(gen,5000,5); });
+    // More than 64 bits for three large integers
+    add("uniform 16000 nm", 5000, 1000, [&]{ return uniform(gen,5000,16000); });
+    // Sizes of large integers are too big to be multiplied
+    add("uniform 40000 nm", 5000, 1000, [&]{ return uniform(gen,5000,40000); });
+    add("uniform 50 nm", 20000, 1000, [&]{ return uniform(gen,20000,50); });
+
+    double t_ref = 0, t_fast = 0;
+    int failed = 0;
+    for(auto& tc: cases){
+        if(!run_case(tc,t_ref,t_fast)) ++failed;
+    }
+
+    printf("%d of %d cases passed\n",int(cases.size())-failed,int(cases.size()));
+    printf("Reference decoder: %g s, fast decoder: %g s\n",t_ref,t_fast);
+    return failed ? 1 : 0;
+}
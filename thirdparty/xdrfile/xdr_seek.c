@@ -13,6 +13,10 @@ struct XDRFILE
     int      buf1size; /**< Current allocated length of buf1          */
     int *    buf2;     /**< Buffer for internal use                   */
     int      buf2size; /**< Current allocated length of buf2          */
+    const char * mem;  /**< Memory block for reading or NULL          */
+    int64_t  memsize;  /**< Size of memory block                      */
+    int64_t  mempos;   /**< Current position in memory block          */
+    int64_t  memcap;   /**< Allocated size of memory block for writing */
 };
 //// end of copied
 
@@ -20,6 +24,9 @@ int64_t xdr_tell(XDRFILE *xd)
 {
 	FILE* fptr = xd->fp;
 
+	// Memory block
+	if(!fptr) return xd->mempos;
+
 #ifndef _WIN32
 	// use posix 64 bit ftell version
 	return ftello(fptr);
@@ -35,6 +42,16 @@ int xdr_seek(XDRFILE *xd, int64_t pos, int whence)
 	int result = 1;
 	FILE* fptr = xd->fp;
 
+	// Memory block, position beyond the end is allowed like in fseek
+	if(!fptr){
+		int64_t newpos = pos;
+		if(whence==SEEK_CUR) newpos += xd->mempos;
+		else if(whence==SEEK_END) newpos += xd->memsize;
+		if(newpos<0) return exdrNR;
+		xd->mempos = newpos;
+		return exdrOK;
+	}
+
 #ifndef _WIN32
 	// use posix 64 bit ftell version
 	result = fseeko(fptr, pos, whence) < 0 ? exdrNR : exdrOK;
@@ -51,5 +68,5 @@ int xdr_seek(XDRFILE *xd, int64_t pos, int whence)
 
 int xdr_flush(XDRFILE* xdr)
 {
-    return fflush(xdr->fp);
+    return xdr->fp ? fflush(xdr->fp) : 0;
 }
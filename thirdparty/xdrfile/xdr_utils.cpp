@@ -630,7 +630,9 @@ int xdr_xtc_seek_time(float time, XDRFILE* handle, int natoms, bool bSeekForward
 int check_trr_content(XDRFILE* handle, int* natoms, int* xsz, int* vsz, int* fsz)
 {
     t_trnheader sh;
+    int64_t pos = xdr_tell(handle); // save pos
     int  ret = do_trnheader(handle,1,&sh);
+    xdr_seek(handle,pos,SEEK_SET); // Rewind
     if(ret != exdrOK) return ret;
 
     *natoms = sh.natoms;
@@ -640,3 +642,117 @@ int check_trr_content(XDRFILE* handle, int* natoms, int* xsz, int* vsz, int* fsz
 
     return exdrOK;
 }
+
+
+// Skip one XTC frame starting from the beginning of current frame.
+// Only the header is read, coordinates are not decompressed.
+// Time of the frame is returned in time if it is not NULL.
+int xdr_xtc_skip_frame(XDRFILE* handle, int natoms, float* time)
+{
+    int i_inp[3];
+    float f_inp[10];
+    int lsize, len, dum;
+    float prec;
+
+    /* magic, natoms, step */
+    if (xdrfile_read_int(i_inp,3,handle) != 3)
+    {
+        return exdrENDOFFILE;
+    }
+    if (i_inp[0] != XTC_MAGIC || i_inp[1] != natoms)
+    {
+        return exdrMAGIC;
+    }
+    /* time and box */
+    if (xdrfile_read_float(f_inp,10,handle) != 10)
+    {
+        return exdrFLOAT;
+    }
+    if (time) *time = f_inp[0];
+    if (xdrfile_read_int(&lsize,1,handle) != 1)
+    {
+        return exdrINT;
+    }
+    if (lsize <= 9)
+    {
+        /* Small systems are stored uncompressed */
+        if (xdr_seek(handle, (int64_t)lsize * 3 * XDR_INT_SIZE, SEEK_CUR))
+        {
+            return exdrENDOFFILE;
+        }
+        return exdrOK;
+    }
+    /* precision, minint, maxint, smallidx and byte count of compressed data */
+    if (xdrfile_read_float(&prec,1,handle) != 1)
+    {
+        return exdrFLOAT;
+    }
+    for (int k = 0; k < 7; k++)
+    {
+        if (xdrfile_read_int(&dum,1,handle) != 1)
+        {
+            return exdrINT;
+        }
+    }
+    if (xdrfile_read_int(&len,1,handle) != 1)
+    {
+        return exdrINT;
+    }
+    /* Compressed data are padded to 4 bytes */
+    if (xdr_seek(handle, (int64_t)((len + 3) & ~3), SEEK_CUR))
+    {
+        return exdrENDOFFILE;
+    }
+    return exdrOK;
+}
+
+// Skip n XTC frames starting from the beginning of current frame.
+// Returns the number of skipped frames, which is less than n at the end of file.
+int xdr_xtc_skip_frames(XDRFILE* handle, int natoms, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        if (xdr_xtc_skip_frame(handle,natoms,NULL) != exdrOK)
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+// Skip one TRR frame starting from the beginning of current frame.
+// Time of the frame is returned in time if it is not NULL.
+int xdr_trr_skip_frame(XDRFILE* handle, float* time)
+{
+    t_trnheader sh;
+    int64_t sz;
+    int ret = do_trnheader(handle,1,&sh);
+    if (ret != exdrOK)
+    {
+        return ret;
+    }
+    if (time) *time = sh.tf;
+    /* Sizes in the header are in bytes */
+    sz = (int64_t)sh.box_size + sh.vir_size + sh.pres_size + sh.x_size + sh.v_size + sh.f_size;
+    if (xdr_seek(handle, sz, SEEK_CUR))
+    {
+        return exdrENDOFFILE;
+    }
+    return exdrOK;
+}
+
+// Skip n TRR frames starting from the beginning of current frame.
+// Returns the number of skipped frames, which is less than n at the end of file.
+int xdr_trr_skip_frames(XDRFILE* handle, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        if (xdr_trr_skip_frame(handle,NULL) != exdrOK)
+        {
+            return i;
+        }
+    }
+    return n;
+}
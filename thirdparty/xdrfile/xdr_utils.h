@@ -13,3 +13,7 @@ float xdr_xtc_get_last_frame_time(XDRFILE* handle, int natoms, bool* bOK);
 int xdr_xtc_seek_frame(int frame, XDRFILE* handle, int natoms);
 int xdr_xtc_seek_time(float time, XDRFILE* handle, int natoms, bool bSeekForwardOnly);
 int check_trr_content(XDRFILE* handle, int* natoms, int* xsz, int* vsz, int* fsz);
+int xdr_xtc_skip_frame(XDRFILE* handle, int natoms, float* time);
+int xdr_xtc_skip_frames(XDRFILE* handle, int natoms, int n);
+int xdr_trr_skip_frame(XDRFILE* handle, float* time);
+int xdr_trr_skip_frames(XDRFILE* handle, int n);
@@ -54,6 +54,7 @@
 #endif
 
 #include "xdrfile.h"
+#include "xdr_seek.h"
 
 /* Default FORTRAN name mangling is: lower case name, append underscore */
 #ifndef F77_FUNC
@@ -177,8 +178,14 @@ struct XDRFILE
     int      buf1size; /**< Current allocated length of buf1          */    
     int *    buf2;     /**< Buffer for internal use                   */
     int      buf2size; /**< Current allocated length of buf2          */ 
+    const char * mem;  /**< Memory block for reading or NULL          */
+    int64_t  memsize;  /**< Size of memory block                      */
+    int64_t  mempos;   /**< Current position in memory block          */
+    int64_t  memcap;   /**< Allocated size of memory block for writing */
 };
 
+static int xdrmapped_create(XDR *xdrs, XDRFILE *xfp, enum xdr_op xop);
+
 
 
 
@@ -228,9 +235,80 @@ xdrfile_open(const char *path, const char *mode)
 	xdrstdio_create((XDR *)(xfp->xdr),xfp->fp,xdrmode);
 	xfp->buf1 = xfp->buf2 = NULL;
 	xfp->buf1size = xfp->buf2size = 0;
+	xfp->mem = NULL;
+	xfp->memsize = xfp->mempos = xfp->memcap = 0;
+	return xfp;
+}
+
+XDRFILE *
+xdrfile_open_mem(const char *data, long long size)
+{
+	XDRFILE *xfp;
+
+	if((xfp=(XDRFILE *)malloc(sizeof(XDRFILE)))==NULL)
+		return NULL;
+	if((xfp->xdr=(XDR *)malloc(sizeof(XDR)))==NULL)
+	{
+		free(xfp);
+		return NULL;
+	}
+	xfp->fp = NULL;
+	xfp->mode = 'r';
+	xfp->buf1 = xfp->buf2 = NULL;
+	xfp->buf1size = xfp->buf2size = 0;
+	xfp->mem = data;
+	xfp->memsize = size;
+	xfp->mempos = 0;
+	xfp->memcap = 0;
+	if(!xdrmapped_create((XDR *)(xfp->xdr),xfp,XDR_DECODE))
+	{
+		free(xfp->xdr);
+		free(xfp);
+		return NULL;
+	}
+	return xfp;
+}
+
+XDRFILE *
+xdrfile_open_mem_write(void)
+{
+	XDRFILE *xfp;
+
+	if((xfp=(XDRFILE *)malloc(sizeof(XDRFILE)))==NULL)
+		return NULL;
+	if((xfp->xdr=(XDR *)malloc(sizeof(XDR)))==NULL)
+	{
+		free(xfp);
+		return NULL;
+	}
+	xfp->fp = NULL;
+	xfp->mode = 'w';
+	xfp->buf1 = xfp->buf2 = NULL;
+	xfp->buf1size = xfp->buf2size = 0;
+	xfp->mem = NULL;
+	xfp->memsize = xfp->mempos = xfp->memcap = 0;
+	if(!xdrmapped_create((XDR *)(xfp->xdr),xfp,XDR_ENCODE))
+	{
+		free(xfp->xdr);
+		free(xfp);
+		return NULL;
+	}
 	return xfp;
 }
 
+const char *
+xdrfile_mem_data(XDRFILE *xfp, long long *size)
+{
+	*size = xfp->memsize;
+	return xfp->mem;
+}
+
+void
+xdrfile_mem_clear(XDRFILE *xfp)
+{
+	xfp->memsize = xfp->mempos = 0;
+}
+
 int 
 xdrfile_close(XDRFILE *xfp)
 {
@@ -241,8 +319,10 @@ xdrfile_close(XDRFILE *xfp)
 		if(xfp->xdr)
 			xdr_destroy((XDR *)(xfp->xdr));
 		free(xfp->xdr);
-		/* close the file */
-		ret=fclose(xfp->fp);
+		/* close the file, memory block for reading is owned by the caller */
+		ret = xfp->fp ? fclose(xfp->fp) : 0;
+		if(!xfp->fp && xfp->memcap)
+			free((char *)xfp->mem);
 		if(xfp->buf1size)
 			free(xfp->buf1);
 		if(xfp->buf2size)
@@ -774,9 +854,10 @@ static const int magicints[] =
 
 /* Compressed coordinate routines - modified from the original
  * implementation by Frans v. Hoesel to make them threadsafe.
+ * This is the original decoder, the fast one is below.
  */
 int
-xdrfile_decompress_coord_float(float     *ptr,
+xdrfile_decompress_coord_float_reference(float     *ptr,
 							   int       *size,
 							   float     *precision,
 							   XDRFILE*   xfp)
@@ -998,6 +1079,358 @@ xdrfile_decompress_coord_float(float     *ptr,
 	return *size;
 }
 
+/*
+ * Fast decoder of compressed coordinates.
+ *
+ * Produces exactly the same result as the reference decoder above but:
+ * - bits are extracted from 64-bit big-endian words instead of byte by byte;
+ * - multi-byte integers are assembled in one 64-bit value and split with
+ *   plain divisions instead of byte-wise long division;
+ * - integers are decoded first and converted to floats in a separate
+ *   loop, which is vectorized by the compiler.
+ * The compressed data are padded by zeros, so reading the words near
+ * the end of data never touches memory outside the buffer.
+ */
+
+/* Padding after compressed data. Larger than the maximal number of bytes,
+ * which could be consumed by one iteration of decoding loop (~103 bytes)
+ * plus the size of the word */
+#define XTC_PAD_BYTES 128
+
+static inline uint64_t
+load_be64(const unsigned char *p)
+{
+	/* Recognized by compilers as a single load and byte swap */
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+		((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+		((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+		((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+static inline uint64_t
+bswap_u64(uint64_t x)
+{
+	x = ((x & 0x00000000ffffffffULL) << 32) | (x >> 32);
+	x = ((x & 0x0000ffff0000ffffULL) << 16) | ((x >> 16) & 0x0000ffff0000ffffULL);
+	x = ((x & 0x00ff00ff00ff00ffULL) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffULL);
+	return x;
+}
+
+/* Reads 1..57 bits from bit position pos */
+static inline uint64_t
+fast_decodebits(const unsigned char *data, uint64_t *pos, int num_of_bits)
+{
+	uint64_t w = load_be64(data + (*pos >> 3)) << (*pos & 7);
+	*pos += num_of_bits;
+	return w >> (64 - num_of_bits);
+}
+
+/* Same as decodeints() for three integers */
+static inline void
+fast_decodeints(const unsigned char *data, uint64_t *pos, int num_of_bits,
+				const unsigned int sizes[], int nums[])
+{
+	if (num_of_bits <= 64)
+	{
+		/* Full bytes go first, least significant first, then the rest of bits */
+		int nfull = (num_of_bits - 1) / 8;
+		int last = num_of_bits - nfull * 8;
+		uint64_t v = 0;
+		if (nfull > 0)
+		{
+			v = bswap_u64(fast_decodebits(data, pos, nfull * 8)) >> (64 - nfull * 8);
+		}
+		v |= fast_decodebits(data, pos, last) << (nfull * 8);
+
+		if (v <= 0xffffffffULL)
+		{
+			/* 32-bit division is much faster */
+			unsigned int v32 = (unsigned int) v;
+			nums[2] = v32 % sizes[2];
+			v32 /= sizes[2];
+			nums[1] = v32 % sizes[1];
+			nums[0] = v32 / sizes[1];
+		}
+		else
+		{
+			nums[2] = (int)(v % sizes[2]);
+			v /= sizes[2];
+			nums[1] = (int)(v % sizes[1]);
+			nums[0] = (int)(v / sizes[1]);
+		}
+	}
+	else
+	{
+		/* Huge integers, use byte-wise division */
+		int bytes[32];
+		int i, j, num_of_bytes, p, num;
+
+		bytes[1] = bytes[2] = bytes[3] = 0;
+		num_of_bytes = 0;
+		while (num_of_bits > 8)
+		{
+			bytes[num_of_bytes++] = (int) fast_decodebits(data, pos, 8);
+			num_of_bits -= 8;
+		}
+		bytes[num_of_bytes++] = (int) fast_decodebits(data, pos, num_of_bits);
+		for (i = 2; i > 0; i--)
+		{
+			num = 0;
+			for (j = num_of_bytes-1; j >=0; j--)
+			{
+				num = (num << 8) | bytes[j];
+				p = num / sizes[i];
+				bytes[j] = p;
+				num = num - p * sizes[i];
+			}
+			nums[i] = num;
+		}
+		nums[0] = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+	}
+}
+
+int
+xdrfile_decompress_coord_float(float     *ptr,
+							   int       *size,
+							   float     *precision,
+							   XDRFILE*   xfp)
+{
+	int minint[3], maxint[3], *out;
+	int smallidx;
+	unsigned sizeint[3], sizesmall[3], bitsizeint[3], size3;
+	int k, *buf1, *buf2, lsize, flag;
+	int smallnum, smaller, i, is_smaller, run;
+	float inv_precision;
+	int tmp, thiscoord[3], prevcoord[3];
+	unsigned int bitsize, nout, nbytes;
+	const unsigned char *data;
+	uint64_t pos;
+
+	bitsizeint[0] = 0;
+	bitsizeint[1] = 0;
+	bitsizeint[2] = 0;
+
+	if(xfp==NULL || ptr==NULL) {
+		fprintf(stderr, "(xdrfile error) Null pointer issue\n");
+		return -1;
+	}
+	tmp=xdrfile_read_int(&lsize,1,xfp);
+	if(tmp==0) {
+		fprintf(stderr, "(xdrfile error) Size could not be read\n");
+		return -1; /* return if we could not read size */
+	}
+	if (*size < lsize)
+	{
+		fprintf(stderr, "(xdrfile error) Requested to decompress %d coords, file contains %d\n",
+				*size, lsize);
+		return -1;
+	}
+	*size = lsize;
+	size3 = *size * 3;
+	if(size3>xfp->buf1size)
+	{
+		free(xfp->buf1);
+		free(xfp->buf2);
+		xfp->buf1size = xfp->buf2size = 0;
+		if((xfp->buf1=(int *)malloc(sizeof(int)*size3))==NULL)
+		{
+			fprintf(stderr, "(xdrfile error) Cannot allocate memory for decompressing coordinates.\n");
+			return -1;
+		}
+		xfp->buf1size=size3;
+		if((xfp->buf2=(int *)malloc(sizeof(int)*(size3*1.2)))==NULL)
+		{
+			fprintf(stderr, "(xdrfile error) Cannot allocate memory for decompressing coordinates.\n");
+			return -1;
+		}
+		xfp->buf2size=size3*1.2;
+	}
+	/* Dont bother with compression for three atoms or less */
+	if(*size<=9)
+	{
+		return xdrfile_read_float(ptr,size3,xfp)/3;
+		/* return number of coords, not floats */
+	}
+	/* Compression-time if we got here. Read precision first */
+	xdrfile_read_float(precision,1,xfp);
+
+	xdrfile_read_int(minint,3,xfp);
+	xdrfile_read_int(maxint,3,xfp);
+
+	sizeint[0] = maxint[0] - minint[0]+1;
+	sizeint[1] = maxint[1] - minint[1]+1;
+	sizeint[2] = maxint[2] - minint[2]+1;
+
+	/* check if one of the sizes is to big to be multiplied */
+	if ((sizeint[0] | sizeint[1] | sizeint[2] ) > 0xffffff)
+	{
+		bitsizeint[0] = sizeofint(sizeint[0]);
+		bitsizeint[1] = sizeofint(sizeint[1]);
+		bitsizeint[2] = sizeofint(sizeint[2]);
+		bitsize = 0; /* flag the use of large sizes */
+	}
+	else
+	{
+		bitsize = sizeofints(3, sizeint);
+	}
+
+	if (xdrfile_read_int(&smallidx,1,xfp) == 0)	{
+		fprintf(stderr,"(xdrfile error) Undocumented error 1");
+		return 0; /* not sure what has happened here or why we return... */
+	}
+	tmp = smallidx-1;
+	tmp = (FIRSTIDX>tmp) ? FIRSTIDX : tmp;
+	smaller = magicints[tmp] / 2;
+	smallnum = magicints[smallidx] / 2;
+	sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx] ;
+
+	/* Length of compressed data in bytes */
+	if (xdrfile_read_int(&tmp,1,xfp) == 0) {
+		fprintf(stderr, "(xdrfile error) Undocumented error 2");
+		return 0;
+	}
+	nbytes = (unsigned int) tmp;
+	/* Data and padding should fit into buf2 */
+	if ((uint64_t)nbytes + XTC_PAD_BYTES > (uint64_t)xfp->buf2size * sizeof(int))
+	{
+		free(xfp->buf2);
+		xfp->buf2size = (nbytes + XTC_PAD_BYTES) / sizeof(int) + 1;
+		if((xfp->buf2=(int *)malloc(sizeof(int)*xfp->buf2size))==NULL)
+		{
+			xfp->buf2size = 0;
+			fprintf(stderr, "(xdrfile error) Cannot allocate memory for decompressing coordinates.\n");
+			return -1;
+		}
+	}
+	buf1=xfp->buf1;
+	buf2=xfp->buf2;
+	if (xdrfile_read_opaque((char *)buf2,nbytes,xfp) == 0) {
+		fprintf(stderr, "(xdrfile error) Undocumented error 3");
+		return 0;
+	}
+	data = (const unsigned char *) buf2;
+	memset((char *)buf2 + nbytes, 0, XTC_PAD_BYTES);
+	pos = 0;
+
+	/* Integer coordinates are collected in buf1 and converted to floats at the end */
+	out = buf1;
+	nout = 0;
+	inv_precision = 1.0 / * precision;
+	run = 0;
+	i = 0;
+	while ( i < lsize )
+	{
+		/* Corrupted data, padding is consumed */
+		if ((pos >> 3) > nbytes)
+		{
+			fprintf(stderr, "(xdrfile error) Buffer overrun during decompression.\n");
+			return 0;
+		}
+
+		if (bitsize == 0)
+		{
+			thiscoord[0] = (int) fast_decodebits(data, &pos, bitsizeint[0]);
+			thiscoord[1] = (int) fast_decodebits(data, &pos, bitsizeint[1]);
+			thiscoord[2] = (int) fast_decodebits(data, &pos, bitsizeint[2]);
+		}
+		else
+		{
+			fast_decodeints(data, &pos, bitsize, sizeint, thiscoord);
+		}
+
+		i++;
+		prevcoord[0] = thiscoord[0] + minint[0];
+		prevcoord[1] = thiscoord[1] + minint[1];
+		prevcoord[2] = thiscoord[2] + minint[2];
+
+		flag = (int) fast_decodebits(data, &pos, 1);
+		is_smaller = 0;
+		if (flag == 1)
+		{
+			run = (int) fast_decodebits(data, &pos, 5);
+			is_smaller = run % 3;
+			run -= is_smaller;
+			is_smaller--;
+		}
+		/* Current atom and the run */
+		if (nout+3+run > size3)
+		{
+			fprintf(stderr, "(xdrfile error) Buffer overrun during decompression.\n");
+			return 0;
+		}
+		if (run > 0)
+		{
+			for (k = 0; k < run; k+=3)
+			{
+				fast_decodeints(data, &pos, smallidx, sizesmall, thiscoord);
+				i++;
+				thiscoord[0] += prevcoord[0] - smallnum;
+				thiscoord[1] += prevcoord[1] - smallnum;
+				thiscoord[2] += prevcoord[2] - smallnum;
+				if (k == 0) {
+					/* interchange first with second atom for better
+					 * compression of water molecules
+					 */
+					out[nout++] = thiscoord[0];
+					out[nout++] = thiscoord[1];
+					out[nout++] = thiscoord[2];
+					out[nout++] = prevcoord[0];
+					out[nout++] = prevcoord[1];
+					out[nout++] = prevcoord[2];
+					prevcoord[0] = thiscoord[0];
+					prevcoord[1] = thiscoord[1];
+					prevcoord[2] = thiscoord[2];
+				} else {
+					prevcoord[0] = thiscoord[0];
+					prevcoord[1] = thiscoord[1];
+					prevcoord[2] = thiscoord[2];
+					out[nout++] = thiscoord[0];
+					out[nout++] = thiscoord[1];
+					out[nout++] = thiscoord[2];
+				}
+			}
+		}
+		else
+		{
+			out[nout++] = prevcoord[0];
+			out[nout++] = prevcoord[1];
+			out[nout++] = prevcoord[2];
+		}
+		smallidx += is_smaller;
+		if (is_smaller < 0)
+		{
+			smallnum = smaller;
+
+			if (smallidx > FIRSTIDX)
+			{
+				smaller = magicints[smallidx - 1] /2;
+			}
+			else
+			{
+				smaller = 0;
+			}
+		}
+		else if (is_smaller > 0)
+		{
+			smaller = smallnum;
+			smallnum = magicints[smallidx] / 2;
+		}
+		sizesmall[0] = sizesmall[1] = sizesmall[2] = magicints[smallidx];
+		if (sizesmall[0]==0 || sizesmall[1]==0 || sizesmall[2]==0)
+		{
+			fprintf(stderr, "(xdrfile error) Undefined error.\n");
+			return 0;
+		}
+	}
+
+	/* Dequantization, vectorized by the compiler */
+	for (k = 0; k < (int)nout; k++)
+	{
+		ptr[k] = out[k] * inv_precision;
+	}
+	return *size;
+}
+
 int
 xdrfile_compress_coord_float(float   *ptr,
 							 int      size,
@@ -2631,4 +3064,135 @@ xdrstdio_setpos (XDR *xdrs, unsigned int pos)
 
 
 
+
+/*
+ * XDR stream over the memory block. For reading the block is usually a
+ * mapped file, for writing the block is allocated and grows as needed.
+ * x_private points to the XDRFILE, which holds the block and position.
+ */
+static int
+xdrmapped_getlong (XDR *xdrs, int32_t *lp)
+{
+	XDRFILE *xfp = (XDRFILE *) xdrs->x_private;
+	int32_t mycopy;
+
+	if (xfp->mempos + 4 > xfp->memsize)
+		return 0;
+	memcpy (&mycopy, xfp->mem + xfp->mempos, 4);
+	xfp->mempos += 4;
+	*lp = (int32_t) xdr_ntohl (mycopy);
+	return 1;
+}
+
+/* Grows memory block for writing if needed */
+static int
+xdrmapped_reserve (XDRFILE *xfp, int64_t len)
+{
+	char *p;
+	int64_t cap;
+
+	if (xfp->mode == 'r')
+		return 0;
+	if (xfp->mempos + len <= xfp->memcap)
+		return 1;
+	cap = xfp->memcap ? xfp->memcap : 4096;
+	while (cap < xfp->mempos + len)
+		cap *= 2;
+	if ((p = (char *) realloc ((char *) xfp->mem, cap)) == NULL)
+		return 0;
+	xfp->mem = p;
+	xfp->memcap = cap;
+	return 1;
+}
+
+static int
+xdrmapped_putlong (XDR *xdrs, int32_t *lp)
+{
+	XDRFILE *xfp = (XDRFILE *) xdrs->x_private;
+	int32_t mycopy = xdr_htonl (*lp);
+
+	if (!xdrmapped_reserve (xfp, 4))
+		return 0;
+	memcpy ((char *) xfp->mem + xfp->mempos, &mycopy, 4);
+	xfp->mempos += 4;
+	if (xfp->mempos > xfp->memsize)
+		xfp->memsize = xfp->mempos;
+	return 1;
+}
+
+/* Bytes are copied from the block to the caller's buffer. This avoids
+ * stdio buffering and read() calls, but not the copy itself. */
+static int
+xdrmapped_getbytes (XDR *xdrs, char *addr, unsigned int len)
+{
+	XDRFILE *xfp = (XDRFILE *) xdrs->x_private;
+
+	if (xfp->mempos + len > xfp->memsize)
+		return 0;
+	memcpy (addr, xfp->mem + xfp->mempos, len);
+	xfp->mempos += len;
+	return 1;
+}
+
+static int
+xdrmapped_putbytes (XDR *xdrs, char *addr, unsigned int len)
+{
+	XDRFILE *xfp = (XDRFILE *) xdrs->x_private;
+
+	if (!xdrmapped_reserve (xfp, len))
+		return 0;
+	memcpy ((char *) xfp->mem + xfp->mempos, addr, len);
+	xfp->mempos += len;
+	if (xfp->mempos > xfp->memsize)
+		xfp->memsize = xfp->mempos;
+	return 1;
+}
+
+static unsigned int
+xdrmapped_getpos (XDR *xdrs)
+{
+	return (unsigned int) ((XDRFILE *) xdrs->x_private)->mempos;
+}
+
+static int
+xdrmapped_setpos (XDR *xdrs, unsigned int pos)
+{
+	((XDRFILE *) xdrs->x_private)->mempos = pos;
+	return 1;
+}
+
+static void
+xdrmapped_destroy (XDR *xdrs)
+{
+}
+
+static const struct xdr_ops xdrmapped_ops =
+	{
+		xdrmapped_getlong,
+		xdrmapped_putlong,
+		xdrmapped_getbytes,
+		xdrmapped_putbytes,
+		xdrmapped_getpos,
+		xdrmapped_setpos,
+		xdrmapped_destroy,
+	};
+
+static int
+xdrmapped_create (XDR *xdrs, XDRFILE *xfp, enum xdr_op xop)
+{
+	xdrs->x_op = xop;
+	xdrs->x_ops = (struct xdr_ops *) &xdrmapped_ops;
+	xdrs->x_private = (char *) xfp;
+	return 1;
+}
+
+#else /* HAVE_RPC_XDR_H */
+
+/* Memory streams are only supported with our own XDR implementation */
+static int
+xdrmapped_create (XDR *xdrs, XDRFILE *xfp, enum xdr_op xop)
+{
+	return 0;
+}
+
 #endif /* HAVE_RPC_XDR_H not defined */
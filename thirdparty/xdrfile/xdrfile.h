@@ -123,6 +123,40 @@ extern "C"
 					 const char *    mode);
 
 
+	/*! \brief Open a memory block for reading as portable binary file
+	 *
+	 *  Used for reading memory-mapped files. The block is not copied and
+	 *  should stay valid until xdrfile_close() is called.
+	 *
+	 *  \param data  Pointer to the memory block
+	 *  \param size  Size of the block in bytes
+	 *
+	 *  \return Pointer to abstract xdr file datatype, or NULL if an error occurs.
+	 */
+	XDRFILE *
+	xdrfile_open_mem(const char *    data,
+					 long long       size);
+
+
+	/*! \brief Open a growing memory block for writing as portable binary file
+	 *
+	 *  Written data are accessed by xdrfile_mem_data(). The block is freed
+	 *  by xdrfile_close().
+	 *
+	 *  \return Pointer to abstract xdr file datatype, or NULL if an error occurs.
+	 */
+	XDRFILE *
+	xdrfile_open_mem_write(void);
+
+	/*! \brief Data written to memory block and their size in bytes */
+	const char *
+	xdrfile_mem_data(XDRFILE *xfp, long long *size);
+
+	/*! \brief Discard data written to memory block keeping allocated memory */
+	void
+	xdrfile_mem_clear(XDRFILE *xfp);
+
+
 	/*! \brief Close a previously opened portable binary file, just like fclose()
 	 *
 	 *  Use this routine much like calls to the standard library function
@@ -544,6 +578,18 @@ extern "C"
 								   XDRFILE *   xfp);
 
 
+	/*! \brief Original implementation of xdrfile_decompress_coord_float()
+	 *
+	 *  Decodes the integers bit by bit. Kept as a reference for testing
+	 *  the fast decoder, which should give exactly the same result.
+	 */
+	int
+	xdrfile_decompress_coord_float_reference(float *     ptr,
+											 int *	     ncoord,
+											 float *     precision,
+											 XDRFILE *   xfp);
+
+
 
 
 	/*! \brief Compress coordiates in a double array to XDR file